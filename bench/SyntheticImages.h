@@ -0,0 +1,122 @@
+#pragma once
+
+// Synthetic images for bcvk-bench and bcvk-test
+//   All images are generated from fixed seeds, so they are the same between runs and platforms.
+//   Pixels are R8G8B8A8_UNORM. ToHDR() converts them to R32G32B32A32_FLOAT for BC6H.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// xorshift32 (`state` should not be 0.)
+inline uint32_t NextRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+inline void GenerateNoise(uint32_t width, uint32_t height, uint32_t seed, uint8_t* out) {
+    const size_t size = size_t(width) * height * 4;
+    for (size_t i = 0; i < size; i++)
+        out[i] = (uint8_t)(NextRandom(&seed) >> 24);
+}
+
+inline void GenerateGradient(uint32_t width, uint32_t height, uint8_t* out) {
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint8_t* px = out + (size_t(y) * width + x) * 4;
+            px[0] = (uint8_t)(x * 255 / std::max(1u, width - 1));
+            px[1] = (uint8_t)(y * 255 / std::max(1u, height - 1));
+            px[2] = (uint8_t)((x + y) * 255 / std::max(1u, width + height - 2));
+            px[3] = (uint8_t)(255 - px[2] / 2);
+        }
+    }
+}
+
+inline void GenerateSolid(uint32_t width, uint32_t height, uint32_t seed, uint8_t* out) {
+    const uint32_t color = NextRandom(&seed) | 0xFF000000u;
+    const size_t size = size_t(width) * height * 4;
+    for (size_t i = 0; i < size; i += 4)
+        memcpy(out + i, &color, 4);
+}
+
+// Normals of a height field made of random waves (opaque)
+inline void GenerateNormalMap(uint32_t width, uint32_t height, uint32_t seed, uint8_t* out) {
+    float waves[8][3];
+    for (int i = 0; i < 8; i++) {
+        waves[i][0] = (float)(NextRandom(&seed) % 64 + 1);  // frequency
+        waves[i][1] = (float)(NextRandom(&seed) % 628) / 100.0f;  // direction
+        waves[i][2] = (float)(NextRandom(&seed) % 100) / 400.0f;  // amplitude
+    }
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const float u = (float)x / width;
+            const float v = (float)y / height;
+            float dx = 0.0f;
+            float dy = 0.0f;
+            for (int i = 0; i < 8; i++) {
+                const float cs = std::cos(waves[i][1]);
+                const float sn = std::sin(waves[i][1]);
+                const float d = std::cos((u * cs + v * sn) * waves[i][0] * 6.2831853f) * waves[i][2] * waves[i][0];
+                dx += d * cs;
+                dy += d * sn;
+            }
+            const float len = std::sqrt(dx * dx + dy * dy + 1.0f);
+            uint8_t* px = out + (size_t(y) * width + x) * 4;
+            px[0] = (uint8_t)((-dx / len * 0.5f + 0.5f) * 255.0f + 0.5f);
+            px[1] = (uint8_t)((-dy / len * 0.5f + 0.5f) * 255.0f + 0.5f);
+            px[2] = (uint8_t)((1.0f / len * 0.5f + 0.5f) * 255.0f + 0.5f);
+            px[3] = 255;
+        }
+    }
+}
+
+// 4x4 blocks of solid colors, gradients, and noise
+//   Some solid blocks are fully opaque or fully transparent. The others have varying alpha.
+inline void GenerateBlocks(uint32_t width, uint32_t height, uint32_t seed, uint8_t* out) {
+    const uint32_t xblocks = (width + 3) / 4;
+    const uint32_t num_blocks = xblocks * ((height + 3) / 4);
+    std::vector<uint8_t> block_colors(size_t(num_blocks) * 4);
+    for (uint8_t& c : block_colors)
+        c = (uint8_t)(NextRandom(&seed) >> 24);
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t block_id = (y / 4) * xblocks + x / 4;
+            const uint8_t* base = &block_colors[size_t(block_id) * 4];
+            const uint32_t pattern = block_id % 4;  // 0: solid, 1: gradient, 2: noise, 3: gradient with noise
+            uint8_t* px = out + (size_t(y) * width + x) * 4;
+            for (uint32_t i = 0; i < 4; i++) {
+                int c = base[i];
+                if (pattern & 1)
+                    c = c / 2 + (int)(((x % 4) * (i + 1) + (y % 4) * (4 - i)) * 255 / 40);
+                if (pattern & 2)
+                    c += (int)(NextRandom(&seed) % 64) - 32;
+                px[i] = (uint8_t)std::min(std::max(c, 0), 255);
+            }
+            if (pattern == 0 && (block_id & 4))
+                px[3] = (block_id & 8) ? 255 : 0;
+        }
+    }
+}
+
+// Convert RGBA8 pixels to RGBA32F pixels for BC6H.
+//   Colors are mapped to [0, 8] (or [-8, 8] for SF16) to cover HDR ranges.
+inline void ToHDR(const std::vector<uint8_t>& rgba8, bool is_signed, std::vector<uint8_t>* out) {
+    out->resize(rgba8.size() * 4);
+    float* f = reinterpret_cast<float*>(out->data());
+    for (size_t i = 0; i < rgba8.size(); i++) {
+        const float c = rgba8[i] / 255.0f;
+        if ((i & 3) == 3)
+            f[i] = c;
+        else if (is_signed)
+            f[i] = (c * 2.0f - 1.0f) * 8.0f;
+        else
+            f[i] = c * c * 8.0f;
+    }
+}
@@ -0,0 +1,479 @@
+// Benchmark for GPUCompressBCVk
+//   It sweeps formats, flags, sizes, and content types, and writes results as JSON.
+//   All synthetic images are generated with fixed seeds, so results are comparable between runs.
+
+#include "VulkanDeviceManager.h"
+#include "BCDirectComputeVk.h"
+#include "DDS.h"
+#include "SyntheticImages.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct BenchFormat {
+    const char* name;
+    DXGI_FORMAT format;
+};
+
+static const BenchFormat BENCH_FORMATS[] = {
+    { "bc7", DXGI_FORMAT_BC7_UNORM },
+    { "bc6h_uf16", DXGI_FORMAT_BC6H_UF16 },
+    { "bc6h_sf16", DXGI_FORMAT_BC6H_SF16 },
+};
+
+struct BenchFlags {
+    const char* name;
+    uint32_t flags;  // TEX_COMPRESS_FLAGS
+};
+
+// BC6H ignores these flags. So, BC6H only uses the first one.
+static const BenchFlags BENCH_FLAGS[] = {
+    { "default", TEX_COMPRESS_DEFAULT },
+    { "quick", TEX_COMPRESS_BC7_QUICK },
+    { "3subsets", TEX_COMPRESS_BC7_USE_3SUBSETS },
+};
+
+enum BENCH_CONTENT : uint32_t {
+    BENCH_CONTENT_NOISE = 0,
+    BENCH_CONTENT_GRADIENT,
+    BENCH_CONTENT_SOLID,
+    BENCH_CONTENT_PHOTO,
+    BENCH_CONTENT_NORMAL,
+    BENCH_CONTENT_COUNT,
+};
+
+static const char* const BENCH_CONTENT_NAMES[BENCH_CONTENT_COUNT] = {
+    "noise", "gradient", "solid", "photo", "normal",
+};
+
+static const uint32_t BENCH_SIZES[] = { 64, 256, 1024, 4096, 8192 };
+
+struct BenchOptions {
+    uint32_t iterations = 5;
+    uint32_t warmup = 1;
+    uint32_t min_size = 64;
+    uint32_t max_size = 1024;
+    uint32_t gpu_id = (uint32_t)-1;
+    bool transfer_queue = false;
+    const char* format = "all";
+    const char* flags = "all";
+    const char* content = "all";
+    const char* photo_file = "example/R8G8B8A8_UNORM_512x512.dds";
+    const char* output_file = nullptr;
+};
+
+struct BenchResult {
+    const char* format;
+    const char* flags;
+    const char* content;
+    uint32_t size;
+    double cold_ms;  // Prepare() and the first Compress() call
+    double p50_ms;
+    double p99_ms;
+    double mean_ms;
+    double mpix_per_sec;
+    double blocks_per_sec;
+    double process_peak_rss_mb;  // peak RSS of the process up to this case (It doesn't drop after larger cases.)
+    double device_memory_mb;  // blocks of the device memory pool
+    uint32_t device_allocations;  // vkAllocateMemory() calls in this case
+};
+
+static double ElapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of this process in MiB
+static double PeakRssMB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0.0;
+    return static_cast<double>(counters.PeakWorkingSetSize) / (1024.0 * 1024.0);
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0.0;
+#ifdef __APPLE__
+    return static_cast<double>(usage.ru_maxrss) / (1024.0 * 1024.0);  // bytes
+#else
+    return static_cast<double>(usage.ru_maxrss) / 1024.0;  // KiB
+#endif
+#endif
+}
+
+// Load an R8G8B8A8_UNORM DDS file for photographic content.
+static int LoadRGBA8DDS(const char* filename, std::vector<uint8_t>* buf, uint32_t* width, uint32_t* height) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs)
+        return 1;
+
+    uint32_t magic = 0;
+    DirectX::DDS_HEADER header = {};
+    ifs.read(reinterpret_cast<char*>(&magic), 4);
+    ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!ifs || magic != DirectX::DDS_MAGIC)
+        return 1;
+
+    bool is_rgba8 = false;
+    if ((header.ddspf.flags & DDS_FOURCC) && header.ddspf.fourCC == MAKEFOURCC('D', 'X', '1', '0')) {
+        DirectX::DDS_HEADER_DXT10 header_dxt10 = {};
+        ifs.read(reinterpret_cast<char*>(&header_dxt10), sizeof(header_dxt10));
+        is_rgba8 = header_dxt10.dxgiFormat == DXGI_FORMAT_R8G8B8A8_UNORM;
+    } else {
+        is_rgba8 = header.ddspf.RGBBitCount == 32 &&
+                   header.ddspf.RBitMask == 0x000000ff && header.ddspf.GBitMask == 0x0000ff00 &&
+                   header.ddspf.BBitMask == 0x00ff0000 && header.ddspf.ABitMask == 0xff000000;
+    }
+    if (!is_rgba8 || header.width == 0 || header.height == 0)
+        return 1;
+
+    *width = header.width;
+    *height = header.height;
+    buf->resize(size_t(header.width) * header.height * 4);
+    ifs.read(reinterpret_cast<char*>(buf->data()), buf->size());
+    return ifs ? 0 : 1;
+}
+
+// Resize the photo with bilinear filtering.
+static void ResizePhoto(const std::vector<uint8_t>& photo, uint32_t photo_width, uint32_t photo_height,
+                        uint32_t size, uint8_t* out) {
+    for (uint32_t y = 0; y < size; y++) {
+        const float fy = (y + 0.5f) * photo_height / size - 0.5f;
+        const int y0 = std::max(0, std::min((int)std::floor(fy), (int)photo_height - 1));
+        const int y1 = std::min(y0 + 1, (int)photo_height - 1);
+        const float ty = std::max(0.0f, fy - y0);
+        for (uint32_t x = 0; x < size; x++) {
+            const float fx = (x + 0.5f) * photo_width / size - 0.5f;
+            const int x0 = std::max(0, std::min((int)std::floor(fx), (int)photo_width - 1));
+            const int x1 = std::min(x0 + 1, (int)photo_width - 1);
+            const float tx = std::max(0.0f, fx - x0);
+            for (int c = 0; c < 4; c++) {
+                const float p00 = photo[(size_t(y0) * photo_width + x0) * 4 + c];
+                const float p01 = photo[(size_t(y0) * photo_width + x1) * 4 + c];
+                const float p10 = photo[(size_t(y1) * photo_width + x0) * 4 + c];
+                const float p11 = photo[(size_t(y1) * photo_width + x1) * 4 + c];
+                const float top = p00 + (p01 - p00) * tx;
+                const float bottom = p10 + (p11 - p10) * tx;
+                out[(size_t(y) * size + x) * 4 + c] = (uint8_t)(top + (bottom - top) * ty + 0.5f);
+            }
+        }
+    }
+}
+
+// Generate RGBA8 pixels. It returns false when the content is not available.
+static bool GenerateRGBA8(BENCH_CONTENT content, uint32_t size,
+                          const std::vector<uint8_t>& photo, uint32_t photo_width, uint32_t photo_height,
+                          std::vector<uint8_t>* pixels) {
+    pixels->resize(size_t(size) * size * 4);
+    uint8_t* p = pixels->data();
+    uint32_t seed = 0x9E3779B9u ^ (size * 2654435761u) ^ ((uint32_t)content * 40503u);
+    if (seed == 0)
+        seed = 1;
+
+    switch (content) {
+    case BENCH_CONTENT_NOISE:
+        GenerateNoise(size, size, seed, p);
+        break;
+    case BENCH_CONTENT_GRADIENT:
+        GenerateGradient(size, size, p);
+        break;
+    case BENCH_CONTENT_SOLID:
+        GenerateSolid(size, size, seed, p);
+        break;
+    case BENCH_CONTENT_PHOTO:
+        if (photo.empty())
+            return false;
+        ResizePhoto(photo, photo_width, photo_height, size, p);
+        break;
+    case BENCH_CONTENT_NORMAL:
+        GenerateNormalMap(size, size, seed, p);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Nearest-rank percentile of sorted times
+static double Percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    rank = std::max<size_t>(1, std::min(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+static int RunCase(GPUCompressBCVk* compressor, const BenchOptions& opt,
+                   const BenchFormat& format, const BenchFlags& flags,
+                   BENCH_CONTENT content, uint32_t size,
+                   const std::vector<uint8_t>& src_pixels, BenchResult* result) {
+    const uint32_t allocations_start = compressor->GetMemoryPoolStats().device_allocation_count;
+    auto cold_start = std::chrono::steady_clock::now();
+    VkResult r = compressor->Prepare(size, size, flags.flags, format.format, 1.0f);
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to prepare buffers (error " << r << ")\n";
+        return 1;
+    }
+
+    std::vector<uint8_t> out_pixels(compressor->GetOutBufSize());
+    void* src = const_cast<uint8_t*>(src_pixels.data());
+
+    std::vector<double> times;
+    const uint32_t warmup = std::max(1u, opt.warmup);
+    for (uint32_t i = 0; i < warmup + opt.iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        r = compressor->Compress(src, out_pixels.data());
+        if (r != VK_SUCCESS) {
+            std::cerr << "Failed to compress (error " << r << ")\n";
+            return 1;
+        }
+        const double ms = ElapsedMilliseconds(start);
+        if (i == 0)
+            result->cold_ms = ElapsedMilliseconds(cold_start);
+        if (i >= warmup)
+            times.push_back(ms);
+    }
+
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (double t : times)
+        sum += t;
+
+    const double blocks = double((size + 3) / 4) * ((size + 3) / 4);
+    result->format = format.name;
+    result->flags = flags.name;
+    result->content = BENCH_CONTENT_NAMES[content];
+    result->size = size;
+    result->p50_ms = times.empty() ? 0.0 : Percentile(times, 50.0);
+    result->p99_ms = times.empty() ? 0.0 : Percentile(times, 99.0);
+    result->mean_ms = times.empty() ? 0.0 : sum / times.size();
+    result->mpix_per_sec = result->p50_ms > 0.0 ? double(size) * size / (result->p50_ms * 1000.0) : 0.0;
+    result->blocks_per_sec = result->p50_ms > 0.0 ? blocks / (result->p50_ms / 1000.0) : 0.0;
+    result->process_peak_rss_mb = PeakRssMB();
+    const MemoryPoolStatsBCVk memory_stats = compressor->GetMemoryPoolStats();
+    result->device_memory_mb = static_cast<double>(memory_stats.block_bytes) / (1024.0 * 1024.0);
+    result->device_allocations = memory_stats.device_allocation_count - allocations_start;
+    return 0;
+}
+
+static std::string EscapeJson(const char* str) {
+    std::string out;
+    for (const char* c = str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            out += '\\';
+        if ((unsigned char)*c < 0x20)
+            continue;
+        out += *c;
+    }
+    return out;
+}
+
+static void WriteJson(std::ostream& os, const BenchOptions& opt, const char* device_name,
+                      double init_ms, const std::vector<BenchResult>& results) {
+    char buf[512];
+    os << "{\n";
+    os << "  \"device\": \"" << EscapeJson(device_name) << "\",\n";
+    os << "  \"iterations\": " << opt.iterations << ",\n";
+    os << "  \"warmup\": " << std::max(1u, opt.warmup) << ",\n";
+    snprintf(buf, sizeof(buf), "%.3f", init_ms);
+    os << "  \"init_ms\": " << buf << ",\n";
+    snprintf(buf, sizeof(buf), "%.1f", PeakRssMB());
+    os << "  \"peak_rss_mb\": " << buf << ",\n";
+    os << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& res = results[i];
+        snprintf(buf, sizeof(buf),
+                 "%s\n    {\"format\": \"%s\", \"flags\": \"%s\", \"content\": \"%s\", "
+                 "\"width\": %u, \"height\": %u, \"cold_ms\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+                 "\"mean_ms\": %.3f, \"mpix_per_sec\": %.3f, \"blocks_per_sec\": %.1f, \"process_peak_rss_mb\": %.1f, "
+                 "\"device_memory_mb\": %.1f, \"device_allocations\": %u}",
+                 i == 0 ? "" : ",", res.format, res.flags, res.content, res.size, res.size,
+                 res.cold_ms, res.p50_ms, res.p99_ms, res.mean_ms,
+                 res.mpix_per_sec, res.blocks_per_sec, res.process_peak_rss_mb,
+                 res.device_memory_mb, res.device_allocations);
+        os << buf;
+    }
+    os << "\n  ]\n}\n";
+}
+
+static void PrintUsage() {
+    static const char* const usage =
+        "Usage: bcvk-bench [<options>]\n"
+        "\n"
+        "  options:\n"
+        "    --iterations <n>: measured runs for each case. (default: 5)\n"
+        "    --warmup <n>: runs before measurement. The first one is reported as cold_ms. (default: 1)\n"
+        "    --min-size <n>: the smallest width and height. (64, 256, 1024, 4096, or 8192. default: 64)\n"
+        "    --max-size <n>: the largest width and height. (default: 1024)\n"
+        "    --format <name>: bc7, bc6h_uf16, bc6h_sf16, or all. (default: all)\n"
+        "    --flags <name>: default, quick, 3subsets, or all. BC7 only. (default: all)\n"
+        "    --content <name>: noise, gradient, solid, photo, normal, or all. (default: all)\n"
+        "    --photo <file>: R8G8B8A8_UNORM dds file for the photo content.\n"
+        "                    (default: example/R8G8B8A8_UNORM_512x512.dds)\n"
+        "    --gpu <id>: GPU id to use. (default: auto)\n"
+        "    --transfer-queue: copy textures on a transfer only queue if the GPU has one.\n"
+        "    --output <file>: write JSON to <file> instead of stdout.\n"
+        "    --help: show this message.\n";
+    std::cerr << usage;
+}
+
+static bool Matches(const char* filter, const char* name) {
+    return strcmp(filter, "all") == 0 || strcmp(filter, name) == 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+
+    // Parse args
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--iterations") == 0 && has_value) {
+            opt.iterations = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--warmup") == 0 && has_value) {
+            opt.warmup = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--min-size") == 0 && has_value) {
+            opt.min_size = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--max-size") == 0 && has_value) {
+            opt.max_size = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--format") == 0 && has_value) {
+            opt.format = argv[++i];
+        } else if (strcmp(arg, "--flags") == 0 && has_value) {
+            opt.flags = argv[++i];
+        } else if (strcmp(arg, "--content") == 0 && has_value) {
+            opt.content = argv[++i];
+        } else if (strcmp(arg, "--photo") == 0 && has_value) {
+            opt.photo_file = argv[++i];
+        } else if (strcmp(arg, "--gpu") == 0 && has_value) {
+            opt.gpu_id = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(arg, "--transfer-queue") == 0) {
+            opt.transfer_queue = true;
+        } else if (strcmp(arg, "--output") == 0 && has_value) {
+            opt.output_file = argv[++i];
+        } else if (strcmp(arg, "--help") == 0) {
+            PrintUsage();
+            return 0;
+        } else {
+            std::cerr << "ERROR: unknown option (" << arg << ")\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    // Device creation and Initialize() are the cold start of the compressor.
+    auto init_start = std::chrono::steady_clock::now();
+
+    VulkanDeviceManager manager = VulkanDeviceManager();
+    VkResult r = manager.CreateInstance();
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create Vulkan instance (error " << r << ")\n";
+        return 1;
+    }
+    if (!manager.HasGPU()) {
+        std::cerr << "No Vulkan-capable GPUs found.\n";
+        return 1;
+    }
+    r = manager.CreateDevice(opt.gpu_id, opt.transfer_queue);
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create VkDevice (error " << r << ")\n";
+        return 1;
+    }
+
+    VkPhysicalDeviceProperties props;
+    manager.GetGPUProperties(manager.GetUsingGPUId(), &props);
+
+    GPUCompressBCVk compressor = GPUCompressBCVk();
+    compressor.SetSubgroupSizeControl(manager.HasSubgroupSizeControl());
+    compressor.SetMemoryBudgetExtension(manager.HasMemoryBudget());
+    r = compressor.Initialize(
+            manager.GetDevice(),
+            manager.GetUsingGPU(),
+            manager.GetUsingFamilyId());
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create VkShaderModule (error " << r << ")\n";
+        return 1;
+    }
+    if (manager.HasTransferQueue()) {
+        VkQueue transfer_queue = VK_NULL_HANDLE;
+        r = manager.GetDeviceQueue(manager.GetTransferFamilyId(), &transfer_queue);
+        if (r == VK_SUCCESS)
+            r = compressor.SetTransferQueue(transfer_queue, manager.GetTransferFamilyId());
+        if (r == VK_ERROR_FEATURE_NOT_PRESENT) {
+            std::cerr << "The transfer queue can't copy bands. Copies run on the compute queue.\n";
+        } else if (r != VK_SUCCESS) {
+            std::cerr << "Failed to set the transfer queue (error " << r << ")\n";
+            return 1;
+        }
+    }
+    const double init_ms = ElapsedMilliseconds(init_start);
+    std::cerr << "Device: " << props.deviceName << " (init " << init_ms << " ms)\n";
+
+    std::vector<uint8_t> photo;
+    uint32_t photo_width = 0;
+    uint32_t photo_height = 0;
+    if (Matches(opt.content, "photo") &&
+        LoadRGBA8DDS(opt.photo_file, &photo, &photo_width, &photo_height) != 0) {
+        std::cerr << "WARNING: skipped the photo content (failed to load " << opt.photo_file << ")\n";
+        photo.clear();
+    }
+
+    std::vector<BenchResult> results;
+    std::vector<uint8_t> rgba8;
+    std::vector<uint8_t> hdr;
+    for (uint32_t size : BENCH_SIZES) {
+        if (size < opt.min_size || size > opt.max_size)
+            continue;
+        for (uint32_t content = 0; content < BENCH_CONTENT_COUNT; content++) {
+            if (!Matches(opt.content, BENCH_CONTENT_NAMES[content]))
+                continue;
+            if (!GenerateRGBA8((BENCH_CONTENT)content, size, photo, photo_width, photo_height, &rgba8))
+                continue;
+            for (const BenchFormat& format : BENCH_FORMATS) {
+                if (!Matches(opt.format, format.name))
+                    continue;
+                const bool is_bc7 = format.format == DXGI_FORMAT_BC7_UNORM;
+                if (!is_bc7)
+                    ToHDR(rgba8, format.format == DXGI_FORMAT_BC6H_SF16, &hdr);
+                for (const BenchFlags& flags : BENCH_FLAGS) {
+                    if (!Matches(opt.flags, flags.name))
+                        continue;
+                    if (!is_bc7 && flags.flags != TEX_COMPRESS_DEFAULT)
+                        continue;
+                    BenchResult result = {};
+                    int res = RunCase(&compressor, opt, format, flags, (BENCH_CONTENT)content, size,
+                                      is_bc7 ? rgba8 : hdr, &result);
+                    if (res != 0)
+                        return res;
+                    std::cerr << format.name << " " << flags.name << " " << BENCH_CONTENT_NAMES[content]
+                              << " " << size << "x" << size << ": p50 " << result.p50_ms << " ms, "
+                              << result.mpix_per_sec << " MPix/s\n";
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+
+    if (opt.output_file) {
+        std::ofstream ofs(opt.output_file);
+        if (!ofs) {
+            std::cerr << "failed to open " << opt.output_file << "\n";
+            return 1;
+        }
+        WriteJson(ofs, opt, props.deviceName, init_ms, results);
+    } else {
+        WriteJson(std::cout, opt, props.deviceName, init_ms, results);
+    }
+    return 0;
+}
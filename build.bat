@@ -14,6 +14,8 @@ cmake -G "%VS_VERSION%"^
 
 cmake --build . --config Debug
 copy Debug\example-app.exe ..\
+copy Debug\bcvk-bench.exe ..\
+copy Debug\bcvk-test.exe ..\
 @popd
 
 pause
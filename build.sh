@@ -10,4 +10,6 @@ pushd $(dirname "$0")/build
 
     cmake --build . --config Debug
     cp ./example-app ..
+    cp ./bcvk-bench ..
+    cp ./bcvk-test ..
 popd
@@ -9,7 +9,6 @@ set DXC_OPT=-spirv ^
     -fvk-use-dx-layout ^
     -no-warnings ^
     -HV 2018 -T cs_6_0 ^
-    -fspv-target-env=vulkan1.0 ^
     -fvk-u-shift 2 0 -fvk-b-shift 3 0
 
 rem Check if dxc exists in PATH
@@ -21,20 +20,88 @@ if errorlevel 1 (
 
 @pushd %~dp0\src
 mkdir .\compiled_shaders > NUL 2>&1
+call :CompileShader BC7Encode ClassifySolidCS
+call :CompileShader BC7Encode CompactBlockListCS
+call :CompileShader BC7Encode PartitionShortlistCS
 call :CompileShader BC7Encode TryMode456CS
 call :CompileShader BC7Encode TryMode137CS
 call :CompileShader BC7Encode TryMode02CS
+call :CompileShader BC7Encode TryMode456ConcurrentCS
+call :CompileShader BC7Encode TryMode137ConcurrentCS
+call :CompileShader BC7Encode TryMode02ConcurrentCS
+call :CompileShader BC7Encode SelectBestModeCS
 call :CompileShader BC7Encode EncodeBlockCS
 
+call :CompileShader BC6HEncode ClassifySolidCS
+call :CompileShader BC6HEncode CompactBlockListCS
+call :CompileShader BC6HEncode PartitionShortlistCS
 call :CompileShader BC6HEncode TryModeG10CS
 call :CompileShader BC6HEncode TryModeLE10CS
+call :CompileShader BC6HEncode TryModeLE10FusedCS
 call :CompileShader BC6HEncode EncodeBlockCS
+
+rem Note: Subgroup builds require Vulkan 1.1. They are used only when the device supports wave ops.
+call :CompileSubgroupShader BC7Encode TryMode456CS
+call :CompileSubgroupShader BC7Encode TryMode137CS
+call :CompileSubgroupShader BC7Encode TryMode02CS
+call :CompileSubgroupShader BC7Encode TryMode456ConcurrentCS
+call :CompileSubgroupShader BC7Encode TryMode137ConcurrentCS
+call :CompileSubgroupShader BC7Encode TryMode02ConcurrentCS
+call :CompileSubgroupShader BC6HEncode TryModeLE10CS
+call :CompileSubgroupShader BC6HEncode TryModeLE10FusedCS
+
+rem Note: Passes with 16 threads per block have builds for each thread group size. (See WorkgroupTuningBC6HBC7.)
+for %%g in (16 32) do (
+    call :CompileGroupShader BC7Encode TryMode456CS %%g
+    call :CompileSubgroupShader BC7Encode TryMode456CS %%g
+    call :CompileGroupShader BC7Encode EncodeBlockCS %%g
+    call :CompileGroupShader BC6HEncode TryModeG10CS %%g
+)
+
+rem Note: Buffer input builds read source pixels from a buffer instead of a texture.
+rem       They are used on unified memory devices which don't use subgroup builds.
+for %%e in (ClassifySolidCS PartitionShortlistCS TryMode456CS TryMode137CS TryMode02CS TryMode456ConcurrentCS TryMode137ConcurrentCS TryMode02ConcurrentCS EncodeBlockCS) do (
+    call :CompileBufferShader BC7Encode %%e
+)
+for %%e in (ClassifySolidCS PartitionShortlistCS TryModeG10CS TryModeLE10CS TryModeLE10FusedCS EncodeBlockCS) do (
+    call :CompileBufferShader BC6HEncode %%e
+)
+for %%g in (16 32) do (
+    call :CompileBufferShader BC7Encode TryMode456CS %%g
+    call :CompileBufferShader BC7Encode EncodeBlockCS %%g
+    call :CompileBufferShader BC6HEncode TryModeG10CS %%g
+)
 @popd
 
 exit /b 0
 
 :CompileShader
 echo Generating %1_%2.inc...
-dxc %DXC_OPT% -E %2 -Fh ".\compiled_shaders\%1_%2.inc" -Vn %1_%2 %1.hlsl
-rem dxc %DXC_OPT% -E %2 -Fo ".\compiled_shaders\%1_%2.spv" %1.hlsl
+dxc %DXC_OPT% -fspv-target-env=vulkan1.0 -E %2 -Fh ".\compiled_shaders\%1_%2.inc" -Vn %1_%2 %1.hlsl
+rem dxc %DXC_OPT% -fspv-target-env=vulkan1.0 -E %2 -Fo ".\compiled_shaders\%1_%2.spv" %1.hlsl
+exit /b
+
+:CompileSubgroupShader
+if "%3"=="" (
+    echo Generating %1_%2_subgroup.inc...
+    dxc %DXC_OPT% -fspv-target-env=vulkan1.1 -D USE_SUBGROUP -E %2 -Fh ".\compiled_shaders\%1_%2_subgroup.inc" -Vn %1_%2_subgroup %1.hlsl
+) else (
+    echo Generating %1_%2_subgroup_g%3.inc...
+    dxc %DXC_OPT% -fspv-target-env=vulkan1.1 -D USE_SUBGROUP -D THREAD_GROUP_SIZE=%3 -E %2 -Fh ".\compiled_shaders\%1_%2_subgroup_g%3.inc" -Vn %1_%2_subgroup_g%3 %1.hlsl
+)
+exit /b
+
+:CompileGroupShader
+echo Generating %1_%2_g%3.inc...
+dxc %DXC_OPT% -fspv-target-env=vulkan1.0 -D THREAD_GROUP_SIZE=%3 -E %2 -Fh ".\compiled_shaders\%1_%2_g%3.inc" -Vn %1_%2_g%3 %1.hlsl
+exit /b
+
+:CompileBufferShader
+if "%3"=="" (
+    echo Generating %1_%2_buffer.inc...
+    dxc %DXC_OPT% -fspv-target-env=vulkan1.0 -D USE_BUFFER_INPUT -E %2 -Fh ".\compiled_shaders\%1_%2_buffer.inc" -Vn %1_%2_buffer %1.hlsl
+) else (
+    echo Generating %1_%2_g%3_buffer.inc...
+    dxc %DXC_OPT% -fspv-target-env=vulkan1.0 -D USE_BUFFER_INPUT -D THREAD_GROUP_SIZE=%3 -E %2 -Fh ".\compiled_shaders\%1_%2_g%3_buffer.inc" -Vn %1_%2_g%3_buffer %1.hlsl
+)
 exit /b
@@ -21,17 +21,30 @@ compile_shader() {
         "-fvk-use-dx-layout"
         "-T" "cs_6_0"
         "-no-warnings"
-        "-fspv-target-env=vulkan1.0"
         "-fvk-u-shift" "2" "0"
         "-fvk-b-shift" "3" "0"
         "-E" "$entry"
     )
     local filename="${base}_${entry}"
+    local target_env="vulkan1.0"
 
     if [ "$3" = "use_llvmpipe" ]; then
         opt+=("-D" "USE_LLVMPIPE")
         filename+="_llvmpipe"
+    elif [ "$3" = "use_subgroup" ]; then
+        opt+=("-D" "USE_SUBGROUP")
+        filename+="_subgroup"
+        target_env="vulkan1.1"
     fi
+    if [ -n "$4" ]; then
+        opt+=("-D" "THREAD_GROUP_SIZE=$4")
+        filename+="_g$4"
+    fi
+    if [ "$5" = "use_buffer_input" ]; then
+        opt+=("-D" "USE_BUFFER_INPUT")
+        filename+="_buffer"
+    fi
+    opt+=("-fspv-target-env=${target_env}")
 
     echo Generating ${filename}.inc...
     dxc "${opt[@]}" -Fh "./compiled_shaders/${filename}.inc" -Vn "${filename}" "${base}.hlsl"
@@ -42,17 +55,67 @@ pushd $(dirname "$0")/src
 
 mkdir -p ./compiled_shaders
 
+compile_shader BC7Encode ClassifySolidCS
+compile_shader BC7Encode CompactBlockListCS
+compile_shader BC7Encode PartitionShortlistCS
 compile_shader BC7Encode TryMode456CS
 compile_shader BC7Encode TryMode137CS
 compile_shader BC7Encode TryMode02CS
+compile_shader BC7Encode TryMode456ConcurrentCS
+compile_shader BC7Encode TryMode137ConcurrentCS
+compile_shader BC7Encode TryMode02ConcurrentCS
+compile_shader BC7Encode SelectBestModeCS
 compile_shader BC7Encode EncodeBlockCS
 
+compile_shader BC6HEncode ClassifySolidCS
+compile_shader BC6HEncode CompactBlockListCS
+compile_shader BC6HEncode PartitionShortlistCS
 compile_shader BC6HEncode TryModeG10CS
 compile_shader BC6HEncode TryModeLE10CS
+compile_shader BC6HEncode TryModeLE10FusedCS
 compile_shader BC6HEncode EncodeBlockCS
 
 # Note: LLVMpipe requires a custom build which does not use f16tof32(), or it crashes on LLVM.
 compile_shader BC6HEncode TryModeG10CS use_llvmpipe
 compile_shader BC6HEncode TryModeLE10CS use_llvmpipe
+compile_shader BC6HEncode TryModeLE10FusedCS use_llvmpipe
+
+# Note: Subgroup builds require Vulkan 1.1. They are used only when the device supports wave ops.
+compile_shader BC7Encode TryMode456CS use_subgroup
+compile_shader BC7Encode TryMode137CS use_subgroup
+compile_shader BC7Encode TryMode02CS use_subgroup
+compile_shader BC7Encode TryMode456ConcurrentCS use_subgroup
+compile_shader BC7Encode TryMode137ConcurrentCS use_subgroup
+compile_shader BC7Encode TryMode02ConcurrentCS use_subgroup
+compile_shader BC6HEncode TryModeLE10CS use_subgroup
+compile_shader BC6HEncode TryModeLE10FusedCS use_subgroup
+
+# Note: Passes with 16 threads per block have builds for each thread group size. (See WorkgroupTuningBC6HBC7.)
+for group_size in 16 32; do
+    compile_shader BC7Encode TryMode456CS "" $group_size
+    compile_shader BC7Encode TryMode456CS use_subgroup $group_size
+    compile_shader BC7Encode EncodeBlockCS "" $group_size
+    compile_shader BC6HEncode TryModeG10CS "" $group_size
+    compile_shader BC6HEncode TryModeG10CS use_llvmpipe $group_size
+done
+
+# Note: Buffer input builds read source pixels from a buffer instead of a texture.
+#       They are used on unified memory devices which don't use subgroup builds.
+for entry in ClassifySolidCS PartitionShortlistCS TryMode456CS TryMode137CS TryMode02CS \
+             TryMode456ConcurrentCS TryMode137ConcurrentCS TryMode02ConcurrentCS EncodeBlockCS; do
+    compile_shader BC7Encode $entry "" "" use_buffer_input
+done
+for entry in ClassifySolidCS PartitionShortlistCS TryModeG10CS TryModeLE10CS TryModeLE10FusedCS EncodeBlockCS; do
+    compile_shader BC6HEncode $entry "" "" use_buffer_input
+done
+compile_shader BC6HEncode TryModeG10CS use_llvmpipe "" use_buffer_input
+compile_shader BC6HEncode TryModeLE10CS use_llvmpipe "" use_buffer_input
+compile_shader BC6HEncode TryModeLE10FusedCS use_llvmpipe "" use_buffer_input
+for group_size in 16 32; do
+    compile_shader BC7Encode TryMode456CS "" $group_size use_buffer_input
+    compile_shader BC7Encode EncodeBlockCS "" $group_size use_buffer_input
+    compile_shader BC6HEncode TryModeG10CS "" $group_size use_buffer_input
+    compile_shader BC6HEncode TryModeG10CS use_llvmpipe $group_size use_buffer_input
+done
 
 popd
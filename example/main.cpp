@@ -4,6 +4,7 @@
 #include "BCDirectComputeVk.h"
 #include "DDS.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <cstring>
@@ -103,13 +104,14 @@ static int LoadDDS(
 static int SaveDDS(
         const char* filename,
         uint32_t width, uint32_t height, DXGI_FORMAT format,
-        void* buf, uint32_t buf_size) {
+        void* buf, uint64_t buf_size) {
     DirectX::DDS_HEADER dds_header = {};
     dds_header.size = sizeof(DirectX::DDS_HEADER);
     dds_header.flags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE;
     dds_header.height = height;
     dds_header.width = width;
-    dds_header.pitchOrLinearSize = buf_size;
+    // It's a 32-bit field. Readers compute larger sizes from the dimensions.
+    dds_header.pitchOrLinearSize = static_cast<uint32_t>(std::min<uint64_t>(buf_size, UINT32_MAX));
     dds_header.ddspf = DirectX::DDSPF_DX10;
     dds_header.mipMapCount = 1;
     dds_header.caps = DDS_SURFACE_FLAGS_TEXTURE;
@@ -132,14 +134,96 @@ static int SaveDDS(
         sizeof(DirectX::DDS_HEADER_DXT10));
     ofs.write(
         reinterpret_cast<const char*>(buf),
-        buf_size);
+        static_cast<std::streamsize>(buf_size));
     ofs.close();
     return 0;
 }
 
+// Restore the pipeline cache and the workgroup tuning saved by SavePipelineCache()
+static void LoadPipelineCache(GPUCompressBCVk* compressor, const char* filename) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs)
+        return;  // Not saved yet
+    std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    VkResult r = compressor->LoadPipelineCacheData(data.data(), data.size());
+    if (r != VK_SUCCESS) {
+        std::cout << "Ignored " << filename << " (made on another device?)\n";
+        return;
+    }
+    WorkgroupTuningBC6HBC7 tuning = compressor->GetWorkgroupTuning();
+    std::cout << "Loaded " << filename << " (blocks per group: BC7 " << tuning.bc7_blocks_per_group
+              << ", BC6H " << tuning.bc6h_blocks_per_group << ")\n";
+}
+
+static int SavePipelineCache(GPUCompressBCVk* compressor, const char* filename) {
+    size_t size = 0;
+    VkResult r = compressor->GetPipelineCacheData(&size, nullptr);
+    if (r != VK_SUCCESS) {
+        std::cout << "Failed to get the pipeline cache (error " << r << ")\n";
+        return 1;
+    }
+    std::vector<char> data(size);
+    r = compressor->GetPipelineCacheData(&size, data.data());
+    if (r != VK_SUCCESS) {
+        std::cout << "Failed to get the pipeline cache (error " << r << ")\n";
+        return 1;
+    }
+
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "failed to open " << filename << "\n";
+        return 1;
+    }
+    ofs.write(data.data(), size);
+    return 0;
+}
+
+// Save spans recorded by GPUCompressBCVk::SetTracing() as Chrome trace-event JSON
+static int SaveTrace(GPUCompressBCVk* compressor, const char* filename) {
+    size_t size = 0;
+    VkResult r = compressor->GetTraceData(&size, nullptr);
+    if (r != VK_SUCCESS) {
+        std::cout << "Failed to get the trace (error " << r << ")\n";
+        return 1;
+    }
+    std::vector<char> data(size);
+    r = compressor->GetTraceData(&size, data.data());
+    if (r != VK_SUCCESS) {
+        std::cout << "Failed to get the trace (error " << r << ")\n";
+        return 1;
+    }
+
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "failed to open " << filename << "\n";
+        return 1;
+    }
+    ofs.write(data.data(), size);
+    std::cout << "Saved " << filename << "\n";
+    return 0;
+}
+
+static void PrintCompressStats(const CompressStatsBC6HBC7& stats) {
+    std::cout << "  total: " << stats.total_ms << " ms (" << stats.num_tiles << " tiles, "
+              << stats.num_batches << " batches, "
+              << stats.upload_bytes << " bytes uploaded, " << stats.readback_bytes << " bytes read back, "
+              << stats.imported_bytes << " bytes imported)\n";
+    for (uint32_t i = 0; i < COMPRESS_PASS_COUNT; i++) {
+        const PassStatsBC6HBC7& pass = stats.passes[i];
+        if (pass.submit_count == 0)
+            continue;
+        std::cout << "    " << GetCompressPassName(static_cast<COMPRESS_PASS>(i)) << ": ";
+        if (stats.has_gpu_times)
+            std::cout << "gpu " << pass.gpu_ms << " ms, ";
+        std::cout << "wait " << pass.wait_ms << " ms, "
+                  << pass.dispatch_count << " dispatches\n";
+    }
+}
+
 static int TryCompression(
         GPUCompressBCVk* compressor,
-        const char* src_file, const char* out_file) {
+        const char* src_file, const char* out_file,
+        bool autotune, bool profile) {
     std::cout << "\"" << src_file << "\" -> \"" << out_file << "\"\n";
 
     std::vector<uint8_t> src_pixels;
@@ -162,9 +246,22 @@ static int TryCompression(
         return 1;
     }
 
-    uint32_t src_buf_size = compressor->GetSrcBufSize();
+    uint64_t src_buf_size = compressor->GetSrcBufSize();
+
+    if (autotune) {
+        std::cout << "Tuning thread group sizes...\n";
+        r = compressor->AutotuneWorkgroupSize(&src_pixels[0], 3);
+        if (r != VK_SUCCESS) {
+            std::cout << "failed (error " << r << ")\n";
+            return 1;
+        }
+        WorkgroupTuningBC6HBC7 tuning = compressor->GetWorkgroupTuning();
+        uint32_t blocks_per_group = (bc_format == DXGI_FORMAT_BC7_UNORM) ?
+            tuning.bc7_blocks_per_group : tuning.bc6h_blocks_per_group;
+        std::cout << "  blocks per group: " << blocks_per_group << "\n";
+    }
 
-    uint32_t out_buf_size = compressor->GetOutBufSize();
+    uint64_t out_buf_size = compressor->GetOutBufSize();
     std::vector<uint8_t> out_pixels(out_buf_size);
     r = compressor->Compress(&src_pixels[0], &out_pixels[0]);
     if (r != VK_SUCCESS) {
@@ -172,6 +269,9 @@ static int TryCompression(
         return 1;
     }
 
+    if (profile)
+        PrintCompressStats(compressor->GetCompressStats());
+
     res = SaveDDS(out_file,
             width, height,
             bc_format,
@@ -185,18 +285,35 @@ static void PrintUsage() {
         "\n"
         "  options:\n"
         "    --enable-debug: enable the validation layer for Vulkan.\n"
+        "    --autotune: measure thread group sizes for the device and use the fastest ones.\n"
+        "    --profile: show GPU times of each pass.\n"
+        "    --pipeline-cache <file>: load the pipeline cache and tuning results from <file>,\n"
+        "                             and save them to <file> after compression.\n"
+        "    --trace <file>: save a timeline of host and GPU work to <file> as Chrome trace JSON.\n"
         "    --help: show this message.\n";
     std::cout << usage;
 }
 
 int main(int argc, char** argv) {
     bool enable_debug = false;
+    bool autotune = false;
+    bool profile = false;
+    const char* pipeline_cache_file = nullptr;
+    const char* trace_file = nullptr;
 
     // Parse args
     for (int i = 1; i < argc; i++) {
         const char* opt = argv[i];
         if (strcmp(opt, "--enable-debug") == 0) {
             enable_debug = true;
+        } else if (strcmp(opt, "--autotune") == 0) {
+            autotune = true;
+        } else if (strcmp(opt, "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(opt, "--pipeline-cache") == 0 && i + 1 < argc) {
+            pipeline_cache_file = argv[++i];
+        } else if (strcmp(opt, "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
         } else if (strcmp(opt, "--help") == 0) {
             PrintUsage();
             return 0;
@@ -257,6 +374,9 @@ int main(int argc, char** argv) {
     }
 
     GPUCompressBCVk compressor = GPUCompressBCVk();
+    compressor.SetTracing(trace_file != nullptr);
+    compressor.SetSubgroupSizeControl(manager.HasSubgroupSizeControl());
+    compressor.SetMemoryBudgetExtension(manager.HasMemoryBudget());
 
     std::cout << "Creating shaders...\n";
     r = compressor.Initialize(
@@ -268,19 +388,36 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (pipeline_cache_file)
+        LoadPipelineCache(&compressor, pipeline_cache_file);
+
+    compressor.SetProfiling(profile);
+
     int res;
     res = TryCompression(
         &compressor,
         "example/R8G8B8A8_UNORM_512x512.dds",
-        "BC7_result.dds");
+        "BC7_result.dds",
+        autotune, profile);
     if (res != 0) return res;
 
     res = TryCompression(
         &compressor,
         "example/R32G32B32A32_FLOAT_512x512.dds",
-        "BC6_result.dds");
+        "BC6_result.dds",
+        autotune, profile);
     if (res != 0) return res;
 
+    if (pipeline_cache_file) {
+        res = SavePipelineCache(&compressor, pipeline_cache_file);
+        if (res != 0) return res;
+    }
+
+    if (trace_file) {
+        res = SaveTrace(&compressor, trace_file);
+        if (res != 0) return res;
+    }
+
     std::cout << "success\n";
     return 0;
 }
@@ -51,6 +51,134 @@ void main() {
 enum DXGI_FORMAT : uint32_t;
 #endif
 
+// Options for GPUCompressBCVk::Prepare() (same as DirectXTex)
+enum TEX_COMPRESS_FLAGS : uint32_t {
+    TEX_COMPRESS_DEFAULT = 0,
+
+    TEX_COMPRESS_RGB_DITHER = 0x10000,
+    // Enables dithering RGB colors for BC1-3 compression
+
+    TEX_COMPRESS_A_DITHER = 0x20000,
+    // Enables dithering alpha for BC1-3 compression
+
+    TEX_COMPRESS_DITHER = 0x30000,
+    // Enables both RGB and alpha dithering for BC1-3 compression
+
+    TEX_COMPRESS_UNIFORM = 0x40000,
+    // Uniform color weighting for BC1-3 compression; by default uses perceptual weighting
+
+    TEX_COMPRESS_BC7_USE_3SUBSETS = 0x80000,
+    // Enables exhaustive search for BC7 compress for mode 0 and 2; by default skips trying these modes
+
+    TEX_COMPRESS_BC7_QUICK = 0x100000,
+    // Minimal modes (usually mode 6) for BC7 compression
+
+    TEX_COMPRESS_SRGB_IN = 0x1000000,
+    TEX_COMPRESS_SRGB_OUT = 0x2000000,
+    TEX_COMPRESS_SRGB = (TEX_COMPRESS_SRGB_IN | TEX_COMPRESS_SRGB_OUT),
+    // if the input format type is IsSRGB(), then SRGB_IN is on by default
+    // if the output format type is IsSRGB(), then SRGB_OUT is on by default
+
+    TEX_COMPRESS_PARALLEL = 0x10000000,
+    // Compress is free to use multithreading to improve performance (by default it does not use multithreading)
+};
+
+// Search options for BC6H and BC7 compression.
+//   Prepare() initializes them with TEX_COMPRESS_FLAGS.
+//   You can override them with GPUCompressBCVk::SetQualityProfile().
+struct QualityProfileBC6HBC7 {
+    uint32_t    bc7_mode_mask;  // bit i enables BC7 mode i (0xFF: all modes)
+    bool    bc7_search_rotation;  // try all component rotations for BC7 mode 4 and 5
+    bool    bc7_search_index_selector;  // try both index selectors for BC7 mode 4
+    uint32_t    bc6h_num_two_region_modes;  // the number of BC6H two-region modes to try (0 to 10)
+    uint32_t    num_partitions;  // the number of partitions searched in partitioned modes (1 to 64)
+    // Rank partitions with a cheap variance estimate, and search only the best ones in partitioned modes.
+    // (0: disabled, 1 to 16: the number of partitions kept for each block)
+    uint32_t    partition_shortlist_size;
+};
+
+// Thread group layouts of passes which use 16 threads per BC block.
+//   (BC7 mode 4/5/6 and encoding, and BC6H mode 11-14)
+//   GPUCompressBCVk::AutotuneWorkgroupSize() selects the fastest one for the device.
+struct WorkgroupTuningBC6HBC7 {
+    uint32_t    bc7_blocks_per_group;  // 1, 2, or 4 (16, 32, or 64 threads per group)
+    uint32_t    bc6h_blocks_per_group;  // 1, 2, or 4 (16, 32, or 64 threads per group)
+};
+
+// Passes measured by GPUCompressBCVk::SetProfiling()
+enum COMPRESS_PASS : uint32_t {
+    COMPRESS_PASS_UPLOAD = 0,  // copy src_pixels to GPU
+    COMPRESS_PASS_CLASSIFY,  // ClassifySolidCS
+    COMPRESS_PASS_SHORTLIST,  // PartitionShortlistCS
+    COMPRESS_PASS_COMPACT,  // CompactBlockListCS
+    COMPRESS_PASS_MODE456_G10,  // BC7 TryMode456CS or BC6H TryModeG10CS
+    COMPRESS_PASS_MODE137_LE10,  // BC7 TryMode137CS or BC6H TryModeLE10CS (all iterations)
+    COMPRESS_PASS_MODE02,  // BC7 TryMode02CS (all iterations)
+    COMPRESS_PASS_CONCURRENT,  // concurrent BC7 mode passes
+    COMPRESS_PASS_SELECT,  // BC7 SelectBestModeCS
+    COMPRESS_PASS_ENCODE,  // EncodeBlockCS
+    COMPRESS_PASS_READBACK,  // copy results to out_pixels
+    COMPRESS_PASS_COUNT
+};
+
+// Get a short name of COMPRESS_PASS. (e.g. "Mode456G10") Traces use the same names.
+const char* GetCompressPassName(COMPRESS_PASS pass);
+
+struct PassStatsBC6HBC7 {
+    double  gpu_ms;  // GPU time between timestamps around each submission
+    double  wait_ms;  // host time from vkQueueSubmit() to the end of vkQueueWaitIdle()
+    uint32_t    submit_count;  // the number of submissions
+    uint32_t    dispatch_count;  // the number of dispatches (or copies)
+};
+
+// Measurements of the last GPUCompressBCVk::Compress() call with profiling enabled.
+struct CompressStatsBC6HBC7 {
+    PassStatsBC6HBC7    passes[COMPRESS_PASS_COUNT];  // indexed with COMPRESS_PASS
+    double  total_ms;  // host time of the whole Compress() call
+    uint64_t    upload_bytes;  // bytes copied from src_pixels to GPU
+    uint64_t    readback_bytes;  // bytes copied from GPU to out_pixels
+    uint64_t    imported_bytes;  // bytes of src_pixels and out_pixels accessed as imported memory
+    uint32_t    num_batches;  // the number of block batches
+    uint32_t    num_tiles;  // the number of tiles (see GPUCompressBCVk::SetMemoryBudget())
+    bool    has_gpu_times;  // false when the queue doesn't support timestamps (gpu_ms is always 0)
+};
+
+// Device memory usage of GPUCompressBCVk
+//   Buffers and images are sub-allocated from blocks of VkDeviceMemory.
+struct MemoryPoolStatsBCVk {
+    uint32_t    block_count;  // VkDeviceMemory objects owned by the pool
+    uint32_t    allocation_count;  // live buffers and images (or arrays of buffers)
+    uint64_t    block_bytes;  // total size of blocks
+    uint64_t    used_bytes;  // total size of live allocations
+    uint64_t    peak_block_bytes;  // the maximum of block_bytes
+    uint32_t    device_allocation_count;  // vkAllocateMemory() calls since Initialize()
+};
+
+// Memory shared by another process or API with VK_KHR_external_memory_fd
+struct ExternalMemoryBCVk {
+    int fd;  // CompressExternal() closes it when it succeeds. The caller still owns it when it fails.
+    VkExternalMemoryHandleTypeFlagBits handle_type;  // OPAQUE_FD_BIT, or DMA_BUF_BIT_EXT with VK_EXT_external_memory_dma_buf
+    VkDeviceSize size;  // the size of the exported memory
+    VkDeviceSize offset;  // the offset of data in the memory (a multiple of 16)
+    uint32_t memory_type_index;  // the memory type of the exporter (UINT32_MAX: a device local type for DMA_BUF_BIT_EXT)
+    bool dedicated;  // The exporter allocated the memory with VkMemoryDedicatedAllocateInfo.
+};
+
+// Receives results of Compress() in ranges of block rows. (See GPUCompressBCVk::SetResultCallback().)
+//   `blocks` points to the first block of `first_block_row` in out_pixels. `size` is the size of the range in bytes.
+typedef void (*ResultCallbackBCVk)(void* user_data, const void* blocks,
+                                   uint32_t first_block_row, uint32_t num_block_rows, size_t size);
+
+struct PassProfilerBCVk;
+struct TraceRecorderBCVk;
+class DeviceMemoryPoolBCVk;
+struct MemoryAllocationBCVk;
+struct SourceImageBCVk;
+struct SourceBandsBCVk;
+struct ReadbackBCVk;
+struct PipelineSetBCVk;
+struct TransientAllocatorBCVk;
+
 class GPUCompressBCVk {
  public:
     GPUCompressBCVk();
@@ -60,17 +188,29 @@ class GPUCompressBCVk {
     //   `physical_device` should be a physical device which `device` uses.
     //   `family_id` should be a queue family id which `device` uses.
     //   Ownership is not transferred. (~GPUCompressBCVk() does not destroy `device`.)
+    //   Mode passes use subgroup operations when a subgroup can hold their thread group. (See SetSubgroupSizeControl().)
+    //   Heap budgets are queried with VK_EXT_memory_budget when it's enabled. (See SetMemoryBudgetExtension().)
+    //   Objects and passes are named for GPU debuggers and profilers when VK_EXT_debug_utils is enabled.
     VkResult Initialize(VkDevice device, VkPhysicalDevice physical_device, uint32_t family_id);
 
     // Create buffers.
     //   `flags` is TEX_COMPRESS_FLAGS (compression options.)
     //     (e.g. TEX_COMPRESS_BC7_QUICK can simplify BC7 compression.)
     //   `format` is a compressed format. (BC6H or BC7)
+    //   Large textures are split into tiles of block rows to fit buffers in the memory budget.
     VkResult Prepare(uint32_t width, uint32_t height, uint32_t flags, DXGI_FORMAT format, float alpha_weight);
 
+    // Override search options set by Prepare().
+    //   Call it after Prepare().
+    //   `bc7_mode_mask` should enable at least one mode.
+    //   Disabled passes are skipped in Compress().
+    VkResult SetQualityProfile(const QualityProfileBC6HBC7& profile);
+    QualityProfileBC6HBC7 GetQualityProfile() { return m_profile; }
+
     // After calling Prepare(), you can check required buffer sizes via these functions.
-    uint32_t GetSrcBufSize() { return m_src_buf_size; }
-    uint32_t GetOutBufSize() { return m_out_buf_size; }
+    //   Both return uint64_t since they can exceed 4 GiB for large textures. (They returned uint32_t before.)
+    uint64_t GetSrcBufSize() { return m_src_buf_size; }
+    uint64_t GetOutBufSize() { return m_out_buf_size; }
 
     // Run shaders.
     //   The pixel format of `src_pixels` should be...
@@ -78,74 +218,449 @@ class GPUCompressBCVk {
     //     - R8G8B8A8_UNORM     for BC7 compression.
     //   The size of `src_pixels` should be GetSrcBufSize().
     //   The size of `out_pixels` should be GetOutBufSize().
+    //   Tiles are uploaded in bands of block rows. Encoding of a band overlaps the upload of the next band.
     VkResult Compress(void* src_pixels, void* out_pixels);
 
+    // Run shaders for a region of a larger image. (e.g. a page of an atlas, or rows with padding from a decoder)
+    //   `src_pixels` is the first row of the image. Rows are `row_pitch` bytes apart. (a multiple of the pixel size)
+    //   `width` and `height` of the region should be the same as Prepare().
+    //   Rows are packed while they are copied to GPU, so the caller doesn't need to repack them.
+    //   They are imported with the pitch when possible. (See SetHostMemoryImport().)
+    VkResult CompressRegion(void* src_pixels, uint32_t row_pitch,
+                            uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                            void* out_pixels);
+
+    // Run shaders for pixels in memory exported by another process or API.
+    //   `src` has pixels in the same layout as src_pixels of Compress(). `dst` receives GetOutBufSize() bytes.
+    //   Ownership of both buffers is acquired from VK_QUEUE_FAMILY_EXTERNAL and released to it after the results are written.
+    //   `wait_semaphore_fd` is an opaque fd of a semaphore which is signaled when `src` is ready. (-1: no wait)
+    //   `signal_semaphore_fd` is an opaque fd of a semaphore which is signaled when `dst` is ready. (-1: no signal)
+    //   `signal_semaphore_fd` is signaled even when it fails, so the consumer can always wait on it.
+    //   (Only when the semaphore itself can't be imported, nothing signals it.)
+    //   All fds are closed when it succeeds. When it fails, the caller still owns all of them. (They are duplicated for imports.)
+    //   It requires VK_KHR_external_memory_fd, and VK_KHR_external_semaphore_fd for semaphores.
+    VkResult CompressExternal(const ExternalMemoryBCVk& src, const ExternalMemoryBCVk& dst,
+                              int wait_semaphore_fd, int signal_semaphore_fd);
+
+    // Record the passes of Compress() into `command_buffer` without submitting them.
+    //   `src` is an image view which shaders sample in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+    //     Its format and size should be the same as src_pixels of Compress().
+    //   Results are copied to `dst` at `offset`. (GetOutBufSize() bytes with VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+    //   The caller synchronizes `src` and `dst` with the other commands, and submits `command_buffer` to a compute queue.
+    //   Descriptor sets, constants, and pipelines of the passes come from `allocator`.
+    //   Don't call Prepare() or Compress() until the commands are complete. They share buffers with the commands.
+    VkResult RecordCompress(VkCommandBuffer command_buffer, VkImageView src, VkBuffer dst, VkDeviceSize offset,
+                            TransientAllocatorBCVk* allocator);
+
+    // Create objects for RecordCompress().
+    //   `max_batches` is the number of batches recorded between resets. (GetRecordBatchCount() for each texture)
+    //   RecordCompress() fails with VK_ERROR_OUT_OF_POOL_MEMORY when the allocator is full.
+    //   It returns VK_ERROR_FEATURE_NOT_PRESENT for buffer input builds, which don't read images.
+    //     Call SetBufferInput(false) before Initialize() to record passes on devices with them.
+    VkResult CreateTransientAllocator(uint32_t max_batches, TransientAllocatorBCVk** allocator);
+
+    // Reuse descriptor sets and constants of the allocator.
+    //   Call it after commands recorded with the allocator are complete. (e.g. at the beginning of a frame)
+    //   Pipelines are kept for the following frames.
+    void ResetTransientAllocator(TransientAllocatorBCVk* allocator);
+
+    // Destroy the allocator. Call it before ~GPUCompressBCVk().
+    void DestroyTransientAllocator(TransientAllocatorBCVk* allocator);
+
+    // Get the number of batches which RecordCompress() records for the texture set by Prepare().
+    uint32_t GetRecordBatchCount();
+
+    // Encode BC7 blocks whose pixels are all transparent (alpha == 0) as a single color.
+    //   Their RGB values are replaced with the average color of the block.
+    //   Disabled by default.
+    void SetCollapseTransparentBlocks(bool enable) { m_collapse_transparent = enable; }
+
+    // Skip the remaining mode passes for blocks whose error is already at most `threshold`.
+    //   The error is the sum of squared errors over the 16 pixels of a block.
+    //   (RGBA8 values with alpha_weight for BC7, and half values for BC6H.)
+    //   0 disables it. (default)
+    void SetErrorThreshold(float threshold) { m_error_threshold = threshold; }
+
+    // Try all BC6H two-region modes in a single pass.
+    //   Disable it to run a pass for each mode. (The reference implementation.)
+    //   Both select the same mode and partition. Ties go to the earlier mode, and then to the earlier partition.
+    //   Enabled by default.
+    void SetBC6HFusedModeSearch(bool enable) { m_bc6_fused_mode_search = enable; }
+
+    // Run BC7 mode passes in a single submission without barriers between them.
+    //   Each pass writes its own result, and the best one is selected before encoding.
+    //   Disable it to run passes one by one with ping-pong error buffers. (The reference implementation.)
+    //   It is not used when SetErrorThreshold() is set, because the threshold needs results of earlier passes.
+    //   Enabled by default.
+    void SetBC7ConcurrentModeSearch(bool enable) { m_bc7_concurrent_mode_search = enable; }
+
+    // Skip BC7 mode 7 when all alpha values of the source pixels are 255.
+    //   It's lossy. Opaque blocks whose best mode is mode 7 are encoded with another mode.
+    //   It trades that quality for the mode 7 pass, and Compress() scans the alpha values on CPU before uploading them.
+    //   Disabled by default.
+    void SetOpaqueFastPath(bool enable) { m_opaque_fast_path = enable; }
+
+    // Upload tiles in bands of block rows, so that encoding of a band overlaps the upload of the next band.
+    //   Disable it to upload each tile on the compute queue before its passes. (The reference implementation.)
+    //   Enabled by default.
+    void SetBandedUpload(bool enable) { m_banded_upload = enable; }
+
+    // Skip staging copies when device local memory is host visible. (e.g. integrated GPUs, llvmpipe, and ReBAR)
+    //   Source pixels are written to a buffer which shaders read directly, or to linear images on devices with subgroup builds.
+    //   Results are read from the output buffer directly when the memory is also host cached.
+    //   Otherwise, results are copied to host cached memory if the device has it.
+    //   Call it before Initialize() since it selects shader builds. Enabled by default.
+    void SetDirectHostAccess(bool enable) { m_direct_host_access = enable; }
+
+    // Use buffer input builds for direct host access on devices without subgroup builds.
+    //   Disable it to write linear images instead. (Imported memory is still copied to optimal images.)
+    //   Call it before Initialize() since it selects shader builds. Enabled by default.
+    void SetBufferInput(bool enable) { m_allow_buffer_input = enable; }
+
+    // Tell Initialize() that `device` enabled subgroupSizeControl and computeFullSubgroups.
+    //   (VK_EXT_subgroup_size_control or Vulkan 1.3. VulkanDeviceManager enables them when they are supported.)
+    //   Subgroup builds of mode passes then require subgroups as large as their thread groups. (e.g. wave64 on wave32 GPUs)
+    //   Call it before Initialize() since it selects shader builds. Disabled by default.
+    void SetSubgroupSizeControl(bool enable) { m_subgroup_size_control = enable; }
+
+    // Tell Initialize() that `device` enabled VK_EXT_memory_budget on a Vulkan 1.1 instance.
+    //   (VulkanDeviceManager enables it when it's supported. See VulkanDeviceManager::HasMemoryBudget().)
+    //   Heap budgets then include allocations of other processes. Otherwise, heap sizes are used. (See SetMemoryBudget().)
+    //   Call it before Initialize(). Disabled by default.
+    void SetMemoryBudgetExtension(bool enable) { m_memory_budget_extension = enable; }
+
+    // Import src_pixels and out_pixels of Compress() as device memory with VK_EXT_external_memory_host.
+    //   Transfers and shaders read the caller's memory without staging copies.
+    //   Each tile is imported with the enclosing range of pages. (aligned to minImportedHostPointerAlignment)
+    //   It falls back to staging buffers when the memory can't be imported.
+    //   The memory should not be freed or unmapped during Compress().
+    //   Enabled by default. It does nothing when the extension is not enabled.
+    void SetHostMemoryImport(bool enable) { m_host_memory_import = enable; }
+
+    // Measure each pass of Compress() with timestamp queries and host timers.
+    //   GetCompressStats() returns the results of the last Compress() call.
+    //   Disabled by default.
+    void SetProfiling(bool enable) { m_profiling = enable; }
+    CompressStatsBC6HBC7 GetCompressStats() { return m_stats; }
+
+    // Record host spans and GPU spans of the compressor for a timeline viewer.
+    //   Call it before Initialize() to record Initialize() as well.
+    //   GPU spans are aligned with host spans when VK_EXT_calibrated_timestamps is enabled on the device.
+    //   Disabling it discards recorded spans. Disabled by default.
+    void SetTracing(bool enable);
+
+    // Get recorded spans as Chrome trace-event JSON. (You can open it with https://ui.perfetto.dev)
+    //   It works like GetPipelineCacheData(). Set `data` to nullptr to get the size.
+    VkResult GetTraceData(size_t* size, char* data);
+
+    // Override thread group layouts. (4 blocks per group by default.)
+    VkResult SetWorkgroupTuning(const WorkgroupTuningBC6HBC7& tuning);
+    WorkgroupTuningBC6HBC7 GetWorkgroupTuning() { return m_tuning; }
+
+    // Run Compress() with each thread group layout for the format set by Prepare(), and keep the fastest one.
+    //   Call it after Prepare(). `src_pixels` is the same as Compress().
+    //   Each layout runs once to create its pipelines, and then `repeat` times.
+    //   The layout with the fastest median time is kept. (3 or more runs are recommended.)
+    //   Runs are measured with GPU timestamps when the queue supports them. (host time otherwise)
+    VkResult AutotuneWorkgroupSize(void* src_pixels, uint32_t repeat);
+
+    // Serialize the pipeline cache with the workgroup tuning.
+    //   It works like vkGetPipelineCacheData(). Set `data` to nullptr to get the size.
+    VkResult GetPipelineCacheData(size_t* size, void* data);
+
+    // Restore the pipeline cache and the workgroup tuning from GetPipelineCacheData().
+    //   Call it after Initialize().
+    //   It fails when the data is broken or was made on another device.
+    VkResult LoadPipelineCacheData(const void* data, size_t size);
+
+    // Get the usage of the device memory pool. Call it after Initialize().
+    MemoryPoolStatsBCVk GetMemoryPoolStats();
+
+    // Use at most `fraction` of the heap budgets (0.0 < fraction <= 1.0, 0.8 by default.)
+    //   Call it before Prepare().
+    //   Prepare() splits the texture into tiles so that buffers and images of a tile fit in the budget.
+    //   Buffers for batches in flight and the error buffers are budgeted as well.
+    //   The error window is reduced only when a single block row doesn't fit next to it. (See SetErrorWindow().)
+    //   Prepare() and Compress() retry with smaller tiles when an allocation fails.
+    VkResult SetMemoryBudget(float fraction);
+
+    // Set the number of blocks in the error buffers which keep the best mode of each block between passes.
+    //   They are reused as ring buffers for batches of 64 blocks. Only the output buffer covers the whole tile.
+    //   `num_blocks` should be a multiple of 64. (1024 by default.)
+    //   Prepare() uses fewer blocks when the window doesn't fit in the memory budget. (See SetMemoryBudget().)
+    //   Call it before Prepare().
+    VkResult SetErrorWindow(uint32_t num_blocks);
+
+    // Run banded uploads and readbacks of Compress() on another queue. (e.g. a transfer only family)
+    //   `queue` should be a queue of `device` in `family_id`. (See VulkanDeviceManager::GetDeviceQueue().)
+    //   It can be in the same family as the compute queue, or even the same queue.
+    //   VK_NULL_HANDLE disables it. It fails with VK_ERROR_INITIALIZATION_FAILED for unknown families.
+    //   The family should copy images at pixel granularity. (minImageTransferGranularity is (1,1,1).)
+    //   Otherwise, it returns VK_ERROR_FEATURE_NOT_PRESENT, and copies stay on the compute queue.
+    //   Uploads use the queue only when they are banded. (See SetBandedUpload().)
+    //   Copies are synchronized with semaphores and fences. They overlap compute passes only partly,
+    //   since each pass still waits for the compute queue to be idle.
+    //   For another family, the output buffer is transferred between the families for each readback,
+    //   and source images are shared by both families with VK_SHARING_MODE_CONCURRENT.
+    //   CompressExternal() and RecordCompress() keep copies on the compute queue. Call it after Initialize().
+    VkResult SetTransferQueue(VkQueue queue, uint32_t family_id);
+
+    // Deliver results of Compress() and CompressRegion() to `callback` for every `block_rows` block rows.
+    //   Each range is read back to out_pixels as soon as its batches are complete.
+    //   The callback runs on the calling thread, and the following batches wait for it to return.
+    //   Hand the range over to another thread to process it during the rest of the encode. (e.g. writers and hashes)
+    //   Ranges don't cross tiles, so the last range of a tile can be shorter.
+    //   `callback` can be nullptr to disable it. CompressExternal() and RecordCompress() don't call it.
+    VkResult SetResultCallback(ResultCallbackBCVk callback, void* user_data, uint32_t block_rows);
+
+    // Get the height of tiles selected by Prepare(). (It can be smaller after Compress() runs out of memory.)
+    uint32_t GetTileHeight() { return m_tile_block_rows * 4; }
+
+    // Free memory blocks which have no buffers or images.
+    //   Freed ranges are kept in blocks to reuse them in the following Prepare() and Compress() calls.
+    void ReleaseUnusedMemory();
+
  private:
+    // Bytes in a row of the source. (R8G8B8A8 or R32G32B32A32)
+    uint32_t GetSrcRowSize() { return m_width * (m_isbc7 ? 4 : 16); }
+
     // activated device
     VkDevice m_device;
     VkQueue m_queue;
     VkCommandPool m_cmd_pool;
-    VkPhysicalDeviceMemoryProperties m_memory_props;
+    VkPhysicalDevice m_physical_device;
+    DeviceMemoryPoolBCVk* m_memory_pool;
+    VkPhysicalDeviceProperties m_gpu_props;
 
     // shaders
+    VkShaderModule m_shader_bc6_classify;
+    VkShaderModule m_shader_bc6_compact;
     VkShaderModule m_shader_bc6_enc;
     VkShaderModule m_shader_bc6_modeG10;
     VkShaderModule m_shader_bc6_modeLE10;
+    VkShaderModule m_shader_bc6_modeLE10_fused;
+    VkShaderModule m_shader_bc6_modeG10_g16;
+    VkShaderModule m_shader_bc6_modeG10_g32;
+    VkShaderModule m_shader_bc6_shortlist;
 
+    VkShaderModule m_shader_bc7_classify;
+    VkShaderModule m_shader_bc7_compact;
     VkShaderModule m_shader_bc7_enc;
     VkShaderModule m_shader_bc7_mode02;
     VkShaderModule m_shader_bc7_mode137;
     VkShaderModule m_shader_bc7_mode456;
+    VkShaderModule m_shader_bc7_mode02_concurrent;
+    VkShaderModule m_shader_bc7_mode137_concurrent;
+    VkShaderModule m_shader_bc7_mode456_concurrent;
+    VkShaderModule m_shader_bc7_select;
+    VkShaderModule m_shader_bc7_enc_g16;
+    VkShaderModule m_shader_bc7_enc_g32;
+    VkShaderModule m_shader_bc7_mode456_g16;
+    VkShaderModule m_shader_bc7_mode456_g32;
+    VkShaderModule m_shader_bc7_shortlist;
 
     // shader info
     VkDescriptorSetLayout m_desc_set_layout;
     VkDescriptorPool m_desc_pool;
     VkDescriptorSet m_desc_set;
     VkPipelineLayout m_pipeline_layout;
+    VkPipelineCache m_pipeline_cache;
 
     // buffers
     VkBuffer m_const_buf;
-    VkDeviceMemory m_const_mem;
+    MemoryAllocationBCVk* m_const_mem;
     VkBuffer m_err1_buf;
     VkBuffer m_err2_buf;
+    MemoryAllocationBCVk* m_err_mem;
     VkBuffer m_out_buf;
-    VkDeviceMemory m_out_mem;
-    VkBuffer m_outcpu_buf;
-    VkDeviceMemory m_outcpu_mem;
+    MemoryAllocationBCVk* m_out_mem;
+    VkBuffer m_outcpu_buf;  // VK_NULL_HANDLE when m_out_buf is read directly
+    MemoryAllocationBCVk* m_outcpu_mem;
+    void* m_out_mapped;  // host pointer to m_out_buf (nullptr unless it's read directly)
+    // [0]: blocks listed by ClassifySolidCS
+    // [1], [2]: blocks listed by CompactBlockListCS (used as ping-pong buffers)
+    VkBuffer m_block_list_buf[3];
+    MemoryAllocationBCVk* m_block_list_mem;
+    VkBuffer m_dispatch_args_buf[3];
+    MemoryAllocationBCVk* m_dispatch_args_mem;
+    VkBuffer m_slot_buf;  // results of concurrent BC7 mode passes
+    MemoryAllocationBCVk* m_slot_mem;
+    VkBuffer m_shortlist_buf;  // partitions kept by PartitionShortlistCS
+    MemoryAllocationBCVk* m_shortlist_mem;
 
     // texture info
     uint32_t m_width;
     uint32_t m_height;
     float m_alpha_weight;
-    uint32_t m_out_buf_size;
-    uint32_t m_src_buf_size;
+    uint64_t m_out_buf_size;
+    uint64_t m_src_buf_size;
+    float m_memory_budget_fraction;
+    uint32_t m_tile_block_rows;  // the number of block rows in a tile
+    uint32_t m_error_window;  // the maximum number of blocks in error buffers
+    uint32_t m_fit_error_window;  // m_error_window fitted in the memory budget by Prepare()
+    uint32_t m_err_buf_blocks;  // the number of blocks in error buffers
+    uint32_t m_input_offset;  // the first pixel of the current tile in the input buffer
+    uint32_t m_input_row_pitch;  // pixels between rows in the input buffer
+    uint32_t m_input_height;  // rows of the current tile (Shaders read 0 below them.)
+    uint32_t m_input_row;  // the first row of the current tile in the caller's image (RecordCompress())
     DXGI_FORMAT m_bcformat;
     DXGI_FORMAT m_srcformat;
     bool m_isbc7;
-    bool m_bc7_mode02;
-    bool m_bc7_mode137;
+    QualityProfileBC6HBC7 m_profile;
+    bool m_collapse_transparent;
+    float m_error_threshold;
+    bool m_bc6_fused_mode_search;
+    bool m_bc7_concurrent_mode_search;
+    bool m_opaque_fast_path;
+    bool m_banded_upload;
+    bool m_direct_host_access;
+    bool m_allow_buffer_input;
+    bool m_buffer_input;  // Shaders read source pixels from a buffer instead of an image.
+    bool m_subgroup_size_control;
+    bool m_memory_budget_extension;
+    // Subgroup sizes that pipelines of subgroup builds require. (0: the default size, or shared memory builds)
+    uint32_t m_subgroup_size_g16;
+    uint32_t m_subgroup_size_g32;
+    uint32_t m_subgroup_size_g64;
+    uint32_t m_subgroup_size_bc6;  // for BC6H TryModeLE10CS (0 with llvmpipe builds)
+    bool m_profiling;
+    CompressStatsBC6HBC7 m_stats;
+    uint32_t m_timestamp_valid_bits;
+    TraceRecorderBCVk* m_tracer;
+    PFN_vkGetCalibratedTimestampsEXT m_get_calibrated_timestamps;
+
+    // Objects of RecordCompress() (nullptr unless it's recording)
+    TransientAllocatorBCVk* m_recording;
+    bool m_desc_set_bound;  // m_desc_set is used by a recorded pass.
+
+    // VK_KHR_external_memory_fd and VK_KHR_external_semaphore_fd (nullptr when the extensions are disabled)
+    PFN_vkGetMemoryFdPropertiesKHR m_get_memory_fd_props;
+    PFN_vkImportSemaphoreFdKHR m_import_semaphore_fd;
+    uint32_t m_family_id;
+
+    // Queue for uploads and readbacks (VK_NULL_HANDLE when copies run on m_queue. See SetTransferQueue().)
+    VkQueue m_transfer_queue;
+    VkCommandPool m_transfer_cmd_pool;
+    uint32_t m_transfer_family_id;
+    VkSemaphore m_transfer_semaphores[3];  // two for bands of source images, and one for readbacks
+    VkFence m_transfer_fences[3];  // two for command buffers of bands, and one for readbacks
+    void ReleaseTransferQueue();
+
+    // VK_EXT_external_memory_host (nullptr when the extension is disabled)
+    PFN_vkGetMemoryHostPointerPropertiesEXT m_get_host_pointer_props;
+    VkDeviceSize m_host_pointer_alignment;
+    bool m_host_memory_import;
+
+    // VK_EXT_debug_utils (nullptr when the extension is disabled)
+    PFN_vkSetDebugUtilsObjectNameEXT m_set_object_name;
+    PFN_vkCmdBeginDebugUtilsLabelEXT m_cmd_begin_label;
+    PFN_vkCmdEndDebugUtilsLabelEXT m_cmd_end_label;
+
+    // Results streamed to the caller (nullptr when they are delivered at once. See SetResultCallback().)
+    ResultCallbackBCVk m_result_callback;
+    void* m_result_user_data;
+    uint32_t m_result_block_rows;
+    WorkgroupTuningBC6HBC7 m_tuning;
+
+    // Allocate buffers for a tile of m_tile_block_rows block rows.
+    VkResult AllocateBuffers();
 
     // Free allocated objects by Prepare()
     void FreeBuffers();
 
+    // Select pipelines for the current options. `src_pixels` can be nullptr when the pixels are not on the host.
+    //   Rows of `src_pixels` are `row_pitch` bytes apart.
+    void SelectPipelines(const void* src_pixels, uint32_t row_pitch, PipelineSetBCVk* pipelines);
+    VkResult CreatePipelines(PipelineSetBCVk* pipelines);
+
+    // Run passes for blocks of a tile in batches of MAX_BLOCK_BATCH blocks.
+    //   It encodes blocks from `first_block_id` to `num_total_blocks`. (The other blocks of the tile are not written.)
+    //   Each pass is submitted to `queue`, or recorded into `command_buffer` when `queue` is VK_NULL_HANDLE.
+    //   `bands` uploads the source during the passes. (nullptr when the whole source is ready)
+    VkResult CompressBatches(VkCommandBuffer command_buffer, VkQueue queue,
+                             const PipelineSetBCVk* pipelines,
+                             uint32_t xblocks, uint32_t first_block_id, uint32_t num_total_blocks,
+                             SourceBandsBCVk* bands, PassProfilerBCVk* profiler);
+
+    // Compress tiles of src_pixels (or src_buf) and write results to out_pixels (or dst_buf).
+    //   Rows of the source are `src_row_pitch` bytes apart.
+    VkResult CompressTiles(void* src_pixels, uint32_t src_row_pitch, void* out_pixels,
+                           VkBuffer src_buf, VkDeviceSize src_offset,
+                           VkBuffer dst_buf, VkDeviceSize dst_offset);
+
+    // Wrap memory exported by another process or API with a buffer.
+    //   `fd` is set to -1 when the Vulkan implementation owns it.
+    VkResult ImportExternalBuffer(const ExternalMemoryBCVk& memory, int* fd, VkBufferUsageFlags usage,
+                                  VkBuffer* buf, VkDeviceMemory* mem);
+
+    // Move ownership of external buffers between VK_QUEUE_FAMILY_EXTERNAL and the queue.
+    //   The submission waits `wait_semaphore`, and signals `signal_semaphore`. (They can be VK_NULL_HANDLE.)
+    VkResult TransferExternalOwnership(VkBuffer src_buf, VkBuffer dst_buf, bool acquire,
+                                       VkSemaphore wait_semaphore, VkSemaphore signal_semaphore);
+
+    // Wrap host memory with a buffer. It fails when the memory can't be imported.
+    //   The buffer covers the enclosing range aligned to minImportedHostPointerAlignment.
+    //   `offset` receives the offset of `ptr` in the buffer.
+    VkResult ImportHostBuffer(void* ptr, VkDeviceSize size, VkBufferUsageFlags usage,
+                              VkBuffer* buf, VkDeviceMemory* mem, VkDeviceSize* offset);
+
+    // Create the source image and its staging buffer for a tile.
+    //   `external_buf` is used as the staging buffer if it's not VK_NULL_HANDLE.
+    //   Otherwise, `pixels` are imported as the staging buffer if possible.
+    VkResult CreateSourceImage(uint32_t height, void* pixels, uint32_t row_pitch,
+                               VkBuffer external_buf, VkDeviceSize external_offset,
+                               SourceImageBCVk* src_image);
+    void DestroySourceImage(SourceImageBCVk* src_image);
+
+    // Name an object for GPU debuggers and profilers. (It does nothing without VK_EXT_debug_utils.)
+    void SetObjectName(VkObjectType type, uint64_t handle, const char* name);
+
     // Update VkBuffer for constants
     VkResult UpdateConstants(uint32_t xblocks, uint32_t mode_id, uint32_t start_block_id, uint32_t num_total_blocks);
-    // Set image view and constant buffer for shaders.
-    void SetImageViewAndConstBuf(VkImageView image_view, VkBuffer const_buf);
+    // Descriptor sets bound to recorded commands can't be updated until the commands are complete.
+    //   While RecordCompress() is recording, the next update after PassDescriptorSet() goes to a copy of the set.
+    VkResult RenewDescriptorSet();
+    // Get the descriptor set for the next pass.
+    VkDescriptorSet PassDescriptorSet();
+    // Set source pixels and constant buffer for shaders.
+    void SetSourceAndConstBuf(const SourceImageBCVk* src_image, VkBuffer const_buf);
     // Use buf as an output buffer of shaders.
     void SetOutputBuffer(VkBuffer buf);
+    // Use buf as the partition shortlist for shaders.
+    void SetShortlistBuffer(VkBuffer buf);
     // Use err_buf as input, and use out_buf as output.
     void SetErrorAndOutputBuffer(VkBuffer err_buf, VkBuffer out_buf);
+    // Use m_block_list_buf[list_id] as the block list for shaders,
+    // and use m_block_list_buf[out_list_id] as the output of CompactBlockListCS.
+    void SetBlockListBuffers(uint32_t list_id, uint32_t out_list_id);
+    // Remove blocks with small errors from the block list.
+    //   `list_id` will be the id of the compacted list.
+    //   `err_buf` should be the output of the last pass.
+    VkResult CompactBlockList(VkCommandBuffer command_buffer, VkQueue queue, VkPipeline pipeline,
+                              uint32_t* list_id, VkBuffer err_buf, VkBuffer other_err_buf,
+                              PassProfilerBCVk* profiler);
 
     // Copy buf to GPU
     VkResult CopyToVkImage(VkCommandBuffer command_buffer,
-                        VkBuffer image_cpu_buf,
-                        VkDeviceMemory image_cpu_mem,
-                        VkImage image,
-                        void* buf, uint32_t buf_size);
+                        SourceImageBCVk* src_image, uint32_t height,
+                        void* buf, uint32_t row_pitch,
+                        PassProfilerBCVk* profiler);
+
+    // Copy the next `height` rows of a tile to the source image, and submit the copy without waiting.
+    VkResult UploadSourceBand(SourceBandsBCVk* bands, uint32_t height, PassProfilerBCVk* profiler);
 
     // Copy result to cpu memory
-    VkResult CopyFromOutBuffer(VkCommandBuffer command_buffer, void* buf);
+    //   It copies `buf_size` bytes from `out_offset` of m_out_buf.
+    //   `dst_buf` is `buf` imported by ImportHostBuffer(), an external buffer, or VK_NULL_HANDLE.
+    //   The copy runs on m_transfer_queue unless `readback` is nullptr. Then, it returns without waiting.
+    //   FinishReadback() waits for it and copies results to `buf`.
+    VkResult CopyFromOutBuffer(VkCommandBuffer command_buffer, void* buf, uint32_t buf_size, VkDeviceSize out_offset,
+                               VkBuffer dst_buf, VkDeviceSize dst_offset,
+                               ReadbackBCVk* readback,
+                               PassProfilerBCVk* profiler);
+
+    // Wait for the pending readback on m_transfer_queue, and copy results to the host if needed.
+    VkResult FinishReadback(ReadbackBCVk* readback, PassProfilerBCVk* profiler);
 };
 
 #ifndef DXGI_FORMAT_DEFINED
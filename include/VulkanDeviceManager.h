@@ -33,6 +33,18 @@ void main() {
     VkDevice         device          = manager.GetDevice(),
     VkPhysicalDevice physical_device = manager.GetUsingGPU(),
     uint32_t         family_id       = manager.GetUsingFamilyId()
+
+    // Call it before compressor.Initialize() to let subgroup builds require larger subgroups.
+    //   compressor.SetSubgroupSizeControl(manager.HasSubgroupSizeControl());
+
+    // Call it before compressor.Initialize() to fit tiles in the heap budgets of VK_EXT_memory_budget.
+    //   compressor.SetMemoryBudgetExtension(manager.HasMemoryBudget());
+
+    // A transfer queue is created with CreateDevice(-1, true) if the GPU has a transfer only family.
+    //   VkQueue transfer_queue;
+    //   if (manager.HasTransferQueue() &&
+    //       manager.GetDeviceQueue(manager.GetTransferFamilyId(), &transfer_queue) == VK_SUCCESS)
+    //       compressor.SetTransferQueue(transfer_queue, manager.GetTransferFamilyId());
 }
  */
 
@@ -49,6 +61,11 @@ class VulkanDeviceManager {
     // activated device info
     VkDevice m_device;
     uint32_t m_family_id;
+    uint32_t m_transfer_family_id;  // -1 when the device has no transfer queue
+    uint32_t m_queue_family_ids[2];  // families of queues created by CreateDevice()
+    uint32_t m_queue_family_count;
+    bool m_subgroup_size_control;  // VK_EXT_subgroup_size_control is enabled with computeFullSubgroups.
+    bool m_memory_budget;  // VK_EXT_memory_budget is enabled on Vulkan 1.1 instances and devices.
     uint32_t m_gpu_id;
 
     // physical devices
@@ -79,7 +96,9 @@ class VulkanDeviceManager {
 
     // Create VkDevice from a GPU.
     // When `gpu_id` is -1, it uses one of GPUs which can run compute shaders.
-    VkResult CreateDevice(uint32_t gpu_id = -1);
+    // When `use_transfer_queue` is true, it also creates a queue of a transfer only family (DMA engine) if possible.
+    //   The family should copy images at pixel granularity. (minImageTransferGranularity is (1,1,1).)
+    VkResult CreateDevice(uint32_t gpu_id = -1, bool use_transfer_queue = false);
 
     bool HasDevice() { return m_device != VK_NULL_HANDLE; }
     VkDevice GetDevice() { return m_device; }
@@ -88,6 +107,13 @@ class VulkanDeviceManager {
 
     // Functions to get info about created VkDevice
     uint32_t GetUsingFamilyId() { return m_family_id; }
+    bool HasTransferQueue() { return m_transfer_family_id != -1; }
+    uint32_t GetTransferFamilyId() { return m_transfer_family_id; }
+    bool HasSubgroupSizeControl() { return m_subgroup_size_control; }
+    bool HasMemoryBudget() { return m_memory_budget; }
+
+    // Get the queue of a family. It fails with VK_ERROR_INITIALIZATION_FAILED when CreateDevice() didn't create it.
+    VkResult GetDeviceQueue(uint32_t family_id, VkQueue* queue);
     uint32_t GetUsingGPUId() { return m_gpu_id; }
     VkPhysicalDevice GetUsingGPU() { return m_gpus[m_gpu_id]; }
     bool UsingGPUIsLLVMpipe() { return GPUIsLLVMpipe(m_gpu_id); }
@@ -26,6 +26,17 @@ cbuffer cbCS : register(b0)
     uint g_mode_id;
     uint g_start_block_id;
     uint g_num_total_blocks;
+    float g_alpha_weight;     //not used for BC6H
+    uint g_options;
+    float g_error_threshold;  //blocks with an error not above this value skip the remaining mode passes
+    uint g_num_partitions;    //the number of partitions searched in two-region modes
+    uint g_num_two_region_modes;  //the number of modes TryModeLE10FusedCS tries
+    uint g_shortlist_size;    //the number of partitions kept by PartitionShortlistCS (0: no shortlist)
+    uint g_error_window;      //the number of blocks in the error buffers (a multiple of the batch size)
+    uint g_input_offset;      //the first pixel of the tile in g_InputBuffer
+    uint g_input_row_pitch;   //pixels between rows in g_InputBuffer
+    uint g_tile_height;       //rows of the current tile (LoadInput() returns 0 for pixels outside the texture)
+    uint g_input_row;         //the first row of the tile in g_Input
 };
 
 static const uint candidateModeMemory[14] = { 0x00, 0x01, 0x02, 0x06, 0x0A, 0x0E, 0x12, 0x16, 0x1A, 0x1E, 0x03, 0x07, 0x0B, 0x0F };
@@ -100,7 +111,10 @@ static const uint aStep2[64] =
 
 static const float3 RGB2LUM = float3(0.2126f, 0.7152f, 0.0722f);
 
+//Passes with 16 threads per BC block are also built with 16 and 32 (1 and 2 blocks per group)
+#ifndef THREAD_GROUP_SIZE
 #define THREAD_GROUP_SIZE    64
+#endif
 #define BLOCK_SIZE_Y         4
 #define BLOCK_SIZE_X         4
 #define BLOCK_SIZE           (BLOCK_SIZE_Y * BLOCK_SIZE_X)
@@ -109,6 +123,7 @@ static const float3 RGB2LUM = float3(0.2126f, 0.7152f, 0.0722f);
 //Forward declaration
 uint3 float2half(float3 pixel_f);
 int3 start_quantize(uint3 pixel_h);
+int3 solid_quantize(uint3 pixel_h);
 void quantize(inout int2x3 endPoint, uint prec);
 void finish_quantize_0(inout int bBadQuantize, inout int2x3 endPoint, uint4 prec, bool transformed);
 void finish_quantize_1(inout int bBadQuantize, inout int2x3 endPoint, uint4 prec, bool transformed);
@@ -196,11 +211,52 @@ int2x3 matrix_and(int2x3 a, int2x3 b)
     return c;
 }
 
+#ifdef USE_BUFFER_INPUT
+//Source pixels (R32G32B32A32_FLOAT) in a host visible buffer. It replaces g_Input on unified memory devices.
+//Rows are g_input_row_pitch pixels apart.
+[[vk::binding(9, 0)]] StructuredBuffer<float4> g_InputBuffer;
+#else
 Texture2D<float4> g_Input : register(t0);
+#endif
 StructuredBuffer<uint4> g_InBuff : register(t1);
 
 RWStructuredBuffer<uint4> g_OutBuff : register(u0);
 
+//Blocks which are not encoded by ClassifySolidCS. Mode passes read block ids from this list.
+[[vk::binding(4, 0)]] RWStructuredBuffer<uint> g_BlockList;
+//[0]: the number of blocks in g_BlockList
+//[1..3], [4..6], [7..9], [10..12]: dispatch arguments for 1, 2, 4 and 64 blocks per thread group
+[[vk::binding(5, 0)]] RWStructuredBuffer<uint> g_DispatchArgs;
+//Output of CompactBlockListCS. It has the same layout as g_BlockList and g_DispatchArgs.
+[[vk::binding(6, 0)]] RWStructuredBuffer<uint> g_OutBlockList;
+[[vk::binding(7, 0)]] RWStructuredBuffer<uint> g_OutDispatchArgs;
+
+//Partitions shortlisted by PartitionShortlistCS (indexed with the block id in the batch)
+//BC6H only uses the first list of each block.
+[[vk::binding(8, 0)]] RWStructuredBuffer<uint> g_Shortlist;
+#define SHORTLIST_STRIDE    48
+
+//Error buffers only keep the blocks of the current batch. They are used as ring buffers.
+uint ErrorID(uint blockID)
+{
+    return blockID % g_error_window;
+}
+
+//Returns the source pixel at (x, y) of the tile
+//Pixels of partial blocks outside the texture are 0 for both buffers and images.
+float4 LoadInput(uint x, uint y)
+{
+    if (x >= g_tex_width || y >= g_tile_height)
+    {
+        return float4(0, 0, 0, 0);
+    }
+#ifdef USE_BUFFER_INPUT
+    return g_InputBuffer[g_input_offset + y * g_input_row_pitch + x];
+#else
+    return g_Input.Load(uint3(x, g_input_row + y, 0));
+#endif
+}
+
 struct SharedData
 {
     float3 pixel;
@@ -218,18 +274,130 @@ struct SharedData
 
 groupshared SharedData shared_temp[THREAD_GROUP_SIZE];
 
+#ifdef USE_SUBGROUP
+//Subgroup builds replace the shared memory reduction ladders with wave intrinsics.
+//They assume the whole thread group is in a single subgroup. (The host only uses them in that case.)
+
+//Returns `value` of the thread that has the smallest error in the BC block this thread is on
+//The lowest `tie` wins a tie, and then the lowest thread index, as it does in the shared memory reduction.
+uint4 wave_select_best(uint GI, uint blockInGroup, uint BLOCK_IN_GROUP, float error, uint tie, uint4 value)
+{
+    uint4 best = value;
+    for (uint b = 0; b < BLOCK_IN_GROUP; b++)
+    {
+        bool in_block = blockInGroup == b;
+        if (WaveActiveAnyTrue(in_block))
+        {
+            float min_error = WaveActiveMin(in_block ? error : MAX_FLOAT);
+            uint best_key = WaveActiveMin((in_block && (error == min_error)) ? ((tie << 8) | GI) : 0xFFFFFFFF);
+            uint best_thread = best_key & 0xFF;
+            uint4 ballot = WaveActiveBallot(GI == best_thread);
+            uint lane = (0 != ballot.x) ? firstbitlow(ballot.x)
+                : (0 != ballot.y) ? 32 + firstbitlow(ballot.y)
+                : (0 != ballot.z) ? 64 + firstbitlow(ballot.z) : 96 + firstbitlow(ballot.w);
+            uint4 candidate = WaveReadLaneAt(value, lane);
+            if (in_block)
+            {
+                best = candidate;
+            }
+        }
+    }
+    return best;
+}
+#endif
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void ClassifySolidCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one block per thread
+{
+    uint blockID = g_start_block_id + groupID.x * THREAD_GROUP_SIZE + GI;
+    if (blockID >= g_num_total_blocks)
+    {
+        return;
+    }
+
+    uint block_y = blockID / g_num_block_x;
+    uint block_x = blockID - block_y * g_num_block_x;
+    uint base_x = block_x * BLOCK_SIZE_X;
+    uint base_y = block_y * BLOCK_SIZE_Y;
+
+    uint3 color_h = float2half(max(LoadInput(base_x, base_y).rgb, float3(0,0,0)));
+    bool solid = true;
+    for (uint i = 1; i < 16; i++)
+    {
+        uint3 pixel_h = float2half(max(LoadInput(base_x + i % 4, base_y + i / 4).rgb, float3(0,0,0)));
+        solid = solid && all(pixel_h == color_h);
+    }
+
+    if (solid)
+    {
+        // mode 14 with all indices 0 decodes the first end point as is
+        bool transformed = candidateModeTransformed[13];
+        uint4 prec = candidateModePrec[13];
+        int2x3 endPoint;
+        endPoint[0] = solid_quantize(color_h);
+        endPoint[1] = 0;
+
+        bool bBadQuantize;
+        finish_quantize(bBadQuantize, endPoint, prec, transformed);
+
+        uint4 block = 0;
+        block_package(block, endPoint, candidateModeFlag[13]);
+        g_OutBuff[blockID] = block;
+    }
+    else
+    {
+        uint index;
+        InterlockedAdd(g_DispatchArgs[0], 1, index);
+        g_BlockList[index] = blockID;
+        InterlockedMax(g_DispatchArgs[1], index + 1);
+        InterlockedMax(g_DispatchArgs[4], index / 2 + 1);
+        InterlockedMax(g_DispatchArgs[7], index / 4 + 1);
+        InterlockedMax(g_DispatchArgs[10], index / THREAD_GROUP_SIZE + 1);
+    }
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void CompactBlockListCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one block per thread
+{
+    uint listID = groupID.x * THREAD_GROUP_SIZE + GI;
+    if (listID >= g_DispatchArgs[0])
+    {
+        return;
+    }
+
+    uint blockID = g_BlockList[listID];
+    uint4 result = g_InBuff[ErrorID(blockID)];
+    if (asfloat(result.x) > g_error_threshold)
+    {
+        uint index;
+        InterlockedAdd(g_OutDispatchArgs[0], 1, index);
+        g_OutBlockList[index] = blockID;
+        InterlockedMax(g_OutDispatchArgs[1], index + 1);
+        InterlockedMax(g_OutDispatchArgs[4], index / 2 + 1);
+        InterlockedMax(g_OutDispatchArgs[7], index / 4 + 1);
+        InterlockedMax(g_OutDispatchArgs[10], index / THREAD_GROUP_SIZE + 1);
+    }
+    else
+    {
+        //the block skips the remaining passes. keep its result in both error buffers.
+        g_OutBuff[ErrorID(blockID)] = result;
+    }
+}
+
 [numthreads(THREAD_GROUP_SIZE, 1, 1)]
 void TryModeG10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 {
     const uint MAX_USED_THREAD = 16;
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
     uint blockInGroup = GI / MAX_USED_THREAD;
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
     uint threadBase = blockInGroup * MAX_USED_THREAD;
     uint threadInBlock = GI - threadBase;
 
 #ifndef REF_DEVICE
-    if (blockID >= g_num_total_blocks)
+    if (!active)
     {
         return;
     }
@@ -242,7 +410,7 @@ void TryModeG10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 
     if (threadInBlock < 16)
     {
-        shared_temp[GI].pixel = g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)).rgb;
+        shared_temp[GI].pixel = LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4).rgb;
         shared_temp[GI].pixel = max(shared_temp[GI].pixel, float3(0,0,0));
         uint3 pixel_h = float2half(shared_temp[GI].pixel);
         shared_temp[GI].pixel_hr = half2float(pixel_h);
@@ -415,29 +583,43 @@ void TryModeG10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
             shared_temp[GI].best_mode = shared_temp[GI + 1].best_mode;
         }
 
-        g_OutBuff[blockID] = uint4(asuint(shared_temp[GI].error), shared_temp[GI].best_mode, 0, 0);
+        if (active)
+        {
+            g_OutBuff[ErrorID(blockID)] = uint4(asuint(shared_temp[GI].error), shared_temp[GI].best_mode, 0, 0);
+        }
     }
 }
 
-[numthreads(THREAD_GROUP_SIZE, 1, 1)]
-void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+//Returns true when the result of thread `other` is better than the result of thread `GI`
+//An earlier mode wins a tie. It's the order in which TryModeLE10CS passes keep their results.
+//So, TryModeLE10FusedCS selects the same mode and partition as the passes.
+bool is_better_le10(uint GI, uint other)
+{
+    return (shared_temp[other].error < shared_temp[GI].error) ||
+        ((shared_temp[other].error == shared_temp[GI].error) && (shared_temp[other].best_mode < shared_temp[GI].best_mode));
+}
+
+//Try two-region modes from first_mode_id to first_mode_id + num_modes - 1
+void try_mode_le10(uint GI, uint3 groupID, uint first_mode_id, uint num_modes)
 {
     const uint MAX_USED_THREAD = 32;
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
     uint blockInGroup = GI / MAX_USED_THREAD;
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
     uint threadBase = blockInGroup * MAX_USED_THREAD;
     uint threadInBlock = GI - threadBase;
 
 #ifndef REF_DEVICE
-    if (blockID >= g_num_total_blocks)
+    if (!active)
     {
         return;
     }
 
-    if (asfloat(g_InBuff[blockID].x) < 1e-6f)
+    if (asfloat(g_InBuff[ErrorID(blockID)].x) < 1e-6f)
     {
-        g_OutBuff[blockID] = g_InBuff[blockID];
+        g_OutBuff[ErrorID(blockID)] = g_InBuff[ErrorID(blockID)];
         return;
     }
 #endif
@@ -449,7 +631,7 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 
     if (threadInBlock < 16)
     {
-        shared_temp[GI].pixel = g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)).rgb;
+        shared_temp[GI].pixel = LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4).rgb;
         shared_temp[GI].pixel = max(shared_temp[GI].pixel, float3(0,0,0));
         uint3 pixel_h = float2half(shared_temp[GI].pixel);
         shared_temp[GI].pixel_hr = half2float(pixel_h);
@@ -460,8 +642,19 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
     GroupMemoryBarrierWithGroupSync();
 #endif
 
+    shared_temp[GI].error = MAX_FLOAT;   //partitions which are not searched
+    shared_temp[GI].best_mode = 0;
+
+    uint num_partitions = g_num_partitions;
+    uint partition = threadInBlock;
+    if (0 != g_shortlist_size)
+    {
+        num_partitions = min(num_partitions, g_shortlist_size);
+        partition = g_Shortlist[(blockID - g_start_block_id) * SHORTLIST_STRIDE + min(threadInBlock, num_partitions - 1)];
+    }
+
     //ergod mode_type 1:10
-    if (threadInBlock < 32)
+    if (threadInBlock < num_partitions)
     {
         // find_axis
         int2x3 endPoint[2];
@@ -476,7 +669,7 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
         endPoint_lum[1][0] = MAX_FLOAT;
         endPoint_lum[1][1] = MIN_FLOAT;
 
-        uint bit = candidateSectionBit[threadInBlock];
+        uint bit = candidateSectionBit[partition];
         for (uint i = 0; i < 16; i++)
         {
             int3 pixel_ph = shared_temp[threadBase + i].pixel_ph;
@@ -518,7 +711,7 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
             span[p] = endPoint[p][1] - endPoint[p][0];
             span_norm_sqr[p] = dot(span[p], span[p]);
 
-            float dotProduct = dot(span[p], shared_temp[threadBase + (0 == p ? 0 : candidateFixUpIndex1D[threadInBlock])].pixel_ph - endPoint[p][0]);// fixed a bug in v0.2
+            float dotProduct = dot(span[p], shared_temp[threadBase + (0 == p ? 0 : candidateFixUpIndex1D[partition])].pixel_ph - endPoint[p][0]);// fixed a bug in v0.2
             if (span_norm_sqr[p] > 0 && dotProduct >= 0 && uint(dotProduct * 63.49999 / span_norm_sqr[p]) > 32)
             {
                 span[p] = -span[p];
@@ -526,65 +719,93 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
             }
         }
 
-        uint4 prec = candidateModePrec[g_mode_id];
-        int2x3 endPoint_q[2] = endPoint;
-        quantize(endPoint_q[0], prec.x);
-        quantize(endPoint_q[1], prec.x);
-
-        bool transformed = candidateModeTransformed[g_mode_id];
-        if (transformed)
+        //the end points are shared by all modes. only quantization differs.
+        float best_error = MAX_FLOAT;
+        uint best_mode_id = first_mode_id;
+        for (uint mode_id = first_mode_id; mode_id < first_mode_id + num_modes; mode_id++)
         {
-            endPoint_q[0][1] -= endPoint_q[0][0];
-            endPoint_q[1][0] -= endPoint_q[0][0];
-            endPoint_q[1][1] -= endPoint_q[0][0];
-        }
+            uint4 prec = candidateModePrec[mode_id];
+            int2x3 endPoint_q[2] = endPoint;
+            quantize(endPoint_q[0], prec.x);
+            quantize(endPoint_q[1], prec.x);
 
-        int bBadQuantize = 0;
-        finish_quantize_0(bBadQuantize, endPoint_q[0], prec, transformed);
-        finish_quantize_1(bBadQuantize, endPoint_q[1], prec, transformed);
+            bool transformed = candidateModeTransformed[mode_id];
+            if (transformed)
+            {
+                endPoint_q[0][1] -= endPoint_q[0][0];
+                endPoint_q[1][0] -= endPoint_q[0][0];
+                endPoint_q[1][1] -= endPoint_q[0][0];
+            }
 
-        start_unquantize(endPoint_q, prec, transformed);
+            int bBadQuantize = 0;
+            finish_quantize_0(bBadQuantize, endPoint_q[0], prec, transformed);
+            finish_quantize_1(bBadQuantize, endPoint_q[1], prec, transformed);
 
-        unquantize(endPoint_q[0], prec.x);
-        unquantize(endPoint_q[1], prec.x);
+            start_unquantize(endPoint_q, prec, transformed);
 
-        float error = 0;
-        for (uint j = 0; j < 16; j++)
-        {
-            uint3 pixel_rh;
-            if ((bit >> j) & 1)
+            unquantize(endPoint_q[0], prec.x);
+            unquantize(endPoint_q[1], prec.x);
+
+            float error = 0;
+            for (uint j = 0; j < 16; j++)
             {
-                float dotProduct = dot(span[1], shared_temp[threadBase + j].pixel_ph - endPoint[1][0]);// fixed a bug in v0.2
-                uint index = (span_norm_sqr[1] <= 0 || dotProduct <= 0) ? 0
-                    : ((dotProduct < span_norm_sqr[1]) ? aStep1[uint(dotProduct * 63.49999 / span_norm_sqr[1])] : aStep1[63]);
-                generate_palette_unquantized8(pixel_rh, endPoint_q[1][0], endPoint_q[1][1], index);
+                uint3 pixel_rh;
+                if ((bit >> j) & 1)
+                {
+                    float dotProduct = dot(span[1], shared_temp[threadBase + j].pixel_ph - endPoint[1][0]);// fixed a bug in v0.2
+                    uint index = (span_norm_sqr[1] <= 0 || dotProduct <= 0) ? 0
+                        : ((dotProduct < span_norm_sqr[1]) ? aStep1[uint(dotProduct * 63.49999 / span_norm_sqr[1])] : aStep1[63]);
+                    generate_palette_unquantized8(pixel_rh, endPoint_q[1][0], endPoint_q[1][1], index);
+                }
+                else
+                {
+                    float dotProduct = dot(span[0], shared_temp[threadBase + j].pixel_ph - endPoint[0][0]);// fixed a bug in v0.2
+                    uint index = (span_norm_sqr[0] <= 0 || dotProduct <= 0) ? 0
+                        : ((dotProduct < span_norm_sqr[0]) ? aStep1[uint(dotProduct * 63.49999 / span_norm_sqr[0])] : aStep1[63]);
+                    generate_palette_unquantized8(pixel_rh, endPoint_q[0][0], endPoint_q[0][1], index);
+                }
+
+                float3 pixel_r = half2float(pixel_rh);
+                pixel_r -= shared_temp[threadBase + j].pixel_hr;
+                error += dot(pixel_r, pixel_r);
             }
-            else
+            if (bBadQuantize)
+                error = 1e20f;
+
+            if (error < best_error)
             {
-                float dotProduct = dot(span[0], shared_temp[threadBase + j].pixel_ph - endPoint[0][0]);// fixed a bug in v0.2
-                uint index = (span_norm_sqr[0] <= 0 || dotProduct <= 0) ? 0
-                    : ((dotProduct < span_norm_sqr[0]) ? aStep1[uint(dotProduct * 63.49999 / span_norm_sqr[0])] : aStep1[63]);
-                generate_palette_unquantized8(pixel_rh, endPoint_q[0][0], endPoint_q[0][1], index);
+                best_error = error;
+                best_mode_id = mode_id;
             }
-
-            float3 pixel_r = half2float(pixel_rh);
-            pixel_r -= shared_temp[threadBase + j].pixel_hr;
-            error += dot(pixel_r, pixel_r);
         }
-        if (bBadQuantize)
-            error = 1e20f;
 
-        shared_temp[GI].error = error;
-        shared_temp[GI].best_mode = candidateModeFlag[g_mode_id];
-        shared_temp[GI].best_partition = threadInBlock;
+        shared_temp[GI].error = best_error;
+        shared_temp[GI].best_mode = best_mode_id;   //converted to the mode flag after the reduction
+        shared_temp[GI].best_partition = partition;
+    }
+#ifdef USE_SUBGROUP
+    uint4 best = wave_select_best(GI, blockInGroup, BLOCK_IN_GROUP, shared_temp[GI].error, shared_temp[GI].best_mode,
+        uint4(asuint(shared_temp[GI].error), shared_temp[GI].best_mode, shared_temp[GI].best_partition, 0));
+    best.y = candidateModeFlag[best.y];
+    if ((threadInBlock < 1) && active)
+    {
+        if (asfloat(g_InBuff[ErrorID(blockID)].x) > asfloat(best.x))
+        {
+            g_OutBuff[ErrorID(blockID)] = best;
+        }
+        else
+        {
+            g_OutBuff[ErrorID(blockID)] = g_InBuff[ErrorID(blockID)];
+        }
     }
+#else
 #ifdef REF_DEVICE
     GroupMemoryBarrierWithGroupSync();
 #endif
 
     if (threadInBlock < 16)
     {
-        if (shared_temp[GI].error > shared_temp[GI + 16].error)
+        if (is_better_le10(GI, GI + 16))
         {
             shared_temp[GI].error = shared_temp[GI + 16].error;
             shared_temp[GI].best_mode = shared_temp[GI + 16].best_mode;
@@ -596,7 +817,7 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 #endif
     if (threadInBlock < 8)
     {
-        if (shared_temp[GI].error > shared_temp[GI + 8].error)
+        if (is_better_le10(GI, GI + 8))
         {
             shared_temp[GI].error = shared_temp[GI + 8].error;
             shared_temp[GI].best_mode = shared_temp[GI + 8].best_mode;
@@ -608,7 +829,7 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 #endif
     if (threadInBlock < 4)
     {
-        if (shared_temp[GI].error > shared_temp[GI + 4].error)
+        if (is_better_le10(GI, GI + 4))
         {
             shared_temp[GI].error = shared_temp[GI + 4].error;
             shared_temp[GI].best_mode = shared_temp[GI + 4].best_mode;
@@ -620,7 +841,7 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 #endif
     if (threadInBlock < 2)
     {
-        if (shared_temp[GI].error > shared_temp[GI + 2].error)
+        if (is_better_le10(GI, GI + 2))
         {
             shared_temp[GI].error = shared_temp[GI + 2].error;
             shared_temp[GI].best_mode = shared_temp[GI + 2].best_mode;
@@ -632,22 +853,108 @@ void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 #endif
     if (threadInBlock < 1)
     {
-        if (shared_temp[GI].error > shared_temp[GI + 1].error)
+        if (is_better_le10(GI, GI + 1))
         {
             shared_temp[GI].error = shared_temp[GI + 1].error;
             shared_temp[GI].best_mode = shared_temp[GI + 1].best_mode;
             shared_temp[GI].best_partition = shared_temp[GI + 1].best_partition;
         }
 
-        if (asfloat(g_InBuff[blockID].x) > shared_temp[GI].error)
+        if (active)
         {
-            g_OutBuff[blockID] = uint4(asuint(shared_temp[GI].error), shared_temp[GI].best_mode, shared_temp[GI].best_partition, 0);
+            if (asfloat(g_InBuff[ErrorID(blockID)].x) > shared_temp[GI].error)
+            {
+                g_OutBuff[ErrorID(blockID)] = uint4(asuint(shared_temp[GI].error), candidateModeFlag[shared_temp[GI].best_mode], shared_temp[GI].best_partition, 0);
+            }
+            else
+            {
+                g_OutBuff[ErrorID(blockID)] = g_InBuff[ErrorID(blockID)];
+            }
         }
-        else
+    }
+#endif
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void PartitionShortlistCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one partition per thread
+{
+    const uint MAX_USED_THREAD = 32;
+    uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
+    uint blockInGroup = GI / MAX_USED_THREAD;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
+    uint threadBase = blockInGroup * MAX_USED_THREAD;
+    uint threadInBlock = GI - threadBase;
+
+    uint block_y = blockID / g_num_block_x;
+    uint block_x = blockID - block_y * g_num_block_x;
+    uint base_x = block_x * BLOCK_SIZE_X;
+    uint base_y = block_y * BLOCK_SIZE_Y;
+
+    if (threadInBlock < 16)
+    {
+        shared_temp[GI].pixel = LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4).rgb;
+        shared_temp[GI].pixel = max(shared_temp[GI].pixel, float3(0,0,0));
+        shared_temp[GI].pixel_hr = half2float(float2half(shared_temp[GI].pixel));
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    //sum of squared distances from the subset means. it's a cheap proxy of the error of a partition.
+    float3 sum[2] = { float3(0, 0, 0), float3(0, 0, 0) };
+    float3 sum_sqr[2] = { float3(0, 0, 0), float3(0, 0, 0) };
+    float count[2] = { 0, 0 };
+    uint bit = candidateSectionBit[threadInBlock];
+    for (uint i = 0; i < 16; i++)
+    {
+        uint subset_index = (bit >> i) & 1;
+        float3 pixel_hr = shared_temp[threadBase + i].pixel_hr;
+        sum[subset_index] += pixel_hr;
+        sum_sqr[subset_index] += pixel_hr * pixel_hr;
+        count[subset_index] += 1;
+    }
+    float score = 0;
+    for (uint s = 0; s < 2; s++)
+    {
+        if (count[s] > 0)
         {
-            g_OutBuff[blockID] = g_InBuff[blockID];
+            float3 variance = sum_sqr[s] - sum[s] * sum[s] / count[s];
+            score += variance.x + variance.y + variance.z;
         }
     }
+    score = max(score, 0);
+    shared_temp[GI].error = score;
+    GroupMemoryBarrierWithGroupSync();
+
+    //rank partitions by their scores. the lower partition index wins a tie.
+    uint num_partitions = min(g_num_partitions, MAX_USED_THREAD);
+    uint rank = 0;
+    for (uint j = 0; j < num_partitions; j++)
+    {
+        float other = shared_temp[threadBase + j].error;
+        if ((other < score) || ((other == score) && (j < threadInBlock)))
+        {
+            rank++;
+        }
+    }
+
+    if (active && (threadInBlock < num_partitions) && (rank < g_shortlist_size))
+    {
+        g_Shortlist[(blockID - g_start_block_id) * SHORTLIST_STRIDE + rank] = threadInBlock;
+    }
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void TryModeLE10CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode_le10(GI, groupID, g_mode_id, 1);
+}
+
+//Try all two-region modes in one pass. TryModeLE10CS is kept as a reference.
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void TryModeLE10FusedCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode_le10(GI, groupID, 0, g_num_two_region_modes);
 }
 
 [numthreads(THREAD_GROUP_SIZE, 1, 1)]
@@ -656,12 +963,14 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
     const uint MAX_USED_THREAD = 32;
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
     uint blockInGroup = GI / MAX_USED_THREAD;
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
     uint threadBase = blockInGroup * MAX_USED_THREAD;
     uint threadInBlock = GI - threadBase;
 
 #ifndef REF_DEVICE
-    if (blockID >= g_num_total_blocks)
+    if (!active)
     {
         return;
     }
@@ -674,7 +983,7 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
 
     if (threadInBlock < 16)
     {
-        shared_temp[GI].pixel = g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)).rgb;
+        shared_temp[GI].pixel = LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4).rgb;
         shared_temp[GI].pixel = max(shared_temp[GI].pixel, float3(0,0,0));
         shared_temp[GI].pixel_lum = dot(shared_temp[GI].pixel, RGB2LUM);
         uint3 pixel_h = float2half(shared_temp[GI].pixel);
@@ -684,8 +993,8 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
     GroupMemoryBarrierWithGroupSync();
 #endif
 
-    uint best_mode = g_InBuff[blockID].y;
-    uint best_partition = g_InBuff[blockID].z;
+    uint best_mode = g_InBuff[ErrorID(blockID)].y;
+    uint best_partition = g_InBuff[ErrorID(blockID)].z;
 
     uint4 block = 0;
 
@@ -1048,7 +1357,10 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
             block_package(block, endPoint_q, best_mode, best_partition);
         }
 
-        g_OutBuff[blockID] = block;
+        if (active)
+        {
+            g_OutBuff[blockID] = block;
+        }
     }
 }
 
@@ -1107,6 +1419,20 @@ int3 start_quantize(uint3 pixel_h)
             : ((pixel_h == 0x7bff) ? 0xffff8001 : -asint(((0x00007fff & pixel_h) << 5) / 31));// fixed a bug in v0.2
     }
 }
+int3 solid_quantize(uint3 pixel_h)
+{
+    // smallest 16 bit end point which finish_unquantize() maps back to pixel_h
+    // pixels are clamped to 0 already. so the sign bit can be set only for -0.
+    pixel_h &= 0x7FFF;
+    if (g_format == UNSIGNED_F16)
+    {
+        return asint(min((pixel_h * 64 + 30) / 31, 0xFFFF));
+    }
+    else
+    {
+        return asint(min((pixel_h * 32 + 30) / 31, 0x7FFF));
+    }
+}
 void quantize(inout int2x3 endPoint, uint prec)
 {
     int iprec = asint(prec);
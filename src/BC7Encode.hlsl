@@ -186,6 +186,44 @@ static const uint aStep[3][64] =
     }
 };
 
+//Mode 5 endpoints (low | high << 8) to reproduce an 8 bit value exactly with the 2 bit index 1
+//(weight 21). Used to encode single color blocks.
+static const uint candidateSolidEndPoint5[256] =
+{
+    0x0000, 0x0100, 0x0101, 0x0201, 0x0202, 0x0302, 0x0303, 0x0403,
+    0x0404, 0x0504, 0x0505, 0x0605, 0x0606, 0x0706, 0x0707, 0x0807,
+    0x0808, 0x0908, 0x0909, 0x0A09, 0x0A0A, 0x0B0A, 0x0B0B, 0x0C0B,
+    0x0C0C, 0x0D0C, 0x0D0D, 0x0E0D, 0x0E0E, 0x0F0E, 0x0F0F, 0x100F,
+    0x1010, 0x1110, 0x1111, 0x1211, 0x1212, 0x1312, 0x1313, 0x1413,
+    0x1414, 0x1514, 0x1515, 0x1615, 0x1616, 0x1716, 0x1717, 0x1817,
+    0x1818, 0x1918, 0x1919, 0x1A19, 0x1A1A, 0x1B1A, 0x1B1B, 0x1C1B,
+    0x1C1C, 0x1D1C, 0x1D1D, 0x1E1D, 0x1E1E, 0x1F1E, 0x1F1F, 0x201F,
+    0x2020, 0x2120, 0x2121, 0x2221, 0x2222, 0x2322, 0x2323, 0x2423,
+    0x2424, 0x2524, 0x2525, 0x2625, 0x2626, 0x2726, 0x2727, 0x2827,
+    0x2828, 0x2928, 0x2929, 0x2A29, 0x2A2A, 0x2B2A, 0x2B2B, 0x2C2B,
+    0x2C2C, 0x2D2C, 0x2D2D, 0x2E2D, 0x2E2E, 0x2F2E, 0x2F2F, 0x302F,
+    0x3030, 0x3130, 0x3131, 0x3231, 0x3232, 0x3332, 0x3333, 0x3433,
+    0x3434, 0x3534, 0x3535, 0x3635, 0x3636, 0x3736, 0x3737, 0x3837,
+    0x3838, 0x3938, 0x3939, 0x3A39, 0x3A3A, 0x3B3A, 0x3B3B, 0x3C3B,
+    0x3C3C, 0x3D3C, 0x3D3D, 0x3E3D, 0x3E3E, 0x3F3E, 0x3F3F, 0x403F,
+    0x3F40, 0x4040, 0x4140, 0x4141, 0x4241, 0x4242, 0x4342, 0x4343,
+    0x4443, 0x4444, 0x4544, 0x4545, 0x4645, 0x4646, 0x4746, 0x4747,
+    0x4847, 0x4848, 0x4948, 0x4949, 0x4A49, 0x4A4A, 0x4B4A, 0x4B4B,
+    0x4C4B, 0x4C4C, 0x4D4C, 0x4D4D, 0x4E4D, 0x4E4E, 0x4F4E, 0x4F4F,
+    0x504F, 0x5050, 0x5150, 0x5151, 0x5251, 0x5252, 0x5352, 0x5353,
+    0x5453, 0x5454, 0x5554, 0x5555, 0x5655, 0x5656, 0x5756, 0x5757,
+    0x5857, 0x5858, 0x5958, 0x5959, 0x5A59, 0x5A5A, 0x5B5A, 0x5B5B,
+    0x5C5B, 0x5C5C, 0x5D5C, 0x5D5D, 0x5E5D, 0x5E5E, 0x5F5E, 0x5F5F,
+    0x605F, 0x6060, 0x6160, 0x6161, 0x6261, 0x6262, 0x6362, 0x6363,
+    0x6463, 0x6464, 0x6564, 0x6565, 0x6665, 0x6666, 0x6766, 0x6767,
+    0x6867, 0x6868, 0x6968, 0x6969, 0x6A69, 0x6A6A, 0x6B6A, 0x6B6B,
+    0x6C6B, 0x6C6C, 0x6D6C, 0x6D6D, 0x6E6D, 0x6E6E, 0x6F6E, 0x6F6F,
+    0x706F, 0x7070, 0x7170, 0x7171, 0x7271, 0x7272, 0x7372, 0x7373,
+    0x7473, 0x7474, 0x7574, 0x7575, 0x7675, 0x7676, 0x7776, 0x7777,
+    0x7877, 0x7878, 0x7978, 0x7979, 0x7A79, 0x7A7A, 0x7B7A, 0x7B7B,
+    0x7C7B, 0x7C7C, 0x7D7C, 0x7D7D, 0x7E7D, 0x7E7E, 0x7F7E, 0x7F7F
+};
+
 cbuffer cbCS : register(b0)
 {
     uint g_tex_width;
@@ -195,8 +233,25 @@ cbuffer cbCS : register(b0)
     uint g_start_block_id;
     uint g_num_total_blocks;
     float g_alpha_weight;
+    uint g_options;
+    float g_error_threshold;  //blocks with an error not above this value skip the remaining mode passes
+    uint g_num_partitions;    //the number of partitions searched in partitioned modes
+    uint g_num_two_region_modes;  //not used for BC7
+    uint g_shortlist_size;    //the number of partitions kept by PartitionShortlistCS (0: no shortlist)
+    uint g_error_window;      //the number of blocks in the error buffers (a multiple of the batch size)
+    uint g_input_offset;      //the first pixel of the tile in g_InputBuffer
+    uint g_input_row_pitch;   //pixels between rows in g_InputBuffer
+    uint g_tile_height;       //rows of the current tile (LoadInput() returns 0 for pixels outside the texture)
+    uint g_input_row;         //the first row of the tile in g_Input
 };
 
+#define OPTION_COLLAPSE_TRANSPARENT 1
+#define OPTION_SKIP_MODE4           2
+#define OPTION_SKIP_MODE5           4
+#define OPTION_SKIP_MODE6           8
+#define OPTION_SKIP_ROTATION        16  //mode 4 5 only use rotation 0
+#define OPTION_SKIP_INDEX_SELECTOR  32  //mode 4 only uses index selector 0
+
 //Forward declaration
 uint2x4 compress_endpoints0(inout uint2x4 endPoint, uint2 P); //Mode = 0
 uint2x4 compress_endpoints1(inout uint2x4 endPoint, uint2 P); //Mode = 1
@@ -215,6 +270,7 @@ void block_package4(out uint4 block, uint rotation, uint index_selector, uint th
 void block_package5(out uint4 block, uint rotation, uint threadBase); //Mode5
 void block_package6(out uint4 block, uint threadBase); //Mode6
 void block_package7(out uint4 block, uint partition, uint threadBase); //Mode7
+void block_package_solid(out uint4 block, uint4 color); //Mode5 with a single color
 
 
 void swap(inout uint4 lhs, inout uint4 rhs)
@@ -254,12 +310,103 @@ void Ensure_A_Is_Larger(inout uint4 a, inout uint4 b)
 }
 
 
+#ifdef USE_BUFFER_INPUT
+//Source pixels (R8G8B8A8) in a host visible buffer. It replaces g_Input on unified memory devices.
+//Rows are g_input_row_pitch pixels apart.
+[[vk::binding(9, 0)]] StructuredBuffer<uint> g_InputBuffer;
+#else
 Texture2D g_Input : register(t0, space0);
+#endif
 StructuredBuffer<uint4> g_InBuff : register(t1, space0);
 
 RWStructuredBuffer<uint4> g_OutBuff : register(u0, space0);
 
+//Blocks which are not encoded by ClassifySolidCS. Mode passes read block ids from this list.
+[[vk::binding(4, 0)]] RWStructuredBuffer<uint> g_BlockList;
+//[0]: the number of blocks in g_BlockList
+//[1..3], [4..6], [7..9], [10..12]: dispatch arguments for 1, 2, 4 and 64 blocks per thread group
+[[vk::binding(5, 0)]] RWStructuredBuffer<uint> g_DispatchArgs;
+//Output of CompactBlockListCS. It has the same layout as g_BlockList and g_DispatchArgs.
+[[vk::binding(6, 0)]] RWStructuredBuffer<uint> g_OutBlockList;
+[[vk::binding(7, 0)]] RWStructuredBuffer<uint> g_OutDispatchArgs;
+
+//Partitions shortlisted by PartitionShortlistCS (indexed with the block id in the batch)
+//[0..15]: partitions for mode 1 3 7, [16..31]: partitions for mode 2, [32..47]: partitions for mode 0
+[[vk::binding(8, 0)]] RWStructuredBuffer<uint> g_Shortlist;
+#define MAX_SHORTLIST_SIZE  16
+#define SHORTLIST_STRIDE    48
+
+//Error buffers only keep the blocks of the current batch. They are used as ring buffers.
+uint ErrorID(uint blockID)
+{
+    return blockID % g_error_window;
+}
+
+//Returns the source pixel at (x, y) of the tile as UNORM values
+//Pixels of partial blocks outside the texture are 0 for both buffers and images.
+float4 LoadInput(uint x, uint y)
+{
+    if (x >= g_tex_width || y >= g_tile_height)
+    {
+        return float4(0, 0, 0, 0);
+    }
+#ifdef USE_BUFFER_INPUT
+    uint pixel = g_InputBuffer[g_input_offset + y * g_input_row_pitch + x];
+    return float4(pixel & 0xFF, (pixel >> 8) & 0xFF, (pixel >> 16) & 0xFF, pixel >> 24) / 255.0f;
+#else
+    return g_Input.Load(uint3(x, g_input_row + y, 0));
+#endif
+}
+
+//Returns the number of partitions a partitioned mode pass tries
+uint num_searched_partitions(uint num_partitions)
+{
+    return (0 != g_shortlist_size) ? min(num_partitions, g_shortlist_size) : num_partitions;
+}
+
+//Returns the partition the i-th thread of a partitioned mode pass tries
+uint searched_partition(uint blockID, uint list, uint i)
+{
+    if (0 == g_shortlist_size)
+    {
+        return i;
+    }
+    return g_Shortlist[(blockID - g_start_block_id) * SHORTLIST_STRIDE + list * MAX_SHORTLIST_SIZE + i];
+}
+
+//Concurrent mode passes don't read the previous result.
+//Each pass writes its best result to its own slot of g_OutBuff (indexed with the block list id) instead.
+struct PassConstants
+{
+    uint mode_id;
+    uint slot;
+};
+[[vk::push_constant]] PassConstants g_pass;
+
+#define NUM_MODE_SLOTS 6    //mode 456, 1, 3, 7, 0, 2
+#define NO_SLOT 0xFFFFFFFF  //sequential passes
+
+//Keep the better one of the previous result and this pass's result, or write this pass's result to its slot
+void write_result(uint blockID, uint listID, uint slot, uint4 result)
+{
+    if (NO_SLOT != slot)
+    {
+        g_OutBuff[listID * NUM_MODE_SLOTS + slot] = result;
+    }
+    else if (g_InBuff[ErrorID(blockID)].x > result.x)
+    {
+        g_OutBuff[ErrorID(blockID)] = result;
+    }
+    else
+    {
+        g_OutBuff[ErrorID(blockID)] = g_InBuff[ErrorID(blockID)];
+    }
+}
+
+//Passes with 16 threads per BC block are also built with 16 and 32 (1 and 2 blocks per group)
+#ifndef THREAD_GROUP_SIZE
 #define THREAD_GROUP_SIZE	64
+#endif
 #define BLOCK_SIZE_Y		4
 #define BLOCK_SIZE_X		4
 #define BLOCK_SIZE			(BLOCK_SIZE_Y * BLOCK_SIZE_X)
@@ -279,19 +426,249 @@ struct BufferShared
 };
 groupshared BufferShared shared_temp[THREAD_GROUP_SIZE];
 
+#ifdef USE_SUBGROUP
+//Subgroup builds replace the shared memory reduction ladders with wave intrinsics.
+//They assume the whole thread group is in a single subgroup. (The host only uses them in that case.)
+
+//Returns min and max of `value` in the BC block this thread is on
+uint2x4 wave_block_min_max(uint blockInGroup, uint BLOCK_IN_GROUP, uint4 value)
+{
+    uint2x4 result = uint2x4(value, value);
+    for (uint b = 0; b < BLOCK_IN_GROUP; b++)
+    {
+        bool in_block = blockInGroup == b;
+        if (WaveActiveAnyTrue(in_block))
+        {
+            uint4 low = WaveActiveMin(in_block ? value : MAX_UINT);
+            uint4 high = WaveActiveMax(in_block ? value : MIN_UINT);
+            if (in_block)
+            {
+                result[0] = low;
+                result[1] = high;
+            }
+        }
+    }
+    return result;
+}
+
+//Returns `value` of the thread that has the smallest error in the BC block this thread is on
+//The lowest thread index wins a tie, as it does in the shared memory reduction.
+uint4 wave_select_best(uint GI, uint blockInGroup, uint BLOCK_IN_GROUP, uint error, uint4 value)
+{
+    uint4 best = value;
+    for (uint b = 0; b < BLOCK_IN_GROUP; b++)
+    {
+        bool in_block = blockInGroup == b;
+        if (WaveActiveAnyTrue(in_block))
+        {
+            uint min_error = WaveActiveMin(in_block ? error : MAX_UINT);
+            uint best_thread = WaveActiveMin((in_block && (error == min_error)) ? GI : MAX_UINT);
+            uint4 ballot = WaveActiveBallot(GI == best_thread);
+            uint lane = (0 != ballot.x) ? firstbitlow(ballot.x)
+                : (0 != ballot.y) ? 32 + firstbitlow(ballot.y)
+                : (0 != ballot.z) ? 64 + firstbitlow(ballot.z) : 96 + firstbitlow(ballot.w);
+            uint4 candidate = WaveReadLaneAt(value, lane);
+            if (in_block)
+            {
+                best = candidate;
+            }
+        }
+    }
+    return best;
+}
+#endif
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void ClassifySolidCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one block per thread
+{
+    uint blockID = g_start_block_id + groupID.x * THREAD_GROUP_SIZE + GI;
+    if (blockID >= g_num_total_blocks)
+    {
+        return;
+    }
+
+    uint block_y = blockID / g_num_block_x;
+    uint block_x = blockID - block_y * g_num_block_x;
+    uint base_x = block_x * BLOCK_SIZE_X;
+    uint base_y = block_y * BLOCK_SIZE_Y;
+
+    uint4 color = clamp(uint4(LoadInput(base_x, base_y) * 255), 0, 255);
+    uint3 color_sum = color.rgb;
+    bool solid = true;
+    bool transparent = (0 == color.a);
+    for (uint i = 1; i < 16; i++)
+    {
+        uint4 pixel = clamp(uint4(LoadInput(base_x + i % 4, base_y + i / 4) * 255), 0, 255);
+        solid = solid && all(pixel == color);
+        transparent = transparent && (0 == pixel.a);
+        color_sum += pixel.rgb;
+    }
+
+    if (!solid && transparent && (g_options & OPTION_COLLAPSE_TRANSPARENT))
+    {
+        // colors are invisible. use the average color for the whole block.
+        color = uint4((color_sum + 8) >> 4, 0);
+        solid = true;
+    }
+
+    if (solid)
+    {
+        uint4 block;
+        block_package_solid(block, color);
+        g_OutBuff[blockID] = block;
+    }
+    else
+    {
+        uint index;
+        InterlockedAdd(g_DispatchArgs[0], 1, index);
+        g_BlockList[index] = blockID;
+        InterlockedMax(g_DispatchArgs[1], index + 1);
+        InterlockedMax(g_DispatchArgs[4], index / 2 + 1);
+        InterlockedMax(g_DispatchArgs[7], index / 4 + 1);
+        InterlockedMax(g_DispatchArgs[10], index / THREAD_GROUP_SIZE + 1);
+    }
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void CompactBlockListCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one block per thread
+{
+    uint listID = groupID.x * THREAD_GROUP_SIZE + GI;
+    if (listID >= g_DispatchArgs[0])
+    {
+        return;
+    }
+
+    uint blockID = g_BlockList[listID];
+    uint4 result = g_InBuff[ErrorID(blockID)];
+    if (float(result.x) > g_error_threshold)
+    {
+        uint index;
+        InterlockedAdd(g_OutDispatchArgs[0], 1, index);
+        g_OutBlockList[index] = blockID;
+        InterlockedMax(g_OutDispatchArgs[1], index + 1);
+        InterlockedMax(g_OutDispatchArgs[4], index / 2 + 1);
+        InterlockedMax(g_OutDispatchArgs[7], index / 4 + 1);
+        InterlockedMax(g_OutDispatchArgs[10], index / THREAD_GROUP_SIZE + 1);
+    }
+    else
+    {
+        //the block skips the remaining passes. keep its result in both error buffers.
+        g_OutBuff[ErrorID(blockID)] = result;
+    }
+}
+
+//Sum of squared distances from the subset means. It's a cheap proxy of the error of a partition.
+//Each pixel has `bits_per_pixel` bits of the subset index in `bits`.
+float partition_score(uint threadBase, uint bits, uint bits_per_pixel)
+{
+    float4 sum[3] = { float4(0, 0, 0, 0), float4(0, 0, 0, 0), float4(0, 0, 0, 0) };
+    float4 sum_sqr[3] = { float4(0, 0, 0, 0), float4(0, 0, 0, 0), float4(0, 0, 0, 0) };
+    float count[3] = { 0, 0, 0 };
+    for (uint i = 0; i < 16; i++)
+    {
+        uint subset_index = (bits >> (i * bits_per_pixel)) & ((1 << bits_per_pixel) - 1);
+        float4 pixel = shared_temp[threadBase + i].pixel;
+        sum[subset_index] += pixel;
+        sum_sqr[subset_index] += pixel * pixel;
+        count[subset_index] += 1;
+    }
+
+    float score = 0;
+    for (uint s = 0; s < 3; s++)
+    {
+        if (count[s] > 0)
+        {
+            float4 variance = sum_sqr[s] - sum[s] * sum[s] / count[s];
+            score += dot(variance, float4(1, 1, 1, g_alpha_weight));
+        }
+    }
+    return max(score, 0);
+}
+
 [numthreads(THREAD_GROUP_SIZE, 1, 1)]
-void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 4 5 6 all have 1 subset per block, and fix-up index is always index 0
+void PartitionShortlistCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one partition per thread
+{
+    const uint MAX_USED_THREAD = 64;
+    uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
+    uint blockInGroup = GI / MAX_USED_THREAD;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
+    uint threadBase = blockInGroup * MAX_USED_THREAD;
+    uint threadInBlock = GI - threadBase;
+
+    uint block_y = blockID / g_num_block_x;
+    uint block_x = blockID - block_y * g_num_block_x;
+    uint base_x = block_x * BLOCK_SIZE_X;
+    uint base_y = block_y * BLOCK_SIZE_Y;
+
+    if (threadInBlock < 16)
+    {
+        shared_temp[GI].pixel = clamp(uint4(LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4) * 255), 0, 255);
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    //scores are non-negative floats. so, their bits can be compared as uint.
+    uint score2 = asuint(partition_score(threadBase, candidateSectionBit[threadInBlock], 1));
+    uint score3 = asuint(partition_score(threadBase, candidateSectionBit2[threadInBlock], 2));
+    shared_temp[GI].error = score2;
+    shared_temp[GI].mode = score3;  //the shortlist doesn't use mode. we use it for scores of 3 subsets.
+    GroupMemoryBarrierWithGroupSync();
+
+    //rank partitions by their scores. the lower partition index wins a tie.
+    uint rank2 = 0;
+    uint rank3 = 0;
+    uint rank0 = 0;   //rank in the first 16 partitions for mode 0
+    for (uint i = 0; i < g_num_partitions; i++)
+    {
+        uint other2 = shared_temp[threadBase + i].error;
+        uint other3 = shared_temp[threadBase + i].mode;
+        if ((other2 < score2) || ((other2 == score2) && (i < threadInBlock)))
+        {
+            rank2++;
+        }
+        if ((other3 < score3) || ((other3 == score3) && (i < threadInBlock)))
+        {
+            rank3++;
+            if (i < 16)
+            {
+                rank0++;
+            }
+        }
+    }
+
+    if (active && (threadInBlock < g_num_partitions))
+    {
+        uint base = (blockID - g_start_block_id) * SHORTLIST_STRIDE;
+        if (rank2 < g_shortlist_size)
+        {
+            g_Shortlist[base + rank2] = threadInBlock;
+        }
+        if (rank3 < g_shortlist_size)
+        {
+            g_Shortlist[base + MAX_SHORTLIST_SIZE + rank3] = threadInBlock;
+        }
+        if ((threadInBlock < 16) && (rank0 < g_shortlist_size))
+        {
+            g_Shortlist[base + MAX_SHORTLIST_SIZE * 2 + rank0] = threadInBlock;
+        }
+    }
+}
+
+void try_mode456(uint GI, uint3 groupID, uint slot) // mode 4 5 6 all have 1 subset per block, and fix-up index is always index 0
 {
     // we process 4 BC blocks per thread group
     const uint MAX_USED_THREAD = 16;                                                // pixels in a BC (block compressed) block
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;                      // the number of BC blocks a thread group processes = 64 / 16 = 4
     uint blockInGroup = GI / MAX_USED_THREAD;                                       // what BC block this thread is on within this thread group
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;    // what global BC block this thread is on
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;                        // what entry of g_BlockList this thread is on
+    bool active = listID < g_DispatchArgs[0];                                       // the last group can have unused BC blocks
+    uint blockID = g_BlockList[active ? listID : 0];                                // what global BC block this thread is on
     uint threadBase = blockInGroup * MAX_USED_THREAD;                               // the first id of the pixel in this BC block in this thread group
     uint threadInBlock = GI - threadBase;                                           // id of the pixel in this BC block
 
 #ifndef REF_DEVICE
-    if (blockID >= g_num_total_blocks)
+    if (!active)
     {
         return;
     }
@@ -304,7 +681,7 @@ void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 4
 
     if (threadInBlock < 16)
     {
-        shared_temp[GI].pixel = clamp(uint4(g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)) * 255), 0, 255);
+        shared_temp[GI].pixel = clamp(uint4(LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4) * 255), 0, 255);
 
         shared_temp[GI].endPoint_low = shared_temp[GI].pixel;
         shared_temp[GI].endPoint_high = shared_temp[GI].pixel;
@@ -313,6 +690,9 @@ void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 4
     GroupMemoryBarrierWithGroupSync();
 #endif
 
+#ifdef USE_SUBGROUP
+    uint2x4 endPoint = wave_block_min_max(blockInGroup, BLOCK_IN_GROUP, shared_temp[GI].pixel);
+#else
     if (threadInBlock < 8)
     {
         shared_temp[GI].endPoint_low = min(shared_temp[GI].endPoint_low, shared_temp[GI + 8].endPoint_low);
@@ -349,6 +729,7 @@ void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 4
     uint2x4 endPoint;
     endPoint[0] = shared_temp[threadBase].endPoint_low;
     endPoint[1] = shared_temp[threadBase].endPoint_high;
+#endif
 
     uint error = 0xFFFFFFFF;
     uint mode = 0;
@@ -571,6 +952,31 @@ void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 4
         rotation = p;    // Borrow rotation for p
     }
 
+    // discard results of modes and searches disabled by the quality profile
+    if (((4 == mode) && (g_options & OPTION_SKIP_MODE4))
+        || ((5 == mode) && (g_options & OPTION_SKIP_MODE5))
+        || ((6 == mode) && (g_options & OPTION_SKIP_MODE6))
+        || ((6 != mode) && (0 != rotation) && (g_options & OPTION_SKIP_ROTATION))
+        || ((0 != index_selector) && (g_options & OPTION_SKIP_INDEX_SELECTOR)))
+    {
+        error = 0xFFFFFFFF;
+    }
+
+#ifdef USE_SUBGROUP
+    uint4 best = wave_select_best(GI, blockInGroup, BLOCK_IN_GROUP, error,
+        uint4(error, (index_selector << 31) | mode, 0, rotation)); // rotation is indeed rotation for mode 4 5. for mode 6, rotation is p bit
+    if ((threadInBlock < 1) && active)
+    {
+        if (NO_SLOT == slot)
+        {
+            g_OutBuff[ErrorID(blockID)] = best;    //the first pass
+        }
+        else
+        {
+            g_OutBuff[listID * NUM_MODE_SLOTS + slot] = best;
+        }
+    }
+#else
     shared_temp[GI].error = error;
     shared_temp[GI].mode = mode;
     shared_temp[GI].index_selector = index_selector;
@@ -629,18 +1035,43 @@ void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 4
             shared_temp[GI].rotation = shared_temp[GI + 1].rotation;
         }
 
-        g_OutBuff[blockID] = uint4(shared_temp[GI].error, (shared_temp[GI].index_selector << 31) | shared_temp[GI].mode,
-            0, shared_temp[GI].rotation); // rotation is indeed rotation for mode 4 5. for mode 6, rotation is p bit
+        if (active)
+        {
+            uint4 result = uint4(shared_temp[GI].error, (shared_temp[GI].index_selector << 31) | shared_temp[GI].mode,
+                0, shared_temp[GI].rotation); // rotation is indeed rotation for mode 4 5. for mode 6, rotation is p bit
+            if (NO_SLOT == slot)
+            {
+                g_OutBuff[ErrorID(blockID)] = result;    //the first pass
+            }
+            else
+            {
+                g_OutBuff[listID * NUM_MODE_SLOTS + slot] = result;
+            }
+        }
     }
+#endif
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void TryMode456CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode456(GI, groupID, NO_SLOT);
 }
 
 [numthreads(THREAD_GROUP_SIZE, 1, 1)]
-void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1 3 7 all have 2 subsets per block
+void TryMode456ConcurrentCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode456(GI, groupID, g_pass.slot);
+}
+
+void try_mode137(uint GI, uint3 groupID, uint mode_id, uint slot) // mode 1 3 7 all have 2 subsets per block
 {
     const uint MAX_USED_THREAD = 64;
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
     uint blockInGroup = GI / MAX_USED_THREAD;
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
     uint threadBase = blockInGroup * MAX_USED_THREAD;
     uint threadInBlock = GI - threadBase;
 
@@ -651,7 +1082,7 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
 
     if (threadInBlock < 16)
     {
-        shared_temp[GI].pixel = clamp(uint4(g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)) * 255), 0, 255);
+        shared_temp[GI].pixel = clamp(uint4(LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4) * 255), 0, 255);
     }
     GroupMemoryBarrierWithGroupSync();
 
@@ -661,9 +1092,9 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
     uint2x4 endPoint[2];        // endPoint[0..1 for subset id][0..1 for low and high in the subset]
     uint2x4 endPointBackup[2];
     uint color_index;
-    if (threadInBlock < 64)
+    if (threadInBlock < num_searched_partitions(g_num_partitions))
     {
-        uint partition = threadInBlock;
+        uint partition = searched_partition(blockID, 0, threadInBlock);
 
         endPoint[0][0] = MAX_UINT;
         endPoint[0][1] = MIN_UINT;
@@ -689,7 +1120,7 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
         endPointBackup[1] = endPoint[1];
 
         uint max_p;
-        if (1 == g_mode_id)
+        if (1 == mode_id)
         {
             // in mode 1, there is only one p bit per subset
             max_p = 2;
@@ -709,15 +1140,15 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
 
             for (uint i = 0; i < 2; i++) // loop through 2 subsets
             {
-                if (g_mode_id == 1)
+                if (mode_id == 1)
                 {
                     compress_endpoints1(endPoint[i], p);
                 }
-                else if (g_mode_id == 3)
+                else if (mode_id == 3)
                 {
                     compress_endpoints3(endPoint[i], uint2(p, p >> 1) & 1);
                 }
-                else if (g_mode_id == 7)
+                else if (mode_id == 7)
                 {
                     compress_endpoints7(endPoint[i], uint2(p, p >> 1) & 1);
                 }
@@ -727,7 +1158,7 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
             span[0] = endPoint[0][1] - endPoint[0][0];
             span[1] = endPoint[1][1] - endPoint[1][0];
 
-            if (g_mode_id != 7)
+            if (mode_id != 7)
             {
                 span[0].w = span[1].w = 0;
             }
@@ -751,7 +1182,7 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
             }
 
             uint step_selector;
-            if (g_mode_id != 1)
+            if (mode_id != 1)
             {
                 step_selector = 2;  // mode 3 7 have 2 bit index
             }
@@ -780,7 +1211,7 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
 
                 pixel_r = ((64 - aWeight[step_selector][color_index]) * endPoint[subset_index][0]
                     + aWeight[step_selector][color_index] * endPoint[subset_index][1] + 32) >> 6;
-                if (g_mode_id != 7)
+                if (mode_id != 7)
                 {
                     pixel_r.a = 255;
                 }
@@ -806,15 +1237,23 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
         }
 
         shared_temp[GI].error = error[0] + error[1];
-        shared_temp[GI].mode = g_mode_id;
+        shared_temp[GI].mode = mode_id;
         shared_temp[GI].partition = partition;
 
         // mode 1 3 7 don't have rotation, we use rotation for p bits
-        if (g_mode_id == 1)
+        if (mode_id == 1)
             shared_temp[GI].rotation = (final_p[1] << 1) | final_p[0];
         else
             shared_temp[GI].rotation = (final_p[1] << 2) | final_p[0];
     }
+#ifdef USE_SUBGROUP
+    uint4 best = wave_select_best(GI, blockInGroup, BLOCK_IN_GROUP, shared_temp[GI].error,
+        uint4(shared_temp[GI].error, shared_temp[GI].mode, shared_temp[GI].partition, shared_temp[GI].rotation));
+    if ((threadInBlock < 1) && active)
+    {
+        write_result(blockID, listID, slot, best); // mode 1 3 7 don't have rotation, we use rotation for p bits
+    }
+#else
     GroupMemoryBarrierWithGroupSync();
 
     if (threadInBlock < 32)
@@ -892,24 +1331,35 @@ void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 1
             shared_temp[GI].rotation = shared_temp[GI + 1].rotation;
         }
 
-        if (g_InBuff[blockID].x > shared_temp[GI].error)
-        {
-            g_OutBuff[blockID] = uint4(shared_temp[GI].error, shared_temp[GI].mode, shared_temp[GI].partition, shared_temp[GI].rotation); // mode 1 3 7 don't have rotation, we use rotation for p bits
-        }
-        else
+        if (active)
         {
-            g_OutBuff[blockID] = g_InBuff[blockID];
+            write_result(blockID, listID, slot,
+                uint4(shared_temp[GI].error, shared_temp[GI].mode, shared_temp[GI].partition, shared_temp[GI].rotation)); // mode 1 3 7 don't have rotation, we use rotation for p bits
         }
     }
+#endif
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void TryMode137CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode137(GI, groupID, g_mode_id, NO_SLOT);
 }
 
 [numthreads(THREAD_GROUP_SIZE, 1, 1)]
-void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0 2 have 3 subsets per block
+void TryMode137ConcurrentCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode137(GI, groupID, g_pass.mode_id, g_pass.slot);
+}
+
+void try_mode02(uint GI, uint3 groupID, uint mode_id, uint slot) // mode 0 2 have 3 subsets per block
 {
     const uint MAX_USED_THREAD = 64;
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
     uint blockInGroup = GI / MAX_USED_THREAD;
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
     uint threadBase = blockInGroup * MAX_USED_THREAD;
     uint threadInBlock = GI - threadBase;
 
@@ -920,14 +1370,14 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
 
     if (threadInBlock < 16)
     {
-        shared_temp[GI].pixel = clamp(uint4(g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)) * 255), 0, 255);
+        shared_temp[GI].pixel = clamp(uint4(LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4) * 255), 0, 255);
     }
     GroupMemoryBarrierWithGroupSync();
 
     shared_temp[GI].error = 0xFFFFFFFF;
 
     uint num_partitions;
-    if (0 == g_mode_id)
+    if (0 == mode_id)
     {
         num_partitions = 16;
     }
@@ -935,6 +1385,7 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
     {
         num_partitions = 64;
     }
+    num_partitions = num_searched_partitions(min(num_partitions, g_num_partitions));
 
     uint4 pixel_r;
     uint2x4 endPoint[3];        // endPoint[0..1 for subset id][0..1 for low and high in the subset]
@@ -942,7 +1393,7 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
     uint color_index[16];
     if (threadInBlock < num_partitions)
     {
-        uint partition = threadInBlock + 64;
+        uint partition = searched_partition(blockID, (0 == mode_id) ? 2 : 1, threadInBlock) + 64;
 
         endPoint[0][0] = MAX_UINT;
         endPoint[0][1] = MIN_UINT;
@@ -977,7 +1428,7 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
         endPointBackup[2] = endPoint[2];
 
         uint max_p;
-        if (0 == g_mode_id)
+        if (0 == mode_id)
         {
             max_p = 4;
         }
@@ -996,7 +1447,7 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
 
             for (uint i = 0; i < 3; i++)
             {
-                if (0 == g_mode_id)
+                if (0 == mode_id)
                 {
                     compress_endpoints0(endPoint[i], uint2(p, p >> 1) & 1);
                 }
@@ -1006,7 +1457,7 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
                 }
             }
 
-            uint step_selector = 1 + (2 == g_mode_id);
+            uint step_selector = 1 + (2 == mode_id);
 
             int4 span[3];
             span[0] = endPoint[0][1] - endPoint[0][0];
@@ -1085,6 +1536,14 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
         shared_temp[GI].partition = partition;
         shared_temp[GI].rotation = (final_p[2] << 4) | (final_p[1] << 2) | final_p[0];
     }
+#ifdef USE_SUBGROUP
+    uint4 best = wave_select_best(GI, blockInGroup, BLOCK_IN_GROUP, shared_temp[GI].error,
+        uint4(shared_temp[GI].error, mode_id, shared_temp[GI].partition, shared_temp[GI].rotation));
+    if ((threadInBlock < 1) && active)
+    {
+        write_result(blockID, listID, slot, best); // rotation is actually p bit for mode 0. for mode 2, rotation is always 0
+    }
+#else
     GroupMemoryBarrierWithGroupSync();
 
     if (threadInBlock < 32)
@@ -1156,15 +1615,48 @@ void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // mode 0
             shared_temp[GI].rotation = shared_temp[GI + 1].rotation;
         }
 
-        if (g_InBuff[blockID].x > shared_temp[GI].error)
+        if (active)
         {
-            g_OutBuff[blockID] = uint4(shared_temp[GI].error, g_mode_id, shared_temp[GI].partition, shared_temp[GI].rotation); // rotation is actually p bit for mode 0. for mode 2, rotation is always 0
+            write_result(blockID, listID, slot,
+                uint4(shared_temp[GI].error, mode_id, shared_temp[GI].partition, shared_temp[GI].rotation)); // rotation is actually p bit for mode 0. for mode 2, rotation is always 0
         }
-        else
+    }
+#endif
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void TryMode02CS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode02(GI, groupID, g_mode_id, NO_SLOT);
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void TryMode02ConcurrentCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
+{
+    try_mode02(GI, groupID, g_pass.mode_id, g_pass.slot);
+}
+
+//Pick the best result from the slots written by the concurrent mode passes
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void SelectBestModeCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID) // one block per thread
+{
+    uint listID = groupID.x * THREAD_GROUP_SIZE + GI;
+    if (listID >= g_DispatchArgs[0])
+    {
+        return;
+    }
+
+    //the earlier slot wins a tie, as it does in the sequential passes
+    uint4 best = g_InBuff[listID * NUM_MODE_SLOTS];
+    for (uint slot = 1; slot < NUM_MODE_SLOTS; slot++)
+    {
+        uint4 result = g_InBuff[listID * NUM_MODE_SLOTS + slot];
+        if (best.x > result.x)
         {
-            g_OutBuff[blockID] = g_InBuff[blockID];
+            best = result;
         }
     }
+    g_OutBuff[ErrorID(g_BlockList[listID])] = best;
 }
 
 [numthreads(THREAD_GROUP_SIZE, 1, 1)]
@@ -1173,12 +1665,14 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
     const uint MAX_USED_THREAD = 16;
     uint BLOCK_IN_GROUP = THREAD_GROUP_SIZE / MAX_USED_THREAD;
     uint blockInGroup = GI / MAX_USED_THREAD;
-    uint blockID = g_start_block_id + groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    uint listID = groupID.x * BLOCK_IN_GROUP + blockInGroup;
+    bool active = listID < g_DispatchArgs[0];
+    uint blockID = g_BlockList[active ? listID : 0];
     uint threadBase = blockInGroup * MAX_USED_THREAD;
     uint threadInBlock = GI - threadBase;
 
 #ifndef REF_DEVICE
-    if (blockID >= g_num_total_blocks)
+    if (!active)
     {
         return;
     }
@@ -1189,14 +1683,15 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
     uint base_x = block_x * BLOCK_SIZE_X;
     uint base_y = block_y * BLOCK_SIZE_Y;
 
-    uint mode = g_InBuff[blockID].y & 0x7FFFFFFF;
-    uint partition = g_InBuff[blockID].z;
-    uint index_selector = (g_InBuff[blockID].y >> 31) & 1;
-    uint rotation = g_InBuff[blockID].w;
+    uint4 best = g_InBuff[ErrorID(blockID)];
+    uint mode = best.y & 0x7FFFFFFF;
+    uint partition = best.z;
+    uint index_selector = (best.y >> 31) & 1;
+    uint rotation = best.w;
 
     if (threadInBlock < 16)
     {
-        uint4 pixel = clamp(uint4(g_Input.Load(uint3(base_x + threadInBlock % 4, base_y + threadInBlock / 4, 0)) * 255), 0, 255);
+        uint4 pixel = clamp(uint4(LoadInput(base_x + threadInBlock % 4, base_y + threadInBlock / 4) * 255), 0, 255);
 
         if ((4 == mode) || (5 == mode))
         {
@@ -1564,7 +2059,10 @@ void EncodeBlockCS(uint GI : SV_GroupIndex, uint3 groupID : SV_GroupID)
             block_package7(block, partition, threadBase);
         }
 
-        g_OutBuff[blockID] = block;
+        if (active)
+        {
+            g_OutBuff[blockID] = block;
+        }
     }
 }
 
@@ -1943,3 +2441,18 @@ void block_package7(out uint4 block, uint partition, uint threadBase)
         block.w |= get_color_index(i) << (i * 2);
     }
 }
+void block_package_solid(out uint4 block, uint4 color)
+{
+    // mode 5, rotation 0, color index 1 for all pixels, alpha index 0 for all pixels
+    uint3 ep = uint3(candidateSolidEndPoint5[color.r], candidateSolidEndPoint5[color.g], candidateSolidEndPoint5[color.b]);
+    uint3 ep_l = ep & 0x7F;
+    uint3 ep_h = ep >> 8;
+
+    block.x = 0x20
+        | (ep_l.r <<  8) | (ep_h.r << 15)
+        | (ep_l.g << 22) | (ep_h.g << 29);
+    block.y = (ep_h.g >>  3) | (ep_l.b <<  4)
+        | (ep_h.b << 11) | (color.a << 18) | (color.a << 26);
+    block.z = (color.a >>  6) | 0xAAAAAAAC;
+    block.w = 0;
+}
@@ -1,25 +1,101 @@
 #include "BCDirectComputeVk.h"
+#include "DeviceMemoryPool.h"
 
-// for std::max
+// for std::max and std::sort
 #include <algorithm>
 
 // for memcpy and free
 #include <stdlib.h>
 #include <string.h>
 
+// for offsetof
+#include <stddef.h>
+
+// for AutotuneWorkgroupSize()
+#include <chrono>
+
+// for dup() and close() in CompressExternal()
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// for SetTracing()
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BC6HEncode_ClassifySolidCS.inc"
+#include "BC6HEncode_CompactBlockListCS.inc"
 #include "BC6HEncode_EncodeBlockCS.inc"
+#include "BC6HEncode_PartitionShortlistCS.inc"
 #include "BC6HEncode_TryModeG10CS.inc"
+#include "BC6HEncode_TryModeG10CS_g16.inc"
+#include "BC6HEncode_TryModeG10CS_g32.inc"
 #include "BC6HEncode_TryModeLE10CS.inc"
+#include "BC6HEncode_TryModeLE10FusedCS.inc"
+#include "BC6HEncode_TryModeLE10CS_subgroup.inc"
+#include "BC6HEncode_TryModeLE10FusedCS_subgroup.inc"
+#include "BC6HEncode_ClassifySolidCS_buffer.inc"
+#include "BC6HEncode_EncodeBlockCS_buffer.inc"
+#include "BC6HEncode_PartitionShortlistCS_buffer.inc"
+#include "BC6HEncode_TryModeG10CS_buffer.inc"
+#include "BC6HEncode_TryModeG10CS_g16_buffer.inc"
+#include "BC6HEncode_TryModeG10CS_g32_buffer.inc"
+#include "BC6HEncode_TryModeLE10CS_buffer.inc"
+#include "BC6HEncode_TryModeLE10FusedCS_buffer.inc"
 
 #ifndef _WIN32
 #include "BC6HEncode_TryModeG10CS_llvmpipe.inc"
+#include "BC6HEncode_TryModeG10CS_llvmpipe_g16.inc"
+#include "BC6HEncode_TryModeG10CS_llvmpipe_g32.inc"
 #include "BC6HEncode_TryModeLE10CS_llvmpipe.inc"
+#include "BC6HEncode_TryModeLE10FusedCS_llvmpipe.inc"
+#include "BC6HEncode_TryModeG10CS_llvmpipe_buffer.inc"
+#include "BC6HEncode_TryModeG10CS_llvmpipe_g16_buffer.inc"
+#include "BC6HEncode_TryModeG10CS_llvmpipe_g32_buffer.inc"
+#include "BC6HEncode_TryModeLE10CS_llvmpipe_buffer.inc"
+#include "BC6HEncode_TryModeLE10FusedCS_llvmpipe_buffer.inc"
 #endif
 
+#include "BC7Encode_ClassifySolidCS.inc"
+#include "BC7Encode_CompactBlockListCS.inc"
 #include "BC7Encode_EncodeBlockCS.inc"
+#include "BC7Encode_EncodeBlockCS_g16.inc"
+#include "BC7Encode_EncodeBlockCS_g32.inc"
+#include "BC7Encode_PartitionShortlistCS.inc"
+#include "BC7Encode_SelectBestModeCS.inc"
 #include "BC7Encode_TryMode02CS.inc"
+#include "BC7Encode_TryMode02ConcurrentCS.inc"
 #include "BC7Encode_TryMode137CS.inc"
+#include "BC7Encode_TryMode137ConcurrentCS.inc"
 #include "BC7Encode_TryMode456CS.inc"
+#include "BC7Encode_TryMode456ConcurrentCS.inc"
+#include "BC7Encode_TryMode02CS_subgroup.inc"
+#include "BC7Encode_TryMode02ConcurrentCS_subgroup.inc"
+#include "BC7Encode_TryMode137CS_subgroup.inc"
+#include "BC7Encode_TryMode137ConcurrentCS_subgroup.inc"
+#include "BC7Encode_TryMode456CS_subgroup.inc"
+#include "BC7Encode_TryMode456CS_g16.inc"
+#include "BC7Encode_TryMode456CS_g32.inc"
+#include "BC7Encode_TryMode456CS_subgroup_g16.inc"
+#include "BC7Encode_TryMode456CS_subgroup_g32.inc"
+#include "BC7Encode_TryMode456ConcurrentCS_subgroup.inc"
+#include "BC7Encode_ClassifySolidCS_buffer.inc"
+#include "BC7Encode_EncodeBlockCS_buffer.inc"
+#include "BC7Encode_EncodeBlockCS_g16_buffer.inc"
+#include "BC7Encode_EncodeBlockCS_g32_buffer.inc"
+#include "BC7Encode_PartitionShortlistCS_buffer.inc"
+#include "BC7Encode_TryMode02CS_buffer.inc"
+#include "BC7Encode_TryMode02ConcurrentCS_buffer.inc"
+#include "BC7Encode_TryMode137CS_buffer.inc"
+#include "BC7Encode_TryMode137ConcurrentCS_buffer.inc"
+#include "BC7Encode_TryMode456CS_buffer.inc"
+#include "BC7Encode_TryMode456CS_g16_buffer.inc"
+#include "BC7Encode_TryMode456CS_g32_buffer.inc"
+#include "BC7Encode_TryMode456ConcurrentCS_buffer.inc"
 
 struct BufferBC6HBC7 {
     uint32_t color[4];
@@ -33,86 +109,426 @@ struct ConstantsBC6HBC7 {
     uint32_t    start_block_id;
     uint32_t    num_total_blocks;
     float   alpha_weight;
-    uint32_t    reserved;
+    uint32_t    options;
+    float   error_threshold;
+    uint32_t    num_partitions;
+    uint32_t    num_two_region_modes;
+    uint32_t    shortlist_size;
+    uint32_t    error_window;
+    uint32_t    input_offset;
+    uint32_t    input_row_pitch;
+    uint32_t    tile_height;
+    uint32_t    input_row;
+};
+
+static_assert(sizeof(ConstantsBC6HBC7) == sizeof(uint32_t) * 17, "Constant buffer size mismatch");
+
+// Bits for ConstantsBC6HBC7::options
+enum SHADER_OPTIONS : uint32_t {
+    SHADER_OPTION_COLLAPSE_TRANSPARENT = 0x1,
+    SHADER_OPTION_SKIP_MODE4 = 0x2,
+    SHADER_OPTION_SKIP_MODE5 = 0x4,
+    SHADER_OPTION_SKIP_MODE6 = 0x8,
+    SHADER_OPTION_SKIP_ROTATION = 0x10,
+    SHADER_OPTION_SKIP_INDEX_SELECTOR = 0x20,
+};
+
+// Written by ClassifySolidCS and CompactBlockListCS.
+// Mode passes and encode passes use these arguments for vkCmdDispatchIndirect().
+struct DispatchArgsBC6HBC7 {
+    uint32_t    num_blocks;  // the number of blocks in the block list
+    VkDispatchIndirectCommand    group_1;  // 1 block per thread group
+    VkDispatchIndirectCommand    group_2;  // 2 blocks per thread group
+    VkDispatchIndirectCommand    group_4;  // 4 blocks per thread group
+    VkDispatchIndirectCommand    group_64;  // 64 blocks per thread group
+};
+
+static_assert(sizeof(DispatchArgsBC6HBC7) == sizeof(uint32_t) * 13, "Dispatch args size mismatch");
+
+// Push constants for concurrent BC7 mode passes
+struct PassConstantsBC7 {
+    uint32_t    mode_id;
+    uint32_t    slot;  // where the pass writes its result
+};
+
+// The number of blocks for each loop in Compress()
+constexpr uint32_t MAX_BLOCK_BATCH = 64u;
+
+// Result slots for each block in concurrent BC7 mode passes. (mode 456, 1, 3, 7, 0, and 2)
+constexpr uint32_t NUM_MODE_SLOTS = 6u;
+
+// Partitions kept by PartitionShortlistCS for each block.
+// (lists for 2 subsets, mode 2, and mode 0. BC6H only uses the first one.)
+constexpr uint32_t MAX_SHORTLIST_SIZE = 16u;
+constexpr uint32_t SHORTLIST_STRIDE = MAX_SHORTLIST_SIZE * 3;
+
+// THREAD_GROUP_SIZE in the shaders
+constexpr uint32_t SHADER_THREAD_GROUP_SIZE = 64u;
+
+// ClassifySolidCS processes 1 block per thread.
+constexpr uint32_t CLASSIFY_BLOCKS_PER_GROUP = 64u;
+
+// Header of GetPipelineCacheData()
+struct PipelineCacheHeaderBCVk {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    vendor_id;
+    uint32_t    device_id;
+    uint8_t     pipeline_cache_uuid[VK_UUID_SIZE];
+    WorkgroupTuningBC6HBC7  tuning;
+};
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x4B564342u;  // "BCVK"
+constexpr uint32_t PIPELINE_CACHE_VERSION = 1u;
+
+// Names of COMPRESS_PASS for traces
+static const char* COMPRESS_PASS_NAMES[COMPRESS_PASS_COUNT] = {
+    "Upload", "Classify", "Shortlist", "Compact",
+    "Mode456G10", "Mode137LE10", "Mode02", "Concurrent",
+    "Select", "Encode", "Readback",
+};
+
+const char* GetCompressPassName(COMPRESS_PASS pass) {
+    if (pass >= COMPRESS_PASS_COUNT)
+        return "Unknown";
+    return COMPRESS_PASS_NAMES[pass];
+}
+
+// A span of GetTraceData()
+struct TraceEventBCVk {
+    const char* name;
+    const char* pass;  // nullptr when the span is not a part of a pass
+    bool gpu;  // true for spans on the GPU track
+    uint32_t thread_id;  // index of TraceRecorderBCVk::threads
+    double start_us;  // since TraceRecorderBCVk::origin
+    double duration_us;
+};
+
+// Spans recorded while tracing is enabled.
+struct TraceRecorderBCVk {
+    std::chrono::steady_clock::time_point origin;
+    std::vector<TraceEventBCVk> events;
+    std::vector<std::thread::id> threads;
+
+    // A pair of GPU and host timestamps taken at the same time with VK_EXT_calibrated_timestamps.
+    bool calibrated;
+    uint64_t calibration_ticks;
+    double calibration_us;
+};
+
+// Host time in microseconds. (0 when tracing is disabled)
+static double TraceNow(TraceRecorderBCVk* tracer) {
+    if (!tracer)
+        return 0.0;
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tracer->origin).count();
+}
+
+static uint32_t TraceThreadId(TraceRecorderBCVk* tracer) {
+    const std::thread::id id = std::this_thread::get_id();
+    for (size_t i = 0; i < tracer->threads.size(); i++) {
+        if (tracer->threads[i] == id)
+            return static_cast<uint32_t>(i);
+    }
+    tracer->threads.push_back(id);
+    return static_cast<uint32_t>(tracer->threads.size() - 1);
+}
+
+// Record a host span from `start_us` to now.
+static void TraceSpan(TraceRecorderBCVk* tracer, const char* name, double start_us, const char* pass = nullptr) {
+    if (!tracer)
+        return;
+    const double end_us = TraceNow(tracer);
+    tracer->events.push_back({ name, pass, false, TraceThreadId(tracer), start_us, end_us - start_us });
+}
+
+// Record a host span for the current scope.
+class TraceScopeBCVk {
+ public:
+    TraceScopeBCVk(TraceRecorderBCVk* tracer, const char* name) :
+        m_tracer(tracer), m_name(name), m_start_us(TraceNow(tracer)) {}
+    ~TraceScopeBCVk() { TraceSpan(m_tracer, m_name, m_start_us); }
+
+ private:
+    TraceRecorderBCVk* m_tracer;
+    const char* m_name;
+    double m_start_us;
 };
 
-static_assert(sizeof(ConstantsBC6HBC7) == sizeof(uint32_t) * 8, "Constant buffer size mismatch");
+// Take a pair of GPU and host timestamps to put GPU spans on the host timeline.
+//   `get_calibrated_timestamps` is nullptr when the device doesn't support VK_EXT_calibrated_timestamps.
+static void CalibrateTrace(TraceRecorderBCVk* tracer, VkDevice device,
+                           PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps) {
+    tracer->calibrated = false;
+    if (!get_calibrated_timestamps)
+        return;
+
+    VkCalibratedTimestampInfoEXT info = {};
+    info.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    info.pNext = 0;
+    info.timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+
+    // The host time is the midpoint of the call.
+    uint64_t ticks = 0;
+    uint64_t deviation = 0;
+    const double before_us = TraceNow(tracer);
+    VkResult r = get_calibrated_timestamps(device, 1, &info, &ticks, &deviation);
+    const double after_us = TraceNow(tracer);
+    if (r != VK_SUCCESS)
+        return;
+
+    tracer->calibrated = true;
+    tracer->calibration_ticks = ticks;
+    tracer->calibration_us = (before_us + after_us) * 0.5;
+}
+
+static void AppendTraceEvent(std::string* json, const TraceEventBCVk& event) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+             event.name, event.gpu ? "gpu" : "host",
+             event.gpu ? 0u : event.thread_id + 1, event.start_us, event.duration_us);
+    *json += buf;
+    if (event.pass) {
+        *json += ",\"args\":{\"pass\":\"";
+        *json += event.pass;
+        *json += "\"}";
+    }
+    *json += "}";
+}
+
+// Chrome trace-event JSON. The GPU track is tid 0, and host threads start from tid 1.
+static std::string WriteTraceJson(const TraceRecorderBCVk& tracer) {
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU queue\"}}";
+    char buf[128];
+    for (size_t i = 0; i < tracer.threads.size(); i++) {
+        snprintf(buf, sizeof(buf),
+                 ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Host thread %u\"}}",
+                 static_cast<uint32_t>(i + 1), static_cast<uint32_t>(i));
+        json += buf;
+    }
+    for (const TraceEventBCVk& event : tracer.events)
+        AppendTraceEvent(&json, event);
+    json += "\n]}\n";
+    return json;
+}
 
 GPUCompressBCVk::GPUCompressBCVk() {
     m_device = VK_NULL_HANDLE;
     m_queue = VK_NULL_HANDLE;
     m_cmd_pool = VK_NULL_HANDLE;
-    m_memory_props = {};
+    m_physical_device = VK_NULL_HANDLE;
+    m_memory_pool = nullptr;
+    m_gpu_props = {};
 
+    m_shader_bc6_classify = VK_NULL_HANDLE;
+    m_shader_bc6_compact = VK_NULL_HANDLE;
     m_shader_bc6_enc = VK_NULL_HANDLE;
     m_shader_bc6_modeG10 = VK_NULL_HANDLE;
     m_shader_bc6_modeLE10 = VK_NULL_HANDLE;
+    m_shader_bc6_modeLE10_fused = VK_NULL_HANDLE;
+    m_shader_bc7_classify = VK_NULL_HANDLE;
+    m_shader_bc7_compact = VK_NULL_HANDLE;
     m_shader_bc7_enc = VK_NULL_HANDLE;
     m_shader_bc7_mode02 = VK_NULL_HANDLE;
     m_shader_bc7_mode137 = VK_NULL_HANDLE;
     m_shader_bc7_mode456 = VK_NULL_HANDLE;
+    m_shader_bc7_mode02_concurrent = VK_NULL_HANDLE;
+    m_shader_bc7_mode137_concurrent = VK_NULL_HANDLE;
+    m_shader_bc7_mode456_concurrent = VK_NULL_HANDLE;
+    m_shader_bc7_select = VK_NULL_HANDLE;
+    m_shader_bc6_modeG10_g16 = VK_NULL_HANDLE;
+    m_shader_bc6_modeG10_g32 = VK_NULL_HANDLE;
+    m_shader_bc7_enc_g16 = VK_NULL_HANDLE;
+    m_shader_bc7_enc_g32 = VK_NULL_HANDLE;
+    m_shader_bc7_mode456_g16 = VK_NULL_HANDLE;
+    m_shader_bc7_mode456_g32 = VK_NULL_HANDLE;
+    m_shader_bc6_shortlist = VK_NULL_HANDLE;
+    m_shader_bc7_shortlist = VK_NULL_HANDLE;
 
     m_desc_set_layout = VK_NULL_HANDLE;
     m_desc_pool = VK_NULL_HANDLE;
     m_desc_set = VK_NULL_HANDLE;
     m_pipeline_layout = VK_NULL_HANDLE;
+    m_pipeline_cache = VK_NULL_HANDLE;
 
     m_const_buf = VK_NULL_HANDLE;
-    m_const_mem = VK_NULL_HANDLE;
+    m_const_mem = nullptr;
     m_err1_buf = VK_NULL_HANDLE;
     m_err2_buf = VK_NULL_HANDLE;
+    m_err_mem = nullptr;
     m_out_buf = VK_NULL_HANDLE;
-    m_out_mem = VK_NULL_HANDLE;
+    m_out_mem = nullptr;
     m_outcpu_buf = VK_NULL_HANDLE;
-    m_outcpu_mem = VK_NULL_HANDLE;
+    m_outcpu_mem = nullptr;
+    m_out_mapped = nullptr;
+    for (uint32_t i = 0; i < 3; i++) {
+        m_block_list_buf[i] = VK_NULL_HANDLE;
+        m_dispatch_args_buf[i] = VK_NULL_HANDLE;
+    }
+    m_block_list_mem = nullptr;
+    m_dispatch_args_mem = nullptr;
+    m_slot_buf = VK_NULL_HANDLE;
+    m_slot_mem = nullptr;
+    m_shortlist_buf = VK_NULL_HANDLE;
+    m_shortlist_mem = nullptr;
 
     m_width = 0;
     m_height = 0;
     m_alpha_weight = 1.0f;
     m_bcformat = DXGI_FORMAT_UNKNOWN;
     m_out_buf_size = 0;
+    m_memory_budget_fraction = 0.8f;
+    m_tile_block_rows = 0;
+    m_error_window = MAX_BLOCK_BATCH * 16;
+    m_fit_error_window = m_error_window;
+    m_err_buf_blocks = 0;
+    m_input_offset = 0;
+    m_input_row_pitch = 0;
+    m_input_height = 0;
+    m_input_row = 0;
+    m_collapse_transparent = false;
+    m_error_threshold = 0.0f;
+    m_profile = {};
+    m_bc6_fused_mode_search = true;
+    m_bc7_concurrent_mode_search = true;
+    m_opaque_fast_path = false;
+    m_banded_upload = true;
+    m_direct_host_access = true;
+    m_allow_buffer_input = true;
+    m_buffer_input = false;
+    m_subgroup_size_control = false;
+    m_memory_budget_extension = false;
+    m_subgroup_size_g16 = 0;
+    m_subgroup_size_g32 = 0;
+    m_subgroup_size_g64 = 0;
+    m_subgroup_size_bc6 = 0;
+    m_profiling = false;
+    m_stats = {};
+    m_timestamp_valid_bits = 0;
+    m_tuning = { 4, 4 };
+    m_tracer = nullptr;
+    m_get_calibrated_timestamps = nullptr;
+    m_recording = nullptr;
+    m_desc_set_bound = false;
+    m_get_memory_fd_props = nullptr;
+    m_import_semaphore_fd = nullptr;
+    m_family_id = 0;
+    m_transfer_queue = VK_NULL_HANDLE;
+    m_transfer_cmd_pool = VK_NULL_HANDLE;
+    m_transfer_family_id = VK_QUEUE_FAMILY_IGNORED;
+    for (uint32_t i = 0; i < 3; i++)
+        m_transfer_semaphores[i] = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i < 3; i++)
+        m_transfer_fences[i] = VK_NULL_HANDLE;
+    m_get_host_pointer_props = nullptr;
+    m_host_pointer_alignment = 0;
+    m_host_memory_import = true;
+    m_set_object_name = nullptr;
+    m_cmd_begin_label = nullptr;
+    m_cmd_end_label = nullptr;
+    m_result_callback = nullptr;
+    m_result_user_data = nullptr;
+    m_result_block_rows = 0;
 }
 
 void GPUCompressBCVk::FreeBuffers() {
     if (m_device == VK_NULL_HANDLE)
         return;
     vkDestroyBuffer(m_device, m_const_buf, 0);
-    vkFreeMemory(m_device, m_const_mem, 0);
+    m_memory_pool->Free(m_const_mem);
     vkDestroyBuffer(m_device, m_err1_buf, 0);
     vkDestroyBuffer(m_device, m_err2_buf, 0);
+    m_memory_pool->Free(m_err_mem);
     vkDestroyBuffer(m_device, m_out_buf, 0);
-    vkFreeMemory(m_device, m_out_mem, 0);
+    m_memory_pool->Free(m_out_mem);
     vkDestroyBuffer(m_device, m_outcpu_buf, 0);
-    vkFreeMemory(m_device, m_outcpu_mem, 0);
-    m_const_mem = VK_NULL_HANDLE;
+    m_memory_pool->Free(m_outcpu_mem);
+    for (uint32_t i = 0; i < 3; i++) {
+        vkDestroyBuffer(m_device, m_block_list_buf[i], 0);
+        vkDestroyBuffer(m_device, m_dispatch_args_buf[i], 0);
+        m_block_list_buf[i] = VK_NULL_HANDLE;
+        m_dispatch_args_buf[i] = VK_NULL_HANDLE;
+    }
+    m_memory_pool->Free(m_block_list_mem);
+    m_memory_pool->Free(m_dispatch_args_mem);
+    vkDestroyBuffer(m_device, m_slot_buf, 0);
+    m_memory_pool->Free(m_slot_mem);
+    vkDestroyBuffer(m_device, m_shortlist_buf, 0);
+    m_memory_pool->Free(m_shortlist_mem);
+    m_const_mem = nullptr;
     m_const_buf = VK_NULL_HANDLE;
-    m_out_mem = VK_NULL_HANDLE;
+    m_out_mem = nullptr;
     m_err1_buf = VK_NULL_HANDLE;
     m_err2_buf = VK_NULL_HANDLE;
+    m_err_mem = nullptr;
+    m_err_buf_blocks = 0;
     m_out_buf = VK_NULL_HANDLE;
-    m_outcpu_mem = VK_NULL_HANDLE;
+    m_outcpu_mem = nullptr;
     m_outcpu_buf = VK_NULL_HANDLE;
+    m_out_mapped = nullptr;
+    m_block_list_mem = nullptr;
+    m_dispatch_args_mem = nullptr;
+    m_slot_mem = nullptr;
+    m_slot_buf = VK_NULL_HANDLE;
+    m_shortlist_mem = nullptr;
+    m_shortlist_buf = VK_NULL_HANDLE;
 }
 
 GPUCompressBCVk::~GPUCompressBCVk() {
     if (m_device != VK_NULL_HANDLE) {
+        ReleaseTransferQueue();
         vkDestroyCommandPool(m_device, m_cmd_pool, nullptr);
         m_cmd_pool = VK_NULL_HANDLE;
 
+        vkDestroyShaderModule(m_device, m_shader_bc6_classify, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc6_compact, 0);
         vkDestroyShaderModule(m_device, m_shader_bc6_enc, 0);
         vkDestroyShaderModule(m_device, m_shader_bc6_modeG10, 0);
         vkDestroyShaderModule(m_device, m_shader_bc6_modeLE10, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc6_modeLE10_fused, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_classify, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_compact, 0);
         vkDestroyShaderModule(m_device, m_shader_bc7_enc, 0);
         vkDestroyShaderModule(m_device, m_shader_bc7_mode02, 0);
         vkDestroyShaderModule(m_device, m_shader_bc7_mode137, 0);
         vkDestroyShaderModule(m_device, m_shader_bc7_mode456, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_mode02_concurrent, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_mode137_concurrent, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_mode456_concurrent, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_select, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc6_modeG10_g16, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc6_modeG10_g32, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_enc_g16, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_enc_g32, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_mode456_g16, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_mode456_g32, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc6_shortlist, 0);
+        vkDestroyShaderModule(m_device, m_shader_bc7_shortlist, 0);
+        m_shader_bc6_classify = VK_NULL_HANDLE;
+        m_shader_bc6_compact = VK_NULL_HANDLE;
         m_shader_bc6_enc = VK_NULL_HANDLE;
         m_shader_bc6_modeG10 = VK_NULL_HANDLE;
         m_shader_bc6_modeLE10 = VK_NULL_HANDLE;
+        m_shader_bc6_modeLE10_fused = VK_NULL_HANDLE;
+        m_shader_bc7_classify = VK_NULL_HANDLE;
+        m_shader_bc7_compact = VK_NULL_HANDLE;
         m_shader_bc7_enc = VK_NULL_HANDLE;
         m_shader_bc7_mode02 = VK_NULL_HANDLE;
         m_shader_bc7_mode137 = VK_NULL_HANDLE;
         m_shader_bc7_mode456 = VK_NULL_HANDLE;
+        m_shader_bc7_mode02_concurrent = VK_NULL_HANDLE;
+        m_shader_bc7_mode137_concurrent = VK_NULL_HANDLE;
+        m_shader_bc7_mode456_concurrent = VK_NULL_HANDLE;
+        m_shader_bc7_select = VK_NULL_HANDLE;
+        m_shader_bc6_modeG10_g16 = VK_NULL_HANDLE;
+        m_shader_bc6_modeG10_g32 = VK_NULL_HANDLE;
+        m_shader_bc7_enc_g16 = VK_NULL_HANDLE;
+        m_shader_bc7_enc_g32 = VK_NULL_HANDLE;
+        m_shader_bc7_mode456_g16 = VK_NULL_HANDLE;
+        m_shader_bc7_mode456_g32 = VK_NULL_HANDLE;
+        m_shader_bc6_shortlist = VK_NULL_HANDLE;
+        m_shader_bc7_shortlist = VK_NULL_HANDLE;
 
         vkDestroyDescriptorSetLayout(m_device, m_desc_set_layout, 0);
         m_desc_set_layout = VK_NULL_HANDLE;
@@ -123,13 +539,62 @@ GPUCompressBCVk::~GPUCompressBCVk() {
         vkDestroyPipelineLayout(m_device, m_pipeline_layout, 0);
         m_pipeline_layout = VK_NULL_HANDLE;
 
+        vkDestroyPipelineCache(m_device, m_pipeline_cache, 0);
+        m_pipeline_cache = VK_NULL_HANDLE;
+
         FreeBuffers();
+        delete m_memory_pool;
+        m_memory_pool = nullptr;
 
         m_device = VK_NULL_HANDLE;
         m_queue = VK_NULL_HANDLE;
     }
+    delete m_tracer;
+    m_tracer = nullptr;
+}
+
+void GPUCompressBCVk::SetTracing(bool enable) {
+    if (!enable) {
+        delete m_tracer;
+        m_tracer = nullptr;
+        return;
+    }
+    if (m_tracer)
+        return;
+    m_tracer = new TraceRecorderBCVk();
+    m_tracer->origin = std::chrono::steady_clock::now();
+    m_tracer->calibrated = false;
+    m_tracer->calibration_ticks = 0;
+    m_tracer->calibration_us = 0.0;
+}
+
+VkResult GPUCompressBCVk::GetTraceData(size_t* size, char* data) {
+    if (!size)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (!m_tracer)
+        return VK_ERROR_UNKNOWN;  // SetTracing(true) is not called yet
+
+    const std::string json = WriteTraceJson(*m_tracer);
+    if (!data) {
+        *size = json.size();
+        return VK_SUCCESS;
+    }
+
+    if (*size < json.size()) {
+        *size = 0;
+        return VK_INCOMPLETE;
+    }
+
+    memcpy(data, json.data(), json.size());
+    *size = json.size();
+    return VK_SUCCESS;
 }
 
+// Select the buffer input build of a shader when `buffer_input` is true. (See USE_BUFFER_INPUT in shaders.)
+#define INPUT_VARIANT(name) \
+    buffer_input ? name##_buffer : name, buffer_input ? sizeof(name##_buffer) : sizeof(name)
+
 static VkResult CreateVkShaderModule(
         VkDevice device, VkShaderModule* module,
         const unsigned char* code, uint32_t code_size) {
@@ -182,17 +647,96 @@ static VkResult CreateVkPipelineLayout(
     plci.flags = 0;
     plci.setLayoutCount = 1;
     plci.pSetLayouts = &desc_set_layout;
-    plci.pushConstantRangeCount = 0;
-    plci.pPushConstantRanges = 0;
+    // Concurrent BC7 mode passes use push constants
+    VkPushConstantRange push_constant_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PassConstantsBC7) };
+    plci.pushConstantRangeCount = 1;
+    plci.pPushConstantRanges = &push_constant_range;
     return vkCreatePipelineLayout(device, &plci, 0, pipe_layout);
 }
 
+static VkResult CreateVkPipelineCache(
+        VkDevice device,
+        VkPipelineCache* pipeline_cache,
+        const void* initial_data, size_t initial_data_size) {
+    VkPipelineCacheCreateInfo pcci = {};
+    pcci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pcci.pNext = 0;
+    pcci.flags = 0;
+    pcci.initialDataSize = initial_data_size;
+    pcci.pInitialData = initial_data;
+    return vkCreatePipelineCache(device, &pcci, 0, pipeline_cache);
+}
+
 static bool IsLLVMpipe(VkPhysicalDevice gpu) {
     VkPhysicalDeviceProperties props;
     vkGetPhysicalDeviceProperties(gpu, &props);
     return strstr(props.deviceName, "llvmpipe") != nullptr;
 }
 
+// Subgroup builds of mode passes use wave ops instead of reductions in shared memory.
+//   They require a subgroup which can hold a whole thread group of `group_size` threads.
+//   `required_size` receives the subgroup size that the pipeline should require. (0: the default size holds the group)
+//   A size can be required only when `size_control` is true. (subgroupSizeControl and computeFullSubgroups are enabled.)
+static bool SupportsSubgroupShaders(VkPhysicalDevice gpu, bool size_control, uint32_t group_size,
+                                    uint32_t* required_size) {
+    *required_size = 0;
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(gpu, &props);
+    if (props.apiVersion < VK_API_VERSION_1_1)
+        return false;
+#ifdef USE_VOLK
+    if (vkGetPhysicalDeviceProperties2 == nullptr)
+        return false;  // The instance does not support Vulkan 1.1
+#endif
+
+    VkPhysicalDeviceSubgroupSizeControlPropertiesEXT size_props = {};
+    size_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES_EXT;
+    VkPhysicalDeviceSubgroupProperties subgroup_props = {};
+    subgroup_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    subgroup_props.pNext = size_control ? &size_props : nullptr;
+    VkPhysicalDeviceProperties2 props2 = {};
+    props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props2.pNext = &subgroup_props;
+    vkGetPhysicalDeviceProperties2(gpu, &props2);
+
+    const VkSubgroupFeatureFlags required_ops =
+        VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_VOTE_BIT |
+        VK_SUBGROUP_FEATURE_ARITHMETIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT;
+    if (!(subgroup_props.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) ||
+        (subgroup_props.supportedOperations & required_ops) != required_ops)
+        return false;
+    if (subgroup_props.subgroupSize >= group_size)
+        return true;
+
+    // Devices with smaller default subgroups can run the group as a single full subgroup. (e.g. wave64 on wave32 GPUs)
+    if (size_control && (size_props.requiredSubgroupSizeStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+        size_props.minSubgroupSize <= group_size && group_size <= size_props.maxSubgroupSize) {
+        *required_size = group_size;
+        return true;
+    }
+    return false;
+}
+
+// Get minImportedHostPointerAlignment of VK_EXT_external_memory_host. (0 when it's unknown)
+static VkDeviceSize GetHostPointerAlignment(VkPhysicalDevice gpu) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(gpu, &props);
+    if (props.apiVersion < VK_API_VERSION_1_1)
+        return 0;
+#ifdef USE_VOLK
+    if (vkGetPhysicalDeviceProperties2 == nullptr)
+        return 0;  // The instance does not support Vulkan 1.1
+#endif
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_props = {};
+    host_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 props2 = {};
+    props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props2.pNext = &host_props;
+    vkGetPhysicalDeviceProperties2(gpu, &props2);
+    return host_props.minImportedHostPointerAlignment;
+}
+
 VkResult GPUCompressBCVk::Initialize(
         VkDevice device,
         VkPhysicalDevice physical_device,
@@ -204,12 +748,53 @@ VkResult GPUCompressBCVk::Initialize(
     if (m_device != VK_NULL_HANDLE)
         return VK_ERROR_UNKNOWN;  // Initialized already
 
+    TraceScopeBCVk trace_scope(m_tracer, "Initialize");
     VkResult r = VK_SUCCESS;
     m_device = device;
+    m_physical_device = physical_device;
+
+    // Align GPU spans with host spans when tracing.
+    m_get_calibrated_timestamps = reinterpret_cast<PFN_vkGetCalibratedTimestampsEXT>(
+        vkGetDeviceProcAddr(m_device, "vkGetCalibratedTimestampsEXT"));
+
+    // Name objects and label passes for GPU debuggers and profilers when VK_EXT_debug_utils is enabled.
+    m_set_object_name = reinterpret_cast<PFN_vkSetDebugUtilsObjectNameEXT>(
+        vkGetDeviceProcAddr(m_device, "vkSetDebugUtilsObjectNameEXT"));
+    m_cmd_begin_label = reinterpret_cast<PFN_vkCmdBeginDebugUtilsLabelEXT>(
+        vkGetDeviceProcAddr(m_device, "vkCmdBeginDebugUtilsLabelEXT"));
+    m_cmd_end_label = reinterpret_cast<PFN_vkCmdEndDebugUtilsLabelEXT>(
+        vkGetDeviceProcAddr(m_device, "vkCmdEndDebugUtilsLabelEXT"));
+    if (!m_cmd_begin_label || !m_cmd_end_label) {
+        m_cmd_begin_label = nullptr;
+        m_cmd_end_label = nullptr;
+    }
 
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &m_memory_props);
+    vkGetPhysicalDeviceProperties(physical_device, &m_gpu_props);
+
+    // Share memory and semaphores with other processes and APIs in CompressExternal().
+    m_get_memory_fd_props = reinterpret_cast<PFN_vkGetMemoryFdPropertiesKHR>(
+        vkGetDeviceProcAddr(m_device, "vkGetMemoryFdPropertiesKHR"));
+    m_import_semaphore_fd = reinterpret_cast<PFN_vkImportSemaphoreFdKHR>(
+        vkGetDeviceProcAddr(m_device, "vkImportSemaphoreFdKHR"));
+    m_family_id = family_id;
+
+    // Import the caller's memory when VK_EXT_external_memory_host is enabled.
+    m_get_host_pointer_props = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+        vkGetDeviceProcAddr(m_device, "vkGetMemoryHostPointerPropertiesEXT"));
+    m_host_pointer_alignment = GetHostPointerAlignment(physical_device);
+    if (m_host_pointer_alignment == 0)
+        m_get_host_pointer_props = nullptr;
+
+    // Buffers and images are sub-allocated from blocks of this pool.
+    m_memory_pool = new DeviceMemoryPoolBCVk(m_device, physical_device, m_memory_budget_extension);
     vkGetDeviceQueue(m_device, family_id, 0, &m_queue);
 
+    // Timestamps are used for profiling if the queue supports them.
+    VkQueueFamilyProperties families[16];
+    uint32_t family_count = 16;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families);
+    m_timestamp_valid_bits = (family_id < family_count) ? families[family_id].timestampValidBits : 0;
+
     VkCommandPoolCreateInfo command_pool_create_info = {};
     command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     command_pool_create_info.queueFamilyIndex = family_id;
@@ -218,51 +803,209 @@ VkResult GPUCompressBCVk::Initialize(
     if (r != VK_SUCCESS)
         return r;
 
+    // Pipelines are created for each Compress() call. The cache can be restored with LoadPipelineCacheData().
+    r = CreateVkPipelineCache(m_device, &m_pipeline_cache, nullptr, 0);
+    if (r != VK_SUCCESS)
+        return r;
+
+    // Use wave ops in mode passes if possible. It's decided for each thread group size.
+    const bool use_subgroup = SupportsSubgroupShaders(physical_device, m_subgroup_size_control,
+                                                      SHADER_THREAD_GROUP_SIZE, &m_subgroup_size_g64);
+
+    // Read source pixels from a host visible buffer when device local memory is host visible.
+    //   It skips the copy to an image and layout transitions. There are no subgroup builds for it.
+    m_buffer_input = m_direct_host_access && m_allow_buffer_input && !use_subgroup &&
+        m_memory_pool->GetHeapIndex(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != UINT32_MAX;
+    const bool buffer_input = m_buffer_input;
+
+    // Mode 4/5/6 passes with 16 or 32 threads per group also fit in smaller subgroups. (e.g. wave32 GPUs)
+    const bool use_subgroup_g32 = !buffer_input &&
+        SupportsSubgroupShaders(physical_device, m_subgroup_size_control, 32, &m_subgroup_size_g32);
+    const bool use_subgroup_g16 = !buffer_input &&
+        SupportsSubgroupShaders(physical_device, m_subgroup_size_control, 16, &m_subgroup_size_g16);
+    m_subgroup_size_bc6 = m_subgroup_size_g64;
+
     // Create shader modules
-    r = CreateVkShaderModule(m_device, &m_shader_bc6_enc, BC6HEncode_EncodeBlockCS, sizeof(BC6HEncode_EncodeBlockCS));
+    double shader_start_us = TraceNow(m_tracer);
+    r = CreateVkShaderModule(m_device, &m_shader_bc6_classify, INPUT_VARIANT(BC6HEncode_ClassifySolidCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc6_compact, BC6HEncode_CompactBlockListCS, sizeof(BC6HEncode_CompactBlockListCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc6_enc, INPUT_VARIANT(BC6HEncode_EncodeBlockCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc6_shortlist, INPUT_VARIANT(BC6HEncode_PartitionShortlistCS));
     if (r != VK_SUCCESS)
         return r;
 
 #ifndef _WIN32
     if (IsLLVMpipe(physical_device)) {
         // Note: LLVMpipe requires a custom build which does not use f16tof32(), or it crashes on LLVM.
-        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10, BC6HEncode_TryModeG10CS_llvmpipe, sizeof(BC6HEncode_TryModeG10CS_llvmpipe));
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10, INPUT_VARIANT(BC6HEncode_TryModeG10CS_llvmpipe));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10_g16, INPUT_VARIANT(BC6HEncode_TryModeG10CS_llvmpipe_g16));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10_g32, INPUT_VARIANT(BC6HEncode_TryModeG10CS_llvmpipe_g32));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10, INPUT_VARIANT(BC6HEncode_TryModeLE10CS_llvmpipe));
         if (r != VK_SUCCESS)
             return r;
 
-        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10, BC6HEncode_TryModeLE10CS_llvmpipe, sizeof(BC6HEncode_TryModeLE10CS_llvmpipe));
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10_fused, INPUT_VARIANT(BC6HEncode_TryModeLE10FusedCS_llvmpipe));
         if (r != VK_SUCCESS)
             return r;
+        m_subgroup_size_bc6 = 0;
     } else
 #endif  // _WIN32
-    {
-        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10, BC6HEncode_TryModeG10CS, sizeof(BC6HEncode_TryModeG10CS));
+    if (use_subgroup) {
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10, INPUT_VARIANT(BC6HEncode_TryModeG10CS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10_g16, INPUT_VARIANT(BC6HEncode_TryModeG10CS_g16));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10_g32, INPUT_VARIANT(BC6HEncode_TryModeG10CS_g32));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10, BC6HEncode_TryModeLE10CS_subgroup, sizeof(BC6HEncode_TryModeLE10CS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10_fused, BC6HEncode_TryModeLE10FusedCS_subgroup, sizeof(BC6HEncode_TryModeLE10FusedCS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+    } else {
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10, INPUT_VARIANT(BC6HEncode_TryModeG10CS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10_g16, INPUT_VARIANT(BC6HEncode_TryModeG10CS_g16));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeG10_g32, INPUT_VARIANT(BC6HEncode_TryModeG10CS_g32));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10, INPUT_VARIANT(BC6HEncode_TryModeLE10CS));
         if (r != VK_SUCCESS)
             return r;
 
-        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10, BC6HEncode_TryModeLE10CS, sizeof(BC6HEncode_TryModeLE10CS));
+        r = CreateVkShaderModule(m_device, &m_shader_bc6_modeLE10_fused, INPUT_VARIANT(BC6HEncode_TryModeLE10FusedCS));
         if (r != VK_SUCCESS)
             return r;
     }
 
-    r = CreateVkShaderModule(m_device, &m_shader_bc7_enc, BC7Encode_EncodeBlockCS, sizeof(BC7Encode_EncodeBlockCS));
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_classify, INPUT_VARIANT(BC7Encode_ClassifySolidCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_compact, BC7Encode_CompactBlockListCS, sizeof(BC7Encode_CompactBlockListCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_enc, INPUT_VARIANT(BC7Encode_EncodeBlockCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_shortlist, INPUT_VARIANT(BC7Encode_PartitionShortlistCS));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_enc_g16, INPUT_VARIANT(BC7Encode_EncodeBlockCS_g16));
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_enc_g32, INPUT_VARIANT(BC7Encode_EncodeBlockCS_g32));
     if (r != VK_SUCCESS)
         return r;
 
-    r = CreateVkShaderModule(m_device, &m_shader_bc7_mode02, BC7Encode_TryMode02CS, sizeof(BC7Encode_TryMode02CS));
+    if (use_subgroup) {
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode02, BC7Encode_TryMode02CS_subgroup, sizeof(BC7Encode_TryMode02CS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode137, BC7Encode_TryMode137CS_subgroup, sizeof(BC7Encode_TryMode137CS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456, BC7Encode_TryMode456CS_subgroup, sizeof(BC7Encode_TryMode456CS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode02_concurrent, BC7Encode_TryMode02ConcurrentCS_subgroup, sizeof(BC7Encode_TryMode02ConcurrentCS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode137_concurrent, BC7Encode_TryMode137ConcurrentCS_subgroup, sizeof(BC7Encode_TryMode137ConcurrentCS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456_concurrent, BC7Encode_TryMode456ConcurrentCS_subgroup, sizeof(BC7Encode_TryMode456ConcurrentCS_subgroup));
+        if (r != VK_SUCCESS)
+            return r;
+    } else {
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode02, INPUT_VARIANT(BC7Encode_TryMode02CS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode137, INPUT_VARIANT(BC7Encode_TryMode137CS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456, INPUT_VARIANT(BC7Encode_TryMode456CS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode02_concurrent, INPUT_VARIANT(BC7Encode_TryMode02ConcurrentCS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode137_concurrent, INPUT_VARIANT(BC7Encode_TryMode137ConcurrentCS));
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456_concurrent, INPUT_VARIANT(BC7Encode_TryMode456ConcurrentCS));
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    if (use_subgroup_g16)
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456_g16, BC7Encode_TryMode456CS_subgroup_g16, sizeof(BC7Encode_TryMode456CS_subgroup_g16));
+    else
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456_g16, INPUT_VARIANT(BC7Encode_TryMode456CS_g16));
     if (r != VK_SUCCESS)
         return r;
 
-    r = CreateVkShaderModule(m_device, &m_shader_bc7_mode137, BC7Encode_TryMode137CS, sizeof(BC7Encode_TryMode137CS));
+    if (use_subgroup_g32)
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456_g32, BC7Encode_TryMode456CS_subgroup_g32, sizeof(BC7Encode_TryMode456CS_subgroup_g32));
+    else
+        r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456_g32, INPUT_VARIANT(BC7Encode_TryMode456CS_g32));
     if (r != VK_SUCCESS)
         return r;
 
-    r = CreateVkShaderModule(m_device, &m_shader_bc7_mode456, BC7Encode_TryMode456CS, sizeof(BC7Encode_TryMode456CS));
+    r = CreateVkShaderModule(m_device, &m_shader_bc7_select, BC7Encode_SelectBestModeCS, sizeof(BC7Encode_SelectBestModeCS));
     if (r != VK_SUCCESS)
         return r;
 
+    TraceSpan(m_tracer, "CreateShaderModules", shader_start_us);
+
     // Create descriptor layout
-    VkDescriptorSetLayoutBinding bindings[4] = {
+    VkDescriptorSetLayoutBinding bindings[9] = {
         // t0: g_Input (source texture)
         { 0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT },
 
@@ -273,14 +1016,34 @@ VkResult GPUCompressBCVk::Initialize(
         { 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
 
         // b0: cbCS (constants)
-        { 3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+        { 3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+
+        // g_BlockList (blocks for mode passes)
+        { 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+
+        // g_DispatchArgs (block count and indirect dispatch arguments)
+        { 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+
+        // g_OutBlockList (compacted block list)
+        { 6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+
+        // g_OutDispatchArgs (dispatch arguments for the compacted block list)
+        { 7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+
+        // g_Shortlist (partitions kept by PartitionShortlistCS)
+        { 8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT }
     };
 
+    // Buffer input builds have g_InputBuffer instead of g_Input.
+    //   Note: llvmpipe requires all bindings to be non-null. So, the layout doesn't have the unused one.
+    if (m_buffer_input)
+        bindings[0] = { 9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT };
+
     VkDescriptorSetLayoutCreateInfo dslci = {};
     dslci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     dslci.pNext = 0;
     dslci.flags = 0;
-    dslci.bindingCount = 4;
+    dslci.bindingCount = 9;
     dslci.pBindings = bindings;
 
     r = vkCreateDescriptorSetLayout(m_device, &dslci, 0, &m_desc_set_layout);
@@ -292,18 +1055,41 @@ VkResult GPUCompressBCVk::Initialize(
         { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 }
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
     };
-    r = CreateVkDescriptorPool(m_device, &m_desc_pool, &m_desc_set, m_desc_set_layout, pool_sizes, 4);
+    if (m_buffer_input)
+        pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    r = CreateVkDescriptorPool(m_device, &m_desc_pool, &m_desc_set, m_desc_set_layout, pool_sizes, 9);
     if (r != VK_SUCCESS)
         return r;
+    SetObjectName(VK_OBJECT_TYPE_DESCRIPTOR_SET, (uint64_t)m_desc_set, "BCVk descriptor set");
 
     // Create pipeline layout
     r = CreateVkPipelineLayout(m_device, &m_pipeline_layout, m_desc_set_layout);
+    if (r != VK_SUCCESS)
+        return r;
+    SetObjectName(VK_OBJECT_TYPE_PIPELINE_LAYOUT, (uint64_t)m_pipeline_layout, "BCVk pipeline layout");
 
     return r;
 }
 
+void GPUCompressBCVk::SetObjectName(VkObjectType type, uint64_t handle, const char* name) {
+    if (!m_set_object_name || !handle)
+        return;
+    VkDebugUtilsObjectNameInfoEXT info = {};
+    info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+    info.pNext = 0;
+    info.objectType = type;
+    info.objectHandle = handle;
+    info.pObjectName = name;
+    m_set_object_name(m_device, &info);
+}
+
 static DXGI_FORMAT BcFormatToSrcFormat(DXGI_FORMAT format) {
     switch (format)
     {
@@ -340,20 +1126,6 @@ static bool IsBC7(DXGI_FORMAT format) {
     return false;
 }
 
-inline uint32_t FindMemoryType(
-        VkPhysicalDeviceMemoryProperties* memory_props,
-        uint32_t type_bits, VkMemoryPropertyFlags flags) {
-    uint32_t type_id = -1;
-    for (uint32_t i = 0; i < memory_props->memoryTypeCount; i++ ) {
-        if ((type_bits & 1 ) && ((memory_props->memoryTypes[i].propertyFlags & flags) == flags)) {
-            type_id = i;
-            break;
-        }
-        type_bits >>= 1;
-    }
-    return type_id;
-}
-
 static VkResult CreateVkBuffer(
         VkDevice device, VkBuffer* buf,
         VkDeviceSize buf_size, VkBufferUsageFlags buf_usage) {
@@ -365,27 +1137,27 @@ static VkResult CreateVkBuffer(
     return vkCreateBuffer(device, &info, 0, buf);
 }
 
-static VkResult AllocateVkMemroy(
-        VkDevice device,
-        VkDeviceMemory* mem,
-        VkPhysicalDeviceMemoryProperties* mem_props,
-        VkDeviceSize alloc_size,
-        uint32_t memory_type_bits,
-        VkMemoryPropertyFlags mem_flags) {
-    VkMemoryAllocateInfo alloc = {};
-    alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc.allocationSize = alloc_size;
-    alloc.memoryTypeIndex = FindMemoryType(mem_props, memory_type_bits, mem_flags);
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
 
-    return vkAllocateMemory(device, &alloc, nullptr, mem);
+// Allocate device local memory for `count` buffers which have the same requirements.
+//   `req.size` should be aligned with `req.alignment`. The i-th buffer uses offset + req.size * i.
+static VkResult AllocateBufferArray(
+        DeviceMemoryPoolBCVk* memory_pool, VkMemoryRequirements req, uint32_t count,
+        VkMemoryPropertyFlags preferred_flags,
+        MemoryAllocationBCVk** mem) {
+    req.size *= count;
+    return memory_pool->Allocate(req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, preferred_flags, false, mem);
 }
 
 static VkResult CreateVkBufferAndMemory(
         VkDevice device,
         VkBuffer* buf, VkDeviceSize buf_size, VkBufferUsageFlags buf_usage,
-        VkDeviceMemory* mem,
-        VkPhysicalDeviceMemoryProperties* mem_props,
-        VkMemoryPropertyFlags mem_flags) {
+        MemoryAllocationBCVk** mem,
+        DeviceMemoryPoolBCVk* memory_pool,
+        VkMemoryPropertyFlags mem_flags,
+        VkMemoryPropertyFlags preferred_flags) {
     VkResult r = CreateVkBuffer(device, buf, buf_size, buf_usage);
     if (r != VK_SUCCESS)
         return r;
@@ -393,78 +1165,261 @@ static VkResult CreateVkBufferAndMemory(
     VkMemoryRequirements req;
     vkGetBufferMemoryRequirements(device, *buf, &req);
 
-    r = AllocateVkMemroy(device, mem, mem_props, req.size, req.memoryTypeBits, mem_flags);
+    r = memory_pool->Allocate(req, mem_flags, preferred_flags, false, mem);
     if (r != VK_SUCCESS)
         return r;
 
-    return vkBindBufferMemory(device, *buf, *mem, 0);
+    return vkBindBufferMemory(device, *buf, (*mem)->memory, (*mem)->offset);
 }
 
-enum TEX_COMPRESS_FLAGS : uint32_t {
-    TEX_COMPRESS_DEFAULT = 0,
+VkResult GPUCompressBCVk::ImportHostBuffer(void* ptr, VkDeviceSize size, VkBufferUsageFlags usage,
+                                           VkBuffer* buf, VkDeviceMemory* mem, VkDeviceSize* offset) {
+    *buf = VK_NULL_HANDLE;
+    *mem = VK_NULL_HANDLE;
+    *offset = 0;
+    if (!m_host_memory_import || !m_get_host_pointer_props || !ptr || size == 0)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    // Import the aligned range which encloses the memory. The buffer covers the whole range.
+    const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t aligned_address = address - address % m_host_pointer_alignment;
+    void* aligned_ptr = reinterpret_cast<void*>(aligned_address);
+    const VkDeviceSize aligned_offset = address - aligned_address;
+    size = (aligned_offset + size + m_host_pointer_alignment - 1) / m_host_pointer_alignment * m_host_pointer_alignment;
+
+    const VkExternalMemoryHandleTypeFlagBits handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    VkMemoryHostPointerPropertiesEXT pointer_props = {};
+    pointer_props.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    VkResult r = m_get_host_pointer_props(m_device, handle_type, aligned_ptr, &pointer_props);
+    if (r != VK_SUCCESS)
+        return r;
 
-    TEX_COMPRESS_RGB_DITHER = 0x10000,
-    // Enables dithering RGB colors for BC1-3 compression
+    VkExternalMemoryBufferCreateInfo external_info = {};
+    external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    external_info.handleTypes = handle_type;
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.pNext = &external_info;
+    info.size  = size;
+    info.usage = usage;
+    r = vkCreateBuffer(m_device, &info, 0, buf);
+    if (r != VK_SUCCESS)
+        return r;
 
-    TEX_COMPRESS_A_DITHER = 0x20000,
-    // Enables dithering alpha for BC1-3 compression
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(m_device, *buf, &req);
+
+    // Imported memory can't be flushed through the pool. So, it should be host coherent.
+    VkPhysicalDeviceMemoryProperties memory_props;
+    vkGetPhysicalDeviceMemoryProperties(m_physical_device, &memory_props);
+    const uint32_t type_id = FindMemoryType(&memory_props, req.memoryTypeBits & pointer_props.memoryTypeBits,
+                                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0);
+    if (type_id == UINT32_MAX || req.size > size) {
+        vkDestroyBuffer(m_device, *buf, 0);
+        *buf = VK_NULL_HANDLE;
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
 
-    TEX_COMPRESS_DITHER = 0x30000,
-    // Enables both RGB and alpha dithering for BC1-3 compression
+    VkImportMemoryHostPointerInfoEXT import_info = {};
+    import_info.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    import_info.handleType = handle_type;
+    import_info.pHostPointer = aligned_ptr;
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.pNext = &import_info;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = type_id;
+    r = vkAllocateMemory(m_device, &alloc_info, 0, mem);
+    if (r == VK_SUCCESS)
+        r = vkBindBufferMemory(m_device, *buf, *mem, 0);
+    if (r != VK_SUCCESS) {
+        vkDestroyBuffer(m_device, *buf, 0);
+        vkFreeMemory(m_device, *mem, 0);
+        *buf = VK_NULL_HANDLE;
+        *mem = VK_NULL_HANDLE;
+        return r;
+    }
+    *offset = aligned_offset;
+    return r;
+}
 
-    TEX_COMPRESS_UNIFORM = 0x40000,
-    // Uniform color weighting for BC1-3 compression; by default uses perceptual weighting
+VkResult GPUCompressBCVk::ImportExternalBuffer(const ExternalMemoryBCVk& memory, int* fd, VkBufferUsageFlags usage,
+                                               VkBuffer* buf, VkDeviceMemory* mem) {
+    *buf = VK_NULL_HANDLE;
+    *mem = VK_NULL_HANDLE;
 
-    TEX_COMPRESS_BC7_USE_3SUBSETS = 0x80000,
-    // Enables exhaustive search for BC7 compress for mode 0 and 2; by default skips trying these modes
+    VkExternalMemoryBufferCreateInfo external_info = {};
+    external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    external_info.handleTypes = memory.handle_type;
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.pNext = &external_info;
+    info.size  = memory.size;
+    info.usage = usage;
+    VkResult r = vkCreateBuffer(m_device, &info, 0, buf);
+    if (r != VK_SUCCESS)
+        return r;
 
-    TEX_COMPRESS_BC7_QUICK = 0x100000,
-    // Minimal modes (usually mode 6) for BC7 compression
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(m_device, *buf, &req);
+    uint32_t type_bits = req.memoryTypeBits;
+    if (memory.handle_type != VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT) {
+        // Memory types of dma-buf depend on the exporter.
+        VkMemoryFdPropertiesKHR fd_props = {};
+        fd_props.sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR;
+        r = m_get_memory_fd_props(m_device, memory.handle_type, *fd, &fd_props);
+        type_bits &= fd_props.memoryTypeBits;
+    }
 
-    TEX_COMPRESS_SRGB_IN = 0x1000000,
-    TEX_COMPRESS_SRGB_OUT = 0x2000000,
-    TEX_COMPRESS_SRGB = (TEX_COMPRESS_SRGB_IN | TEX_COMPRESS_SRGB_OUT),
-    // if the input format type is IsSRGB(), then SRGB_IN is on by default
-    // if the output format type is IsSRGB(), then SRGB_OUT is on by default
+    // Opaque fds should be imported with the memory type and the dedicated allocation of the exporter.
+    VkPhysicalDeviceMemoryProperties memory_props;
+    vkGetPhysicalDeviceMemoryProperties(m_physical_device, &memory_props);
+    uint32_t type_id = memory.memory_type_index;
+    if (type_id == UINT32_MAX && memory.handle_type != VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT)
+        type_id = FindMemoryType(&memory_props, type_bits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (r == VK_SUCCESS && (type_id >= memory_props.memoryTypeCount || !(type_bits & (1u << type_id)) ||
+                            req.size > memory.size))
+        r = VK_ERROR_INVALID_EXTERNAL_HANDLE;
 
-    TEX_COMPRESS_PARALLEL = 0x10000000,
-    // Compress is free to use multithreading to improve performance (by default it does not use multithreading)
-};
+    if (r == VK_SUCCESS) {
+        VkMemoryDedicatedAllocateInfo dedicated_info = {};
+        dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+        dedicated_info.buffer = *buf;
+        VkImportMemoryFdInfoKHR import_info = {};
+        import_info.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR;
+        import_info.pNext = memory.dedicated ? &dedicated_info : nullptr;
+        import_info.handleType = memory.handle_type;
+        import_info.fd = *fd;
+        VkMemoryAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.pNext = &import_info;
+        alloc_info.allocationSize = memory.size;
+        alloc_info.memoryTypeIndex = type_id;
+        r = vkAllocateMemory(m_device, &alloc_info, 0, mem);
+        if (r == VK_SUCCESS)
+            *fd = -1;  // vkFreeMemory() closes it.
+    }
+    if (r == VK_SUCCESS)
+        r = vkBindBufferMemory(m_device, *buf, *mem, 0);
+    if (r != VK_SUCCESS) {
+        vkDestroyBuffer(m_device, *buf, 0);
+        vkFreeMemory(m_device, *mem, 0);
+        *buf = VK_NULL_HANDLE;
+        *mem = VK_NULL_HANDLE;
+    }
+    return r;
+}
 
-VkResult GPUCompressBCVk::Prepare(uint32_t width, uint32_t height, uint32_t flags, DXGI_FORMAT format, float alpha_weight) {
-    VkResult r = VK_SUCCESS;
+// `fd` is set to -1 when the Vulkan implementation owns it.
+static VkResult ImportVkSemaphore(VkDevice device, PFN_vkImportSemaphoreFdKHR import_semaphore_fd,
+                                  int* fd, VkSemaphore* semaphore) {
+    VkSemaphoreCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkResult r = vkCreateSemaphore(device, &info, 0, semaphore);
+    if (r != VK_SUCCESS)
+        return r;
 
-    if (!width || !height || alpha_weight < 0.f)
-        return VK_ERROR_UNKNOWN;  // Invalid args
+    VkImportSemaphoreFdInfoKHR import_info = {};
+    import_info.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+    import_info.semaphore = *semaphore;
+    import_info.flags = 0;
+    import_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+    import_info.fd = *fd;
+    r = import_semaphore_fd(device, &import_info);
+    if (r == VK_SUCCESS) {
+        *fd = -1;  // vkDestroySemaphore() closes it.
+    } else {
+        vkDestroySemaphore(device, *semaphore, 0);
+        *semaphore = VK_NULL_HANDLE;
+    }
+    return r;
+}
 
-    if ((width > UINT32_MAX) || (height > UINT32_MAX))
-        return VK_ERROR_UNKNOWN;  // Invalid args
+// Duplicate an fd, so that the caller's fd is kept when an import fails. (-1 for -1)
+static int DuplicateFd(int fd) {
+    if (fd < 0)
+        return -1;
+#ifdef _WIN32
+    return _dup(fd);
+#else
+    return dup(fd);
+#endif
+}
 
-    if (m_pipeline_layout == VK_NULL_HANDLE)
-        return VK_ERROR_UNKNOWN;  // GPUCompressBCVk::Initialize() is not called yet (or failed.)
+static void CloseFd(int fd) {
+    if (fd < 0)
+        return;
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
 
-    FreeBuffers();
+static bool IsOutOfMemory(VkResult r) {
+    return r == VK_ERROR_OUT_OF_DEVICE_MEMORY || r == VK_ERROR_OUT_OF_HOST_MEMORY;
+}
 
-    m_width = width;
-    m_height = height;
-    m_alpha_weight = alpha_weight;
+// Get the number of block rows in a tile whose buffers and images fit in the memory budget.
+//   `row_size` is the size of a row of source pixels.
+// Bytes of buffers which don't depend on the tile size
+//   the error buffers of `error_window` blocks, and buffers for each batch in flight
+//   (mode slots, partition shortlists, block lists, dispatch arguments, and constants)
+static VkDeviceSize GetFixedBufferBytes(uint32_t error_window) {
+    return (VkDeviceSize)error_window * sizeof(BufferBC6HBC7) * 2 +
+           (VkDeviceSize)MAX_BLOCK_BATCH * NUM_MODE_SLOTS * sizeof(BufferBC6HBC7) +
+           (VkDeviceSize)MAX_BLOCK_BATCH * SHORTLIST_STRIDE * sizeof(uint32_t) +
+           (VkDeviceSize)MAX_BLOCK_BATCH * sizeof(uint32_t) * 3 +
+           sizeof(DispatchArgsBC6HBC7) * 3 + sizeof(ConstantsBC6HBC7);
+}
 
-    if (flags & TEX_COMPRESS_BC7_QUICK) {
-        m_bc7_mode02 = false;
-        m_bc7_mode137 = false;
-    } else {
-        m_bc7_mode02 = (flags & TEX_COMPRESS_BC7_USE_3SUBSETS) != 0;
-        m_bc7_mode137 = true;
+// Choose the number of block rows in a tile, and the number of blocks in the error buffers.
+//   `error_window` is the window set by SetErrorWindow(). It's halved (down to a batch)
+//   only when a single block row doesn't fit in the budget next to it.
+static uint32_t FitTileBlockRows(DeviceMemoryPoolBCVk* memory_pool, float fraction,
+                                 size_t xblocks, size_t yblocks, size_t row_size, uint32_t* error_window) {
+    // Bytes for each block row
+    //   device local: the output buffer and the source image
+    //   host visible: the readback buffer and the staging buffer
+    const VkDeviceSize out_row_bytes = (VkDeviceSize)xblocks * sizeof(BufferBC6HBC7);
+    const VkDeviceSize src_row_bytes = (VkDeviceSize)row_size * 4;
+    VkDeviceSize device_bytes = out_row_bytes + src_row_bytes;
+    VkDeviceSize host_bytes = out_row_bytes + src_row_bytes;
+
+    const uint32_t device_heap = memory_pool->GetHeapIndex(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    const uint32_t host_heap = memory_pool->GetHeapIndex(
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (device_heap == host_heap) {
+        // Unified memory (e.g. integrated GPUs)
+        device_bytes += host_bytes;
+        host_bytes = 0;
     }
 
-    m_srcformat = BcFormatToSrcFormat(format);
-    if (m_srcformat == DXGI_FORMAT_UNKNOWN) {
-        m_bcformat = DXGI_FORMAT_UNKNOWN;
-        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    // Error buffers don't need to be larger than the texture.
+    const uint64_t num_batches = ((uint64_t)xblocks * yblocks + MAX_BLOCK_BATCH - 1) / MAX_BLOCK_BATCH;
+    uint32_t window = static_cast<uint32_t>(std::min<uint64_t>(*error_window, num_batches * MAX_BLOCK_BATCH));
+
+    uint64_t rows = yblocks;
+    if (device_heap != UINT32_MAX) {
+        const VkDeviceSize available = memory_pool->GetAvailableBytes(device_heap, fraction);
+        while (window > MAX_BLOCK_BATCH && GetFixedBufferBytes(window) + device_bytes > available)
+            window = std::max(MAX_BLOCK_BATCH, window / 2 / MAX_BLOCK_BATCH * MAX_BLOCK_BATCH);
+        const VkDeviceSize fixed_bytes = GetFixedBufferBytes(window);
+        rows = std::min<uint64_t>(rows, (available > fixed_bytes) ? (available - fixed_bytes) / device_bytes : 0);
     }
-    m_bcformat = format;
-    m_isbc7 = IsBC7(m_bcformat);
-    m_src_buf_size = m_width * m_height * (m_isbc7 ? 4 : 16);
+    if (host_heap != UINT32_MAX && host_bytes > 0)
+        rows = std::min<uint64_t>(rows, memory_pool->GetAvailableBytes(host_heap, fraction) / host_bytes);
+    rows = std::max<uint64_t>(1, rows);
+
+    *error_window = window;
+
+    // Balance tiles. (e.g. 50 + 50 rows instead of 60 + 40 rows)
+    const uint64_t num_tiles = (yblocks + rows - 1) / rows;
+    return static_cast<uint32_t>((yblocks + num_tiles - 1) / num_tiles);
+}
+
+VkResult GPUCompressBCVk::AllocateBuffers() {
+    VkResult r = VK_SUCCESS;
 
     // Constants
     r = CreateVkBufferAndMemory(m_device,
@@ -472,16 +1427,15 @@ VkResult GPUCompressBCVk::Prepare(uint32_t width, uint32_t height, uint32_t flag
                     sizeof(ConstantsBC6HBC7),
                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                     &m_const_mem,
-                    &m_memory_props,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                    m_memory_pool,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     if (r != VK_SUCCESS)
         return r;
 
-    // Outputs for GPU
-    const size_t xblocks = std::max<size_t>(1, (width + 3) >> 2);
-    const size_t yblocks = std::max<size_t>(1, (height + 3) >> 2);
-    const size_t num_blocks = xblocks * yblocks;
-    m_out_buf_size = (uint32_t)num_blocks * sizeof(BufferBC6HBC7);
+    // Outputs for GPU (for each tile)
+    const size_t xblocks = std::max<size_t>(1, (m_width + 3) >> 2);
+    const size_t num_blocks = xblocks * m_tile_block_rows;
     // Note: num_blocks should be a multiple of 4 in shaders. So we add paddings here.
     VkDeviceSize buf_size = VkDeviceSize((num_blocks + 3) / 4 * 4) * sizeof(BufferBC6HBC7);
     VkBufferUsageFlags buf_usage =
@@ -489,46 +1443,299 @@ VkResult GPUCompressBCVk::Prepare(uint32_t width, uint32_t height, uint32_t flag
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
         VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-    r = CreateVkBuffer(m_device, &m_err1_buf, buf_size, buf_usage);
+    // Error buffers (ring buffers for batches)
+    //   Shaders index them with block_id % m_err_buf_blocks. They don't need to be larger than a tile.
+    const size_t tile_batches = (num_blocks + MAX_BLOCK_BATCH - 1) / MAX_BLOCK_BATCH;
+    m_err_buf_blocks = static_cast<uint32_t>(std::min<size_t>(m_fit_error_window, tile_batches * MAX_BLOCK_BATCH));
+    const VkDeviceSize err_buf_size = VkDeviceSize(m_err_buf_blocks) * sizeof(BufferBC6HBC7);
+
+    r = CreateVkBuffer(m_device, &m_err1_buf, err_buf_size, buf_usage);
+    if (r != VK_SUCCESS)
+        return r;
+    r = CreateVkBuffer(m_device, &m_err2_buf, err_buf_size, buf_usage);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(m_device, m_err1_buf, &req);
+    req.size = AlignUp(req.size, req.alignment);
+
+    r = AllocateBufferArray(m_memory_pool, req, 2, 0, &m_err_mem);
+    if (r != VK_SUCCESS)
+        return r;
+
+    r = vkBindBufferMemory(m_device, m_err1_buf, m_err_mem->memory, m_err_mem->offset);
     if (r != VK_SUCCESS)
         return r;
-    r = CreateVkBuffer(m_device, &m_err2_buf, buf_size, buf_usage);
+    r = vkBindBufferMemory(m_device, m_err2_buf, m_err_mem->memory, m_err_mem->offset + req.size);
     if (r != VK_SUCCESS)
         return r;
+
     r = CreateVkBuffer(m_device, &m_out_buf, buf_size, buf_usage);
     if (r != VK_SUCCESS)
         return r;
 
-    VkMemoryRequirements req;
-    vkGetBufferMemoryRequirements(m_device, m_err1_buf, &req);
+    vkGetBufferMemoryRequirements(m_device, m_out_buf, &req);
 
-    r = AllocateVkMemroy(
-            m_device, &m_out_mem, &m_memory_props,
-            req.size * 3, req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    // Read the output buffer directly when device local memory can be host visible and cached.
+    //   (e.g. integrated GPUs and llvmpipe)
+    const VkMemoryPropertyFlags host_read_flags =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    const bool try_direct_readback = m_direct_host_access &&
+        m_memory_pool->GetHeapIndex(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | host_read_flags) != UINT32_MAX;
+    r = AllocateBufferArray(m_memory_pool, req, 1, try_direct_readback ? host_read_flags : 0, &m_out_mem);
     if (r != VK_SUCCESS)
         return r;
 
-    r = vkBindBufferMemory(m_device, m_err1_buf, m_out_mem, 0);
+    r = vkBindBufferMemory(m_device, m_out_buf, m_out_mem->memory, m_out_mem->offset);
     if (r != VK_SUCCESS)
         return r;
-    r = vkBindBufferMemory(m_device, m_err2_buf, m_out_mem, req.size);
+
+    if ((m_out_mem->flags & host_read_flags) == host_read_flags) {
+        m_out_mapped = m_out_mem->mapped;
+    } else {
+        // Output for CPU
+        //   Cached memory is much faster than write-combined memory for CPU reads.
+        r = CreateVkBufferAndMemory(m_device,
+                        &m_outcpu_buf,
+                        buf_size,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        &m_outcpu_mem,
+                        m_memory_pool,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                        VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    // Blocks which are not solid colors (for each batch)
+    for (uint32_t i = 0; i < 3; i++) {
+        r = CreateVkBuffer(m_device, &m_block_list_buf[i],
+                           MAX_BLOCK_BATCH * sizeof(uint32_t),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    vkGetBufferMemoryRequirements(m_device, m_block_list_buf[0], &req);
+    req.size = AlignUp(req.size, req.alignment);
+
+    r = AllocateBufferArray(m_memory_pool, req, 3, 0, &m_block_list_mem);
     if (r != VK_SUCCESS)
         return r;
-    r = vkBindBufferMemory(m_device, m_out_buf, m_out_mem, req.size * 2);
+
+    for (uint32_t i = 0; i < 3; i++) {
+        r = vkBindBufferMemory(m_device, m_block_list_buf[i],
+                               m_block_list_mem->memory, m_block_list_mem->offset + req.size * i);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    // Arguments for vkCmdDispatchIndirect()
+    for (uint32_t i = 0; i < 3; i++) {
+        r = CreateVkBuffer(m_device, &m_dispatch_args_buf[i],
+                           sizeof(DispatchArgsBC6HBC7),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                           VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                           VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    vkGetBufferMemoryRequirements(m_device, m_dispatch_args_buf[0], &req);
+    req.size = AlignUp(req.size, req.alignment);
+
+    r = AllocateBufferArray(m_memory_pool, req, 3, 0, &m_dispatch_args_mem);
     if (r != VK_SUCCESS)
         return r;
 
-    // Output for CPU
+    for (uint32_t i = 0; i < 3; i++) {
+        r = vkBindBufferMemory(m_device, m_dispatch_args_buf[i],
+                               m_dispatch_args_mem->memory, m_dispatch_args_mem->offset + req.size * i);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    // Results of concurrent BC7 mode passes (for each batch)
     r = CreateVkBufferAndMemory(m_device,
-                    &m_outcpu_buf,
-                    buf_size,
+                    &m_slot_buf,
+                    MAX_BLOCK_BATCH * NUM_MODE_SLOTS * sizeof(BufferBC6HBC7),
                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                    &m_outcpu_mem,
-                    &m_memory_props,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                    &m_slot_mem,
+                    m_memory_pool,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    if (r != VK_SUCCESS)
+        return r;
+
+    // Partitions kept by PartitionShortlistCS (for each batch)
+    r = CreateVkBufferAndMemory(m_device,
+                    &m_shortlist_buf,
+                    MAX_BLOCK_BATCH * SHORTLIST_STRIDE * sizeof(uint32_t),
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                    &m_shortlist_mem,
+                    m_memory_pool,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    if (r != VK_SUCCESS)
+        return r;
+
+    if (m_set_object_name) {
+        char name[64];
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_const_buf, "BCVk constants");
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_err1_buf, "BCVk error 1");
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_err2_buf, "BCVk error 2");
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_out_buf, "BCVk output");
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_outcpu_buf, "BCVk output readback");
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_slot_buf, "BCVk mode slots");
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_shortlist_buf, "BCVk partition shortlist");
+        for (uint32_t i = 0; i < 3; i++) {
+            snprintf(name, sizeof(name), "BCVk block list %u", i);
+            SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_block_list_buf[i], name);
+            snprintf(name, sizeof(name), "BCVk dispatch args %u", i);
+            SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)m_dispatch_args_buf[i], name);
+        }
+    }
+
+    return r;
+}
+
+VkResult GPUCompressBCVk::Prepare(uint32_t width, uint32_t height, uint32_t flags, DXGI_FORMAT format, float alpha_weight) {
+    VkResult r = VK_SUCCESS;
+
+    if (!width || !height || alpha_weight < 0.f)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if ((width > UINT32_MAX) || (height > UINT32_MAX))
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_pipeline_layout == VK_NULL_HANDLE)
+        return VK_ERROR_UNKNOWN;  // GPUCompressBCVk::Initialize() is not called yet (or failed.)
+
+    TraceScopeBCVk trace_scope(m_tracer, "Prepare");
+    FreeBuffers();
+
+    m_width = width;
+    m_height = height;
+    m_alpha_weight = alpha_weight;
+
+    if (flags & TEX_COMPRESS_BC7_QUICK) {
+        // mode 4, 5, and 6
+        m_profile.bc7_mode_mask = 0x70;
+    } else if (flags & TEX_COMPRESS_BC7_USE_3SUBSETS) {
+        m_profile.bc7_mode_mask = 0xFF;
+    } else {
+        // all modes except for 0 and 2
+        m_profile.bc7_mode_mask = 0xFA;
+    }
+    m_profile.bc7_search_rotation = true;
+    m_profile.bc7_search_index_selector = true;
+    m_profile.bc6h_num_two_region_modes = 10;
+    m_profile.num_partitions = 64;
+    m_profile.partition_shortlist_size = 0;
+
+    m_srcformat = BcFormatToSrcFormat(format);
+    if (m_srcformat == DXGI_FORMAT_UNKNOWN) {
+        m_bcformat = DXGI_FORMAT_UNKNOWN;
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    m_bcformat = format;
+    m_isbc7 = IsBC7(m_bcformat);
+    m_src_buf_size = (uint64_t)GetSrcRowSize() * m_height;
+
+    // Split the texture into tiles when buffers for the whole texture don't fit in the memory budget.
+    const size_t xblocks = std::max<size_t>(1, (width + 3) >> 2);
+    const size_t yblocks = std::max<size_t>(1, (height + 3) >> 2);
+    m_out_buf_size = (uint64_t)xblocks * yblocks * sizeof(BufferBC6HBC7);
+    m_fit_error_window = m_error_window;
+    m_tile_block_rows = FitTileBlockRows(m_memory_pool, m_memory_budget_fraction,
+                                         xblocks, yblocks, GetSrcRowSize(), &m_fit_error_window);
+
+    double alloc_start_us = TraceNow(m_tracer);
+    for (;;) {
+        r = AllocateBuffers();
+        const uint32_t err_buf_blocks = m_err_buf_blocks;  // 0 when it failed before the error buffers
+        if (!IsOutOfMemory(r) || (m_tile_block_rows == 1 && err_buf_blocks <= MAX_BLOCK_BATCH))
+            break;
+        // Retry with smaller tiles, and then with smaller error buffers.
+        FreeBuffers();
+        m_memory_pool->ReleaseUnusedBlocks();
+        if (m_tile_block_rows > 1)
+            m_tile_block_rows = (m_tile_block_rows + 1) / 2;
+        else
+            m_fit_error_window = std::max(MAX_BLOCK_BATCH, err_buf_blocks / 2 / MAX_BLOCK_BATCH * MAX_BLOCK_BATCH);
+    }
+    if (r != VK_SUCCESS)
+        return r;
+    TraceSpan(m_tracer, "AllocateBuffers", alloc_start_us);
     return r;
 }
 
+VkResult GPUCompressBCVk::SetQualityProfile(const QualityProfileBC6HBC7& profile) {
+    if ((profile.bc7_mode_mask & 0xFF) == 0)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (profile.bc6h_num_two_region_modes > 10)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (profile.num_partitions == 0 || profile.num_partitions > 64)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (profile.partition_shortlist_size > MAX_SHORTLIST_SIZE)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    m_profile = profile;
+    return VK_SUCCESS;
+}
+
+static bool IsValidBlocksPerGroup(uint32_t blocks_per_group) {
+    return blocks_per_group == 1 || blocks_per_group == 2 || blocks_per_group == 4;
+}
+
+VkResult GPUCompressBCVk::SetWorkgroupTuning(const WorkgroupTuningBC6HBC7& tuning) {
+    if (!IsValidBlocksPerGroup(tuning.bc7_blocks_per_group) ||
+        !IsValidBlocksPerGroup(tuning.bc6h_blocks_per_group))
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    m_tuning = tuning;
+    return VK_SUCCESS;
+}
+
+// Pipelines for the passes of Compress() and RecordCompress()
+struct PipelineSetBCVk {
+    // Options which select the pipelines (See SelectPipelines().)
+    bool isbc7;
+    uint32_t bc7_mode_mask;
+    bool bc7_concurrent;
+    bool bc6_fused;
+    bool use_shortlist;
+    uint32_t blocks_per_group;
+
+    VkPipeline classify;
+    VkPipeline compact;
+    VkPipeline mode456_G10;
+    VkPipeline mode137_LE10;
+    VkPipeline mode02;
+    VkPipeline enc;
+    VkPipeline select;
+    VkPipeline shortlist;
+};
+
+// Upper bounds of a batch recorded by RecordCompress(). (BC6H with 10 mode passes and the error threshold)
+static const uint32_t RECORD_SETS_PER_BATCH = 25;
+static const uint32_t RECORD_CONSTANTS_PER_BATCH = 11;
+
+// Objects for commands recorded by RecordCompress()
+//   They are used until the commands are complete, so the caller resets them instead of the compressor.
+struct TransientAllocatorBCVk {
+    VkDescriptorPool desc_pool;  // a set for each pass
+    VkBuffer const_buf;  // constants for each pass
+    MemoryAllocationBCVk* const_mem;
+    VkDeviceSize const_stride;  // sizeof(ConstantsBC6HBC7) aligned to minUniformBufferOffsetAlignment
+    uint32_t max_constants;
+    uint32_t used_constants;
+    std::vector<PipelineSetBCVk> pipelines;  // kept until DestroyTransientAllocator()
+    VkResult result;  // the first error of descriptor updates while recording
+};
+
 VkResult GPUCompressBCVk::UpdateConstants(uint32_t xblocks, uint32_t mode_id, uint32_t start_block_id, uint32_t num_total_blocks) {
     ConstantsBC6HBC7 param = {};
     param.tex_width = static_cast<uint32_t>(m_width);
@@ -538,20 +1745,178 @@ VkResult GPUCompressBCVk::UpdateConstants(uint32_t xblocks, uint32_t mode_id, ui
     param.start_block_id = start_block_id;
     param.num_total_blocks = num_total_blocks;
     param.alpha_weight = m_alpha_weight;
-    void* data;
-    VkResult r = vkMapMemory(m_device, m_const_mem, 0, sizeof(ConstantsBC6HBC7), 0, &data);
-    if (r == VK_SUCCESS) {
-        memcpy(data, &param, sizeof(param));
-        vkUnmapMemory(m_device, m_const_mem);
+    param.options = m_collapse_transparent ? SHADER_OPTION_COLLAPSE_TRANSPARENT : 0;
+    if (!(m_profile.bc7_mode_mask & (1 << 4)))
+        param.options |= SHADER_OPTION_SKIP_MODE4;
+    if (!(m_profile.bc7_mode_mask & (1 << 5)))
+        param.options |= SHADER_OPTION_SKIP_MODE5;
+    if (!(m_profile.bc7_mode_mask & (1 << 6)))
+        param.options |= SHADER_OPTION_SKIP_MODE6;
+    if (!m_profile.bc7_search_rotation)
+        param.options |= SHADER_OPTION_SKIP_ROTATION;
+    if (!m_profile.bc7_search_index_selector)
+        param.options |= SHADER_OPTION_SKIP_INDEX_SELECTOR;
+    param.error_threshold = m_error_threshold;
+    param.num_partitions = m_profile.num_partitions;
+    param.num_two_region_modes = m_profile.bc6h_num_two_region_modes;
+    param.shortlist_size = m_profile.partition_shortlist_size;
+    param.error_window = m_err_buf_blocks;
+    param.input_offset = m_input_offset;
+    param.input_row_pitch = m_input_row_pitch;
+    param.tile_height = m_input_height;
+    param.input_row = m_input_row;
+
+    if (m_recording) {
+        // Passes recorded by RecordCompress() run later. So, each of them has its own constants.
+        if (m_recording->used_constants >= m_recording->max_constants)
+            return VK_ERROR_OUT_OF_POOL_MEMORY;
+        VkResult r = RenewDescriptorSet();
+        if (r != VK_SUCCESS)
+            return r;
+        VkDescriptorBufferInfo const_buf_info = {};
+        const_buf_info.buffer = m_recording->const_buf;
+        const_buf_info.offset = m_recording->const_stride * m_recording->used_constants++;
+        const_buf_info.range = sizeof(ConstantsBC6HBC7);
+        memcpy(static_cast<uint8_t*>(m_recording->const_mem->mapped) + const_buf_info.offset, &param, sizeof(param));
+        VkWriteDescriptorSet write = {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
+            m_desc_set, 3, 0, 1,
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, nullptr, &const_buf_info
+        };
+        vkUpdateDescriptorSets(m_device, 1, &write, 0, 0);
+        return VK_SUCCESS;
+    }
+
+    // The pool keeps host visible memory mapped.
+    memcpy(m_const_mem->mapped, &param, sizeof(param));
+    return VK_SUCCESS;
+}
+
+static VkResult AllocateDescriptorSet(VkDevice device, VkDescriptorPool descriptor_pool,
+                                      VkDescriptorSetLayout dsl, VkDescriptorSet* descriptor_set) {
+    VkDescriptorSetAllocateInfo dsai = {};
+    dsai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    dsai.pNext = 0;
+    dsai.descriptorPool = descriptor_pool;
+    dsai.descriptorSetCount = 1;
+    dsai.pSetLayouts = &dsl;
+    return vkAllocateDescriptorSets(device, &dsai, descriptor_set);
+}
+
+VkResult GPUCompressBCVk::RenewDescriptorSet() {
+    if (!m_recording || !m_desc_set_bound)
+        return VK_SUCCESS;
+
+    VkDescriptorSet desc_set = VK_NULL_HANDLE;
+    VkResult r = AllocateDescriptorSet(m_device, m_recording->desc_pool, m_desc_set_layout, &desc_set);
+    if (r != VK_SUCCESS) {
+        if (m_recording->result == VK_SUCCESS)
+            m_recording->result = r;
+        return r;
+    }
+
+    // Image builds have bindings 0 to 8.
+    VkCopyDescriptorSet copies[9] = {};
+    for (uint32_t i = 0; i < 9; i++) {
+        copies[i].sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+        copies[i].srcSet = m_desc_set;
+        copies[i].srcBinding = i;
+        copies[i].dstSet = desc_set;
+        copies[i].dstBinding = i;
+        copies[i].descriptorCount = 1;
+    }
+    vkUpdateDescriptorSets(m_device, 0, nullptr, 9, copies);
+    m_desc_set = desc_set;
+    m_desc_set_bound = false;
+    return r;
+}
+
+VkDescriptorSet GPUCompressBCVk::PassDescriptorSet() {
+    m_desc_set_bound = true;
+    return m_desc_set;
+}
+
+// The source image of a tile
+//   A linear image is written by the host directly when staging_buf is VK_NULL_HANDLE.
+struct SourceImageBCVk {
+    VkBuffer staging_buf;  // host visible (shaders read it directly when image is VK_NULL_HANDLE)
+    VkDeviceSize staging_offset;  // offset of the tile in staging_buf
+    uint32_t row_length;  // pixels between rows in staging_buf (0: tightly packed)
+    MemoryAllocationBCVk* staging_mem;  // nullptr when staging_buf has pixels already
+    VkDeviceMemory imported_mem;  // the caller's memory bound to staging_buf
+    bool external;  // staging_buf is owned by CompressExternal().
+    VkImage image;
+    MemoryAllocationBCVk* image_mem;
+    VkImageView image_view;
+    bool banded;  // The image stays in VK_IMAGE_LAYOUT_GENERAL while bands are uploaded.
+};
+
+// Bands of block rows of a tile. Each band is copied while the previous bands are encoded.
+struct SourceBandsBCVk {
+    VkCommandBuffer command_buffers[2];  // record copies of bands alternately (only the first one on m_queue)
+    uint32_t command_buffer_id;  // the command buffer for the next copy
+    SourceImageBCVk* src_image;
+    uint8_t* pixels;  // the first row of the tile (nullptr when staging_buf has pixels already)
+    uint32_t row_pitch;  // bytes between rows of `pixels`
+    uint32_t height;  // rows of the tile
+    uint32_t band_height;  // rows of a band (a multiple of 4)
+    uint32_t uploaded_rows;  // rows whose copies are submitted
+    uint32_t visible_rows;  // rows which shaders can read
+
+    // Copies run on m_transfer_queue when `on_transfer_queue` is true. (It can be the same queue as m_queue.)
+    //   Each copy signals one of the semaphores, and the next classify pass waits for it.
+    VkQueue queue;
+    bool on_transfer_queue;
+    VkSemaphore* semaphores;  // m_transfer_semaphores
+    uint32_t semaphore_id;  // the semaphore signaled by the last copy
+    bool semaphore_pending;  // The last copy signaled a semaphore which is not waited yet.
+    VkFence* fences;  // m_transfer_fences. Each copy signals the fence of its command buffer.
+    bool fence_pending[2];  // The fence is submitted and not reset yet.
+};
+
+// A readback of results on the transfer queue. The host waits for it only when it needs the results.
+struct ReadbackBCVk {
+    VkCommandBuffer release_command_buffer;  // releases m_out_buf on m_queue
+    VkCommandBuffer command_buffer;  // copies results on m_transfer_queue
+    bool pending;  // The copy is submitted with m_transfer_fences[2], and it's not waited yet.
+    void* buf;  // copies results from m_outcpu_buf here after the wait (nullptr when the copy is to imported memory)
+    uint32_t size;
+    VkDeviceSize offset;  // offset of results in m_outcpu_buf
+
+    // Imported memory of the previous tile, which is released after the copy.
+    VkBuffer import_buf;
+    VkDeviceMemory import_mem;
+};
+
+// Wait for copies of bands on the transfer queue, and reset their fences for the next tile.
+static VkResult WaitSourceBands(VkDevice device, SourceBandsBCVk* bands) {
+    VkResult r = VK_SUCCESS;
+    for (uint32_t i = 0; i < 2; i++) {
+        if (!bands->fence_pending[i])
+            continue;
+        VkResult fence_r = vkWaitForFences(device, 1, &bands->fences[i], VK_TRUE, UINT64_MAX);
+        if (fence_r == VK_SUCCESS)
+            fence_r = vkResetFences(device, 1, &bands->fences[i]);
+        if (fence_r != VK_SUCCESS && r == VK_SUCCESS)
+            r = fence_r;
+        bands->fence_pending[i] = false;
     }
     return r;
 }
 
-// Set image view and constant buffer for shaders.
-void GPUCompressBCVk::SetImageViewAndConstBuf(VkImageView image_view, VkBuffer const_buf) {
+// Set source pixels and constant buffer for shaders.
+void GPUCompressBCVk::SetSourceAndConstBuf(const SourceImageBCVk* src_image, VkBuffer const_buf) {
+    if (RenewDescriptorSet() != VK_SUCCESS)
+        return;  // RecordCompress() returns the error.
     VkDescriptorImageInfo img_info = {};
-    img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    img_info.imageView = image_view;
+    img_info.imageLayout = src_image->banded ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    img_info.imageView = src_image->image_view;
+
+    // Buffer input builds read the staging buffer instead of the image.
+    VkDescriptorBufferInfo src_buf_info = {};
+    src_buf_info.buffer = src_image->staging_buf;
+    src_buf_info.offset = 0;
+    src_buf_info.range = VK_WHOLE_SIZE;
 
     VkDescriptorBufferInfo const_buf_info = {};
     const_buf_info.buffer = const_buf;
@@ -561,20 +1926,47 @@ void GPUCompressBCVk::SetImageViewAndConstBuf(VkImageView image_view, VkBuffer c
     VkWriteDescriptorSet writes[] = {
         {
             VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
-            m_desc_set, 0, 0, 1,
-            VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, &img_info
+            m_desc_set, 3, 0, 1,
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, nullptr, &const_buf_info
         },
         {
             VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
-            m_desc_set, 3, 0, 1,
-            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, nullptr, &const_buf_info
+            m_desc_set, 0, 0, 1,
+            VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, &img_info
         }
     };
+    if (m_buffer_input) {
+        writes[1].dstBinding = 9;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[1].pImageInfo = nullptr;
+        writes[1].pBufferInfo = &src_buf_info;
+    }
     vkUpdateDescriptorSets(m_device, 2, writes, 0, 0);
 }
 
+// Use buf as the partition shortlist for shaders.
+void GPUCompressBCVk::SetShortlistBuffer(VkBuffer buf) {
+    if (RenewDescriptorSet() != VK_SUCCESS)
+        return;  // RecordCompress() returns the error.
+    VkDescriptorBufferInfo buf_info = {};
+    buf_info.buffer = buf;
+    buf_info.offset = 0;
+    buf_info.range = VK_WHOLE_SIZE;
+    VkWriteDescriptorSet writes[] = {
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
+            m_desc_set, 8, 0, 1,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &buf_info
+        }
+    };
+
+    vkUpdateDescriptorSets(m_device, 1, writes, 0, 0);
+}
+
 // Use buf as an output buffer of shaders.
 void GPUCompressBCVk::SetOutputBuffer(VkBuffer buf) {
+    if (RenewDescriptorSet() != VK_SUCCESS)
+        return;  // RecordCompress() returns the error.
     VkDescriptorBufferInfo buf_info = {};
     buf_info.buffer = buf;
     buf_info.offset = 0;
@@ -592,6 +1984,8 @@ void GPUCompressBCVk::SetOutputBuffer(VkBuffer buf) {
 
 // Use err_buf as input and use out_buf as output.
 void GPUCompressBCVk::SetErrorAndOutputBuffer(VkBuffer err_buf, VkBuffer out_buf) {
+    if (RenewDescriptorSet() != VK_SUCCESS)
+        return;  // RecordCompress() returns the error.
     VkDescriptorBufferInfo err_buf_info = {};
     err_buf_info.buffer = err_buf;
     err_buf_info.offset = 0;
@@ -616,6 +2010,53 @@ void GPUCompressBCVk::SetErrorAndOutputBuffer(VkBuffer err_buf, VkBuffer out_buf
     vkUpdateDescriptorSets(m_device, 2, writes, 0, 0);
 }
 
+// Use m_block_list_buf[list_id] as the block list for shaders,
+// and use m_block_list_buf[out_list_id] as the output of CompactBlockListCS.
+void GPUCompressBCVk::SetBlockListBuffers(uint32_t list_id, uint32_t out_list_id) {
+    if (RenewDescriptorSet() != VK_SUCCESS)
+        return;  // RecordCompress() returns the error.
+    VkDescriptorBufferInfo list_buf_info = {};
+    list_buf_info.buffer = m_block_list_buf[list_id];
+    list_buf_info.offset = 0;
+    list_buf_info.range = VK_WHOLE_SIZE;
+    VkDescriptorBufferInfo args_buf_info = {};
+    args_buf_info.buffer = m_dispatch_args_buf[list_id];
+    args_buf_info.offset = 0;
+    args_buf_info.range = VK_WHOLE_SIZE;
+    VkDescriptorBufferInfo out_list_buf_info = {};
+    out_list_buf_info.buffer = m_block_list_buf[out_list_id];
+    out_list_buf_info.offset = 0;
+    out_list_buf_info.range = VK_WHOLE_SIZE;
+    VkDescriptorBufferInfo out_args_buf_info = {};
+    out_args_buf_info.buffer = m_dispatch_args_buf[out_list_id];
+    out_args_buf_info.offset = 0;
+    out_args_buf_info.range = VK_WHOLE_SIZE;
+    VkWriteDescriptorSet writes[] = {
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
+            m_desc_set, 4, 0, 1,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &list_buf_info
+        },
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
+            m_desc_set, 5, 0, 1,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &args_buf_info
+        },
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
+            m_desc_set, 6, 0, 1,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &out_list_buf_info
+        },
+        {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, nullptr,
+            m_desc_set, 7, 0, 1,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &out_args_buf_info
+        }
+    };
+
+    vkUpdateDescriptorSets(m_device, 4, writes, 0, 0);
+}
+
 static void ChangeImageLayout(
         VkCommandBuffer command_buffer, VkImage image,
         VkImageLayout old_layout, VkImageLayout new_layout,
@@ -649,50 +2090,208 @@ static void ChangeImageLayout(
     );
 }
 
-static VkResult RunCommand(VkQueue queue, VkCommandBuffer command_buffer) {
+// Measures and labels submissions of Compress() when profiling, tracing, or VK_EXT_debug_utils is enabled.
+struct PassProfilerBCVk {
+    VkDevice device;
+    VkQueryPool query_pool;  // VK_NULL_HANDLE when the queue doesn't support timestamps
+    double ns_per_tick;  // timestampPeriod
+    uint64_t timestamp_mask;  // timestampValidBits
+    CompressStatsBC6HBC7* stats;
+    COMPRESS_PASS pass;  // where the next submission is counted
+    TraceRecorderBCVk* tracer;  // nullptr when tracing is disabled
+
+    // Debug labels of passes (nullptr when VK_EXT_debug_utils is disabled)
+    PFN_vkCmdBeginDebugUtilsLabelEXT cmd_begin_label;
+    PFN_vkCmdEndDebugUtilsLabelEXT cmd_end_label;
+    const char* format_name;  // "BC7" or "BC6H"
+    uint32_t batch_id;  // the current block batch
+};
+
+// Count the next submission as `pass`. It returns `profiler`. (nullptr when profiling is disabled)
+static PassProfilerBCVk* ProfilePass(PassProfilerBCVk* profiler, COMPRESS_PASS pass) {
+    if (profiler)
+        profiler->pass = pass;
+    return profiler;
+}
+
+// Begin a debug label and write a timestamp at the beginning of a command buffer.
+//   The label looks like "BC7 Mode137LE10 batch 12".
+static void BeginPass(VkCommandBuffer command_buffer, PassProfilerBCVk* profiler) {
+    if (!profiler)
+        return;
+    if (profiler->cmd_begin_label) {
+        char name[64];
+        if (profiler->pass == COMPRESS_PASS_UPLOAD || profiler->pass == COMPRESS_PASS_READBACK) {
+            snprintf(name, sizeof(name), "%s %s", profiler->format_name, COMPRESS_PASS_NAMES[profiler->pass]);
+        } else {
+            snprintf(name, sizeof(name), "%s %s batch %u",
+                     profiler->format_name, COMPRESS_PASS_NAMES[profiler->pass], profiler->batch_id);
+        }
+        VkDebugUtilsLabelEXT label = {};
+        label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+        label.pNext = 0;
+        label.pLabelName = name;
+        profiler->cmd_begin_label(command_buffer, &label);
+    }
+    if (profiler->query_pool == VK_NULL_HANDLE)
+        return;
+    vkCmdResetQueryPool(command_buffer, profiler->query_pool, 0, 2);
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->query_pool, 0);
+}
+
+// Write a timestamp and end the debug label at the end of a command buffer.
+//   `dispatch_count` is the number of dispatches (or copies) in the command buffer.
+static void EndPass(VkCommandBuffer command_buffer, PassProfilerBCVk* profiler, uint32_t dispatch_count) {
+    if (!profiler)
+        return;
+    profiler->stats->passes[profiler->pass].dispatch_count += dispatch_count;
+    if (profiler->query_pool != VK_NULL_HANDLE)
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->query_pool, 1);
+    if (profiler->cmd_end_label)
+        profiler->cmd_end_label(command_buffer);
+}
+
+static double ElapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Submit a command buffer and wait for the queue to be idle.
+//   The submission waits `wait_semaphore`, and signals `signal_semaphore`. (They can be VK_NULL_HANDLE.)
+static VkResult RunCommand(VkQueue queue, VkCommandBuffer command_buffer, PassProfilerBCVk* profiler,
+                           VkSemaphore wait_semaphore, VkSemaphore signal_semaphore) {
+    auto start = std::chrono::steady_clock::now();
+    TraceRecorderBCVk* tracer = profiler ? profiler->tracer : nullptr;
+    const char* pass_name = profiler ? COMPRESS_PASS_NAMES[profiler->pass] : nullptr;
+    const double submit_start_us = TraceNow(tracer);
+
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
     VkSubmitInfo si = {};
     si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     si.pNext = 0;
-    si.waitSemaphoreCount = 0;
-    si.pWaitSemaphores = 0;
-    si.pWaitDstStageMask = 0;
+    si.waitSemaphoreCount = (wait_semaphore != VK_NULL_HANDLE) ? 1 : 0;
+    si.pWaitSemaphores = &wait_semaphore;
+    si.pWaitDstStageMask = &wait_stage;
     si.commandBufferCount = 1;
     si.pCommandBuffers = &command_buffer;
-    si.signalSemaphoreCount = 0;
-    si.pSignalSemaphores = 0;
+    si.signalSemaphoreCount = (signal_semaphore != VK_NULL_HANDLE) ? 1 : 0;
+    si.pSignalSemaphores = &signal_semaphore;
 
     VkResult r = vkQueueSubmit(queue, 1, &si, VK_NULL_HANDLE);
     if (r != VK_SUCCESS)
         return r;
-    return vkQueueWaitIdle(queue);
+    TraceSpan(tracer, "vkQueueSubmit", submit_start_us, pass_name);
+    const double wait_start_us = TraceNow(tracer);
+    r = vkQueueWaitIdle(queue);
+    if (r != VK_SUCCESS || !profiler)
+        return r;
+    TraceSpan(tracer, "vkQueueWaitIdle", wait_start_us, pass_name);
+
+    PassStatsBC6HBC7* pass = &profiler->stats->passes[profiler->pass];
+    pass->wait_ms += ElapsedMilliseconds(start);
+    pass->submit_count++;
+    if (profiler->query_pool == VK_NULL_HANDLE)
+        return r;
+
+    uint64_t timestamps[2];
+    r = vkGetQueryPoolResults(profiler->device, profiler->query_pool, 0, 2,
+                              sizeof(timestamps), timestamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (r != VK_SUCCESS)
+        return r;
+    const uint64_t ticks = (timestamps[1] - timestamps[0]) & profiler->timestamp_mask;
+    pass->gpu_ms += static_cast<double>(ticks) * profiler->ns_per_tick / 1000000.0;
+
+    if (tracer) {
+        // Without calibration, the GPU span is aligned to the end of the wait.
+        const double duration_us = static_cast<double>(ticks) * profiler->ns_per_tick / 1000.0;
+        double start_us = TraceNow(tracer) - duration_us;
+        if (tracer->calibrated) {
+            const uint64_t offset = (timestamps[0] - tracer->calibration_ticks) & profiler->timestamp_mask;
+            start_us = tracer->calibration_us + static_cast<double>(offset) * profiler->ns_per_tick / 1000.0;
+        }
+        tracer->events.push_back({ pass_name, pass_name, true, 0, start_us, duration_us });
+    }
+    return r;
+}
+
+// Copy rows of pixels between buffers with different row pitches.
+static void CopyRows(void* dst, size_t dst_pitch, const void* src, size_t src_pitch, size_t row_size, uint32_t height) {
+    if (dst_pitch == row_size && src_pitch == row_size) {
+        memcpy(dst, src, row_size * height);
+        return;
+    }
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(static_cast<uint8_t*>(dst) + dst_pitch * y, static_cast<const uint8_t*>(src) + src_pitch * y, row_size);
 }
 
 VkResult GPUCompressBCVk::CopyToVkImage(
         VkCommandBuffer command_buffer,
-        VkBuffer image_cpu_buf,
-        VkDeviceMemory image_cpu_mem,
-        VkImage image,
-        void* buf, uint32_t buf_size) {
-    // Copy c buffer to host visible VkBuffer
-    void* data;
-    VkResult r = vkMapMemory(m_device, image_cpu_mem, 0, buf_size, 0, &data);
-    if (r == VK_SUCCESS) {
-        memcpy(data, buf, buf_size);
-        vkUnmapMemory(m_device, image_cpu_mem);
-    } else {
-        return r;
-    }
+        SourceImageBCVk* src_image, uint32_t height,
+        void* buf, uint32_t row_pitch,
+        PassProfilerBCVk* profiler) {
+    TraceScopeBCVk trace_scope(m_tracer, "CopyToVkImage");
 
-    // Copy host visible VkBuffer to local VkImage
     VkCommandBufferBeginInfo cbi = {};
     cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     cbi.pNext = 0;
     cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     cbi.pInheritanceInfo = 0;
 
-    r = vkBeginCommandBuffer(command_buffer, &cbi);
-    if (r != VK_SUCCESS)
-        return r;
+    VkResult r = VK_SUCCESS;
+    const uint32_t row_size = GetSrcRowSize();
+    if (src_image->image == VK_NULL_HANDLE) {
+        // Buffer input builds read the host visible buffer. No commands are needed.
+        if (!src_image->staging_mem)
+            return VK_SUCCESS;
+        CopyRows(src_image->staging_mem->mapped, row_size, buf, row_pitch, row_size, height);
+        return m_memory_pool->Flush(src_image->staging_mem);
+    }
+
+    if (src_image->staging_buf == VK_NULL_HANDLE) {
+        // Copy c buffer to the linear image row by row
+        VkImageSubresource subresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
+        VkSubresourceLayout layout;
+        vkGetImageSubresourceLayout(m_device, src_image->image, &subresource, &layout);
+        uint8_t* dst = static_cast<uint8_t*>(src_image->image_mem->mapped) + layout.offset;
+        CopyRows(dst, (size_t)layout.rowPitch, buf, row_pitch, row_size, height);
+        r = m_memory_pool->Flush(src_image->image_mem);
+        if (r != VK_SUCCESS)
+            return r;
+
+        // Only a layout transition is needed. Host writes are visible to the device after vkQueueSubmit().
+        r = vkBeginCommandBuffer(command_buffer, &cbi);
+        if (r != VK_SUCCESS)
+            return r;
+        BeginPass(command_buffer, profiler);
+        ChangeImageLayout(command_buffer, src_image->image,
+            VK_IMAGE_LAYOUT_PREINITIALIZED,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        EndPass(command_buffer, profiler, 0);
+
+        r = vkEndCommandBuffer(command_buffer);
+        if (r != VK_SUCCESS)
+            return r;
+
+        return RunCommand(m_queue, command_buffer, profiler, VK_NULL_HANDLE, VK_NULL_HANDLE);
+    }
+
+    // Copy c buffer to host visible VkBuffer (unless the buffer is imported)
+    //   Rows are packed while copying. Imported rows keep the caller's pitch with bufferRowLength.
+    if (src_image->staging_mem) {
+        CopyRows(src_image->staging_mem->mapped, row_size, buf, row_pitch, row_size, height);
+        r = m_memory_pool->Flush(src_image->staging_mem);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    // Copy host visible VkBuffer to local VkImage
+    r = vkBeginCommandBuffer(command_buffer, &cbi);
+    if (r != VK_SUCCESS)
+        return r;
+    BeginPass(command_buffer, profiler);
+    VkImage image = src_image->image;
     ChangeImageLayout(command_buffer, image,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
@@ -700,12 +2299,14 @@ VkResult GPUCompressBCVk::CopyToVkImage(
         VK_PIPELINE_STAGE_TRANSFER_BIT);
 
     VkBufferImageCopy region = {};
+    region.bufferOffset = src_image->staging_offset;
+    region.bufferRowLength = src_image->row_length;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     region.imageSubresource.layerCount = 1;
-    region.imageExtent = { m_width, m_height, 1 };
+    region.imageExtent = { m_width, height, 1 };
     vkCmdCopyBufferToImage(
         command_buffer,
-        image_cpu_buf,
+        src_image->staging_buf,
         image,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         1,
@@ -717,115 +2318,646 @@ VkResult GPUCompressBCVk::CopyToVkImage(
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    EndPass(command_buffer, profiler, 1);
+
+    r = vkEndCommandBuffer(command_buffer);
+    if (r != VK_SUCCESS)
+        return r;
+
+    return RunCommand(m_queue, command_buffer, profiler, VK_NULL_HANDLE, VK_NULL_HANDLE);
+}
+
+// Submit a command buffer without waiting.
+static VkResult SubmitCommand(VkQueue queue, VkCommandBuffer command_buffer,
+                              VkSemaphore wait_semaphore, VkSemaphore signal_semaphore, VkFence fence) {
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.pNext = 0;
+    si.waitSemaphoreCount = (wait_semaphore != VK_NULL_HANDLE) ? 1 : 0;
+    si.pWaitSemaphores = &wait_semaphore;
+    si.pWaitDstStageMask = &wait_stage;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &command_buffer;
+    si.signalSemaphoreCount = (signal_semaphore != VK_NULL_HANDLE) ? 1 : 0;
+    si.pSignalSemaphores = &signal_semaphore;
+    return vkQueueSubmit(queue, 1, &si, fence);
+}
+
+// Count a submission as `pass` without timestamps. It returns `untimed`. (nullptr when profiling is disabled)
+//   It's for submissions which run with other passes, or on a queue without timestamps.
+static PassProfilerBCVk* UntimedPass(PassProfilerBCVk* profiler, COMPRESS_PASS pass, PassProfilerBCVk* untimed) {
+    if (!profiler)
+        return nullptr;
+    *untimed = *profiler;
+    untimed->query_pool = VK_NULL_HANDLE;
+    untimed->pass = pass;
+    return untimed;
+}
+
+// Wait for a signaled semaphore with an empty submission, so that it can be signaled again.
+static VkResult UnsignalSemaphore(VkQueue queue, VkSemaphore semaphore) {
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.waitSemaphoreCount = 1;
+    si.pWaitSemaphores = &semaphore;
+    si.pWaitDstStageMask = &wait_stage;
+    VkResult r = vkQueueSubmit(queue, 1, &si, VK_NULL_HANDLE);
+    if (r != VK_SUCCESS)
+        return r;
+    return vkQueueWaitIdle(queue);
+}
+
+// Copy the next `height` rows of a tile to the source image, and submit the copy without waiting.
+//   The image is in VK_IMAGE_LAYOUT_GENERAL, so shaders can read the previous bands during the copy.
+//   The classify pass which reads the rows first makes them visible. (See CompressBatches().)
+//   On m_queue, the copy should be complete before the next call. (Passes wait for the queue to be idle.)
+//   On m_transfer_queue, the copy signals a semaphore, and it waits for the previous semaphore if it's pending.
+//   Copies there alternate two command buffers, so the previous copy can still run.
+VkResult GPUCompressBCVk::UploadSourceBand(SourceBandsBCVk* bands, uint32_t height, PassProfilerBCVk* profiler) {
+    TraceScopeBCVk trace_scope(m_tracer, "UploadSourceBand");
+
+    // The copy which used the command buffer two bands ago should be complete to reuse it.
+    const bool on_transfer_queue = bands->on_transfer_queue;
+    const uint32_t slot = on_transfer_queue ? bands->command_buffer_id : 0;
+    VkResult r = VK_SUCCESS;
+    if (bands->fence_pending[slot]) {
+        r = vkWaitForFences(m_device, 1, &bands->fences[slot], VK_TRUE, UINT64_MAX);
+        if (r != VK_SUCCESS)
+            return r;
+        r = vkResetFences(m_device, 1, &bands->fences[slot]);
+        if (r != VK_SUCCESS)
+            return r;
+        bands->fence_pending[slot] = false;
+    }
+
+    SourceImageBCVk* src_image = bands->src_image;
+    VkCommandBuffer command_buffer = bands->command_buffers[slot];
+    const uint32_t y = bands->uploaded_rows;
+    const uint32_t row_size = GetSrcRowSize();
+    const VkDeviceSize staging_pitch = src_image->row_length ?
+        (VkDeviceSize)src_image->row_length * (m_isbc7 ? 4 : 16) : row_size;
+
+    VkCommandBufferBeginInfo cbi = {};
+    cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cbi.pNext = 0;
+    cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    cbi.pInheritanceInfo = 0;
+
+    // Timestamps are not written because the copy runs with other passes which use the query pool.
+    PassProfilerBCVk band_profiler_data;
+    PassProfilerBCVk* band_profiler = UntimedPass(profiler, COMPRESS_PASS_UPLOAD, &band_profiler_data);
+
+    // Copy rows of the band to host visible VkBuffer (unless the buffer is imported)
+    if (src_image->staging_mem) {
+        uint8_t* dst = static_cast<uint8_t*>(src_image->staging_mem->mapped) + (size_t)row_size * y;
+        CopyRows(dst, row_size, bands->pixels + (size_t)bands->row_pitch * y, bands->row_pitch, row_size, height);
+        r = m_memory_pool->Flush(src_image->staging_mem);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+
+    // Copy the rows to local VkImage
+    r = vkBeginCommandBuffer(command_buffer, &cbi);
+    if (r != VK_SUCCESS)
+        return r;
+    BeginPass(command_buffer, band_profiler);
+    VkImage image = src_image->image;
+    if (y == 0) {
+        ChangeImageLayout(command_buffer, image,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = src_image->staging_offset + staging_pitch * y;
+    region.bufferRowLength = src_image->row_length;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = { 0, static_cast<int32_t>(y), 0 };
+    region.imageExtent = { m_width, height, 1 };
+    vkCmdCopyBufferToImage(
+        command_buffer,
+        src_image->staging_buf,
+        image,
+        VK_IMAGE_LAYOUT_GENERAL,
+        1,
+        &region
+    );
+    EndPass(command_buffer, band_profiler, 1);
 
     r = vkEndCommandBuffer(command_buffer);
     if (r != VK_SUCCESS)
         return r;
 
-    return RunCommand(m_queue, command_buffer);
+    // Binary semaphores are signaled alternately. A pending semaphore is waited here instead of a classify pass.
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSemaphore wait_semaphore = bands->semaphores[bands->semaphore_id];
+    VkSemaphore signal_semaphore = bands->semaphores[bands->semaphore_id ^ 1];
+    VkSubmitInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.pNext = 0;
+    si.waitSemaphoreCount = (on_transfer_queue && bands->semaphore_pending) ? 1 : 0;
+    si.pWaitSemaphores = &wait_semaphore;
+    si.pWaitDstStageMask = &wait_stage;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &command_buffer;
+    si.signalSemaphoreCount = on_transfer_queue ? 1 : 0;
+    si.pSignalSemaphores = &signal_semaphore;
+
+    r = vkQueueSubmit(bands->queue, 1, &si, on_transfer_queue ? bands->fences[slot] : VK_NULL_HANDLE);
+    if (r != VK_SUCCESS)
+        return r;
+    if (on_transfer_queue) {
+        bands->semaphore_id ^= 1;
+        bands->semaphore_pending = true;
+        bands->fence_pending[slot] = true;
+        bands->command_buffer_id ^= 1;
+    }
+    if (profiler)
+        profiler->stats->passes[COMPRESS_PASS_UPLOAD].submit_count++;
+    bands->uploaded_rows += height;
+    return r;
 }
 
 // Copy result to cpu memory
-VkResult GPUCompressBCVk::CopyFromOutBuffer(VkCommandBuffer command_buffer, void* buf) {
+VkResult GPUCompressBCVk::CopyFromOutBuffer(VkCommandBuffer command_buffer, void* buf, uint32_t buf_size,
+                                            VkDeviceSize out_offset,
+                                            VkBuffer dst_buf, VkDeviceSize dst_offset,
+                                            ReadbackBCVk* readback,
+                                            PassProfilerBCVk* profiler) {
+    TraceScopeBCVk trace_scope(m_tracer, "CopyFromOutBuffer");
+
     // Copy local VkBuffer to host visible VkBuffer
+    //   (or only make shader writes visible to the host when m_out_buf is read directly.)
+    //   Results are copied to `buf` directly when it's imported as `dst_buf`.
+    const bool imported = dst_buf != VK_NULL_HANDLE;
+    const bool read_mapped = m_out_mapped && !imported;
+    if (!imported)
+        dst_buf = m_outcpu_buf;
     VkCommandBufferBeginInfo cbi = {};
     cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     cbi.pNext = 0;
     cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     cbi.pInheritanceInfo = 0;
 
-    VkResult r = vkBeginCommandBuffer(command_buffer, &cbi);
+    // The copy runs on the transfer queue unless the host reads m_out_buf directly.
+    //   Then, m_out_buf is released with a dedicated command buffer, so that passes can reuse `command_buffer`.
+    //   Neither submission is waited, so they have no timestamps.
+    const bool on_transfer_queue = readback != nullptr && !read_mapped;
+    PassProfilerBCVk transfer_profiler_data;
+    PassProfilerBCVk* copy_profiler = on_transfer_queue ?
+        UntimedPass(profiler, COMPRESS_PASS_READBACK, &transfer_profiler_data) : profiler;
+    VkResult r = VK_SUCCESS;
+    if (on_transfer_queue) {
+        // The previous readback should be complete to reuse m_outcpu_buf, the command buffers, and the semaphore.
+        r = FinishReadback(readback, profiler);
+        if (r != VK_SUCCESS)
+            return r;
+        command_buffer = readback->release_command_buffer;
+    }
+
+    r = vkBeginCommandBuffer(command_buffer, &cbi);
     if (r != VK_SUCCESS)
         return r;
+    BeginPass(command_buffer, copy_profiler);
 
     VkBufferMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
     barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = read_mapped ? VK_ACCESS_HOST_READ_BIT : VK_ACCESS_TRANSFER_READ_BIT;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.buffer = m_out_buf;
+    barrier.offset = out_offset;
+    barrier.size = buf_size;
+
+    VkCommandBuffer copy_command_buffer = command_buffer;
+
+    if (on_transfer_queue) {
+        // Release m_out_buf on the compute queue...
+        //   The semaphore is enough when the transfer queue is in the same family.
+        barrier.dstAccessMask = 0;
+        if (m_transfer_family_id != m_family_id) {
+            barrier.srcQueueFamilyIndex = m_family_id;
+            barrier.dstQueueFamilyIndex = m_transfer_family_id;
+        }
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0, nullptr,
+            1, &barrier,
+            0, nullptr
+        );
+        EndPass(command_buffer, copy_profiler, 0);
+
+        r = vkEndCommandBuffer(command_buffer);
+        if (r != VK_SUCCESS)
+            return r;
+
+        r = SubmitCommand(m_queue, command_buffer, VK_NULL_HANDLE, m_transfer_semaphores[2], VK_NULL_HANDLE);
+        if (r != VK_SUCCESS)
+            return r;
+        if (profiler)
+            profiler->stats->passes[profiler->pass].submit_count++;
+
+        // ...and acquire it on the transfer queue.
+        //   Only the range is transferred. It's not released back because the next range or tile overwrites it.
+        //   The caller calls FinishReadback() before passes write m_out_buf again.
+        copy_command_buffer = readback->command_buffer;
+
+        r = vkBeginCommandBuffer(copy_command_buffer, &cbi);
+        if (r != VK_SUCCESS)
+            return r;
+        BeginPass(copy_command_buffer, copy_profiler);
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(
+            copy_command_buffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, nullptr,
+            1, &barrier,
+            0, nullptr
+        );
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    } else {
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            read_mapped ? VK_PIPELINE_STAGE_HOST_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, nullptr,
+            1, &barrier,
+            0, nullptr
+        );
+    }
+
+    if (!read_mapped) {
+        VkBufferCopy region = { out_offset, dst_offset, buf_size };
+        vkCmdCopyBuffer(
+            copy_command_buffer,
+            m_out_buf,
+            dst_buf,
+            1,
+            &region
+        );
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.buffer = dst_buf;
+        barrier.offset = dst_offset;
+        barrier.size = buf_size;
+        vkCmdPipelineBarrier(
+            copy_command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0,
+            0, nullptr,
+            1, &barrier,
+            0, nullptr
+        );
+    }
+    EndPass(copy_command_buffer, copy_profiler, read_mapped ? 0 : 1);
+
+    r = vkEndCommandBuffer(copy_command_buffer);
+    if (r != VK_SUCCESS)
+        return r;
+
+    if (on_transfer_queue) {
+        r = SubmitCommand(m_transfer_queue, copy_command_buffer, m_transfer_semaphores[2], VK_NULL_HANDLE,
+                          m_transfer_fences[2]);
+        if (r != VK_SUCCESS) {
+            // The release signaled the semaphore, but nothing waits for it.
+            vkQueueWaitIdle(m_queue);
+            UnsignalSemaphore(m_transfer_queue, m_transfer_semaphores[2]);
+            return r;
+        }
+        if (profiler)
+            profiler->stats->passes[profiler->pass].submit_count++;
+        readback->pending = true;
+        readback->buf = imported ? nullptr : buf;
+        readback->size = buf_size;
+        readback->offset = dst_offset;
+        return r;
+    }
+
+    r = RunCommand(m_queue, copy_command_buffer, copy_profiler, VK_NULL_HANDLE, VK_NULL_HANDLE);
+    if (r != VK_SUCCESS)
+        return r;
+
+    // Imported memory is host coherent, and it's `buf` itself.
+    if (imported)
+        return r;
+
+    // Copy host visible VkBuffer to c buffer
+    MemoryAllocationBCVk* mem = read_mapped ? m_out_mem : m_outcpu_mem;
+    r = m_memory_pool->Invalidate(mem);
+    if (r != VK_SUCCESS)
+        return r;
+    memcpy(buf, static_cast<uint8_t*>(read_mapped ? m_out_mapped : mem->mapped) + (read_mapped ? out_offset : dst_offset),
+           buf_size);
+    return r;
+}
+
+VkResult GPUCompressBCVk::FinishReadback(ReadbackBCVk* readback, PassProfilerBCVk* profiler) {
+    if (!readback->pending)
+        return VK_SUCCESS;
+    TraceScopeBCVk trace_scope(m_tracer, "FinishReadback");
+
+    auto start = std::chrono::steady_clock::now();
+    readback->pending = false;
+    VkResult r = vkWaitForFences(m_device, 1, &m_transfer_fences[2], VK_TRUE, UINT64_MAX);
+    if (r == VK_SUCCESS)
+        r = vkResetFences(m_device, 1, &m_transfer_fences[2]);
+    if (profiler)
+        profiler->stats->passes[profiler->pass].wait_ms += ElapsedMilliseconds(start);
+
+    vkDestroyBuffer(m_device, readback->import_buf, 0);
+    vkFreeMemory(m_device, readback->import_mem, 0);
+    readback->import_buf = VK_NULL_HANDLE;
+    readback->import_mem = VK_NULL_HANDLE;
+    if (r != VK_SUCCESS || !readback->buf)
+        return r;
+
+    // Copy host visible VkBuffer to c buffer
+    r = m_memory_pool->Invalidate(m_outcpu_mem);
+    if (r != VK_SUCCESS)
+        return r;
+    memcpy(readback->buf, static_cast<uint8_t*>(m_outcpu_mem->mapped) + readback->offset, readback->size);
+    return r;
+}
+
+static VkFormat SrcFormatToVkFormat(DXGI_FORMAT format) {
+    if (format == DXGI_FORMAT_R32G32B32A32_FLOAT)
+        return VK_FORMAT_R32G32B32A32_SFLOAT;
+    return VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+// Begin a command buffer for a pass.
+//   When `queue` is VK_NULL_HANDLE, the pass is recorded into the caller's command buffer by RecordCompress().
+static VkResult BeginPassCommand(VkCommandBuffer command_buffer, VkQueue queue, PassProfilerBCVk* profiler) {
+    if (queue != VK_NULL_HANDLE) {
+        VkCommandBufferBeginInfo cbi = {};
+        cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cbi.pNext = 0;
+        cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        cbi.pInheritanceInfo = 0;
+
+        VkResult r = vkBeginCommandBuffer(command_buffer, &cbi);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+    BeginPass(command_buffer, profiler);
+    return VK_SUCCESS;
+}
+
+// End a command buffer for a pass, and run it. It only ends the pass when `queue` is VK_NULL_HANDLE.
+//   The submission waits `wait_semaphore` unless it's VK_NULL_HANDLE.
+static VkResult SubmitPassCommand(VkCommandBuffer command_buffer, VkQueue queue,
+                                  PassProfilerBCVk* profiler, uint32_t dispatch_count,
+                                  VkSemaphore wait_semaphore) {
+    EndPass(command_buffer, profiler, dispatch_count);
+    if (queue == VK_NULL_HANDLE)
+        return VK_SUCCESS;
+
+    VkResult r = vkEndCommandBuffer(command_buffer);
+    if (r != VK_SUCCESS)
+        return r;
+
+    return RunCommand(queue, command_buffer, profiler, wait_semaphore, VK_NULL_HANDLE);
+}
+
+// Record commands to clear a block list.
+static void ResetDispatchArgs(VkCommandBuffer command_buffer, VkBuffer dispatch_args_buf) {
+    // No blocks in the list. Each dispatch runs 0 thread groups until a shader appends blocks.
+    DispatchArgsBC6HBC7 args = { 0, { 0, 1, 1 }, { 0, 1, 1 }, { 0, 1, 1 }, { 0, 1, 1 } };
+    vkCmdUpdateBuffer(command_buffer, dispatch_args_buf, 0, sizeof(args), &args);
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = dispatch_args_buf;
     barrier.offset = 0;
     barrier.size = VK_WHOLE_SIZE;
 
     vkCmdPipelineBarrier(
         command_buffer,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         0,
         0, nullptr,
         1, &barrier,
         0, nullptr
     );
+}
 
-    uint32_t buf_size = (uint32_t)GetOutBufSize();
-    VkBufferCopy region = { 0, 0, buf_size };
-    vkCmdCopyBuffer(
-        command_buffer,
-        m_out_buf,
-        m_outcpu_buf,
-        1,
-        &region
-    );
-
-    r = vkEndCommandBuffer(command_buffer);
+// Reset dispatch arguments and run ClassifySolidCS.
+static VkResult RunClassifyShader(
+        VkCommandBuffer command_buffer, VkQueue queue,
+        VkPipeline pipeline, VkPipelineLayout pipeline_layout,
+        VkDescriptorSet descriptor_set,
+        VkBuffer dispatch_args_buf,
+        uint32_t dispatch_x, bool wait_for_upload, VkSemaphore upload_semaphore,
+        PassProfilerBCVk* profiler) {
+    VkResult r = BeginPassCommand(command_buffer, queue, profiler);
     if (r != VK_SUCCESS)
         return r;
 
-    r = RunCommand(m_queue, command_buffer);
+    if (queue == VK_NULL_HANDLE || wait_for_upload) {
+        // Wait for the previous batch and the copy of results in the same command buffer,
+        // or for bands of the source image copied by UploadSourceBand().
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            1, &barrier,
+            0, nullptr,
+            0, nullptr
+        );
+    }
+
+    ResetDispatchArgs(command_buffer, dispatch_args_buf);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
+                            0, 1, &descriptor_set, 0, 0);
+    vkCmdDispatch(command_buffer, dispatch_x, 1, 1);
+    return SubmitPassCommand(command_buffer, queue, profiler, 1, upload_semaphore);
+}
+
+// Reset out_dispatch_args_buf and run CompactBlockListCS for blocks listed in dispatch_args_buf.
+static VkResult RunCompactShader(
+        VkCommandBuffer command_buffer, VkQueue queue,
+        VkPipeline pipeline, VkPipelineLayout pipeline_layout,
+        VkDescriptorSet descriptor_set,
+        VkBuffer dispatch_args_buf, VkBuffer out_dispatch_args_buf,
+        PassProfilerBCVk* profiler) {
+    VkResult r = BeginPassCommand(command_buffer, queue, profiler);
     if (r != VK_SUCCESS)
         return r;
 
-    // Copy host visible VkBuffer to c buffer
-    void* data;
-    r = vkMapMemory(m_device, m_outcpu_mem, 0, VK_WHOLE_SIZE, 0, &data);
-    if (r == VK_SUCCESS) {
-        memcpy(buf, data, buf_size);
-        vkUnmapMemory(m_device, m_outcpu_mem);
-    }
-    return r;
-}
+    // Make shader writes (the block list, dispatch args, and errors) visible to this dispatch.
+    //   The reset also waits for earlier dispatches which read out_dispatch_args_buf.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
 
-static VkFormat SrcFormatToVkFormat(DXGI_FORMAT format) {
-    if (format == DXGI_FORMAT_R32G32B32A32_FLOAT)
-        return VK_FORMAT_R32G32B32A32_SFLOAT;
-    return VK_FORMAT_R8G8B8A8_UNORM;
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        1, &barrier,
+        0, nullptr,
+        0, nullptr
+    );
+
+    ResetDispatchArgs(command_buffer, out_dispatch_args_buf);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
+                            0, 1, &descriptor_set, 0, 0);
+    vkCmdDispatchIndirect(command_buffer, dispatch_args_buf, offsetof(DispatchArgsBC6HBC7, group_64));
+    return SubmitPassCommand(command_buffer, queue, profiler, 1, VK_NULL_HANDLE);
 }
 
-static VkResult RunComputeShader(
+// Run a shader with the dispatch arguments written by ClassifySolidCS or CompactBlockListCS.
+//   `offset` should be the offset of group_1, group_2, or group_4 in DispatchArgsBC6HBC7.
+static VkResult RunComputeShaderIndirect(
         VkCommandBuffer command_buffer, VkQueue queue,
         VkPipeline pipeline, VkPipelineLayout pipeline_layout,
         VkDescriptorSet descriptor_set,
-        uint32_t dispatch_x) {
-    VkResult r = VK_SUCCESS;
-    VkCommandBufferBeginInfo cbi = {};
-    cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    cbi.pNext = 0;
-    cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    cbi.pInheritanceInfo = 0;
-
-    r = vkBeginCommandBuffer(command_buffer, &cbi);
+        VkBuffer dispatch_args_buf, VkDeviceSize offset,
+        PassProfilerBCVk* profiler) {
+    VkResult r = BeginPassCommand(command_buffer, queue, profiler);
     if (r != VK_SUCCESS)
         return r;
 
+    // Make shader writes (the block list, dispatch args, and errors) visible to this dispatch.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1, &barrier,
+        0, nullptr,
+        0, nullptr
+    );
+
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
                             0, 1, &descriptor_set, 0, 0);
-    vkCmdDispatch(command_buffer, dispatch_x, 1, 1);
+    vkCmdDispatchIndirect(command_buffer, dispatch_args_buf, offset);
+    return SubmitPassCommand(command_buffer, queue, profiler, 1, VK_NULL_HANDLE);
+}
 
-    r = vkEndCommandBuffer(command_buffer);
+// Run concurrent BC7 mode passes in a single submission.
+//   There are no barriers between the passes because each pass writes to its own slot in slot_buf.
+//   `offsets` should be offsets of group_1, group_2, or group_4 in DispatchArgsBC6HBC7.
+static VkResult RunConcurrentShaders(
+        VkCommandBuffer command_buffer, VkQueue queue,
+        const VkPipeline* pipelines, const PassConstantsBC7* passes,
+        const VkDeviceSize* offsets, uint32_t pass_count,
+        VkPipelineLayout pipeline_layout,
+        VkDescriptorSet descriptor_set,
+        VkBuffer dispatch_args_buf, VkBuffer slot_buf,
+        PassProfilerBCVk* profiler) {
+    VkResult r = BeginPassCommand(command_buffer, queue, profiler);
+    if (r != VK_SUCCESS)
+        return r;
+
+    // Slots of skipped passes have the max error.
+    vkCmdFillBuffer(command_buffer, slot_buf, 0, VK_WHOLE_SIZE, 0xFFFFFFFF);
+
+    VkMemoryBarrier barriers[2] = {};
+    // Make shader writes (the block list and dispatch args) visible to the passes.
+    barriers[0].sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    // Make the fill visible to the passes.
+    barriers[1].sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        2, barriers,
+        0, nullptr,
+        0, nullptr
+    );
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
+                            0, 1, &descriptor_set, 0, 0);
+    for (uint32_t i = 0; i < pass_count; i++) {
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[i]);
+        vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(PassConstantsBC7), &passes[i]);
+        vkCmdDispatchIndirect(command_buffer, dispatch_args_buf, offsets[i]);
+    }
+    return SubmitPassCommand(command_buffer, queue, profiler, pass_count, VK_NULL_HANDLE);
+}
+
+// Remove blocks with small errors from the block list.
+//   `list_id` will be the id of the compacted list.
+//   `err_buf` should be the output of the last pass.
+//   Results of the removed blocks are copied to `other_err_buf`,
+//   so both error buffers have them for the following passes.
+VkResult GPUCompressBCVk::CompactBlockList(
+        VkCommandBuffer command_buffer, VkQueue queue, VkPipeline pipeline,
+        uint32_t* list_id, VkBuffer err_buf, VkBuffer other_err_buf,
+        PassProfilerBCVk* profiler) {
+    // Note: m_block_list_buf[0] is kept for EncodeBlockCS.
+    uint32_t out_list_id = (*list_id == 1) ? 2 : 1;
+    SetBlockListBuffers(*list_id, out_list_id);
+    SetErrorAndOutputBuffer(err_buf, other_err_buf);
+    VkResult r = RunCompactShader(command_buffer, queue,
+                                  pipeline, m_pipeline_layout, PassDescriptorSet(),
+                                  m_dispatch_args_buf[*list_id], m_dispatch_args_buf[out_list_id],
+                                  ProfilePass(profiler, COMPRESS_PASS_COMPACT));
     if (r != VK_SUCCESS)
         return r;
 
-    r = RunCommand(queue, command_buffer);
+    // The following passes use the compacted list.
+    SetBlockListBuffers(out_list_id, *list_id);
+    *list_id = out_list_id;
     return r;
 }
 
+// `required_subgroup_size` runs each thread group as full subgroups of the size. (0: the default size)
 static VkResult CreateVkPipeline(
         VkDevice device, VkPipeline* pipeline,
         VkShaderModule shader_module,
         const char* entry_point,
-        VkPipelineLayout pipeline_layout) {
+        VkPipelineLayout pipeline_layout,
+        VkPipelineCache pipeline_cache,
+        uint32_t required_subgroup_size = 0) {
     VkPipelineShaderStageCreateInfo ssi = {};
     ssi.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     ssi.pNext = 0;
@@ -835,6 +2967,14 @@ static VkResult CreateVkPipeline(
     ssi.pName = entry_point;
     ssi.pSpecializationInfo = 0;
 
+    VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT subgroup_size_info = {};
+    if (required_subgroup_size > 0) {
+        subgroup_size_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT;
+        subgroup_size_info.requiredSubgroupSize = required_subgroup_size;
+        ssi.pNext = &subgroup_size_info;
+        ssi.flags = VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT_EXT;
+    }
+
     VkComputePipelineCreateInfo cpci = {};
     cpci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     cpci.pNext = 0;
@@ -844,15 +2984,17 @@ static VkResult CreateVkPipeline(
     cpci.basePipelineHandle = VK_NULL_HANDLE;
     cpci.basePipelineIndex = -1;
 
-    return vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &cpci, 0, pipeline);
+    return vkCreateComputePipelines(device, pipeline_cache, 1, &cpci, 0, pipeline);
 }
 
 static VkResult CreateVkImage(
         VkDevice device, VkImage* image,
-        uint32_t width, uint32_t height, VkFormat format,
-        VkDeviceMemory* mem,
-        VkPhysicalDeviceMemoryProperties* mem_props,
-        VkMemoryPropertyFlags mem_flags) {
+        uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
+        MemoryAllocationBCVk** mem,
+        DeviceMemoryPoolBCVk* memory_pool,
+        VkMemoryPropertyFlags mem_flags,
+        VkMemoryPropertyFlags preferred_flags,
+        const uint32_t* shared_family_ids) {
 
     VkImageCreateInfo img_info = {};
     img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -862,10 +3004,22 @@ static VkResult CreateVkImage(
     img_info.mipLevels = 1;
     img_info.arrayLayers = 1;
     img_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-    img_info.usage =
-        VK_IMAGE_USAGE_SAMPLED_BIT |
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    img_info.tiling = tiling;
+    if (tiling == VK_IMAGE_TILING_LINEAR) {
+        // Written by the host before the first use
+        img_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+        img_info.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+    } else {
+        img_info.usage =
+            VK_IMAGE_USAGE_SAMPLED_BIT |
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+    if (shared_family_ids) {
+        // Used by two queue families without ownership transfers
+        img_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        img_info.queueFamilyIndexCount = 2;
+        img_info.pQueueFamilyIndices = shared_family_ids;
+    }
     VkResult r = vkCreateImage(device, &img_info, nullptr, image);
     if (r != VK_SUCCESS)
         return r;
@@ -873,11 +3027,12 @@ static VkResult CreateVkImage(
     VkMemoryRequirements req;
     vkGetImageMemoryRequirements(device, *image, &req);
 
-    r = AllocateVkMemroy(device, mem, mem_props, req.size, req.memoryTypeBits, mem_flags);
+    // Linear images are linear resources like buffers for bufferImageGranularity.
+    r = memory_pool->Allocate(req, mem_flags, preferred_flags, tiling == VK_IMAGE_TILING_OPTIMAL, mem);
     if (r != VK_SUCCESS)
         return r;
 
-    return vkBindImageMemory(device, *image, *mem, 0);
+    return vkBindImageMemory(device, *image, (*mem)->memory, (*mem)->offset);
 }
 
 static VkResult CreateVkImageView(
@@ -916,221 +3071,1544 @@ static VkResult AllocateVkCommandBuffer(
     return vkAllocateCommandBuffers(device, &cbai, command_buffer);
 }
 
-VkResult GPUCompressBCVk::Compress(void* src_pixels, void* out_pixels) {
-    VkResult r = VK_SUCCESS;
+// Offset of dispatch args for `blocks_per_group` (1, 2, or 4) in DispatchArgsBC6HBC7
+static VkDeviceSize GroupArgsOffset(uint32_t blocks_per_group) {
+    if (blocks_per_group == 1)
+        return offsetof(DispatchArgsBC6HBC7, group_1);
+    if (blocks_per_group == 2)
+        return offsetof(DispatchArgsBC6HBC7, group_2);
+    return offsetof(DispatchArgsBC6HBC7, group_4);
+}
 
-    if (!src_pixels || !out_pixels)
-        return VK_ERROR_UNKNOWN;
+// Shader module built for `blocks_per_group` (1, 2, or 4)
+static VkShaderModule SelectTunedModule(
+        uint32_t blocks_per_group,
+        VkShaderModule module_g16, VkShaderModule module_g32, VkShaderModule module_g64) {
+    if (blocks_per_group == 1)
+        return module_g16;
+    if (blocks_per_group == 2)
+        return module_g32;
+    return module_g64;
+}
+
+// Required subgroup size for `blocks_per_group` (1, 2, or 4)
+static uint32_t SelectTunedSubgroupSize(
+        uint32_t blocks_per_group,
+        uint32_t size_g16, uint32_t size_g32, uint32_t size_g64) {
+    if (blocks_per_group == 1)
+        return size_g16;
+    if (blocks_per_group == 2)
+        return size_g32;
+    return size_g64;
+}
 
+// Check if the device can sample a linear image of the size.
+static bool SupportsLinearImage(VkPhysicalDevice physical_device, VkFormat format, uint32_t width, uint32_t height) {
+    VkImageFormatProperties props;
+    VkResult r = vkGetPhysicalDeviceImageFormatProperties(
+        physical_device, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_LINEAR,
+        VK_IMAGE_USAGE_SAMPLED_BIT, 0, &props);
+    return r == VK_SUCCESS && props.maxExtent.width >= width && props.maxExtent.height >= height;
+}
+
+VkResult GPUCompressBCVk::CreateSourceImage(uint32_t height, void* pixels, uint32_t row_pitch,
+                                            VkBuffer external_buf, VkDeviceSize external_offset,
+                                            SourceImageBCVk* src_image) {
     VkFormat src_format = SrcFormatToVkFormat(m_srcformat);
+    VkResult r = VK_SUCCESS;
+    *src_image = {};
+
+    // Use the caller's memory as the staging buffer if it can be imported.
+    //   It covers rows of the tile with the caller's row pitch.
+    //   The pointer should be aligned to the pixel size because copies and shaders address pixels from its offset.
+    const uint32_t row_size = GetSrcRowSize();
+    const VkDeviceSize src_size = (VkDeviceSize)row_size * height;
+    const VkDeviceSize src_span = (VkDeviceSize)row_pitch * (height - 1) + row_size;
+    bool imported = false;
+    if (external_buf != VK_NULL_HANDLE) {
+        src_image->staging_buf = external_buf;
+        src_image->staging_offset = external_offset;
+        src_image->external = true;
+        imported = true;
+    } else if (reinterpret_cast<uintptr_t>(pixels) % (row_size / m_width) == 0 &&
+               ImportHostBuffer(pixels, src_span,
+                                m_buffer_input ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                &src_image->staging_buf, &src_image->imported_mem,
+                                &src_image->staging_offset) == VK_SUCCESS) {
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)src_image->staging_buf, "BCVk imported source");
+        imported = true;
+    }
+    if (imported && row_pitch != row_size)
+        src_image->row_length = row_pitch / (row_size / m_width);
+    if (imported && m_buffer_input)
+        return r;
 
-    constexpr uint32_t MAX_BLOCK_BATCH = 64u;
-    const size_t xblocks = std::max<size_t>(1, (m_width + 3) >> 2);
-    const size_t yblocks = std::max<size_t>(1, (m_height + 3) >> 2);
+    // Buffer input builds only need a host visible buffer. It should be device local if possible.
+    if (m_buffer_input && !imported) {
+        r = CreateVkBufferAndMemory(m_device,
+                        &src_image->staging_buf,
+                        src_size,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        &src_image->staging_mem,
+                        m_memory_pool,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if (r != VK_SUCCESS)
+            return r;
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)src_image->staging_buf, "BCVk source");
+        return r;
+    }
 
-    const auto num_total_blocks = static_cast<uint32_t>(xblocks * yblocks);
-    uint32_t num_blocks = num_total_blocks;
-    uint32_t start_block_id = 0;
+    // Skip the staging buffer when device local memory is host visible. (e.g. integrated GPUs and ReBAR)
+    //   It falls back to the staging buffer when the linear image can't be created.
+    if (!imported && m_direct_host_access &&
+        m_memory_pool->GetHeapIndex(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != UINT32_MAX &&
+        SupportsLinearImage(m_physical_device, src_format, m_width, height)) {
+        r = CreateVkImage(m_device, &src_image->image,
+                    m_width, height, src_format, VK_IMAGE_TILING_LINEAR,
+                    &src_image->image_mem, m_memory_pool,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, nullptr);
+        if (r == VK_SUCCESS)
+            r = CreateVkImageView(m_device, &src_image->image_view, src_image->image, src_format);
+        if (r == VK_SUCCESS) {
+            SetObjectName(VK_OBJECT_TYPE_IMAGE, (uint64_t)src_image->image, "BCVk source");
+            SetObjectName(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)src_image->image_view, "BCVk source");
+            return r;
+        }
+        DestroySourceImage(src_image);
+    }
 
-    // Pipelines
-    VkPipeline pipeline_mode456_G10 = VK_NULL_HANDLE;
-    VkPipeline pipeline_mode137_LE10 = VK_NULL_HANDLE;
-    VkPipeline pipeline_mode02 = VK_NULL_HANDLE;
-    VkPipeline pipeline_enc = VK_NULL_HANDLE;
+    if (!imported) {
+        r = CreateVkBufferAndMemory(m_device,
+                        &src_image->staging_buf,
+                        src_size,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        &src_image->staging_mem,
+                        m_memory_pool,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        if (r != VK_SUCCESS)
+            return r;
+        SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)src_image->staging_buf, "BCVk source staging");
+    }
 
-    // Host visible image buffer
-    VkBuffer src_image_cpu = VK_NULL_HANDLE;
-    VkDeviceMemory src_image_cpu_memory = VK_NULL_HANDLE;
+    const uint32_t shared_family_ids[2] = { m_family_id, m_transfer_family_id };
+    const bool shared = m_transfer_queue != VK_NULL_HANDLE && m_transfer_family_id != m_family_id;
+    r = CreateVkImage(m_device, &src_image->image,
+                m_width, height, src_format, VK_IMAGE_TILING_OPTIMAL,
+                &src_image->image_mem, m_memory_pool,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                shared ? shared_family_ids : nullptr);
+    if (r != VK_SUCCESS)
+        return r;
 
-    // Image buffer for GPU
-    VkImage src_image = VK_NULL_HANDLE;
-    VkDeviceMemory src_image_memory = VK_NULL_HANDLE;
-    VkImageView src_image_view = VK_NULL_HANDLE;
+    r = CreateVkImageView(m_device, &src_image->image_view, src_image->image, src_format);
+    if (r != VK_SUCCESS)
+        return r;
 
-    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    SetObjectName(VK_OBJECT_TYPE_IMAGE, (uint64_t)src_image->image, "BCVk source");
+    SetObjectName(VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)src_image->image_view, "BCVk source");
+    return r;
+}
 
-    // Create objects
-    if (m_isbc7) {
-        r = CreateVkPipeline(m_device, &pipeline_mode456_G10, m_shader_bc7_mode456, "TryMode456CS", m_pipeline_layout);
-        if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+void GPUCompressBCVk::DestroySourceImage(SourceImageBCVk* src_image) {
+    if (!src_image->external)
+        vkDestroyBuffer(m_device, src_image->staging_buf, 0);
+    m_memory_pool->Free(src_image->staging_mem);
+    vkFreeMemory(m_device, src_image->imported_mem, 0);
+    vkDestroyImageView(m_device, src_image->image_view, 0);
+    vkDestroyImage(m_device, src_image->image, 0);
+    m_memory_pool->Free(src_image->image_mem);
+    *src_image = {};
+}
+
+// Check if all alpha values of R8G8B8A8 pixels are 255.
+static bool IsOpaqueRGBA8(const void* pixels, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(pixels);
+    // Scan 4KB at a time. The inner loop has no branches so compilers can vectorize it.
+    const size_t CHUNK_SIZE = 4096;
+    for (size_t offset = 0; offset < size; offset += CHUNK_SIZE) {
+        const size_t end = std::min(size, offset + CHUNK_SIZE);
+        uint8_t alpha = 0xFF;
+        for (size_t i = offset + 3; i < end; i += 4)
+            alpha &= bytes[i];
+        if (alpha != 0xFF)
+            return false;
+    }
+    return true;
+}
 
-        r = CreateVkPipeline(m_device, &pipeline_mode137_LE10, m_shader_bc7_mode137, "TryMode137CS", m_pipeline_layout);
+// Check rows of a region. The padding between rows is skipped.
+static bool IsOpaqueRGBA8Rows(const void* pixels, size_t row_size, size_t row_pitch, uint32_t height) {
+    if (row_pitch == row_size)
+        return IsOpaqueRGBA8(pixels, row_size * height);
+    for (uint32_t y = 0; y < height; y++) {
+        if (!IsOpaqueRGBA8(static_cast<const uint8_t*>(pixels) + row_pitch * y, row_size))
+            return false;
+    }
+    return true;
+}
+
+// Select pipelines for the current options. They are created by CreatePipelines().
+//   `src_pixels` can be nullptr when the pixels are not on the host.
+void GPUCompressBCVk::SelectPipelines(const void* src_pixels, uint32_t row_pitch, PipelineSetBCVk* pipelines) {
+    *pipelines = {};
+    pipelines->isbc7 = m_isbc7;
+
+    // Concurrent mode passes need results of all passes. They can't skip blocks with the error threshold.
+    pipelines->bc7_concurrent = m_isbc7 && m_bc7_concurrent_mode_search && !(m_error_threshold > 0.0f);
+    pipelines->bc6_fused = !m_isbc7 && m_bc6_fused_mode_search;
+
+    // BC7 mode 7 is the only partitioned mode with alpha.
+    // Mode 3 usually stores endpoints of opaque blocks with more precision, but the endpoint search is heuristic,
+    // and mode 7 still wins for some blocks. So, skipping it for opaque textures is lossy. (See SetOpaqueFastPath().)
+    pipelines->bc7_mode_mask = m_profile.bc7_mode_mask;
+    if (m_isbc7 && m_opaque_fast_path && (pipelines->bc7_mode_mask & 0x7F) && src_pixels &&
+        IsOpaqueRGBA8Rows(src_pixels, GetSrcRowSize(), row_pitch, m_height))
+        pipelines->bc7_mode_mask &= 0x7F;
+
+    // Shortlist partitions before partitioned mode passes. (BC7 mode 0, 1, 2, 3, and 7, or BC6H mode 1-10)
+    pipelines->use_shortlist = m_profile.partition_shortlist_size > 0 &&
+        (m_isbc7 ? (pipelines->bc7_mode_mask & 0x8F) != 0 : m_profile.bc6h_num_two_region_modes > 0);
+
+    // Passes with 16 threads per block use the thread group layout in m_tuning.
+    pipelines->blocks_per_group = m_isbc7 ? m_tuning.bc7_blocks_per_group : m_tuning.bc6h_blocks_per_group;
+}
+
+static bool HasSameOptions(const PipelineSetBCVk& a, const PipelineSetBCVk& b) {
+    return a.isbc7 == b.isbc7 && a.bc7_mode_mask == b.bc7_mode_mask &&
+        a.bc7_concurrent == b.bc7_concurrent && a.bc6_fused == b.bc6_fused &&
+        a.use_shortlist == b.use_shortlist && a.blocks_per_group == b.blocks_per_group;
+}
+
+VkResult GPUCompressBCVk::CreatePipelines(PipelineSetBCVk* pipelines) {
+    VkResult r = VK_SUCCESS;
+    double pipelines_start_us = TraceNow(m_tracer);
+    VkShaderModule shader_bc7_mode456 = SelectTunedModule(
+        pipelines->blocks_per_group, m_shader_bc7_mode456_g16, m_shader_bc7_mode456_g32, m_shader_bc7_mode456);
+    VkShaderModule shader_bc7_enc = SelectTunedModule(
+        pipelines->blocks_per_group, m_shader_bc7_enc_g16, m_shader_bc7_enc_g32, m_shader_bc7_enc);
+    VkShaderModule shader_bc6_modeG10 = SelectTunedModule(
+        pipelines->blocks_per_group, m_shader_bc6_modeG10_g16, m_shader_bc6_modeG10_g32, m_shader_bc6_modeG10);
+    const uint32_t subgroup_size_bc7_mode456 = SelectTunedSubgroupSize(
+        pipelines->blocks_per_group, m_subgroup_size_g16, m_subgroup_size_g32, m_subgroup_size_g64);
+
+    if (pipelines->isbc7) {
+        r = CreateVkPipeline(m_device, &pipelines->classify, m_shader_bc7_classify, "ClassifySolidCS", m_pipeline_layout, m_pipeline_cache);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+            return r;
 
-        r = CreateVkPipeline(m_device, &pipeline_mode02, m_shader_bc7_mode02, "TryMode02CS", m_pipeline_layout);
+        r = CreateVkPipeline(m_device, &pipelines->compact, m_shader_bc7_compact, "CompactBlockListCS", m_pipeline_layout, m_pipeline_cache);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+            return r;
+
+        if (pipelines->bc7_concurrent) {
+            r = CreateVkPipeline(m_device, &pipelines->mode456_G10, m_shader_bc7_mode456_concurrent, "TryMode456ConcurrentCS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_g64);
+            if (r != VK_SUCCESS)
+                return r;
 
-        r = CreateVkPipeline(m_device, &pipeline_enc, m_shader_bc7_enc, "EncodeBlockCS", m_pipeline_layout);
+            r = CreateVkPipeline(m_device, &pipelines->mode137_LE10, m_shader_bc7_mode137_concurrent, "TryMode137ConcurrentCS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_g64);
+            if (r != VK_SUCCESS)
+                return r;
+
+            r = CreateVkPipeline(m_device, &pipelines->mode02, m_shader_bc7_mode02_concurrent, "TryMode02ConcurrentCS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_g64);
+            if (r != VK_SUCCESS)
+                return r;
+
+            r = CreateVkPipeline(m_device, &pipelines->select, m_shader_bc7_select, "SelectBestModeCS", m_pipeline_layout, m_pipeline_cache);
+            if (r != VK_SUCCESS)
+                return r;
+        } else {
+            r = CreateVkPipeline(m_device, &pipelines->mode456_G10, shader_bc7_mode456, "TryMode456CS", m_pipeline_layout, m_pipeline_cache,
+                                 subgroup_size_bc7_mode456);
+            if (r != VK_SUCCESS)
+                return r;
+
+            r = CreateVkPipeline(m_device, &pipelines->mode137_LE10, m_shader_bc7_mode137, "TryMode137CS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_g64);
+            if (r != VK_SUCCESS)
+                return r;
+
+            r = CreateVkPipeline(m_device, &pipelines->mode02, m_shader_bc7_mode02, "TryMode02CS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_g64);
+            if (r != VK_SUCCESS)
+                return r;
+        }
+
+        r = CreateVkPipeline(m_device, &pipelines->enc, shader_bc7_enc, "EncodeBlockCS", m_pipeline_layout, m_pipeline_cache);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+            return r;
     } else {
-        r = CreateVkPipeline(m_device, &pipeline_mode456_G10, m_shader_bc6_modeG10, "TryModeG10CS", m_pipeline_layout);
+        r = CreateVkPipeline(m_device, &pipelines->classify, m_shader_bc6_classify, "ClassifySolidCS", m_pipeline_layout, m_pipeline_cache);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+            return r;
 
-        r = CreateVkPipeline(m_device, &pipeline_mode137_LE10, m_shader_bc6_modeLE10, "TryModeLE10CS", m_pipeline_layout);
+        r = CreateVkPipeline(m_device, &pipelines->compact, m_shader_bc6_compact, "CompactBlockListCS", m_pipeline_layout, m_pipeline_cache);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+            return r;
 
-        r = CreateVkPipeline(m_device, &pipeline_enc, m_shader_bc6_enc, "EncodeBlockCS", m_pipeline_layout);
+        r = CreateVkPipeline(m_device, &pipelines->mode456_G10, shader_bc6_modeG10, "TryModeG10CS", m_pipeline_layout, m_pipeline_cache);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
-    }
+            return r;
 
-    r = CreateVkBufferAndMemory(m_device,
-                    &src_image_cpu,
-                    m_src_buf_size,
-                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    &src_image_cpu_memory,
-                    &m_memory_props,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    if (r != VK_SUCCESS)
-        goto COMPUTE_END;
+        if (pipelines->bc6_fused)
+            r = CreateVkPipeline(m_device, &pipelines->mode137_LE10, m_shader_bc6_modeLE10_fused, "TryModeLE10FusedCS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_bc6);
+        else
+            r = CreateVkPipeline(m_device, &pipelines->mode137_LE10, m_shader_bc6_modeLE10, "TryModeLE10CS", m_pipeline_layout, m_pipeline_cache,
+                                 m_subgroup_size_bc6);
+        if (r != VK_SUCCESS)
+            return r;
 
-    r = CreateVkImage(m_device, &src_image,
-                m_width, m_height, src_format,
-                &src_image_memory, &m_memory_props,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    if (r != VK_SUCCESS)
-        goto COMPUTE_END;
+        r = CreateVkPipeline(m_device, &pipelines->enc, m_shader_bc6_enc, "EncodeBlockCS", m_pipeline_layout, m_pipeline_cache);
+        if (r != VK_SUCCESS)
+            return r;
+    }
 
-    r = CreateVkImageView(m_device, &src_image_view, src_image, src_format);
-    if (r != VK_SUCCESS)
-        goto COMPUTE_END;
+    if (pipelines->use_shortlist) {
+        r = CreateVkPipeline(m_device, &pipelines->shortlist,
+                             pipelines->isbc7 ? m_shader_bc7_shortlist : m_shader_bc6_shortlist,
+                             "PartitionShortlistCS", m_pipeline_layout, m_pipeline_cache);
+        if (r != VK_SUCCESS)
+            return r;
+    }
+    TraceSpan(m_tracer, "CreatePipelines", pipelines_start_us);
 
-    r = AllocateVkCommandBuffer(m_device, &command_buffer, m_cmd_pool);
-    if (r != VK_SUCCESS)
-        goto COMPUTE_END;
+    if (m_set_object_name) {
+        const VkPipeline handles[] = {
+            pipelines->classify, pipelines->compact, pipelines->shortlist, pipelines->mode456_G10,
+            pipelines->mode137_LE10, pipelines->mode02, pipelines->select, pipelines->enc,
+        };
+        const COMPRESS_PASS passes[] = {
+            COMPRESS_PASS_CLASSIFY, COMPRESS_PASS_COMPACT, COMPRESS_PASS_SHORTLIST, COMPRESS_PASS_MODE456_G10,
+            COMPRESS_PASS_MODE137_LE10, COMPRESS_PASS_MODE02, COMPRESS_PASS_SELECT, COMPRESS_PASS_ENCODE,
+        };
+        char name[64];
+        for (size_t i = 0; i < sizeof(handles) / sizeof(handles[0]); i++) {
+            snprintf(name, sizeof(name), "%s %s", pipelines->isbc7 ? "BC7" : "BC6H", COMPRESS_PASS_NAMES[passes[i]]);
+            SetObjectName(VK_OBJECT_TYPE_PIPELINE, (uint64_t)handles[i], name);
+        }
+    }
 
-    // Copy src_pixels to GPU
-    r = CopyToVkImage(
-        command_buffer,
-        src_image_cpu, src_image_cpu_memory, src_image,
-        src_pixels, (uint32_t)m_src_buf_size);
+    return r;
+}
 
-    // Set bindings
-    SetImageViewAndConstBuf(src_image_view, m_const_buf);
-    // Note: llvmpipe requires all bindings to be non-null even when shaders do not use them.
-    //       So, we use m_err1_buf as a dummy ref here.
-    SetErrorAndOutputBuffer(m_err1_buf, m_err1_buf);
+static void DestroyPipelines(VkDevice device, PipelineSetBCVk* pipelines) {
+    vkDestroyPipeline(device, pipelines->classify, 0);
+    vkDestroyPipeline(device, pipelines->compact, 0);
+    vkDestroyPipeline(device, pipelines->mode456_G10, 0);
+    vkDestroyPipeline(device, pipelines->mode137_LE10, 0);
+    vkDestroyPipeline(device, pipelines->mode02, 0);
+    vkDestroyPipeline(device, pipelines->enc, 0);
+    vkDestroyPipeline(device, pipelines->select, 0);
+    vkDestroyPipeline(device, pipelines->shortlist, 0);
+    pipelines->classify = VK_NULL_HANDLE;
+    pipelines->compact = VK_NULL_HANDLE;
+    pipelines->mode456_G10 = VK_NULL_HANDLE;
+    pipelines->mode137_LE10 = VK_NULL_HANDLE;
+    pipelines->mode02 = VK_NULL_HANDLE;
+    pipelines->enc = VK_NULL_HANDLE;
+    pipelines->select = VK_NULL_HANDLE;
+    pipelines->shortlist = VK_NULL_HANDLE;
+}
+
+VkResult GPUCompressBCVk::CompressBatches(VkCommandBuffer command_buffer, VkQueue queue,
+                                          const PipelineSetBCVk* pipelines,
+                                          uint32_t xblocks, uint32_t first_block_id, uint32_t num_total_blocks,
+                                          SourceBandsBCVk* bands, PassProfilerBCVk* profiler) {
+    VkResult r = VK_SUCCESS;
+    const bool bc7_concurrent = pipelines->bc7_concurrent;
+    const uint32_t bc7_mode_mask = pipelines->bc7_mode_mask;
+    const bool use_shortlist = pipelines->use_shortlist;
+    const VkDeviceSize tuned_args_offset = GroupArgsOffset(pipelines->blocks_per_group);
+    uint32_t num_blocks = num_total_blocks - first_block_id;
+    uint32_t start_block_id = first_block_id;
 
     while (num_blocks > 0) {
         const uint32_t n = std::min<uint32_t>(num_blocks, MAX_BLOCK_BATCH);
-        const uint32_t uThreadGroupCount = n;
-        r = UpdateConstants((uint32_t)xblocks, 0, start_block_id, num_total_blocks);
+        if (profiler) {
+            profiler->batch_id = profiler->stats->num_batches;
+            profiler->stats->num_batches++;
+        }
+        r = UpdateConstants(xblocks, 0, start_block_id, num_total_blocks);
         if (r != VK_SUCCESS)
-            goto COMPUTE_END;
+            return r;
+
+        // Upload rows of the batch unless the previous batches did, and make them visible to the classify pass.
+        bool wait_for_upload = false;
+        VkSemaphore upload_semaphore = VK_NULL_HANDLE;
+        if (bands) {
+            const uint32_t batch_rows = std::min<uint32_t>(bands->height, ((start_block_id + n - 1) / xblocks + 1) * 4);
+            if (bands->uploaded_rows < batch_rows) {
+                r = UploadSourceBand(bands,
+                                     std::min<uint32_t>(bands->height - bands->uploaded_rows,
+                                                        std::max<uint32_t>(bands->band_height, batch_rows - bands->uploaded_rows)),
+                                     profiler);
+                if (r != VK_SUCCESS)
+                    return r;
+            }
+            wait_for_upload = bands->visible_rows < batch_rows;
+            if (wait_for_upload) {
+                bands->visible_rows = bands->uploaded_rows;
+                if (bands->semaphore_pending) {
+                    upload_semaphore = bands->semaphores[bands->semaphore_id];
+                    bands->semaphore_pending = false;
+                }
+            }
+        }
+
+        // Encode solid color blocks, and list the other blocks for the following passes.
+        // The following passes run only for the listed blocks with vkCmdDispatchIndirect().
+        uint32_t list_id = 0;
+        SetBlockListBuffers(list_id, 1);
+        SetOutputBuffer(m_out_buf);
+        r = RunClassifyShader(command_buffer, queue,
+                            pipelines->classify, m_pipeline_layout, PassDescriptorSet(),
+                            m_dispatch_args_buf[list_id],
+                            (n + CLASSIFY_BLOCKS_PER_GROUP - 1) / CLASSIFY_BLOCKS_PER_GROUP,
+                            wait_for_upload, upload_semaphore,
+                            ProfilePass(profiler, COMPRESS_PASS_CLASSIFY));
+        if (r != VK_SUCCESS)
+            return r;
+
+        // Copy the next band while the mode passes of this batch run.
+        //   Mode passes don't wait for transfers. The next classify pass which reads the band does.
+        //   Only one band is copied ahead, so that each semaphore is waited before it's signaled again.
+        if (bands && bands->uploaded_rows == bands->visible_rows && bands->uploaded_rows < bands->height) {
+            r = UploadSourceBand(bands, std::min<uint32_t>(bands->band_height, bands->height - bands->uploaded_rows), profiler);
+            if (r != VK_SUCCESS)
+                return r;
+        }
+
+        // Error buffers are swapped after each pass.
+        // err_in has the best result so far.
+        VkBuffer err_in = m_err1_buf;
+        VkBuffer err_out = m_err2_buf;
+
+        // Blocks with small errors skip the remaining passes when m_error_threshold is set.
+        const bool use_threshold = m_error_threshold > 0.0f;
+
+        // Keep the best partitions of each block for the partitioned mode passes.
+        // The shortlist is indexed with block ids, so it's still valid after CompactBlockList().
+        if (use_shortlist) {
+            r = RunComputeShaderIndirect(command_buffer, queue,
+                                pipelines->shortlist, m_pipeline_layout, PassDescriptorSet(),
+                                m_dispatch_args_buf[list_id],
+                                m_isbc7 ? offsetof(DispatchArgsBC6HBC7, group_1) : offsetof(DispatchArgsBC6HBC7, group_2),
+                                ProfilePass(profiler, COMPRESS_PASS_SHORTLIST));
+            if (r != VK_SUCCESS)
+                return r;
+        }
 
         if (m_isbc7) {
             // BC7
-            // Try mode456
-            SetOutputBuffer(m_err1_buf);
-            r = RunComputeShader(command_buffer, m_queue,
-                                pipeline_mode456_G10, m_pipeline_layout, m_desc_set,
-                                std::max<uint32_t>((uThreadGroupCount + 3) / 4, 1));
-            if (r != VK_SUCCESS)
-                goto COMPUTE_END;
+            if (bc7_concurrent) {
+                // Try all modes in a single submission. Each pass writes its result to m_slot_buf.
+                VkPipeline mode_pipelines[NUM_MODE_SLOTS];
+                PassConstantsBC7 passes[NUM_MODE_SLOTS];
+                VkDeviceSize offsets[NUM_MODE_SLOTS];
+
+                // Note: mode456 runs even when mode 4, 5, and 6 are disabled,
+                //       because SelectBestModeCS uses its result as an initial value.
+                mode_pipelines[0] = pipelines->mode456_G10;
+                passes[0] = { 0, 0 };
+                offsets[0] = offsetof(DispatchArgsBC6HBC7, group_4);
+                uint32_t pass_count = 1;
+
+                for (uint32_t i = 0; i < 5; ++i) {
+                    static const uint32_t modes[] = { 1, 3, 7, 0, 2 };
+                    if (!(bc7_mode_mask & (1 << modes[i])))
+                        continue;
+                    mode_pipelines[pass_count] = (i < 3) ? pipelines->mode137_LE10 : pipelines->mode02;
+                    passes[pass_count] = { modes[i], i + 1 };
+                    offsets[pass_count] = offsetof(DispatchArgsBC6HBC7, group_1);
+                    pass_count++;
+                }
+
+                SetOutputBuffer(m_slot_buf);
+                r = RunConcurrentShaders(command_buffer, queue,
+                                    mode_pipelines, passes, offsets, pass_count,
+                                    m_pipeline_layout, PassDescriptorSet(),
+                                    m_dispatch_args_buf[list_id], m_slot_buf,
+                                    ProfilePass(profiler, COMPRESS_PASS_CONCURRENT));
+                if (r != VK_SUCCESS)
+                    return r;
+
+                // Select the best mode
+                SetErrorAndOutputBuffer(m_slot_buf, err_in);
+                r = RunComputeShaderIndirect(command_buffer, queue,
+                                    pipelines->select, m_pipeline_layout, PassDescriptorSet(),
+                                    m_dispatch_args_buf[list_id], offsetof(DispatchArgsBC6HBC7, group_64),
+                                    ProfilePass(profiler, COMPRESS_PASS_SELECT));
+                if (r != VK_SUCCESS)
+                    return r;
+            } else {
+                // Try mode456
+                // Note: This pass runs even when mode 4, 5, and 6 are disabled,
+                //       because it initializes the error buffer for the other passes.
+                SetOutputBuffer(err_in);
+                r = RunComputeShaderIndirect(command_buffer, queue,
+                                    pipelines->mode456_G10, m_pipeline_layout, PassDescriptorSet(),
+                                    m_dispatch_args_buf[list_id], tuned_args_offset,
+                                    ProfilePass(profiler, COMPRESS_PASS_MODE456_G10));
+                if (r != VK_SUCCESS)
+                    return r;
 
-            if (m_bc7_mode137) {
                 // Try mode137
                 for (uint32_t i = 0; i < 3; ++i) {
                     static const uint32_t modes[] = { 1, 3, 7 };
-                    r = UpdateConstants((uint32_t)xblocks, modes[i], start_block_id, num_total_blocks);
+                    if (!(bc7_mode_mask & (1 << modes[i])))
+                        continue;
+                    r = UpdateConstants(xblocks, modes[i], start_block_id, num_total_blocks);
                     if (r != VK_SUCCESS)
-                        goto COMPUTE_END;
-                    SetErrorAndOutputBuffer(
-                        (i & 1) ? m_err2_buf : m_err1_buf,
-                        (i & 1) ? m_err1_buf : m_err2_buf);
-                    r = RunComputeShader(command_buffer, m_queue,
-                                    pipeline_mode137_LE10, m_pipeline_layout, m_desc_set,
-                                    uThreadGroupCount);
+                        return r;
+                    if (use_threshold) {
+                        r = CompactBlockList(command_buffer, queue, pipelines->compact, &list_id, err_in, err_out, profiler);
+                        if (r != VK_SUCCESS)
+                            return r;
+                    }
+                    SetErrorAndOutputBuffer(err_in, err_out);
+                    r = RunComputeShaderIndirect(command_buffer, queue,
+                                    pipelines->mode137_LE10, m_pipeline_layout, PassDescriptorSet(),
+                                    m_dispatch_args_buf[list_id], offsetof(DispatchArgsBC6HBC7, group_1),
+                                    ProfilePass(profiler, COMPRESS_PASS_MODE137_LE10));
                     if (r != VK_SUCCESS)
-                        goto COMPUTE_END;
+                        return r;
+                    std::swap(err_in, err_out);
                 }
-            }
 
-            if (m_bc7_mode02) {
                 // Try mode02
                 for (uint32_t i = 0; i < 2; ++i) {
                     static const uint32_t modes[] = { 0, 2 };
-                    r = UpdateConstants((uint32_t)xblocks, modes[i], start_block_id, num_total_blocks);
+                    if (!(bc7_mode_mask & (1 << modes[i])))
+                        continue;
+                    r = UpdateConstants(xblocks, modes[i], start_block_id, num_total_blocks);
                     if (r != VK_SUCCESS)
-                        goto COMPUTE_END;
-                    SetErrorAndOutputBuffer(
-                        (i & 1) ? m_err1_buf : m_err2_buf,
-                        (i & 1) ? m_err2_buf : m_err1_buf);
-                    r = RunComputeShader(command_buffer, m_queue,
-                                    pipeline_mode02, m_pipeline_layout, m_desc_set,
-                                    uThreadGroupCount);
+                        return r;
+                    if (use_threshold) {
+                        r = CompactBlockList(command_buffer, queue, pipelines->compact, &list_id, err_in, err_out, profiler);
+                        if (r != VK_SUCCESS)
+                            return r;
+                    }
+                    SetErrorAndOutputBuffer(err_in, err_out);
+                    r = RunComputeShaderIndirect(command_buffer, queue,
+                                    pipelines->mode02, m_pipeline_layout, PassDescriptorSet(),
+                                    m_dispatch_args_buf[list_id], offsetof(DispatchArgsBC6HBC7, group_1),
+                                    ProfilePass(profiler, COMPRESS_PASS_MODE02));
                     if (r != VK_SUCCESS)
-                        goto COMPUTE_END;
+                        return r;
+                    std::swap(err_in, err_out);
                 }
             }
 
-            // Encode
-            SetErrorAndOutputBuffer(m_err1_buf, m_out_buf);
-            r = RunComputeShader(command_buffer, m_queue,
-                                pipeline_enc, m_pipeline_layout, m_desc_set,
-                                std::max<uint32_t>((uThreadGroupCount + 3) / 4, 1));
+            // Encode all blocks listed by ClassifySolidCS
+            SetBlockListBuffers(0, 1);
+            SetErrorAndOutputBuffer(err_in, m_out_buf);
+            r = RunComputeShaderIndirect(command_buffer, queue,
+                                pipelines->enc, m_pipeline_layout, PassDescriptorSet(),
+                                m_dispatch_args_buf[0], tuned_args_offset,
+                                ProfilePass(profiler, COMPRESS_PASS_ENCODE));
             if (r != VK_SUCCESS)
-                goto COMPUTE_END;
+                return r;
         } else {
             // BC6H
             // Try modeG10
 
-            SetOutputBuffer(m_err1_buf);
-            r = RunComputeShader(command_buffer, m_queue,
-                                pipeline_mode456_G10, m_pipeline_layout, m_desc_set,
-                                std::max<uint32_t>((uThreadGroupCount + 3) / 4, 1));
+            SetOutputBuffer(err_in);
+            r = RunComputeShaderIndirect(command_buffer, queue,
+                                pipelines->mode456_G10, m_pipeline_layout, PassDescriptorSet(),
+                                m_dispatch_args_buf[list_id], tuned_args_offset,
+                                ProfilePass(profiler, COMPRESS_PASS_MODE456_G10));
             if (r != VK_SUCCESS)
-                goto COMPUTE_END;
+                return r;
 
             // Try modeLE10
-            for (uint32_t i = 0; i < 10; ++i) {
-                r = UpdateConstants((uint32_t)xblocks, i, start_block_id, num_total_blocks);
+            // The fused shader tries all two-region modes in a single pass.
+            const uint32_t num_le10_passes = m_bc6_fused_mode_search ?
+                std::min<uint32_t>(1, m_profile.bc6h_num_two_region_modes) : m_profile.bc6h_num_two_region_modes;
+            for (uint32_t i = 0; i < num_le10_passes; ++i) {
+                r = UpdateConstants(xblocks, i, start_block_id, num_total_blocks);
                 if (r != VK_SUCCESS)
-                    goto COMPUTE_END;
-                SetErrorAndOutputBuffer(
-                    (i & 1) ? m_err2_buf : m_err1_buf,
-                    (i & 1) ? m_err1_buf : m_err2_buf);
-                r = RunComputeShader(command_buffer, m_queue,
-                                pipeline_mode137_LE10, m_pipeline_layout, m_desc_set,
-                                std::max<uint32_t>((uThreadGroupCount + 1) / 2, 1));
+                    return r;
+                if (use_threshold) {
+                    r = CompactBlockList(command_buffer, queue, pipelines->compact, &list_id, err_in, err_out, profiler);
+                    if (r != VK_SUCCESS)
+                        return r;
+                }
+                SetErrorAndOutputBuffer(err_in, err_out);
+                r = RunComputeShaderIndirect(command_buffer, queue,
+                                pipelines->mode137_LE10, m_pipeline_layout, PassDescriptorSet(),
+                                m_dispatch_args_buf[list_id], offsetof(DispatchArgsBC6HBC7, group_2),
+                                ProfilePass(profiler, COMPRESS_PASS_MODE137_LE10));
                 if (r != VK_SUCCESS)
-                    goto COMPUTE_END;
+                    return r;
+                std::swap(err_in, err_out);
             }
 
-            // Encode
-            SetErrorAndOutputBuffer(m_err1_buf, m_out_buf);
-            r = RunComputeShader(command_buffer, m_queue,
-                                pipeline_enc, m_pipeline_layout, m_desc_set,
-                                std::max<uint32_t>((uThreadGroupCount + 1) / 2, 1));
+            // Encode all blocks listed by ClassifySolidCS
+            SetBlockListBuffers(0, 1);
+            SetErrorAndOutputBuffer(err_in, m_out_buf);
+            r = RunComputeShaderIndirect(command_buffer, queue,
+                                pipelines->enc, m_pipeline_layout, PassDescriptorSet(),
+                                m_dispatch_args_buf[0], offsetof(DispatchArgsBC6HBC7, group_2),
+                                ProfilePass(profiler, COMPRESS_PASS_ENCODE));
             if (r != VK_SUCCESS)
-                goto COMPUTE_END;
+                return r;
         }
 
         start_block_id += n;
         num_blocks -= n;
     }
+    return r;
+}
+
+VkResult GPUCompressBCVk::Compress(void* src_pixels, void* out_pixels) {
+    if (!src_pixels || !out_pixels)
+        return VK_ERROR_UNKNOWN;
+
+    return CompressTiles(src_pixels, GetSrcRowSize(), out_pixels, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, 0);
+}
+
+VkResult GPUCompressBCVk::CompressRegion(void* src_pixels, uint32_t row_pitch,
+                                         uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                                         void* out_pixels) {
+    if (!src_pixels || !out_pixels)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_out_buf_size == 0)
+        return VK_ERROR_UNKNOWN;  // Not prepared yet
+
+    // The region should have the size set by Prepare(), and rows should be aligned to pixels.
+    const uint32_t pixel_size = m_isbc7 ? 4 : 16;
+    if (width != m_width || height != m_height || row_pitch % pixel_size != 0 ||
+        (uint64_t)x + width > row_pitch / pixel_size)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    uint8_t* region_pixels = static_cast<uint8_t*>(src_pixels) + (size_t)row_pitch * y + (size_t)pixel_size * x;
+    return CompressTiles(region_pixels, row_pitch, out_pixels, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, 0);
+}
+
+VkResult GPUCompressBCVk::CompressTiles(void* src_pixels, uint32_t src_row_pitch, void* out_pixels,
+                                        VkBuffer src_buf, VkDeviceSize src_offset,
+                                        VkBuffer dst_buf, VkDeviceSize dst_offset) {
+    VkResult r = VK_SUCCESS;
+
+    TraceScopeBCVk trace_scope(m_tracer, "Compress");
+
+    const size_t xblocks = std::max<size_t>(1, (m_width + 3) >> 2);
+    const uint32_t src_row_size = GetSrcRowSize();
+
+    // The texture is compressed in tiles of m_tile_block_rows block rows.
+    //   Each tile works as a texture of the same width.
+    uint32_t tile_y = 0;
+    uint32_t num_total_blocks = 0;
+
+    // Pipelines
+    PipelineSetBCVk pipelines;
+    SelectPipelines(src_pixels, src_row_pitch, &pipelines);
+
+    // Source image of a tile
+    SourceImageBCVk src_image = {};
+    // Output of a tile imported from out_pixels
+    VkBuffer out_import_buf = VK_NULL_HANDLE;
+    VkDeviceMemory out_import_mem = VK_NULL_HANDLE;
+    VkDeviceSize out_import_offset = 0;
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+
+    // Bands of a tile uploaded during the passes
+    SourceBandsBCVk bands = {};
+    VkCommandBuffer upload_command_buffers[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+
+    // Copies of the caller's memory run on the transfer queue.
+    //   External buffers are owned by m_family_id. (See TransferExternalOwnership().)
+    //   Uploads on the transfer queue go through bands. So, they stay on m_queue without SetBandedUpload().
+    const bool transfer_upload = m_transfer_queue != VK_NULL_HANDLE && src_buf == VK_NULL_HANDLE && m_banded_upload;
+    const bool transfer_readback = m_transfer_queue != VK_NULL_HANDLE && dst_buf == VK_NULL_HANDLE;
+    ReadbackBCVk readback = {};
+
+    // Timestamps for profiling
+    auto compress_start = std::chrono::steady_clock::now();
+    PassProfilerBCVk profiler_data = {};
+    PassProfilerBCVk* profiler = nullptr;
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    m_stats = {};
+
+    // Create objects
+    r = CreatePipelines(&pipelines);
+    if (r != VK_SUCCESS)
+        goto COMPUTE_END;
+
+    r = AllocateVkCommandBuffer(m_device, &command_buffer, m_cmd_pool);
+    if (r != VK_SUCCESS)
+        goto COMPUTE_END;
+
+    SetObjectName(VK_OBJECT_TYPE_COMMAND_BUFFER, (uint64_t)command_buffer, "BCVk compress");
+
+    // Copies on the transfer queue alternate two command buffers. (See UploadSourceBand().)
+    for (uint32_t i = 0; i < (transfer_upload ? 2u : 1u); i++) {
+        r = AllocateVkCommandBuffer(m_device, &upload_command_buffers[i], transfer_upload ? m_transfer_cmd_pool : m_cmd_pool);
+        if (r != VK_SUCCESS)
+            goto COMPUTE_END;
+
+        SetObjectName(VK_OBJECT_TYPE_COMMAND_BUFFER, (uint64_t)upload_command_buffers[i], "BCVk upload");
+    }
+
+    if (transfer_readback) {
+        r = AllocateVkCommandBuffer(m_device, &readback.release_command_buffer, m_cmd_pool);
+        if (r != VK_SUCCESS)
+            goto COMPUTE_END;
+
+        SetObjectName(VK_OBJECT_TYPE_COMMAND_BUFFER, (uint64_t)readback.release_command_buffer, "BCVk release");
 
-    // Copy result from GPU
-    r = CopyFromOutBuffer(command_buffer, out_pixels);
+        r = AllocateVkCommandBuffer(m_device, &readback.command_buffer, m_transfer_cmd_pool);
+        if (r != VK_SUCCESS)
+            goto COMPUTE_END;
+
+        SetObjectName(VK_OBJECT_TYPE_COMMAND_BUFFER, (uint64_t)readback.command_buffer, "BCVk readback");
+    }
+
+    if (m_profiling || m_tracer || m_cmd_begin_label) {
+        if ((m_profiling || m_tracer) && m_timestamp_valid_bits > 0) {
+            VkQueryPoolCreateInfo qpci = {};
+            qpci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            qpci.pNext = 0;
+            qpci.flags = 0;
+            qpci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            qpci.queryCount = 2;
+            r = vkCreateQueryPool(m_device, &qpci, 0, &query_pool);
+            if (r != VK_SUCCESS)
+                goto COMPUTE_END;
+        }
+        profiler_data.device = m_device;
+        profiler_data.query_pool = query_pool;
+        profiler_data.ns_per_tick = m_gpu_props.limits.timestampPeriod;
+        profiler_data.timestamp_mask = (m_timestamp_valid_bits >= 64) ?
+            ~0ull : (1ull << m_timestamp_valid_bits) - 1;
+        profiler_data.stats = &m_stats;
+        profiler_data.tracer = m_tracer;
+        profiler_data.cmd_begin_label = m_cmd_begin_label;
+        profiler_data.cmd_end_label = m_cmd_end_label;
+        profiler_data.format_name = m_isbc7 ? "BC7" : "BC6H";
+        profiler = &profiler_data;
+        m_stats.has_gpu_times = query_pool != VK_NULL_HANDLE;
+        if (m_tracer)
+            CalibrateTrace(m_tracer, m_device, m_get_calibrated_timestamps);
+    }
+
+    SetShortlistBuffer(m_shortlist_buf);
+
+    while (tile_y < m_height) {
+        const uint32_t tile_height = std::min<uint32_t>(m_height - tile_y, m_tile_block_rows * 4);
+        const uint64_t tile_src_size = (uint64_t)src_row_size * tile_height;
+        uint8_t* tile_src_pixels = src_pixels ? static_cast<uint8_t*>(src_pixels) + (size_t)src_row_pitch * tile_y : nullptr;
+        r = CreateSourceImage(tile_height, tile_src_pixels, src_row_pitch,
+                              src_buf, src_offset + (VkDeviceSize)src_row_pitch * tile_y, &src_image);
+        if (IsOutOfMemory(r) && m_tile_block_rows > 1) {
+            // Degrade to smaller tiles under memory pressure.
+            DestroySourceImage(&src_image);
+            m_memory_pool->ReleaseUnusedBlocks();
+            m_tile_block_rows = (m_tile_block_rows + 1) / 2;
+            continue;
+        }
+        if (r != VK_SUCCESS)
+            goto COMPUTE_END;
+        if (profiler)
+            m_stats.num_tiles++;
+
+        num_total_blocks = static_cast<uint32_t>(xblocks * ((tile_height + 3) >> 2));
+
+        // Copy src_pixels to GPU
+        //   Tiles with a staging buffer are uploaded in bands of at least MAX_BLOCK_BATCH blocks
+        //   when there are multiple batches. CompressBatches() copies each band during the previous batch.
+        //   Copies on the transfer queue always go through bands, which are synchronized with semaphores.
+        src_image.banded = src_image.image != VK_NULL_HANDLE && src_image.staging_buf != VK_NULL_HANDLE &&
+                           m_banded_upload && (num_total_blocks > MAX_BLOCK_BATCH || transfer_upload);
+        if (src_image.banded) {
+            bands.command_buffers[0] = upload_command_buffers[0];
+            bands.command_buffers[1] = upload_command_buffers[1];
+            bands.command_buffer_id = 0;
+            bands.src_image = &src_image;
+            bands.pixels = src_image.staging_mem ? tile_src_pixels : nullptr;
+            bands.row_pitch = src_row_pitch;
+            bands.height = tile_height;
+            bands.band_height = static_cast<uint32_t>((MAX_BLOCK_BATCH + xblocks - 1) / xblocks) * 4;
+            bands.uploaded_rows = 0;
+            bands.visible_rows = 0;
+            bands.queue = transfer_upload ? m_transfer_queue : m_queue;
+            bands.on_transfer_queue = transfer_upload;
+            bands.semaphores = m_transfer_semaphores;
+            bands.semaphore_id = 0;
+            bands.semaphore_pending = false;
+            bands.fences = m_transfer_fences;
+            bands.fence_pending[0] = false;
+            bands.fence_pending[1] = false;
+        } else {
+            r = CopyToVkImage(
+                command_buffer,
+                &src_image, tile_height,
+                tile_src_pixels, src_row_pitch,
+                ProfilePass(profiler, COMPRESS_PASS_UPLOAD));
+            if (r != VK_SUCCESS)
+                goto COMPUTE_END;
+        }
+        if (profiler) {
+            m_stats.upload_bytes += tile_src_size;
+            if (src_image.imported_mem != VK_NULL_HANDLE || src_image.external)
+                m_stats.imported_bytes += tile_src_size;
+        }
+
+        // Set bindings
+        SetSourceAndConstBuf(&src_image, m_const_buf);
+        m_input_offset = m_buffer_input ? static_cast<uint32_t>(src_image.staging_offset / (m_isbc7 ? 4 : 16)) : 0;
+        m_input_row_pitch = src_image.row_length ? src_image.row_length : m_width;
+        m_input_height = tile_height;
+        // Note: llvmpipe requires all bindings to be non-null even when shaders do not use them.
+        //       So, we use m_err1_buf as a dummy ref here.
+        SetErrorAndOutputBuffer(m_err1_buf, m_err1_buf);
+
+        // Results are copied to out_pixels directly if it can be imported.
+        const uint32_t tile_block_rows = (tile_height + 3) >> 2;
+        const VkDeviceSize tile_out_offset = xblocks * (tile_y / 4) * sizeof(BufferBC6HBC7);
+        uint8_t* tile_out_pixels = out_pixels ? static_cast<uint8_t*>(out_pixels) + tile_out_offset : nullptr;
+        if (dst_buf == VK_NULL_HANDLE && !m_out_mapped)
+            ImportHostBuffer(tile_out_pixels, num_total_blocks * sizeof(BufferBC6HBC7), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             &out_import_buf, &out_import_mem, &out_import_offset);
+
+        // Encode the tile in ranges of block rows, and copy results of each range from GPU.
+        //   The whole tile is a single range unless results are streamed to m_result_callback.
+        const bool stream_results = m_result_callback && dst_buf == VK_NULL_HANDLE;
+        const uint32_t range_block_rows = stream_results ?
+            std::min<uint32_t>(m_result_block_rows, tile_block_rows) : tile_block_rows;
+        for (uint32_t block_row = 0; block_row < tile_block_rows; block_row += range_block_rows) {
+            const uint32_t num_block_rows = std::min<uint32_t>(range_block_rows, tile_block_rows - block_row);
+            const uint32_t first_block_id = static_cast<uint32_t>(xblocks * block_row);
+            const uint32_t end_block_id = static_cast<uint32_t>(xblocks * (block_row + num_block_rows));
+
+            // The readback of the previous range or tile should be complete before passes overwrite m_out_buf.
+            r = FinishReadback(&readback, ProfilePass(profiler, COMPRESS_PASS_READBACK));
+            if (r != VK_SUCCESS)
+                goto COMPUTE_END;
+
+            r = CompressBatches(command_buffer, m_queue, &pipelines, (uint32_t)xblocks, first_block_id, end_block_id,
+                                src_image.banded ? &bands : nullptr, profiler);
+            if (r != VK_SUCCESS)
+                goto COMPUTE_END;
+
+            const uint32_t range_out_size = (end_block_id - first_block_id) * sizeof(BufferBC6HBC7);
+            const VkDeviceSize range_out_offset = (VkDeviceSize)first_block_id * sizeof(BufferBC6HBC7);
+            uint8_t* range_out_pixels = tile_out_pixels ? tile_out_pixels + range_out_offset : nullptr;
+            if (dst_buf != VK_NULL_HANDLE)
+                r = CopyFromOutBuffer(command_buffer, nullptr, range_out_size, range_out_offset,
+                                      dst_buf, dst_offset + tile_out_offset + range_out_offset,
+                                      VK_NULL_HANDLE, ProfilePass(profiler, COMPRESS_PASS_READBACK));
+            else
+                r = CopyFromOutBuffer(command_buffer, range_out_pixels, range_out_size, range_out_offset,
+                                      out_import_buf, out_import_offset + range_out_offset,
+                                      transfer_readback ? &readback : nullptr,
+                                      ProfilePass(profiler, COMPRESS_PASS_READBACK));
+            if (r != VK_SUCCESS)
+                goto COMPUTE_END;
+            if (profiler) {
+                m_stats.readback_bytes += range_out_size;
+                if (out_import_buf != VK_NULL_HANDLE || dst_buf != VK_NULL_HANDLE)
+                    m_stats.imported_bytes += range_out_size;
+            }
+
+            if (stream_results) {
+                r = FinishReadback(&readback, ProfilePass(profiler, COMPRESS_PASS_READBACK));
+                if (r != VK_SUCCESS)
+                    goto COMPUTE_END;
+                m_result_callback(m_result_user_data, range_out_pixels, tile_y / 4 + block_row, num_block_rows, range_out_size);
+            }
+        }
+
+        // Classify passes waited for all bands. This only resets the fences.
+        if (src_image.banded) {
+            r = WaitSourceBands(m_device, &bands);
+            if (r != VK_SUCCESS)
+                goto COMPUTE_END;
+        }
+
+        // Imported memory is released after the pending readback. Otherwise, it's released here.
+        if (readback.pending) {
+            readback.import_buf = out_import_buf;
+            readback.import_mem = out_import_mem;
+        } else {
+            vkDestroyBuffer(m_device, out_import_buf, 0);
+            vkFreeMemory(m_device, out_import_mem, 0);
+        }
+        out_import_buf = VK_NULL_HANDLE;
+        out_import_mem = VK_NULL_HANDLE;
+        DestroySourceImage(&src_image);
+        tile_y += tile_height;
+    }
+
+    // Results of the last tile
+    if (r == VK_SUCCESS)
+        r = FinishReadback(&readback, ProfilePass(profiler, COMPRESS_PASS_READBACK));
 
     COMPUTE_END:
-    vkDestroyBuffer(m_device, src_image_cpu, 0);
-    vkFreeMemory(m_device, src_image_cpu_memory, 0);
-    vkDestroyImageView(m_device, src_image_view, 0);
-    vkDestroyImage(m_device, src_image, 0);
-    vkFreeMemory(m_device, src_image_memory, 0);
-    vkDestroyPipeline(m_device, pipeline_mode456_G10, 0);
-    vkDestroyPipeline(m_device, pipeline_mode137_LE10, 0);
-    vkDestroyPipeline(m_device, pipeline_mode02, 0);
-    vkDestroyPipeline(m_device, pipeline_enc, 0);
+    // Results are discarded when a pass failed.
+    if (r != VK_SUCCESS && readback.pending) {
+        readback.buf = nullptr;
+        FinishReadback(&readback, nullptr);
+    }
+    // A band can be still in flight when a pass failed.
+    if (r != VK_SUCCESS && src_image.banded) {
+        vkQueueWaitIdle(m_queue);
+        if (bands.on_transfer_queue) {
+            WaitSourceBands(m_device, &bands);
+            if (bands.semaphore_pending)
+                UnsignalSemaphore(bands.queue, bands.semaphores[bands.semaphore_id]);
+        }
+    }
+    DestroySourceImage(&src_image);
+    vkDestroyBuffer(m_device, out_import_buf, 0);
+    vkFreeMemory(m_device, out_import_mem, 0);
+    DestroyPipelines(m_device, &pipelines);
+    vkFreeCommandBuffers(m_device, m_cmd_pool, 1, &command_buffer);
+    for (uint32_t i = 0; i < 2; i++)
+        vkFreeCommandBuffers(m_device, transfer_upload ? m_transfer_cmd_pool : m_cmd_pool, 1, &upload_command_buffers[i]);
+    vkFreeCommandBuffers(m_device, m_cmd_pool, 1, &readback.release_command_buffer);
+    vkFreeCommandBuffers(m_device, m_transfer_cmd_pool, 1, &readback.command_buffer);
+    vkDestroyQueryPool(m_device, query_pool, 0);
+
+    if (profiler)
+        m_stats.total_ms = ElapsedMilliseconds(compress_start);
+
+    return r;
+}
+
+// Record a copy of results of a tile. The caller synchronizes `dst_buf` with the following commands.
+static void RecordOutputCopy(VkCommandBuffer command_buffer, VkBuffer out_buf,
+                             VkBuffer dst_buf, VkDeviceSize dst_offset, uint32_t size,
+                             PassProfilerBCVk* profiler) {
+    BeginPass(command_buffer, profiler);
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = out_buf;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, nullptr,
+        1, &barrier,
+        0, nullptr
+    );
+
+    VkBufferCopy region = { 0, dst_offset, size };
+    vkCmdCopyBuffer(command_buffer, out_buf, dst_buf, 1, &region);
+    EndPass(command_buffer, profiler, 1);
+}
+
+VkResult GPUCompressBCVk::RecordCompress(VkCommandBuffer command_buffer, VkImageView src,
+                                         VkBuffer dst, VkDeviceSize offset,
+                                         TransientAllocatorBCVk* allocator) {
+    if (command_buffer == VK_NULL_HANDLE || src == VK_NULL_HANDLE || dst == VK_NULL_HANDLE || !allocator)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_out_buf_size == 0)
+        return VK_ERROR_UNKNOWN;  // Not prepared yet
+
+    TraceScopeBCVk trace_scope(m_tracer, "RecordCompress");
+
+    VkResult r = VK_SUCCESS;
+    const uint32_t xblocks = std::max<uint32_t>(1, (m_width + 3) >> 2);
+    const VkDescriptorSet desc_set = m_desc_set;
+    uint32_t tile_y = 0;
+
+    // Shaders read tiles from the caller's image with g_input_row.
+    SourceImageBCVk src_image = {};
+    src_image.image_view = src;
+
+    // Pipelines are reused while the options are the same.
+    PipelineSetBCVk* pipelines = nullptr;
+    PipelineSetBCVk new_pipelines;
+    SelectPipelines(nullptr, 0, &new_pipelines);
+
+    // Debug labels for GPU captures of the caller. (Stats are not measured.)
+    PassProfilerBCVk profiler_data = {};
+    PassProfilerBCVk* profiler = nullptr;
+    CompressStatsBC6HBC7 label_stats = {};
+
+    for (PipelineSetBCVk& p : allocator->pipelines) {
+        if (HasSameOptions(p, new_pipelines))
+            pipelines = &p;
+    }
+    if (!pipelines) {
+        r = CreatePipelines(&new_pipelines);
+        if (r != VK_SUCCESS) {
+            DestroyPipelines(m_device, &new_pipelines);
+            return r;
+        }
+        allocator->pipelines.push_back(new_pipelines);
+        pipelines = &allocator->pipelines.back();
+    }
+
+    if (m_cmd_begin_label) {
+        profiler_data.stats = &label_stats;
+        profiler_data.cmd_begin_label = m_cmd_begin_label;
+        profiler_data.cmd_end_label = m_cmd_end_label;
+        profiler_data.format_name = m_isbc7 ? "BC7" : "BC6H";
+        profiler = &profiler_data;
+    }
+
+    // Descriptor updates go to sets of the allocator.
+    r = AllocateDescriptorSet(m_device, allocator->desc_pool, m_desc_set_layout, &m_desc_set);
+    if (r != VK_SUCCESS) {
+        m_desc_set = desc_set;
+        return r;
+    }
+    m_recording = allocator;
+    m_desc_set_bound = false;
+
+    SetShortlistBuffer(m_shortlist_buf);
+
+    while (tile_y < m_height) {
+        const uint32_t tile_height = std::min<uint32_t>(m_height - tile_y, m_tile_block_rows * 4);
+        const uint32_t num_total_blocks = xblocks * ((tile_height + 3) >> 2);
+        const VkDeviceSize tile_out_offset = (VkDeviceSize)xblocks * (tile_y / 4) * sizeof(BufferBC6HBC7);
+
+        SetSourceAndConstBuf(&src_image, allocator->const_buf);
+        m_input_row = tile_y;
+        m_input_height = tile_height;
+        // Note: llvmpipe requires all bindings to be non-null even when shaders do not use them.
+        SetErrorAndOutputBuffer(m_err1_buf, m_err1_buf);
+
+        r = CompressBatches(command_buffer, VK_NULL_HANDLE, pipelines, xblocks, 0, num_total_blocks, nullptr, profiler);
+        if (r != VK_SUCCESS)
+            break;
+
+        RecordOutputCopy(command_buffer, m_out_buf, dst, offset + tile_out_offset,
+                         num_total_blocks * sizeof(BufferBC6HBC7),
+                         ProfilePass(profiler, COMPRESS_PASS_READBACK));
+        tile_y += tile_height;
+    }
+    if (r == VK_SUCCESS)
+        r = allocator->result;
+
+    m_recording = nullptr;
+    m_desc_set = desc_set;
+    m_input_row = 0;
+    return r;
+}
+
+VkResult GPUCompressBCVk::CreateTransientAllocator(uint32_t max_batches, TransientAllocatorBCVk** allocator) {
+    if (max_batches == 0 || max_batches > UINT32_MAX / (RECORD_SETS_PER_BATCH * 7) || !allocator)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_device == VK_NULL_HANDLE)
+        return VK_ERROR_UNKNOWN;  // Not initialized yet
+
+    // Buffer input builds don't read images. It's the only way to RecordCompress(), so it rejects them here.
+    if (m_buffer_input)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    TransientAllocatorBCVk* new_allocator = new TransientAllocatorBCVk();
+    new_allocator->desc_pool = VK_NULL_HANDLE;
+    new_allocator->const_buf = VK_NULL_HANDLE;
+    new_allocator->const_mem = nullptr;
+    new_allocator->const_stride = AlignUp(sizeof(ConstantsBC6HBC7),
+                                          std::max<VkDeviceSize>(1, m_gpu_props.limits.minUniformBufferOffsetAlignment));
+    new_allocator->max_constants = max_batches * RECORD_CONSTANTS_PER_BATCH;
+    new_allocator->used_constants = 0;
+    new_allocator->result = VK_SUCCESS;
+
+    // Each set has an image, constants, and 7 storage buffers.
+    const uint32_t max_sets = max_batches * RECORD_SETS_PER_BATCH;
+    VkDescriptorPoolSize pool_sizes[] = {
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, max_sets },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, max_sets },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_sets * 7 }
+    };
+    VkDescriptorPoolCreateInfo dpci = {};
+    dpci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    dpci.pNext = 0;
+    dpci.flags = 0;
+    dpci.maxSets = max_sets;
+    dpci.poolSizeCount = 3;
+    dpci.pPoolSizes = pool_sizes;
+    VkResult r = vkCreateDescriptorPool(m_device, &dpci, 0, &new_allocator->desc_pool);
+    if (r == VK_SUCCESS) {
+        r = CreateVkBufferAndMemory(m_device,
+                        &new_allocator->const_buf,
+                        new_allocator->const_stride * new_allocator->max_constants,
+                        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                        &new_allocator->const_mem,
+                        m_memory_pool,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    if (r != VK_SUCCESS) {
+        DestroyTransientAllocator(new_allocator);
+        return r;
+    }
+    SetObjectName(VK_OBJECT_TYPE_DESCRIPTOR_POOL, (uint64_t)new_allocator->desc_pool, "BCVk transient descriptor pool");
+    SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)new_allocator->const_buf, "BCVk transient constants");
+
+    *allocator = new_allocator;
+    return r;
+}
+
+void GPUCompressBCVk::ResetTransientAllocator(TransientAllocatorBCVk* allocator) {
+    if (!allocator)
+        return;
+    vkResetDescriptorPool(m_device, allocator->desc_pool, 0);
+    allocator->used_constants = 0;
+    allocator->result = VK_SUCCESS;
+}
+
+void GPUCompressBCVk::DestroyTransientAllocator(TransientAllocatorBCVk* allocator) {
+    if (!allocator)
+        return;
+    for (PipelineSetBCVk& pipelines : allocator->pipelines)
+        DestroyPipelines(m_device, &pipelines);
+    vkDestroyDescriptorPool(m_device, allocator->desc_pool, 0);
+    vkDestroyBuffer(m_device, allocator->const_buf, 0);
+    m_memory_pool->Free(allocator->const_mem);
+    delete allocator;
+}
+
+uint32_t GPUCompressBCVk::GetRecordBatchCount() {
+    if (m_out_buf_size == 0)
+        return 0;  // Not prepared yet
+
+    const uint32_t xblocks = std::max<uint32_t>(1, (m_width + 3) >> 2);
+    const uint32_t tile_height = m_tile_block_rows * 4;
+    uint32_t count = 0;
+    for (uint32_t tile_y = 0; tile_y < m_height; tile_y += tile_height) {
+        const uint32_t num_blocks = xblocks * ((std::min<uint32_t>(m_height - tile_y, tile_height) + 3) >> 2);
+        count += (num_blocks + MAX_BLOCK_BATCH - 1) / MAX_BLOCK_BATCH;
+    }
+    return count;
+}
+
+VkResult GPUCompressBCVk::TransferExternalOwnership(VkBuffer src_buf, VkBuffer dst_buf, bool acquire,
+                                                    VkSemaphore wait_semaphore, VkSemaphore signal_semaphore) {
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkResult r = AllocateVkCommandBuffer(m_device, &command_buffer, m_cmd_pool);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkCommandBufferBeginInfo cbi = {};
+    cbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    r = vkBeginCommandBuffer(command_buffer, &cbi);
+    if (r == VK_SUCCESS) {
+        // The source buffer is read by transfers or shaders. The output buffer is written by transfers.
+        VkBufferMemoryBarrier barriers[2] = {};
+        const VkBuffer buffers[2] = { src_buf, dst_buf };
+        for (uint32_t i = 0; i < 2; i++) {
+            barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barriers[i].srcQueueFamilyIndex = acquire ? VK_QUEUE_FAMILY_EXTERNAL : m_family_id;
+            barriers[i].dstQueueFamilyIndex = acquire ? m_family_id : VK_QUEUE_FAMILY_EXTERNAL;
+            barriers[i].buffer = buffers[i];
+            barriers[i].offset = 0;
+            barriers[i].size = VK_WHOLE_SIZE;
+        }
+        if (acquire) {
+            barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        } else {
+            barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        }
+        vkCmdPipelineBarrier(
+            command_buffer,
+            acquire ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+            acquire ? VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0, nullptr,
+            2, barriers,
+            0, nullptr
+        );
+        r = vkEndCommandBuffer(command_buffer);
+    }
+
+    if (r == VK_SUCCESS) {
+        const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo si = {};
+        si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        si.waitSemaphoreCount = wait_semaphore ? 1 : 0;
+        si.pWaitSemaphores = &wait_semaphore;
+        si.pWaitDstStageMask = &wait_stage;
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &command_buffer;
+        si.signalSemaphoreCount = signal_semaphore ? 1 : 0;
+        si.pSignalSemaphores = &signal_semaphore;
+        r = vkQueueSubmit(m_queue, 1, &si, VK_NULL_HANDLE);
+    }
+    if (r == VK_SUCCESS)
+        r = vkQueueWaitIdle(m_queue);
+
     vkFreeCommandBuffers(m_device, m_cmd_pool, 1, &command_buffer);
+    return r;
+}
+
+VkResult GPUCompressBCVk::CompressExternal(const ExternalMemoryBCVk& src, const ExternalMemoryBCVk& dst,
+                                           int wait_semaphore_fd, int signal_semaphore_fd) {
+    VkResult r = VK_SUCCESS;
+
+    if (src.fd < 0 || dst.fd < 0 || src.offset % 16 != 0 ||
+        src.offset > src.size || m_src_buf_size > src.size - src.offset ||
+        dst.offset > dst.size || m_out_buf_size > dst.size - dst.offset)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_out_buf_size == 0)
+        return VK_ERROR_UNKNOWN;  // Not prepared yet
+
+    if (!m_get_memory_fd_props)
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+    if ((wait_semaphore_fd >= 0 || signal_semaphore_fd >= 0) && !m_import_semaphore_fd)
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+
+    TraceScopeBCVk trace_scope(m_tracer, "CompressExternal");
+
+    VkBuffer src_buf = VK_NULL_HANDLE;
+    VkDeviceMemory src_mem = VK_NULL_HANDLE;
+    VkBuffer dst_buf = VK_NULL_HANDLE;
+    VkDeviceMemory dst_mem = VK_NULL_HANDLE;
+    VkSemaphore wait_semaphore = VK_NULL_HANDLE;
+    VkSemaphore signal_semaphore = VK_NULL_HANDLE;
+    bool acquired = false;
+    VkResult release_r = VK_SUCCESS;
+
+    // Imports consume duplicates. The caller's fds are closed only when it succeeds.
+    int src_fd = DuplicateFd(src.fd);
+    int dst_fd = DuplicateFd(dst.fd);
+    int wait_fd = DuplicateFd(wait_semaphore_fd);
+    int signal_fd = DuplicateFd(signal_semaphore_fd);
+    if (src_fd < 0 || dst_fd < 0 || (wait_semaphore_fd >= 0 && wait_fd < 0) ||
+        (signal_semaphore_fd >= 0 && signal_fd < 0)) {
+        r = VK_ERROR_TOO_MANY_OBJECTS;
+        goto EXTERNAL_END;
+    }
+
+    r = ImportExternalBuffer(src, &src_fd, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             &src_buf, &src_mem);
+    if (r != VK_SUCCESS)
+        goto EXTERNAL_END;
+    r = ImportExternalBuffer(dst, &dst_fd, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &dst_buf, &dst_mem);
+    if (r != VK_SUCCESS)
+        goto EXTERNAL_END;
+    SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)src_buf, "BCVk external source");
+    SetObjectName(VK_OBJECT_TYPE_BUFFER, (uint64_t)dst_buf, "BCVk external output");
+
+    if (wait_fd >= 0) {
+        r = ImportVkSemaphore(m_device, m_import_semaphore_fd, &wait_fd, &wait_semaphore);
+        if (r != VK_SUCCESS)
+            goto EXTERNAL_END;
+    }
+    if (signal_fd >= 0) {
+        r = ImportVkSemaphore(m_device, m_import_semaphore_fd, &signal_fd, &signal_semaphore);
+        if (r != VK_SUCCESS)
+            goto EXTERNAL_END;
+    }
+
+    // Wait for the producer, and acquire the buffers.
+    r = TransferExternalOwnership(src_buf, dst_buf, true, wait_semaphore, VK_NULL_HANDLE);
+    if (r != VK_SUCCESS)
+        goto EXTERNAL_END;
+    acquired = true;
+
+    r = CompressTiles(nullptr, GetSrcRowSize(), nullptr, src_buf, src.offset, dst_buf, dst.offset);
+
+    // Release the buffers, and notify the consumer. (even when compression failed)
+    release_r = TransferExternalOwnership(src_buf, dst_buf, false, VK_NULL_HANDLE, signal_semaphore);
+    if (r == VK_SUCCESS)
+        r = release_r;
+
+    EXTERNAL_END:
+    // Notify the consumer when it failed before the buffers were acquired.
+    if (!acquired && signal_semaphore != VK_NULL_HANDLE) {
+        const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo si = {};
+        si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        si.waitSemaphoreCount = wait_semaphore ? 1 : 0;
+        si.pWaitSemaphores = &wait_semaphore;
+        si.pWaitDstStageMask = &wait_stage;
+        si.signalSemaphoreCount = 1;
+        si.pSignalSemaphores = &signal_semaphore;
+        if (vkQueueSubmit(m_queue, 1, &si, VK_NULL_HANDLE) == VK_SUCCESS)
+            vkQueueWaitIdle(m_queue);
+    }
+    vkDestroySemaphore(m_device, wait_semaphore, 0);
+    vkDestroySemaphore(m_device, signal_semaphore, 0);
+    vkDestroyBuffer(m_device, src_buf, 0);
+    vkFreeMemory(m_device, src_mem, 0);
+    vkDestroyBuffer(m_device, dst_buf, 0);
+    vkFreeMemory(m_device, dst_mem, 0);
+
+    // Duplicates which were not imported
+    CloseFd(src_fd);
+    CloseFd(dst_fd);
+    CloseFd(wait_fd);
+    CloseFd(signal_fd);
+    if (r == VK_SUCCESS) {
+        CloseFd(src.fd);
+        CloseFd(dst.fd);
+        CloseFd(wait_semaphore_fd);
+        CloseFd(signal_semaphore_fd);
+    }
+    return r;
+}
+
+VkResult GPUCompressBCVk::AutotuneWorkgroupSize(void* src_pixels, uint32_t repeat) {
+    if (!src_pixels || repeat == 0)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_out_buf_size == 0)
+        return VK_ERROR_UNKNOWN;  // Not prepared yet
+
+    if (m_out_buf_size > SIZE_MAX)
+        return VK_ERROR_OUT_OF_HOST_MEMORY;  // 32-bit platforms
+    void* out_pixels = malloc(static_cast<size_t>(m_out_buf_size));
+    if (!out_pixels)
+        return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+    VkResult r = VK_SUCCESS;
+    uint32_t* blocks_per_group = m_isbc7 ? &m_tuning.bc7_blocks_per_group : &m_tuning.bc6h_blocks_per_group;
+    uint32_t best_blocks_per_group = *blocks_per_group;
+    double best_time = -1.0;
+    std::vector<double> times;
+
+    // Measure GPU time of the passes with timestamps when the queue supports them.
+    //   Host time also includes pipeline creation and submissions, which don't depend on the layout.
+    const bool profiling = m_profiling;
+    const CompressStatsBC6HBC7 stats = m_stats;
+    const bool use_timestamps = m_timestamp_valid_bits > 0;
+    m_profiling = use_timestamps;
+
+    for (uint32_t candidate = 1; candidate <= 4; candidate *= 2) {
+        *blocks_per_group = candidate;
+
+        // The first run creates the pipelines and adds them to the cache. It's not measured.
+        r = Compress(src_pixels, out_pixels);
+        if (r != VK_SUCCESS)
+            break;
+
+        times.clear();
+        for (uint32_t i = 0; i < repeat; i++) {
+            auto start = std::chrono::steady_clock::now();
+            r = Compress(src_pixels, out_pixels);
+            if (r != VK_SUCCESS)
+                break;
+            double elapsed = ElapsedMilliseconds(start);
+            if (use_timestamps && m_stats.has_gpu_times) {
+                elapsed = 0.0;
+                for (uint32_t pass = 0; pass < COMPRESS_PASS_COUNT; pass++)
+                    elapsed += m_stats.passes[pass].gpu_ms;
+            }
+            times.push_back(elapsed);
+        }
+        if (r != VK_SUCCESS)
+            break;
+
+        // Compare medians, so that a single fast or slow run doesn't decide the layout.
+        std::sort(times.begin(), times.end());
+        const size_t mid = times.size() / 2;
+        const double median = (times.size() % 2) ? times[mid] : (times[mid - 1] + times[mid]) * 0.5;
+        if (best_time < 0.0 || median < best_time) {
+            best_time = median;
+            best_blocks_per_group = candidate;
+        }
+    }
+
+    m_profiling = profiling;
+    m_stats = stats;
+    *blocks_per_group = best_blocks_per_group;
+    free(out_pixels);
+    return r;
+}
+
+MemoryPoolStatsBCVk GPUCompressBCVk::GetMemoryPoolStats() {
+    if (!m_memory_pool)
+        return {};
+    return m_memory_pool->GetStats();
+}
+
+void GPUCompressBCVk::ReleaseUnusedMemory() {
+    if (m_memory_pool)
+        m_memory_pool->ReleaseUnusedBlocks();
+}
+
+VkResult GPUCompressBCVk::SetErrorWindow(uint32_t num_blocks) {
+    if (num_blocks == 0 || num_blocks % MAX_BLOCK_BATCH != 0)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    m_error_window = num_blocks;
+    return VK_SUCCESS;
+}
+
+// Compress() waits for its copies with fences before it returns, so nothing uses these objects here.
+//   (The queue can be shared with the caller, so it doesn't wait for the queue to be idle.)
+void GPUCompressBCVk::ReleaseTransferQueue() {
+    vkDestroyCommandPool(m_device, m_transfer_cmd_pool, nullptr);
+    for (uint32_t i = 0; i < 3; i++) {
+        vkDestroySemaphore(m_device, m_transfer_semaphores[i], 0);
+        m_transfer_semaphores[i] = VK_NULL_HANDLE;
+    }
+    for (uint32_t i = 0; i < 3; i++) {
+        vkDestroyFence(m_device, m_transfer_fences[i], 0);
+        m_transfer_fences[i] = VK_NULL_HANDLE;
+    }
+    m_transfer_queue = VK_NULL_HANDLE;
+    m_transfer_cmd_pool = VK_NULL_HANDLE;
+    m_transfer_family_id = VK_QUEUE_FAMILY_IGNORED;
+}
 
+VkResult GPUCompressBCVk::SetTransferQueue(VkQueue queue, uint32_t family_id) {
+    if (m_device == VK_NULL_HANDLE)
+        return VK_ERROR_UNKNOWN;  // Not initialized yet
+
+    ReleaseTransferQueue();
+    if (queue == VK_NULL_HANDLE || family_id == VK_QUEUE_FAMILY_IGNORED)
+        return VK_SUCCESS;
+
+    VkQueueFamilyProperties families[16];
+    uint32_t family_count = 16;
+    vkGetPhysicalDeviceQueueFamilyProperties(m_physical_device, &family_count, families);
+    if (family_id >= family_count || !(families[family_id].queueFlags &
+            (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+        return VK_ERROR_INITIALIZATION_FAILED;  // Not a family of the device
+
+    // Bands of source images start at any row. Copies stay on m_queue when the family can't copy them.
+    const VkExtent3D granularity = families[family_id].minImageTransferGranularity;
+    if (granularity.width != 1 || granularity.height != 1 || granularity.depth != 1)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    VkCommandPoolCreateInfo command_pool_create_info = {};
+    command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    command_pool_create_info.queueFamilyIndex = family_id;
+    command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VkResult r = vkCreateCommandPool(m_device, &command_pool_create_info, nullptr, &m_transfer_cmd_pool);
+    if (r != VK_SUCCESS) {
+        ReleaseTransferQueue();
+        return r;
+    }
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (uint32_t i = 0; i < 3; i++) {
+        r = vkCreateSemaphore(m_device, &semaphore_info, 0, &m_transfer_semaphores[i]);
+        if (r != VK_SUCCESS) {
+            ReleaseTransferQueue();
+            return r;
+        }
+    }
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    for (uint32_t i = 0; i < 3; i++) {
+        r = vkCreateFence(m_device, &fence_info, 0, &m_transfer_fences[i]);
+        if (r != VK_SUCCESS) {
+            ReleaseTransferQueue();
+            return r;
+        }
+    }
+
+    m_transfer_queue = queue;
+    m_transfer_family_id = family_id;
+    SetObjectName(VK_OBJECT_TYPE_QUEUE, (uint64_t)m_transfer_queue, "BCVk transfer");
+    return VK_SUCCESS;
+}
+
+VkResult GPUCompressBCVk::SetResultCallback(ResultCallbackBCVk callback, void* user_data, uint32_t block_rows) {
+    if (callback && block_rows == 0)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    m_result_callback = callback;
+    m_result_user_data = user_data;
+    m_result_block_rows = block_rows;
+    return VK_SUCCESS;
+}
+
+VkResult GPUCompressBCVk::SetMemoryBudget(float fraction) {
+    if (!(fraction > 0.0f) || fraction > 1.0f)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    m_memory_budget_fraction = fraction;
+    return VK_SUCCESS;
+}
+
+VkResult GPUCompressBCVk::GetPipelineCacheData(size_t* size, void* data) {
+    if (!size)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_device == VK_NULL_HANDLE)
+        return VK_ERROR_UNKNOWN;  // Not initialized yet
+
+    size_t cache_size = 0;
+    VkResult r = vkGetPipelineCacheData(m_device, m_pipeline_cache, &cache_size, nullptr);
+    if (r != VK_SUCCESS)
+        return r;
+
+    if (!data) {
+        *size = sizeof(PipelineCacheHeaderBCVk) + cache_size;
+        return VK_SUCCESS;
+    }
+
+    if (*size < sizeof(PipelineCacheHeaderBCVk) + cache_size) {
+        *size = 0;
+        return VK_INCOMPLETE;
+    }
+
+    PipelineCacheHeaderBCVk header = {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.version = PIPELINE_CACHE_VERSION;
+    header.vendor_id = m_gpu_props.vendorID;
+    header.device_id = m_gpu_props.deviceID;
+    memcpy(header.pipeline_cache_uuid, m_gpu_props.pipelineCacheUUID, VK_UUID_SIZE);
+    header.tuning = m_tuning;
+    memcpy(data, &header, sizeof(PipelineCacheHeaderBCVk));
+
+    r = vkGetPipelineCacheData(m_device, m_pipeline_cache, &cache_size,
+                               static_cast<uint8_t*>(data) + sizeof(PipelineCacheHeaderBCVk));
+    *size = sizeof(PipelineCacheHeaderBCVk) + cache_size;
     return r;
 }
+
+VkResult GPUCompressBCVk::LoadPipelineCacheData(const void* data, size_t size) {
+    if (!data || size < sizeof(PipelineCacheHeaderBCVk))
+        return VK_ERROR_UNKNOWN;  // Invalid args
+
+    if (m_device == VK_NULL_HANDLE)
+        return VK_ERROR_UNKNOWN;  // Not initialized yet
+
+    PipelineCacheHeaderBCVk header;
+    memcpy(&header, data, sizeof(PipelineCacheHeaderBCVk));
+    if (header.magic != PIPELINE_CACHE_MAGIC || header.version != PIPELINE_CACHE_VERSION)
+        return VK_ERROR_UNKNOWN;  // Broken data
+
+    if (header.vendor_id != m_gpu_props.vendorID || header.device_id != m_gpu_props.deviceID ||
+        memcmp(header.pipeline_cache_uuid, m_gpu_props.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        return VK_ERROR_UNKNOWN;  // Made on another device or driver
+
+    VkResult r = SetWorkgroupTuning(header.tuning);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    r = CreateVkPipelineCache(m_device, &pipeline_cache,
+                              static_cast<const uint8_t*>(data) + sizeof(PipelineCacheHeaderBCVk),
+                              size - sizeof(PipelineCacheHeaderBCVk));
+    if (r != VK_SUCCESS)
+        return r;
+
+    vkDestroyPipelineCache(m_device, m_pipeline_cache, 0);
+    m_pipeline_cache = pipeline_cache;
+    return VK_SUCCESS;
+}
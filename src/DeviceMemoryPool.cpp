@@ -0,0 +1,312 @@
+#include "DeviceMemoryPool.h"
+
+// for std::max
+#include <algorithm>
+
+// The size of blocks for small allocations
+constexpr VkDeviceSize POOL_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t CountBits(uint32_t bits) {
+    uint32_t count = 0;
+    for (; bits; bits &= bits - 1)
+        count++;
+    return count;
+}
+
+uint32_t FindMemoryType(
+        const VkPhysicalDeviceMemoryProperties* memory_props, uint32_t type_bits,
+        VkMemoryPropertyFlags required_flags, VkMemoryPropertyFlags preferred_flags) {
+    uint32_t type_id = UINT32_MAX;
+    uint32_t best_missing = UINT32_MAX;
+    uint32_t best_extra = UINT32_MAX;
+    for (uint32_t i = 0; i < memory_props->memoryTypeCount; i++ ) {
+        const VkMemoryPropertyFlags flags = memory_props->memoryTypes[i].propertyFlags;
+        if (!((type_bits >> i) & 1) || (flags & required_flags) != required_flags)
+            continue;
+        const uint32_t missing = CountBits(preferred_flags & ~flags);
+        const uint32_t extra = CountBits(flags & ~(required_flags | preferred_flags));
+        if (missing < best_missing || (missing == best_missing && extra < best_extra)) {
+            type_id = i;
+            best_missing = missing;
+            best_extra = extra;
+        }
+    }
+    return type_id;
+}
+
+DeviceMemoryPoolBCVk::DeviceMemoryPoolBCVk(VkDevice device, VkPhysicalDevice physical_device, bool memory_budget) {
+    m_device = device;
+    m_physical_device = physical_device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &m_memory_props);
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    // vkGetPhysicalDeviceMemoryProperties2() requires Vulkan 1.1. Fall back to heap sizes without it.
+    m_has_memory_budget = memory_budget && props.apiVersion >= VK_API_VERSION_1_1;
+#ifdef USE_VOLK
+    if (vkGetPhysicalDeviceMemoryProperties2 == nullptr)
+        m_has_memory_budget = false;  // The instance does not support Vulkan 1.1
+#endif
+    m_granularity = std::max<VkDeviceSize>(1, props.limits.bufferImageGranularity);
+    m_non_coherent_atom_size = std::max<VkDeviceSize>(1, props.limits.nonCoherentAtomSize);
+    m_peak_block_bytes = 0;
+    m_device_allocation_count = 0;
+}
+
+DeviceMemoryPoolBCVk::~DeviceMemoryPoolBCVk() {
+    for (MemoryBlockBCVk& block : m_blocks)
+        FreeBlock(&block);
+}
+
+VkResult DeviceMemoryPoolBCVk::AllocateBlock(uint32_t type_id, VkDeviceSize size, bool is_image, uint32_t* block_id) {
+    VkMemoryAllocateInfo alloc = {};
+    alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc.allocationSize = size;
+    alloc.memoryTypeIndex = type_id;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkResult r = vkAllocateMemory(m_device, &alloc, nullptr, &memory);
+    if (r != VK_SUCCESS)
+        return r;
+    m_device_allocation_count++;
+
+    void* mapped = nullptr;
+    if (m_memory_props.memoryTypes[type_id].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        r = vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        if (r != VK_SUCCESS) {
+            vkFreeMemory(m_device, memory, nullptr);
+            return r;
+        }
+    }
+
+    // Reuse a released slot to keep block ids of live allocations.
+    uint32_t id = 0;
+    while (id < m_blocks.size() && m_blocks[id].memory != VK_NULL_HANDLE)
+        id++;
+    if (id == m_blocks.size())
+        m_blocks.push_back({});
+
+    MemoryBlockBCVk& block = m_blocks[id];
+    block.memory = memory;
+    block.size = size;
+    block.type_id = type_id;
+    block.is_image = is_image;
+    block.mapped = mapped;
+    block.free_ranges.assign(1, { 0, size });
+    block.allocation_count = 0;
+    *block_id = id;
+
+    uint64_t block_bytes = 0;
+    for (const MemoryBlockBCVk& b : m_blocks)
+        block_bytes += b.memory != VK_NULL_HANDLE ? b.size : 0;
+    m_peak_block_bytes = std::max(m_peak_block_bytes, block_bytes);
+    return VK_SUCCESS;
+}
+
+void DeviceMemoryPoolBCVk::FreeBlock(MemoryBlockBCVk* block) {
+    if (block->memory == VK_NULL_HANDLE)
+        return;
+    if (block->mapped)
+        vkUnmapMemory(m_device, block->memory);
+    vkFreeMemory(m_device, block->memory, nullptr);
+    block->memory = VK_NULL_HANDLE;
+    block->mapped = nullptr;
+    block->free_ranges.clear();
+}
+
+// Take a range from the first free range which fits. It returns false when no ranges fit.
+static bool TakeFreeRange(std::vector<MemoryRangeBCVk>* ranges, VkDeviceSize size,
+                          VkDeviceSize alignment, VkDeviceSize* offset) {
+    for (size_t i = 0; i < ranges->size(); i++) {
+        const MemoryRangeBCVk range = (*ranges)[i];
+        const VkDeviceSize aligned = AlignUp(range.offset, alignment);
+        if (aligned + size > range.offset + range.size)
+            continue;
+
+        // Split the range into the padding before `aligned` and the rest after the allocation.
+        const MemoryRangeBCVk head = { range.offset, aligned - range.offset };
+        const MemoryRangeBCVk tail = { aligned + size, range.offset + range.size - (aligned + size) };
+        ranges->erase(ranges->begin() + i);
+        if (tail.size > 0)
+            ranges->insert(ranges->begin() + i, tail);
+        if (head.size > 0)
+            ranges->insert(ranges->begin() + i, head);
+        *offset = aligned;
+        return true;
+    }
+    return false;
+}
+
+// Return a range, and merge it with adjacent free ranges.
+static void ReturnFreeRange(std::vector<MemoryRangeBCVk>* ranges, MemoryRangeBCVk range) {
+    size_t i = 0;
+    while (i < ranges->size() && (*ranges)[i].offset < range.offset)
+        i++;
+    if (i < ranges->size() && range.offset + range.size == (*ranges)[i].offset) {
+        range.size += (*ranges)[i].size;
+        ranges->erase(ranges->begin() + i);
+    }
+    if (i > 0 && (*ranges)[i - 1].offset + (*ranges)[i - 1].size == range.offset) {
+        (*ranges)[i - 1].size += range.size;
+        return;
+    }
+    ranges->insert(ranges->begin() + i, range);
+}
+
+VkResult DeviceMemoryPoolBCVk::Allocate(
+        const VkMemoryRequirements& req,
+        VkMemoryPropertyFlags required_flags, VkMemoryPropertyFlags preferred_flags,
+        bool is_image, MemoryAllocationBCVk** alloc) {
+    if (!alloc || req.size == 0)
+        return VK_ERROR_UNKNOWN;  // Invalid args
+    *alloc = nullptr;
+
+    const uint32_t type_id = FindMemoryType(&m_memory_props, req.memoryTypeBits, required_flags, preferred_flags);
+    if (type_id == UINT32_MAX)
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;  // No memory type has the flags.
+
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(1, req.alignment);
+    const bool share_blocks = m_granularity <= 1;
+
+    uint32_t block_id = UINT32_MAX;
+    VkDeviceSize offset = 0;
+    for (uint32_t i = 0; i < m_blocks.size() && block_id == UINT32_MAX; i++) {
+        MemoryBlockBCVk& block = m_blocks[i];
+        if (block.memory == VK_NULL_HANDLE || block.type_id != type_id)
+            continue;
+        if (!share_blocks && block.is_image != is_image)
+            continue;
+        if (TakeFreeRange(&block.free_ranges, req.size, alignment, &offset))
+            block_id = i;
+    }
+
+    if (block_id == UINT32_MAX) {
+        // Large resources get their own blocks.
+        const VkDeviceSize heap_size = m_memory_props.memoryHeaps[m_memory_props.memoryTypes[type_id].heapIndex].size;
+        const VkDeviceSize block_size = std::max<VkDeviceSize>(
+            1024 * 1024, std::min<VkDeviceSize>(POOL_BLOCK_SIZE, heap_size / 8));
+        const VkDeviceSize size = (req.size > block_size / 2) ? req.size : block_size;
+        VkResult r = AllocateBlock(type_id, size, is_image, &block_id);
+        if (r != VK_SUCCESS)
+            return r;
+        TakeFreeRange(&m_blocks[block_id].free_ranges, req.size, alignment, &offset);
+    }
+
+    MemoryBlockBCVk& block = m_blocks[block_id];
+    block.allocation_count++;
+
+    MemoryAllocationBCVk* a = new MemoryAllocationBCVk();
+    a->memory = block.memory;
+    a->offset = offset;
+    a->size = req.size;
+    a->mapped = block.mapped ? static_cast<uint8_t*>(block.mapped) + offset : nullptr;
+    a->flags = m_memory_props.memoryTypes[type_id].propertyFlags;
+    a->block_id = block_id;
+    *alloc = a;
+    return VK_SUCCESS;
+}
+
+void DeviceMemoryPoolBCVk::Free(MemoryAllocationBCVk* alloc) {
+    if (!alloc)
+        return;
+    MemoryBlockBCVk& block = m_blocks[alloc->block_id];
+    ReturnFreeRange(&block.free_ranges, { alloc->offset, alloc->size });
+    block.allocation_count--;
+    delete alloc;
+}
+
+void DeviceMemoryPoolBCVk::ReleaseUnusedBlocks() {
+    for (MemoryBlockBCVk& block : m_blocks) {
+        if (block.allocation_count == 0)
+            FreeBlock(&block);
+    }
+}
+
+// Get the range of an allocation aligned with nonCoherentAtomSize.
+VkMappedMemoryRange DeviceMemoryPoolBCVk::GetMappedRange(const MemoryAllocationBCVk* alloc) {
+    const VkDeviceSize block_size = m_blocks[alloc->block_id].size;
+    const VkDeviceSize begin = alloc->offset / m_non_coherent_atom_size * m_non_coherent_atom_size;
+    const VkDeviceSize end = std::min(block_size, AlignUp(alloc->offset + alloc->size, m_non_coherent_atom_size));
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = alloc->memory;
+    range.offset = begin;
+    range.size = end - begin;
+    return range;
+}
+
+VkResult DeviceMemoryPoolBCVk::Flush(const MemoryAllocationBCVk* alloc) {
+    if (!alloc || !alloc->mapped || (alloc->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return VK_SUCCESS;
+    VkMappedMemoryRange range = GetMappedRange(alloc);
+    return vkFlushMappedMemoryRanges(m_device, 1, &range);
+}
+
+VkResult DeviceMemoryPoolBCVk::Invalidate(const MemoryAllocationBCVk* alloc) {
+    if (!alloc || !alloc->mapped || (alloc->flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        return VK_SUCCESS;
+    VkMappedMemoryRange range = GetMappedRange(alloc);
+    return vkInvalidateMappedMemoryRanges(m_device, 1, &range);
+}
+
+MemoryPoolStatsBCVk DeviceMemoryPoolBCVk::GetStats() {
+    MemoryPoolStatsBCVk stats = {};
+    for (const MemoryBlockBCVk& block : m_blocks) {
+        if (block.memory == VK_NULL_HANDLE)
+            continue;
+        VkDeviceSize free_bytes = 0;
+        for (const MemoryRangeBCVk& range : block.free_ranges)
+            free_bytes += range.size;
+        stats.block_count++;
+        stats.allocation_count += block.allocation_count;
+        stats.block_bytes += block.size;
+        stats.used_bytes += block.size - free_bytes;
+    }
+    stats.peak_block_bytes = m_peak_block_bytes;
+    stats.device_allocation_count = m_device_allocation_count;
+    return stats;
+}
+
+uint32_t DeviceMemoryPoolBCVk::GetHeapIndex(VkMemoryPropertyFlags flags) {
+    const uint32_t type_id = FindMemoryType(&m_memory_props, UINT32_MAX, flags, 0);
+    if (type_id == UINT32_MAX)
+        return UINT32_MAX;
+    return m_memory_props.memoryTypes[type_id].heapIndex;
+}
+
+VkDeviceSize DeviceMemoryPoolBCVk::GetAvailableBytes(uint32_t heap_id, float fraction) {
+    if (heap_id >= m_memory_props.memoryHeapCount)
+        return 0;
+
+    // Bytes of the pool's own blocks in the heap
+    VkDeviceSize block_bytes = 0;
+    VkDeviceSize free_bytes = 0;
+    for (const MemoryBlockBCVk& block : m_blocks) {
+        if (block.memory == VK_NULL_HANDLE || m_memory_props.memoryTypes[block.type_id].heapIndex != heap_id)
+            continue;
+        block_bytes += block.size;
+        for (const MemoryRangeBCVk& range : block.free_ranges)
+            free_bytes += range.size;
+    }
+
+    VkDeviceSize budget = m_memory_props.memoryHeaps[heap_id].size;
+    VkDeviceSize usage = block_bytes - free_bytes;
+    if (m_has_memory_budget) {
+        // The budget and the usage include other processes and other allocators of this process.
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_props = {};
+        budget_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 props2 = {};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        props2.pNext = &budget_props;
+        vkGetPhysicalDeviceMemoryProperties2(m_physical_device, &props2);
+        budget = budget_props.heapBudget[heap_id];
+        usage = budget_props.heapUsage[heap_id];
+        usage = (usage > free_bytes) ? usage - free_bytes : 0;
+    }
+
+    const VkDeviceSize limit = static_cast<VkDeviceSize>(static_cast<double>(budget) * fraction);
+    return (limit > usage) ? limit - usage : 0;
+}
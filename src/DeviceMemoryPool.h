@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include "BCDirectComputeVk.h"
+
+// DeviceMemoryPoolBCVk: Sub-allocator for VkDeviceMemory
+//   It allocates large blocks for each memory type, and sub-allocates ranges from them.
+//   Freed ranges are reused by the following allocations. Blocks are kept until ReleaseUnusedBlocks().
+//   Heap budgets come from VK_EXT_memory_budget when the caller enabled it, or heap sizes otherwise.
+
+struct MemoryRangeBCVk {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+// A range of a memory block
+struct MemoryAllocationBCVk {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped;  // host pointer to `offset` (nullptr when the memory type is not host visible)
+    VkMemoryPropertyFlags flags;  // property flags of the memory type
+    uint32_t block_id;
+};
+
+class DeviceMemoryPoolBCVk {
+ public:
+    // `memory_budget` should be true only when `device` enabled VK_EXT_memory_budget on a Vulkan 1.1 instance.
+    DeviceMemoryPoolBCVk(VkDevice device, VkPhysicalDevice physical_device, bool memory_budget);
+    ~DeviceMemoryPoolBCVk();
+
+    // Allocate a range for a buffer or an image.
+    //   The memory type has all `required_flags`, and as many `preferred_flags` as possible.
+    //   `is_image` should be true for optimal tiling images. (for bufferImageGranularity)
+    //   Host visible blocks are persistently mapped. Don't call vkMapMemory() for them.
+    VkResult Allocate(const VkMemoryRequirements& req,
+                      VkMemoryPropertyFlags required_flags, VkMemoryPropertyFlags preferred_flags,
+                      bool is_image, MemoryAllocationBCVk** alloc);
+
+    // Return a range to the pool. (`alloc` can be nullptr.)
+    void Free(MemoryAllocationBCVk* alloc);
+
+    // Free blocks which have no allocations.
+    void ReleaseUnusedBlocks();
+
+    // Make host writes visible to the device, or device writes visible to the host.
+    //   They do nothing for host coherent memory.
+    VkResult Flush(const MemoryAllocationBCVk* alloc);
+    VkResult Invalidate(const MemoryAllocationBCVk* alloc);
+
+    MemoryPoolStatsBCVk GetStats();
+
+    // Get the heap of the first memory type which has all `flags`. It returns UINT32_MAX when there is no such type.
+    uint32_t GetHeapIndex(VkMemoryPropertyFlags flags);
+
+    // Bytes which can still be allocated from a heap without exceeding `fraction` of its budget.
+    //   Free ranges in the pool's own blocks count as available.
+    VkDeviceSize GetAvailableBytes(uint32_t heap_id, float fraction);
+
+ private:
+    struct MemoryBlockBCVk {
+        VkDeviceMemory memory;  // VK_NULL_HANDLE when the slot is unused
+        VkDeviceSize size;
+        uint32_t type_id;
+        bool is_image;  // Blocks are not shared between buffers and images when bufferImageGranularity > 1.
+        void* mapped;
+        std::vector<MemoryRangeBCVk> free_ranges;  // sorted by offset
+        uint32_t allocation_count;
+    };
+
+    VkDevice m_device;
+    VkPhysicalDevice m_physical_device;
+    VkPhysicalDeviceMemoryProperties m_memory_props;
+    bool m_has_memory_budget;  // VK_EXT_memory_budget
+    VkDeviceSize m_granularity;  // bufferImageGranularity
+    VkDeviceSize m_non_coherent_atom_size;
+    std::vector<MemoryBlockBCVk> m_blocks;
+    uint64_t m_peak_block_bytes;
+    uint32_t m_device_allocation_count;
+
+    VkResult AllocateBlock(uint32_t type_id, VkDeviceSize size, bool is_image, uint32_t* block_id);
+    void FreeBlock(MemoryBlockBCVk* block);
+    VkMappedMemoryRange GetMappedRange(const MemoryAllocationBCVk* alloc);
+};
+
+// Find a memory type which has all `required_flags`. It returns UINT32_MAX when there is no such type.
+//   Types are ranked by the number of `preferred_flags` they have.
+//   Ties go to the type with fewer other flags. (e.g. device local memory which is not host visible)
+uint32_t FindMemoryType(const VkPhysicalDeviceMemoryProperties* memory_props, uint32_t type_bits,
+                        VkMemoryPropertyFlags required_flags, VkMemoryPropertyFlags preferred_flags);
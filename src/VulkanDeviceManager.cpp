@@ -8,6 +8,10 @@ VulkanDeviceManager::VulkanDeviceManager() {
     m_dbg = VK_NULL_HANDLE;
     m_device = VK_NULL_HANDLE;
     m_family_id = 0;
+    m_transfer_family_id = -1;
+    m_queue_family_count = 0;
+    m_subgroup_size_control = false;
+    m_memory_budget = false;
     m_gpu_id = 0;
     m_gpu_count = 0;
     m_gpus = nullptr;
@@ -37,7 +41,7 @@ VulkanDeviceManager::~VulkanDeviceManager() {
 #endif
 }
 
-static VkResult CreateVkInstance(VkInstance* instance, bool enable_debug = true) {
+static VkResult CreateVkInstance(VkInstance* instance, bool enable_debug = true, bool enable_debug_utils = true) {
     VkApplicationInfo app_info = {};
     app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     app_info.pApplicationName = nullptr;
@@ -86,8 +90,9 @@ static VkResult CreateVkInstance(VkInstance* instance, bool enable_debug = true)
         create_info.pNext = nullptr;
         create_info.enabledLayerCount = 0;
         create_info.ppEnabledLayerNames = nullptr;
-        extension_count--;  // remove VK_EXT_DEBUG_UTILS_EXTENSION_NAME
     }
+    if (!enable_debug && !enable_debug_utils)
+        extension_count--;  // remove VK_EXT_DEBUG_UTILS_EXTENSION_NAME
     create_info.enabledExtensionCount = extension_count;
     create_info.ppEnabledExtensionNames = extension_names;
 
@@ -147,6 +152,26 @@ static bool HasValidationLayerSupport() {
     return result;
 }
 
+static bool HasInstanceExtension(const char* name) {
+    uint32_t ext_count = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, nullptr);
+    VkExtensionProperties* ext_props = (VkExtensionProperties*)calloc(ext_count, sizeof(VkExtensionProperties));
+    if (!ext_props)
+        return false;
+    vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, ext_props);
+
+    bool result = false;
+    for (uint32_t i = 0; i < ext_count; i++) {
+        if (strcmp(ext_props[i].extensionName, name) == 0) {
+            result = true;
+            break;
+        }
+    }
+
+    free(ext_props);
+    return result;
+}
+
 VkResult VulkanDeviceManager::CreateInstance(bool enable_debug) {
     m_gpu_count = 0;
     VkResult r = VK_SUCCESS;
@@ -165,7 +190,9 @@ VkResult VulkanDeviceManager::CreateInstance(bool enable_debug) {
     }
 
     // Create VkInstance
-    r = CreateVkInstance(&m_instance, m_enable_debug);
+    // VK_EXT_debug_utils is also enabled without validation if possible.
+    // GPUCompressBCVk uses it to name objects and label passes for GPU debuggers and profilers.
+    r = CreateVkInstance(&m_instance, m_enable_debug, HasInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME));
     if (r != VK_SUCCESS)
         return r;
 #if USE_VOLK
@@ -227,6 +254,34 @@ static void GetComputeQueueFamily(VkPhysicalDevice device, uint32_t *family_id,
     free(family_props);
 }
 
+// Find a family which supports transfers but no graphics and compute. (DMA engines on most discrete GPUs)
+static void GetTransferQueueFamily(VkPhysicalDevice device, uint32_t *family_id) {
+    *family_id = -1;
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, NULL);
+    if (family_count == 0)
+        return;
+
+    VkQueueFamilyProperties* family_props = (VkQueueFamilyProperties*)calloc(family_count, sizeof(VkQueueFamilyProperties));
+    if (!family_props)
+        return;
+
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, family_props);
+
+    // Bands of source images are copied at any row. So, the family should copy images at pixel granularity.
+    for (uint32_t i = 0; i < family_count; ++i) {
+        VkQueueFlags flags = family_props[i].queueFlags;
+        VkExtent3D granularity = family_props[i].minImageTransferGranularity;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+            *family_id = i;
+            break;
+        }
+    }
+    free(family_props);
+}
+
 inline uint32_t FindMemoryType(
         VkPhysicalDeviceMemoryProperties* memory_props,
         uint32_t type_bits, VkMemoryPropertyFlags flags) {
@@ -251,28 +306,133 @@ static int HasSupportedGpuMemroy(VkPhysicalDevice device) {
     return (visible_id != -1) && (invisible_id != -1);
 }
 
+static bool HasDeviceExtension(VkPhysicalDevice device, const char* name) {
+    uint32_t ext_count = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &ext_count, nullptr);
+    VkExtensionProperties* ext_props = (VkExtensionProperties*)calloc(ext_count, sizeof(VkExtensionProperties));
+    if (!ext_props)
+        return false;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &ext_count, ext_props);
+
+    bool result = false;
+    for (uint32_t i = 0; i < ext_count; i++) {
+        if (strcmp(ext_props[i].extensionName, name) == 0) {
+            result = true;
+            break;
+        }
+    }
+
+    free(ext_props);
+    return result;
+}
+
+// Check if the device supports subgroupSizeControl and computeFullSubgroups of VK_EXT_subgroup_size_control.
+static bool SupportsSubgroupSizeControl(VkPhysicalDevice physical_device) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    if (props.apiVersion < VK_API_VERSION_1_1 ||
+        !HasDeviceExtension(physical_device, VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME))
+        return false;
+#ifdef USE_VOLK
+    if (vkGetPhysicalDeviceFeatures2 == nullptr)
+        return false;  // The instance does not support Vulkan 1.1
+#endif
+
+    VkPhysicalDeviceSubgroupSizeControlFeaturesEXT size_control_features = {};
+    size_control_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &size_control_features;
+    vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+    return size_control_features.subgroupSizeControl && size_control_features.computeFullSubgroups;
+}
+
+// Check if VK_EXT_memory_budget can be queried with vkGetPhysicalDeviceMemoryProperties2().
+//   It requires Vulkan 1.1 on both the instance and the device.
+static bool SupportsMemoryBudget(VkInstance instance, VkPhysicalDevice physical_device) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    if (props.apiVersion < VK_API_VERSION_1_1 ||
+        !HasDeviceExtension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+        return false;
+
+    // Vulkan 1.0 loaders don't have vkEnumerateInstanceVersion().
+    PFN_vkEnumerateInstanceVersion enumerate_instance_version =
+        (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+    uint32_t instance_version = VK_API_VERSION_1_0;
+    if (enumerate_instance_version == nullptr ||
+        enumerate_instance_version(&instance_version) != VK_SUCCESS ||
+        instance_version < VK_API_VERSION_1_1)
+        return false;
+    return vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2") != nullptr;
+}
+
 static VkResult CreateVkDevice(
         VkPhysicalDevice physical_device,
         uint32_t family_id, uint32_t queue_count,
+        uint32_t transfer_family_id,
+        bool subgroup_size_control,
+        bool memory_budget,
         VkDevice* device) {
-    VkDeviceQueueCreateInfo device_queue_create_info = {};
-    device_queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    device_queue_create_info.queueFamilyIndex = family_id;
-    device_queue_create_info.queueCount = 1;
-    // device_queue_create_info.queueCount = queue_count;
+    VkDeviceQueueCreateInfo device_queue_create_infos[2] = {};
+    device_queue_create_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    device_queue_create_infos[0].queueFamilyIndex = family_id;
+    device_queue_create_infos[0].queueCount = 1;
+    // device_queue_create_infos[0].queueCount = queue_count;
     float queue_priorities[]{ 1.0f };
-    device_queue_create_info.pQueuePriorities = queue_priorities;
+    device_queue_create_infos[0].pQueuePriorities = queue_priorities;
+
+    // An optional queue for uploads and readbacks
+    device_queue_create_infos[1] = device_queue_create_infos[0];
+    device_queue_create_infos[1].queueFamilyIndex = transfer_family_id;
 
     VkDeviceCreateInfo device_create_info = {};
     device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.queueCreateInfoCount = 1;
-    device_create_info.pQueueCreateInfos = &device_queue_create_info;
+    device_create_info.queueCreateInfoCount = (transfer_family_id != -1) ? 2 : 1;
+    device_create_info.pQueueCreateInfos = device_queue_create_infos;
 
     VkPhysicalDeviceFeatures features = {};
     features.fragmentStoresAndAtomics = VK_TRUE;
     features.vertexPipelineStoresAndAtomics = VK_TRUE;
     device_create_info.pEnabledFeatures = &features;
 
+    // Optional extensions
+    const char* extension_names[8];
+    uint32_t extension_count = 0;
+    // GPUCompressBCVk uses it to align GPU timestamps with host time for tracing.
+    if (HasDeviceExtension(physical_device, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME))
+        extension_names[extension_count++] = VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+    // GPUCompressBCVk uses it to fit its buffers in the memory budget.
+    if (memory_budget)
+        extension_names[extension_count++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    // GPUCompressBCVk uses it to import pixels from the caller's memory. (It requires Vulkan 1.1.)
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical_device, &props);
+    if (props.apiVersion >= VK_API_VERSION_1_1 &&
+        HasDeviceExtension(physical_device, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+        extension_names[extension_count++] = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+    // GPUCompressBCVk uses them to share memory and semaphores with other processes. (See CompressExternal().)
+    if (props.apiVersion >= VK_API_VERSION_1_1 &&
+        HasDeviceExtension(physical_device, VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME)) {
+        extension_names[extension_count++] = VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME;
+        if (HasDeviceExtension(physical_device, VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME))
+            extension_names[extension_count++] = VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME;
+    }
+    if (props.apiVersion >= VK_API_VERSION_1_1 &&
+        HasDeviceExtension(physical_device, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME))
+        extension_names[extension_count++] = VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME;
+    // GPUCompressBCVk uses it to run subgroup builds on devices with smaller default subgroups.
+    VkPhysicalDeviceSubgroupSizeControlFeaturesEXT size_control_features = {};
+    if (subgroup_size_control) {
+        extension_names[extension_count++] = VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME;
+        size_control_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+        size_control_features.subgroupSizeControl = VK_TRUE;
+        size_control_features.computeFullSubgroups = VK_TRUE;
+        device_create_info.pNext = &size_control_features;
+    }
+    device_create_info.enabledExtensionCount = extension_count;
+    device_create_info.ppEnabledExtensionNames = extension_names;
+
     *device = VK_NULL_HANDLE;
     return vkCreateDevice(physical_device, &device_create_info, nullptr, device);
 }
@@ -287,7 +447,7 @@ bool VulkanDeviceManager::GPUIsLLVMpipe(uint32_t id) {
     return IsLLVMpipe(m_gpus[id]);
 }
 
-VkResult VulkanDeviceManager::CreateDevice(uint32_t gpu_id) {
+VkResult VulkanDeviceManager::CreateDevice(uint32_t gpu_id, bool use_transfer_queue) {
     if (m_device != VK_NULL_HANDLE)
         return VK_ERROR_UNKNOWN;  // VkDevice exists already.
     if (gpu_id != -1 && m_gpu_count <= gpu_id)
@@ -326,10 +486,37 @@ VkResult VulkanDeviceManager::CreateDevice(uint32_t gpu_id) {
     if (m_family_id == -1)
         return VK_ERROR_UNKNOWN;  // Supported device not found
 
-    r = CreateVkDevice(gpu, m_family_id, queue_count, &m_device);
+    m_transfer_family_id = -1;
+    if (use_transfer_queue)
+        GetTransferQueueFamily(gpu, &m_transfer_family_id);
+
+    m_subgroup_size_control = SupportsSubgroupSizeControl(gpu);
+    m_memory_budget = SupportsMemoryBudget(m_instance, gpu);
+
+    r = CreateVkDevice(gpu, m_family_id, queue_count, m_transfer_family_id,
+                       m_subgroup_size_control, m_memory_budget, &m_device);
     #if USE_VOLK
         if (r == VK_SUCCESS)
             volkLoadDevice(m_device);
     #endif
+    if (r != VK_SUCCESS)
+        return r;
+
+    // Families which have a queue in the device
+    m_queue_family_count = 0;
+    m_queue_family_ids[m_queue_family_count++] = m_family_id;
+    if (m_transfer_family_id != -1)
+        m_queue_family_ids[m_queue_family_count++] = m_transfer_family_id;
     return r;
 }
+
+VkResult VulkanDeviceManager::GetDeviceQueue(uint32_t family_id, VkQueue* queue) {
+    *queue = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i < m_queue_family_count; i++) {
+        if (m_queue_family_ids[i] == family_id) {
+            vkGetDeviceQueue(m_device, family_id, 0, queue);
+            return VK_SUCCESS;
+        }
+    }
+    return VK_ERROR_INITIALIZATION_FAILED;  // The device has no queue in the family.
+}
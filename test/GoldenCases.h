@@ -0,0 +1,148 @@
+#pragma once
+
+// Golden cases shared by bcvk-test and bcvk-golden-writer
+//   bcvk-golden-writer is built with the baseline compressor (test/make_golden.sh),
+//   so this header only uses what the baseline BCDirectComputeVk.h has.
+
+#include "BCDirectComputeVk.h"
+#include "SyntheticImages.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Values of TEX_COMPRESS_FLAGS (The baseline defines them in BCDirectComputeVk.cpp.)
+static const uint32_t GOLDEN_FLAGS_DEFAULT = 0;
+static const uint32_t GOLDEN_FLAGS_BC7_USE_3SUBSETS = 0x80000;
+static const uint32_t GOLDEN_FLAGS_BC7_QUICK = 0x100000;
+
+enum GOLDEN_IMAGE : uint32_t {
+    GOLDEN_IMAGE_BLOCKS = 0,  // GenerateBlocks()
+    GOLDEN_IMAGE_TWO_REGIONS,  // GenerateTwoRegionBlocks()
+    GOLDEN_IMAGE_OPAQUE,  // GenerateBlocks() with alpha = 255
+};
+
+struct GoldenCase {
+    const char* name;  // file name in the golden directory (without ".bin")
+    uint32_t width;
+    uint32_t height;
+    DXGI_FORMAT format;
+    uint32_t flags;  // TEX_COMPRESS_FLAGS of the baseline
+    GOLDEN_IMAGE image;
+    // A region of a larger source image (0: the source image has the same size as the golden case)
+    //   Golden blocks are compressed from pixels extracted at (x, y).
+    uint32_t src_width;
+    uint32_t src_height;
+    uint32_t x;
+    uint32_t y;
+};
+
+// 256x256: 4096 blocks, which are split into many error windows and tiles.
+// 40x102: the last block row and the last band are partial.
+// 37x21: blocks in the last column and the last row are partial.
+// Regions start at odd pixels of the source image, so their rows are not aligned to blocks or bytes of the source rows.
+// BC7 without BC7_QUICK needs test/baseline/0001-encode-last-bc7-mode-result.patch. (The baseline drops mode 7, or mode 2 with BC7_USE_3SUBSETS.)
+static const GoldenCase GOLDEN_CASES[] = {
+    { "bc7_256", 256, 256, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc7_40x102", 40, 102, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc7_37x21", 37, 21, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc7_mode7_64", 64, 64, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_TWO_REGIONS },
+    { "bc7_opaque_128", 128, 128, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_OPAQUE },
+    { "bc7_3subsets_40x102", 40, 102, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_BC7_USE_3SUBSETS, GOLDEN_IMAGE_BLOCKS },
+    { "bc7_quick_256", 256, 256, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_BC7_QUICK, GOLDEN_IMAGE_BLOCKS },
+    { "bc7_quick_40x102", 40, 102, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_BC7_QUICK, GOLDEN_IMAGE_BLOCKS },
+    { "bc6h_256", 256, 256, DXGI_FORMAT_BC6H_UF16, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc6h_40x102", 40, 102, DXGI_FORMAT_BC6H_UF16, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc6h_37x21", 37, 21, DXGI_FORMAT_BC6H_UF16, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc6h_sf16_256", 256, 256, DXGI_FORMAT_BC6H_SF16, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc6h_sf16_40x102", 40, 102, DXGI_FORMAT_BC6H_SF16, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS },
+    { "bc7_region_40x102", 40, 102, DXGI_FORMAT_BC7_UNORM, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS, 97, 131, 13, 7 },
+    { "bc6h_region_37x21", 37, 21, DXGI_FORMAT_BC6H_UF16, GOLDEN_FLAGS_DEFAULT, GOLDEN_IMAGE_BLOCKS, 64, 40, 9, 17 },
+};
+
+// Blocks whose left and right halves are gradients between two random colors with different alpha values
+//   Both halves are lines in RGBA space, but the whole block is not.
+//   Only BC7 mode 7 has two subsets with alpha, so it's the best mode for most blocks.
+inline void GenerateTwoRegionBlocks(uint32_t width, uint32_t height, uint32_t seed, uint8_t* out) {
+    const uint32_t xblocks = (width + 3) / 4;
+    const uint32_t num_blocks = xblocks * ((height + 3) / 4);
+    std::vector<uint8_t> block_colors(size_t(num_blocks) * 16);  // 4 colors for each block
+    for (uint8_t& c : block_colors)
+        c = (uint8_t)(NextRandom(&seed) >> 24);
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t block_id = (y / 4) * xblocks + x / 4;
+            const uint8_t* c0 = &block_colors[size_t(block_id) * 16 + ((x % 4) / 2) * 8];
+            const uint8_t* c1 = c0 + 4;
+            uint8_t* px = out + (size_t(y) * width + x) * 4;
+            for (uint32_t i = 0; i < 4; i++)
+                px[i] = (uint8_t)((c0[i] * (3 - y % 4) + c1[i] * (y % 4)) / 3);
+        }
+    }
+}
+
+inline const GoldenCase* FindGoldenCase(const char* name) {
+    for (const GoldenCase& golden : GOLDEN_CASES) {
+        if (strcmp(golden.name, name) == 0)
+            return &golden;
+    }
+    return nullptr;
+}
+
+inline uint32_t GetGoldenSourceWidth(const GoldenCase& golden) {
+    return golden.src_width ? golden.src_width : golden.width;
+}
+
+inline uint32_t GetGoldenSourceHeight(const GoldenCase& golden) {
+    return golden.src_height ? golden.src_height : golden.height;
+}
+
+// Bytes per pixel of MakeGoldenImage()
+inline uint32_t GetGoldenPixelSize(const GoldenCase& golden) {
+    return (golden.format == DXGI_FORMAT_BC6H_UF16 || golden.format == DXGI_FORMAT_BC6H_SF16) ? 16 : 4;
+}
+
+// Make the whole source image of a golden case. (GetGoldenSourceWidth() x GetGoldenSourceHeight())
+//   Pixels are R8G8B8A8_UNORM for BC7, and R32G32B32A32_FLOAT for BC6H.
+inline void MakeGoldenSourceImage(const GoldenCase& golden, std::vector<uint8_t>* pixels) {
+    const uint32_t width = GetGoldenSourceWidth(golden);
+    const uint32_t height = GetGoldenSourceHeight(golden);
+    std::vector<uint8_t> rgba8((size_t)width * height * 4);
+    switch (golden.image) {
+    case GOLDEN_IMAGE_BLOCKS:
+    default:
+        GenerateBlocks(width, height, 0x12345678u, rgba8.data());
+        break;
+    case GOLDEN_IMAGE_TWO_REGIONS:
+        GenerateTwoRegionBlocks(width, height, 0x2468ACE1u, rgba8.data());
+        break;
+    case GOLDEN_IMAGE_OPAQUE:
+        GenerateBlocks(width, height, 0x13579BDFu, rgba8.data());
+        for (size_t i = 3; i < rgba8.size(); i += 4)
+            rgba8[i] = 255;
+        break;
+    }
+
+    if (golden.format == DXGI_FORMAT_BC6H_UF16 || golden.format == DXGI_FORMAT_BC6H_SF16)
+        ToHDR(rgba8, golden.format == DXGI_FORMAT_BC6H_SF16, pixels);
+    else
+        *pixels = std::move(rgba8);
+}
+
+// Make pixels which golden blocks are compressed from. (width x height pixels at (x, y) of the source image)
+inline void MakeGoldenImage(const GoldenCase& golden, std::vector<uint8_t>* pixels) {
+    std::vector<uint8_t> src_pixels;
+    MakeGoldenSourceImage(golden, &src_pixels);
+    if (!golden.src_width && !golden.src_height) {
+        *pixels = std::move(src_pixels);
+        return;
+    }
+
+    const size_t pixel_size = GetGoldenPixelSize(golden);
+    const size_t src_row_size = GetGoldenSourceWidth(golden) * pixel_size;
+    const size_t row_size = golden.width * pixel_size;
+    pixels->resize(row_size * golden.height);
+    for (uint32_t y = 0; y < golden.height; y++)
+        memcpy(pixels->data() + row_size * y, &src_pixels[src_row_size * (golden.y + y) + pixel_size * golden.x], row_size);
+}
@@ -0,0 +1,84 @@
+// Write golden blocks of GOLDEN_CASES with the baseline compressor
+//   It's built with the sources of the baseline commit. (Run test/make_golden.sh.)
+//   Only Initialize(), Prepare(), and Compress() of the baseline are available here.
+
+#include "VulkanDeviceManager.h"
+#include "BCDirectComputeVk.h"
+#include "GoldenCases.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static int WriteGolden(GPUCompressBCVk* compressor, const GoldenCase& golden, const std::string& dir) {
+    std::vector<uint8_t> src_pixels;
+    MakeGoldenImage(golden, &src_pixels);
+
+    VkResult r = compressor->Prepare(golden.width, golden.height, golden.flags, golden.format, 1.0f);
+    if (r != VK_SUCCESS) {
+        std::cerr << golden.name << ": Failed to create VkBuffer (error " << r << ")\n";
+        return 1;
+    }
+    std::vector<uint8_t> out_pixels(compressor->GetOutBufSize());
+    r = compressor->Compress(src_pixels.data(), out_pixels.data());
+    if (r != VK_SUCCESS) {
+        std::cerr << golden.name << ": Failed to compress (error " << r << ")\n";
+        return 1;
+    }
+
+    const std::string path = dir + "/" + golden.name + ".bin";
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "Failed to open " << path << "\n";
+        return 1;
+    }
+    ofs.write(reinterpret_cast<const char*>(out_pixels.data()), out_pixels.size());
+    if (!ofs) {
+        std::cerr << "Failed to write " << path << "\n";
+        return 1;
+    }
+    std::cout << path << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cout << "Usage: bcvk-golden-writer <output dir>\n";
+        return 1;
+    }
+
+    VulkanDeviceManager manager = VulkanDeviceManager();
+    VkResult r = manager.CreateInstance();
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create Vulkan instance (error " << r << ")\n";
+        return 1;
+    }
+
+    if (!manager.HasGPU()) {
+        std::cerr << "No Vulkan-capable GPUs found.\n";
+        return 1;
+    }
+
+    r = manager.CreateDevice();
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create VkDevice (error " << r << ")\n";
+        return 1;
+    }
+
+    GPUCompressBCVk compressor = GPUCompressBCVk();
+    r = compressor.Initialize(
+            manager.GetDevice(),
+            manager.GetUsingGPU(),
+            manager.GetUsingFamilyId());
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create VkShaderModule (error " << r << ")\n";
+        return 1;
+    }
+
+    for (const GoldenCase& golden : GOLDEN_CASES) {
+        int res = WriteGolden(&compressor, golden, argv[1]);
+        if (res != 0) return res;
+    }
+    return 0;
+}
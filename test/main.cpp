@@ -0,0 +1,907 @@
+// Test app to check that the compressor writes the same blocks as the baseline compressor
+//   Golden blocks are written by the baseline compressor with test/make_golden.sh.
+//   Each test case compresses the image of a golden case with its own options, and compares the blocks.
+
+#include "VulkanDeviceManager.h"
+#include "BCDirectComputeVk.h"
+#include "GoldenCases.h"
+
+#include <iostream>
+#include <fstream>
+#include <cfloat>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>  // for close()
+#endif
+
+struct TestContext {
+    VulkanDeviceManager* manager;
+    GPUCompressBCVk* compressor;
+    const GoldenCase* golden;
+    std::vector<uint8_t> src_pixels;  // made with MakeGoldenImage()
+    const std::vector<uint8_t>* expected;  // golden blocks
+};
+
+struct TestCase {
+    const char* name;
+    const char* golden;  // name of a golden case
+    // Set options before Initialize(). (nullptr: default options)
+    void (*configure)(GPUCompressBCVk* compressor);
+    // Compress src_pixels to `out`. (nullptr: RunCompress())
+    //   VK_ERROR_FEATURE_NOT_PRESENT skips the test case.
+    VkResult (*run)(TestContext* ctx, std::vector<uint8_t>* out);
+    // Allow a block to differ from the golden block. (nullptr: all blocks should be the same)
+    bool (*allow_mismatch)(const uint8_t* expected, const uint8_t* actual);
+};
+
+// Error window of windowed test cases. (Every golden case has more blocks than it.)
+static const uint32_t TEST_ERROR_WINDOW = 128;
+
+static VkResult PrepareGolden(TestContext* ctx, uint32_t flags) {
+    const GoldenCase& golden = *ctx->golden;
+    return ctx->compressor->Prepare(golden.width, golden.height, flags, golden.format, 1.0f);
+}
+
+// Compress() after PrepareGolden().
+static VkResult CompressPrepared(TestContext* ctx, std::vector<uint8_t>* out) {
+    *out = std::vector<uint8_t>(ctx->compressor->GetOutBufSize());
+    return ctx->compressor->Compress(ctx->src_pixels.data(), out->data());
+}
+
+// Prepare() with `flags`, and Compress().
+static VkResult CompressWithFlags(TestContext* ctx, uint32_t flags, std::vector<uint8_t>* out) {
+    VkResult r = PrepareGolden(ctx, flags);
+    if (r != VK_SUCCESS)
+        return r;
+    return CompressPrepared(ctx, out);
+}
+
+// Compress with the same flags as the golden case.
+static VkResult RunCompress(TestContext* ctx, std::vector<uint8_t>* out) {
+    return CompressWithFlags(ctx, ctx->golden->flags, out);
+}
+
+// Each BC6H mode in its own pass, BC7 modes one by one with ping-pong error buffers,
+// and uploads of whole tiles to images before their passes.
+static void ConfigureReference(GPUCompressBCVk* compressor) {
+    compressor->SetDirectHostAccess(false);
+    compressor->SetBC6HFusedModeSearch(false);
+    compressor->SetBC7ConcurrentModeSearch(false);
+    compressor->SetBandedUpload(false);
+}
+
+// Only the fused BC6H mode search differs from the reference.
+static void ConfigureFusedModeSearch(GPUCompressBCVk* compressor) {
+    ConfigureReference(compressor);
+    compressor->SetBC6HFusedModeSearch(true);
+}
+
+// Only the concurrent BC7 mode search differs from the reference.
+static void ConfigureConcurrentModeSearch(GPUCompressBCVk* compressor) {
+    ConfigureReference(compressor);
+    compressor->SetBC7ConcurrentModeSearch(true);
+}
+
+// Only the banded upload differs from the reference.
+//   Tiles with more than one batch of blocks are uploaded in bands through staging buffers.
+static void ConfigureBandedUpload(GPUCompressBCVk* compressor) {
+    ConfigureReference(compressor);
+    compressor->SetBandedUpload(true);
+}
+
+// Shaders read source pixels from host visible buffers on llvmpipe.
+//   Pixels are copied to a buffer without the caller's memory.
+static void ConfigureBufferInputCopy(GPUCompressBCVk* compressor) {
+    compressor->SetHostMemoryImport(false);
+}
+
+// Source pixels are written to linear images on devices with host visible device local memory. (e.g. llvmpipe)
+static void ConfigureLinearImage(GPUCompressBCVk* compressor) {
+    compressor->SetBufferInput(false);
+    compressor->SetHostMemoryImport(false);
+}
+
+// Error buffers which are smaller than the texture.
+//   Source images are uploaded through staging buffers, so that bands are used even on llvmpipe.
+static void ConfigureWindowed(GPUCompressBCVk* compressor) {
+    compressor->SetDirectHostAccess(false);
+    compressor->SetErrorWindow(TEST_ERROR_WINDOW);
+}
+
+// BC7 blocks of mode 7 start with 0x80.
+static uint32_t CountBC7Mode7Blocks(const std::vector<uint8_t>& blocks) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < blocks.size(); i += 16)
+        count += blocks[i] == 0x80;
+    return count;
+}
+
+// Compress a golden case which has mode 7 blocks.
+//   The encode pass of the baseline used to read the result before mode 7 was tried.
+static VkResult RunMode7(TestContext* ctx, std::vector<uint8_t>* out) {
+    if (CountBC7Mode7Blocks(*ctx->expected) == 0) {
+        std::cout << "(golden blocks have no mode 7 blocks) ";
+        return VK_ERROR_UNKNOWN;
+    }
+    return RunCompress(ctx, out);
+}
+
+// Skip all passes after mode 4/5/6 with the error threshold.
+//   It should be the same as BC7_QUICK, which only tries mode 4/5/6.
+static VkResult RunMaxErrorThreshold(TestContext* ctx, std::vector<uint8_t>* out) {
+    ctx->compressor->SetErrorThreshold(FLT_MAX);
+    return CompressWithFlags(ctx, GOLDEN_FLAGS_DEFAULT, out);
+}
+
+// An error threshold which no block reaches changes nothing.
+static VkResult RunMinErrorThreshold(TestContext* ctx, std::vector<uint8_t>* out) {
+    ctx->compressor->SetErrorThreshold(FLT_MIN);
+    return RunCompress(ctx, out);
+}
+
+// Enable BC7 modes with the quality profile instead of TEX_COMPRESS_FLAGS.
+static VkResult RunBC7ModeMask(TestContext* ctx, uint32_t mode_mask, std::vector<uint8_t>* out) {
+    VkResult r = PrepareGolden(ctx, GOLDEN_FLAGS_DEFAULT);
+    if (r != VK_SUCCESS)
+        return r;
+    QualityProfileBC6HBC7 profile = ctx->compressor->GetQualityProfile();
+    profile.bc7_mode_mask = mode_mask;
+    r = ctx->compressor->SetQualityProfile(profile);
+    if (r != VK_SUCCESS)
+        return r;
+    return CompressPrepared(ctx, out);
+}
+
+// Same as BC7_QUICK
+static VkResult RunBC7Modes456(TestContext* ctx, std::vector<uint8_t>* out) {
+    return RunBC7ModeMask(ctx, 0x70, out);
+}
+
+// Same as BC7_USE_3SUBSETS
+static VkResult RunBC7AllModes(TestContext* ctx, std::vector<uint8_t>* out) {
+    return RunBC7ModeMask(ctx, 0xFF, out);
+}
+
+// Search partitions in the shortlist only.
+//   Each half of the blocks in GenerateTwoRegionBlocks() is a line in RGBA space,
+//   so the partition which splits them has the lowest score, and it's what the baseline selects.
+static VkResult RunPartitionShortlist(TestContext* ctx, std::vector<uint8_t>* out) {
+    VkResult r = PrepareGolden(ctx, ctx->golden->flags);
+    if (r != VK_SUCCESS)
+        return r;
+    QualityProfileBC6HBC7 profile = ctx->compressor->GetQualityProfile();
+    profile.partition_shortlist_size = 4;
+    r = ctx->compressor->SetQualityProfile(profile);
+    if (r != VK_SUCCESS)
+        return r;
+    return CompressPrepared(ctx, out);
+}
+
+// Run banded uploads and readbacks on the transfer queue.
+//   Devices without a transfer family (e.g. llvmpipe) use the compute family, so copies are still synchronized with semaphores.
+static VkResult RunTransferQueue(TestContext* ctx, std::vector<uint8_t>* out) {
+    VulkanDeviceManager* manager = ctx->manager;
+    const uint32_t family_id = manager->HasTransferQueue() ? manager->GetTransferFamilyId() : manager->GetUsingFamilyId();
+    VkQueue queue = VK_NULL_HANDLE;
+    VkResult r = manager->GetDeviceQueue(family_id, &queue);
+    if (r != VK_SUCCESS)
+        return r;
+    r = ctx->compressor->SetTransferQueue(queue, family_id);
+    if (r != VK_SUCCESS)
+        return r;  // VK_ERROR_FEATURE_NOT_PRESENT when the family can't copy bands
+    return RunCompress(ctx, out);
+}
+
+// Ranges delivered to the result callback
+struct ResultRanges {
+    std::vector<uint8_t> blocks;  // ranges copied at their block rows
+    std::vector<uint32_t> row_counts;  // the number of times each block row was delivered
+    size_t row_size;  // bytes of a block row
+    bool invalid;  // A range had a wrong size or rows outside the texture.
+};
+
+static void CollectResultRange(void* user_data, const void* blocks,
+                               uint32_t first_block_row, uint32_t num_block_rows, size_t size) {
+    ResultRanges* ranges = static_cast<ResultRanges*>(user_data);
+    if (size != ranges->row_size * num_block_rows || first_block_row + num_block_rows > ranges->row_counts.size()) {
+        ranges->invalid = true;
+        return;
+    }
+    memcpy(&ranges->blocks[ranges->row_size * first_block_row], blocks, size);
+    for (uint32_t i = 0; i < num_block_rows; i++)
+        ranges->row_counts[first_block_row + i]++;
+}
+
+// Assemble the ranges of the result callback. Each block row should be delivered once.
+//   Ranges have 3 block rows, so the last range of a tile is usually shorter.
+static VkResult RunResultCallback(TestContext* ctx, std::vector<uint8_t>* out) {
+    const GoldenCase& golden = *ctx->golden;
+    ResultRanges ranges;
+    ranges.row_size = ctx->expected->size() / ((golden.height + 3) / 4);
+    ranges.blocks = std::vector<uint8_t>(ctx->expected->size());
+    ranges.row_counts = std::vector<uint32_t>((golden.height + 3) / 4);
+    ranges.invalid = false;
+    VkResult r = ctx->compressor->SetResultCallback(CollectResultRange, &ranges, 3);
+    if (r != VK_SUCCESS)
+        return r;
+    std::vector<uint8_t> out_pixels;
+    r = RunCompress(ctx, &out_pixels);
+    if (r != VK_SUCCESS)
+        return r;
+    if (ranges.invalid) {
+        std::cout << "(a range had a wrong size or position) ";
+        return VK_ERROR_UNKNOWN;
+    }
+    for (uint32_t count : ranges.row_counts) {
+        if (count != 1) {
+            std::cout << "(block rows were not delivered once) ";
+            return VK_ERROR_UNKNOWN;
+        }
+    }
+    *out = std::move(ranges.blocks);
+    return VK_SUCCESS;
+}
+
+// Skip mode 7 for the opaque image.
+static VkResult RunOpaqueFastPath(TestContext* ctx, std::vector<uint8_t>* out) {
+    ctx->compressor->SetOpaqueFastPath(true);
+    VkResult r = RunCompress(ctx, out);
+    if (r != VK_SUCCESS)
+        return r;
+    if (CountBC7Mode7Blocks(*out) > 0) {
+        std::cout << "(mode 7 was not skipped) ";
+        return VK_ERROR_UNKNOWN;
+    }
+    return VK_SUCCESS;
+}
+
+// The opaque fast path only changes blocks whose best mode is mode 7.
+static bool AllowMode7Mismatch(const uint8_t* expected, const uint8_t* actual) {
+    return expected[0] == 0x80;
+}
+
+// Vulkan objects which tests make without the compressor
+struct TestBuffer {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void* mapped;
+};
+
+struct TestImage {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+};
+
+static uint32_t FindMemoryType(TestContext* ctx, uint32_t type_bits, VkMemoryPropertyFlags flags) {
+    VkPhysicalDeviceMemoryProperties props;
+    vkGetPhysicalDeviceMemoryProperties(ctx->manager->GetUsingGPU(), &props);
+    for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+        if ((type_bits & (1u << i)) && (props.memoryTypes[i].propertyFlags & flags) == flags)
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+static VkResult AllocateTestMemory(TestContext* ctx, const VkMemoryRequirements& req, VkMemoryPropertyFlags flags,
+                                   VkDeviceMemory* memory) {
+    VkMemoryAllocateInfo mai = {};
+    mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    mai.allocationSize = req.size;
+    mai.memoryTypeIndex = FindMemoryType(ctx, req.memoryTypeBits, flags);
+    if (mai.memoryTypeIndex == UINT32_MAX)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    return vkAllocateMemory(ctx->manager->GetDevice(), &mai, nullptr, memory);
+}
+
+// A host visible buffer which is mapped until DestroyTestBuffer().
+static VkResult CreateTestBuffer(TestContext* ctx, VkDeviceSize size, VkBufferUsageFlags usage, TestBuffer* buf) {
+    VkDevice device = ctx->manager->GetDevice();
+    *buf = {};
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = size;
+    bci.usage = usage;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult r = vkCreateBuffer(device, &bci, nullptr, &buf->buffer);
+    if (r != VK_SUCCESS)
+        return r;
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(device, buf->buffer, &req);
+    r = AllocateTestMemory(ctx, req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           &buf->memory);
+    if (r != VK_SUCCESS)
+        return r;
+    r = vkBindBufferMemory(device, buf->buffer, buf->memory, 0);
+    if (r != VK_SUCCESS)
+        return r;
+    return vkMapMemory(device, buf->memory, 0, VK_WHOLE_SIZE, 0, &buf->mapped);
+}
+
+static void DestroyTestBuffer(TestContext* ctx, TestBuffer* buf) {
+    VkDevice device = ctx->manager->GetDevice();
+    vkDestroyBuffer(device, buf->buffer, nullptr);
+    vkFreeMemory(device, buf->memory, nullptr);
+    *buf = {};
+}
+
+// Format of src_pixels
+static VkFormat GetSourceFormat(const GoldenCase& golden) {
+    if (golden.format == DXGI_FORMAT_BC6H_UF16 || golden.format == DXGI_FORMAT_BC6H_SF16)
+        return VK_FORMAT_R32G32B32A32_SFLOAT;
+    return VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+// An optimal image which shaders can sample.
+static VkResult CreateTestImage(TestContext* ctx, uint32_t width, uint32_t height, TestImage* img) {
+    VkDevice device = ctx->manager->GetDevice();
+    *img = {};
+    VkImageCreateInfo ici = {};
+    ici.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    ici.imageType = VK_IMAGE_TYPE_2D;
+    ici.format = GetSourceFormat(*ctx->golden);
+    ici.extent = { width, height, 1 };
+    ici.mipLevels = 1;
+    ici.arrayLayers = 1;
+    ici.samples = VK_SAMPLE_COUNT_1_BIT;
+    ici.tiling = VK_IMAGE_TILING_OPTIMAL;
+    ici.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    ici.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkResult r = vkCreateImage(device, &ici, nullptr, &img->image);
+    if (r != VK_SUCCESS)
+        return r;
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(device, img->image, &req);
+    r = AllocateTestMemory(ctx, req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &img->memory);
+    if (r != VK_SUCCESS)
+        return r;
+    r = vkBindImageMemory(device, img->image, img->memory, 0);
+    if (r != VK_SUCCESS)
+        return r;
+    VkImageViewCreateInfo ivci = {};
+    ivci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    ivci.image = img->image;
+    ivci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    ivci.format = ici.format;
+    ivci.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    return vkCreateImageView(device, &ivci, nullptr, &img->view);
+}
+
+static void DestroyTestImage(TestContext* ctx, TestImage* img) {
+    VkDevice device = ctx->manager->GetDevice();
+    vkDestroyImageView(device, img->view, nullptr);
+    vkDestroyImage(device, img->image, nullptr);
+    vkFreeMemory(device, img->memory, nullptr);
+    *img = {};
+}
+
+static void RecordImageBarrier(VkCommandBuffer cmd, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout,
+                               VkAccessFlags src_access, VkAccessFlags dst_access,
+                               VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// Record commands with `record`, and wait for them on the compute queue.
+template <typename F>
+static VkResult SubmitAndWait(TestContext* ctx, F record) {
+    VkDevice device = ctx->manager->GetDevice();
+    VkQueue queue = VK_NULL_HANDLE;
+    VkResult r = ctx->manager->GetDeviceQueue(ctx->manager->GetUsingFamilyId(), &queue);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkCommandPoolCreateInfo cpci = {};
+    cpci.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cpci.queueFamilyIndex = ctx->manager->GetUsingFamilyId();
+    VkCommandPool pool = VK_NULL_HANDLE;
+    r = vkCreateCommandPool(device, &cpci, nullptr, &pool);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkCommandBufferAllocateInfo cbai = {};
+    cbai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cbai.commandPool = pool;
+    cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cbai.commandBufferCount = 1;
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    r = vkAllocateCommandBuffers(device, &cbai, &cmd);
+    if (r != VK_SUCCESS)
+        goto cleanup;
+
+    {
+        VkCommandBufferBeginInfo cbbi = {};
+        cbbi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cbbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        r = vkBeginCommandBuffer(cmd, &cbbi);
+        if (r != VK_SUCCESS)
+            goto cleanup;
+        r = record(cmd);
+        VkResult end_r = vkEndCommandBuffer(cmd);
+        if (r == VK_SUCCESS)
+            r = end_r;
+        if (r != VK_SUCCESS)
+            goto cleanup;
+
+        VkSubmitInfo si = {};
+        si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &cmd;
+        r = vkQueueSubmit(queue, 1, &si, VK_NULL_HANDLE);
+        if (r == VK_SUCCESS)
+            r = vkQueueWaitIdle(queue);
+    }
+
+cleanup:
+    vkDestroyCommandPool(device, pool, nullptr);
+    return r;
+}
+
+// Upload src_pixels to an image, record the passes into a command buffer, and read the results.
+static VkResult RunRecordCompress(TestContext* ctx, std::vector<uint8_t>* out) {
+    GPUCompressBCVk* compressor = ctx->compressor;
+    const GoldenCase& golden = *ctx->golden;
+    VkResult r = PrepareGolden(ctx, golden.flags);
+    if (r != VK_SUCCESS)
+        return r;
+
+    TransientAllocatorBCVk* allocator = nullptr;
+    r = compressor->CreateTransientAllocator(compressor->GetRecordBatchCount(), &allocator);
+    if (r != VK_SUCCESS)
+        return r;  // VK_ERROR_FEATURE_NOT_PRESENT with buffer input builds
+
+    const VkDeviceSize out_size = compressor->GetOutBufSize();
+    TestBuffer src_buf = {};
+    TestBuffer dst_buf = {};
+    TestImage src_image = {};
+    r = CreateTestBuffer(ctx, ctx->src_pixels.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &src_buf);
+    if (r == VK_SUCCESS)
+        r = CreateTestBuffer(ctx, out_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &dst_buf);
+    if (r == VK_SUCCESS)
+        r = CreateTestImage(ctx, golden.width, golden.height, &src_image);
+    if (r == VK_SUCCESS) {
+        memcpy(src_buf.mapped, ctx->src_pixels.data(), ctx->src_pixels.size());
+        r = SubmitAndWait(ctx, [&](VkCommandBuffer cmd) {
+            RecordImageBarrier(cmd, src_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                               VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            VkBufferImageCopy region = {};
+            region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            region.imageExtent = { golden.width, golden.height, 1 };
+            vkCmdCopyBufferToImage(cmd, src_buf.buffer, src_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            RecordImageBarrier(cmd, src_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                               VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+            VkResult record_r = compressor->RecordCompress(cmd, src_image.view, dst_buf.buffer, 0, allocator);
+
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                                 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            return record_r;
+        });
+    }
+    if (r == VK_SUCCESS) {
+        const uint8_t* mapped = static_cast<const uint8_t*>(dst_buf.mapped);
+        *out = std::vector<uint8_t>(mapped, mapped + out_size);
+    }
+
+    DestroyTestImage(ctx, &src_image);
+    DestroyTestBuffer(ctx, &dst_buf);
+    DestroyTestBuffer(ctx, &src_buf);
+    compressor->DestroyTransientAllocator(allocator);
+    return r;
+}
+
+#ifdef __linux__
+// A host visible buffer whose memory is exported as an opaque fd.
+//   `usage` should be the same as the buffer which imports it, in case the memory is dedicated.
+static VkResult CreateExportedBuffer(TestContext* ctx, VkDeviceSize size, VkBufferUsageFlags usage,
+                                     TestBuffer* buf, ExternalMemoryBCVk* memory) {
+    VkDevice device = ctx->manager->GetDevice();
+    *buf = {};
+    *memory = {};
+    memory->fd = -1;
+    PFN_vkGetMemoryFdKHR get_memory_fd = reinterpret_cast<PFN_vkGetMemoryFdKHR>(
+        vkGetDeviceProcAddr(device, "vkGetMemoryFdKHR"));
+    if (!get_memory_fd)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    const VkExternalMemoryHandleTypeFlagBits handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+    VkPhysicalDeviceExternalBufferInfo ext_info = {};
+    ext_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_BUFFER_INFO;
+    ext_info.usage = usage;
+    ext_info.handleType = handle_type;
+    VkExternalBufferProperties ext_props = {};
+    ext_props.sType = VK_STRUCTURE_TYPE_EXTERNAL_BUFFER_PROPERTIES;
+    vkGetPhysicalDeviceExternalBufferProperties(ctx->manager->GetUsingGPU(), &ext_info, &ext_props);
+    const VkFlags features = ext_props.externalMemoryProperties.externalMemoryFeatures;
+    const VkFlags required = VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT | VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT;
+    if ((features & required) != required)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    VkExternalMemoryBufferCreateInfo external_info = {};
+    external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    external_info.handleTypes = handle_type;
+    VkBufferCreateInfo bci = {};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.pNext = &external_info;
+    bci.size = size;
+    bci.usage = usage;
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkResult r = vkCreateBuffer(device, &bci, nullptr, &buf->buffer);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(device, buf->buffer, &req);
+    memory->handle_type = handle_type;
+    memory->size = req.size;
+    memory->memory_type_index = FindMemoryType(ctx, req.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    memory->dedicated = (features & VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT) != 0;
+    if (memory->memory_type_index == UINT32_MAX)
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+
+    VkMemoryDedicatedAllocateInfo dedicated_info = {};
+    dedicated_info.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicated_info.buffer = buf->buffer;
+    VkExportMemoryAllocateInfo export_info = {};
+    export_info.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO;
+    export_info.pNext = memory->dedicated ? &dedicated_info : nullptr;
+    export_info.handleTypes = handle_type;
+    VkMemoryAllocateInfo mai = {};
+    mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    mai.pNext = &export_info;
+    mai.allocationSize = req.size;
+    mai.memoryTypeIndex = memory->memory_type_index;
+    r = vkAllocateMemory(device, &mai, nullptr, &buf->memory);
+    if (r != VK_SUCCESS)
+        return r;
+    r = vkBindBufferMemory(device, buf->buffer, buf->memory, 0);
+    if (r != VK_SUCCESS)
+        return r;
+    r = vkMapMemory(device, buf->memory, 0, VK_WHOLE_SIZE, 0, &buf->mapped);
+    if (r != VK_SUCCESS)
+        return r;
+
+    VkMemoryGetFdInfoKHR fd_info = {};
+    fd_info.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR;
+    fd_info.memory = buf->memory;
+    fd_info.handleType = handle_type;
+    return get_memory_fd(device, &fd_info, &memory->fd);
+}
+#endif  // __linux__
+
+// Export memory of source pixels and results as opaque fds, and compress them with CompressExternal().
+static VkResult RunCompressExternal(TestContext* ctx, std::vector<uint8_t>* out) {
+#ifdef __linux__
+    VkResult r = PrepareGolden(ctx, ctx->golden->flags);
+    if (r != VK_SUCCESS)
+        return r;
+
+    const VkDeviceSize out_size = ctx->compressor->GetOutBufSize();
+    TestBuffer src_buf = {};
+    TestBuffer dst_buf = {};
+    ExternalMemoryBCVk src = {};
+    ExternalMemoryBCVk dst = {};
+    dst.fd = -1;
+    r = CreateExportedBuffer(ctx, ctx->src_pixels.size(),
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &src_buf, &src);
+    if (r == VK_SUCCESS)
+        r = CreateExportedBuffer(ctx, out_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &dst_buf, &dst);
+    if (r == VK_SUCCESS) {
+        memcpy(src_buf.mapped, ctx->src_pixels.data(), ctx->src_pixels.size());
+        r = ctx->compressor->CompressExternal(src, dst, -1, -1);
+        if (r == VK_SUCCESS) {
+            const uint8_t* mapped = static_cast<const uint8_t*>(dst_buf.mapped);
+            *out = std::vector<uint8_t>(mapped, mapped + out_size);
+        }
+    }
+
+    // CompressExternal() closes the fds only when it succeeds.
+    if (r != VK_SUCCESS) {
+        if (src.fd >= 0)
+            close(src.fd);
+        if (dst.fd >= 0)
+            close(dst.fd);
+    }
+    DestroyTestBuffer(ctx, &dst_buf);
+    DestroyTestBuffer(ctx, &src_buf);
+    return r;
+#else
+    (void)ctx;
+    (void)out;
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+#endif  // __linux__
+}
+
+// Compress the region of the golden case in the whole source image.
+static VkResult RunCompressRegion(TestContext* ctx, std::vector<uint8_t>* out) {
+    const GoldenCase& golden = *ctx->golden;
+    std::vector<uint8_t> src_pixels;
+    MakeGoldenSourceImage(golden, &src_pixels);
+    VkResult r = PrepareGolden(ctx, golden.flags);
+    if (r != VK_SUCCESS)
+        return r;
+    *out = std::vector<uint8_t>(ctx->compressor->GetOutBufSize());
+    const uint32_t row_pitch = GetGoldenSourceWidth(golden) * GetGoldenPixelSize(golden);
+    return ctx->compressor->CompressRegion(src_pixels.data(), row_pitch, golden.x, golden.y,
+                                           golden.width, golden.height, out->data());
+}
+
+static const TestCase TEST_CASES[] = {
+    { "reference", "bc7_256", ConfigureReference, nullptr },
+    { "reference", "bc7_40x102", ConfigureReference, nullptr },
+    { "reference", "bc7_37x21", ConfigureReference, nullptr },
+    { "reference", "bc7_mode7_64", ConfigureReference, RunMode7 },
+    { "reference", "bc7_3subsets_40x102", ConfigureReference, nullptr },
+    { "reference", "bc7_quick_256", ConfigureReference, nullptr },
+    { "reference", "bc7_quick_40x102", ConfigureReference, nullptr },
+    { "reference", "bc6h_256", ConfigureReference, nullptr },
+    { "reference", "bc6h_40x102", ConfigureReference, nullptr },
+    { "reference", "bc6h_37x21", ConfigureReference, nullptr },
+    { "reference", "bc6h_sf16_256", ConfigureReference, nullptr },
+    { "reference", "bc6h_sf16_40x102", ConfigureReference, nullptr },
+    { "reference", "bc7_region_40x102", ConfigureReference, nullptr },
+    { "reference", "bc6h_region_37x21", ConfigureReference, nullptr },
+    { "windowed", "bc7_256", ConfigureWindowed, nullptr },
+    { "windowed", "bc7_40x102", ConfigureWindowed, nullptr },
+    { "windowed", "bc7_mode7_64", ConfigureWindowed, RunMode7 },
+    { "windowed", "bc7_3subsets_40x102", ConfigureWindowed, nullptr },
+    { "windowed", "bc7_quick_256", ConfigureWindowed, nullptr },
+    { "windowed", "bc7_quick_40x102", ConfigureWindowed, nullptr },
+    { "windowed", "bc6h_256", ConfigureWindowed, nullptr },
+    { "windowed", "bc6h_40x102", ConfigureWindowed, nullptr },
+    { "windowed", "bc6h_sf16_256", ConfigureWindowed, nullptr },
+    { "windowed", "bc6h_sf16_40x102", ConfigureWindowed, nullptr },
+    { "max error threshold", "bc7_quick_256", nullptr, RunMaxErrorThreshold },
+    { "max error threshold", "bc7_quick_40x102", ConfigureWindowed, RunMaxErrorThreshold },
+    { "min error threshold", "bc7_mode7_64", ConfigureWindowed, RunMinErrorThreshold },
+    // Buffer input builds on llvmpipe (with imported memory), and images on the other devices
+    { "direct host access", "bc7_256", nullptr, nullptr },
+    { "direct host access", "bc7_40x102", nullptr, nullptr },
+    { "direct host access", "bc7_37x21", nullptr, nullptr },
+    { "direct host access", "bc6h_40x102", nullptr, nullptr },
+    { "direct host access", "bc6h_37x21", nullptr, nullptr },
+    { "direct host access", "bc6h_sf16_40x102", nullptr, nullptr },
+    { "buffer input copy", "bc7_40x102", ConfigureBufferInputCopy, nullptr },
+    { "buffer input copy", "bc7_37x21", ConfigureBufferInputCopy, nullptr },
+    { "buffer input copy", "bc6h_37x21", ConfigureBufferInputCopy, nullptr },
+    { "linear image", "bc7_256", ConfigureLinearImage, nullptr },
+    { "linear image", "bc7_40x102", ConfigureLinearImage, nullptr },
+    { "linear image", "bc7_37x21", ConfigureLinearImage, nullptr },
+    { "linear image", "bc6h_40x102", ConfigureLinearImage, nullptr },
+    { "linear image", "bc6h_37x21", ConfigureLinearImage, nullptr },
+    { "banded upload", "bc7_256", ConfigureBandedUpload, nullptr },
+    { "banded upload", "bc7_40x102", ConfigureBandedUpload, nullptr },
+    { "banded upload", "bc7_mode7_64", ConfigureBandedUpload, RunMode7 },
+    { "banded upload", "bc6h_256", ConfigureBandedUpload, nullptr },
+    { "banded upload", "bc6h_40x102", ConfigureBandedUpload, nullptr },
+    { "banded upload", "bc7_region_40x102", ConfigureBandedUpload, RunCompressRegion },
+    { "transfer queue", "bc7_256", ConfigureBandedUpload, RunTransferQueue },
+    { "transfer queue", "bc7_40x102", ConfigureBandedUpload, RunTransferQueue },
+    { "transfer queue", "bc7_37x21", ConfigureWindowed, RunTransferQueue },
+    { "transfer queue", "bc6h_40x102", ConfigureWindowed, RunTransferQueue },
+    { "transfer queue", "bc6h_sf16_256", ConfigureBandedUpload, RunTransferQueue },
+    { "result callback", "bc7_256", ConfigureReference, RunResultCallback },
+    { "result callback", "bc7_40x102", nullptr, RunResultCallback },
+    { "result callback", "bc7_37x21", ConfigureWindowed, RunResultCallback },
+    { "result callback", "bc6h_40x102", ConfigureReference, RunResultCallback },
+    { "result callback", "bc6h_sf16_256", ConfigureWindowed, RunResultCallback },
+    { "result callback", "bc7_40x102", ConfigureBandedUpload, RunResultCallback },
+    { "fused BC6H mode search", "bc6h_256", ConfigureFusedModeSearch, nullptr },
+    { "fused BC6H mode search", "bc6h_40x102", ConfigureFusedModeSearch, nullptr },
+    { "fused BC6H mode search", "bc6h_sf16_256", ConfigureFusedModeSearch, nullptr },
+    { "fused BC6H mode search", "bc6h_sf16_40x102", ConfigureFusedModeSearch, nullptr },
+    { "concurrent BC7 mode search", "bc7_256", ConfigureConcurrentModeSearch, nullptr },
+    { "concurrent BC7 mode search", "bc7_40x102", ConfigureConcurrentModeSearch, nullptr },
+    { "concurrent BC7 mode search", "bc7_mode7_64", ConfigureConcurrentModeSearch, RunMode7 },
+    { "concurrent BC7 mode search", "bc7_3subsets_40x102", ConfigureConcurrentModeSearch, nullptr },
+    { "partition shortlist", "bc7_mode7_64", ConfigureReference, RunPartitionShortlist },
+    { "partition shortlist", "bc7_mode7_64", ConfigureWindowed, RunPartitionShortlist },
+    { "opaque fast path off", "bc7_opaque_128", ConfigureReference, nullptr },
+    { "opaque fast path off", "bc7_opaque_128", ConfigureWindowed, nullptr },
+    { "opaque fast path on", "bc7_opaque_128", ConfigureWindowed, RunOpaqueFastPath, AllowMode7Mismatch },
+    { "profile with mode 4-6", "bc7_quick_256", nullptr, RunBC7Modes456 },
+    { "profile with mode 4-6", "bc7_quick_40x102", ConfigureReference, RunBC7Modes456 },
+    { "profile with all modes", "bc7_3subsets_40x102", ConfigureReference, RunBC7AllModes },
+    { "profile with all modes", "bc7_3subsets_40x102", ConfigureWindowed, RunBC7AllModes },
+    { "record compress", "bc7_256", ConfigureReference, RunRecordCompress },
+    { "record compress", "bc7_37x21", ConfigureReference, RunRecordCompress },
+    { "record compress", "bc7_mode7_64", ConfigureWindowed, RunRecordCompress },
+    { "record compress", "bc6h_40x102", ConfigureReference, RunRecordCompress },
+    { "record compress", "bc6h_sf16_256", ConfigureWindowed, RunRecordCompress },
+    { "record compress with buffer input", "bc7_40x102", nullptr, RunRecordCompress },
+    { "compress region", "bc7_region_40x102", ConfigureReference, RunCompressRegion },
+    { "compress region", "bc7_region_40x102", nullptr, RunCompressRegion },
+    { "compress region", "bc7_region_40x102", ConfigureWindowed, RunCompressRegion },
+    { "compress region", "bc7_region_40x102", ConfigureBufferInputCopy, RunCompressRegion },
+    { "compress region", "bc7_region_40x102", ConfigureLinearImage, RunCompressRegion },
+    { "compress region", "bc6h_region_37x21", ConfigureReference, RunCompressRegion },
+    { "compress region", "bc6h_region_37x21", nullptr, RunCompressRegion },
+    { "compress region", "bc6h_region_37x21", ConfigureWindowed, RunCompressRegion },
+    { "compress external", "bc7_40x102", ConfigureReference, RunCompressExternal },
+    { "compress external", "bc7_37x21", nullptr, RunCompressExternal },
+    { "compress external", "bc6h_37x21", ConfigureWindowed, RunCompressExternal },
+};
+
+static bool LoadGolden(const std::string& path, std::vector<uint8_t>* blocks) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        return false;
+    ifs.seekg(0, std::ios_base::end);
+    const size_t size = (size_t)ifs.tellg();
+    ifs.seekg(0, std::ios_base::beg);
+    *blocks = std::vector<uint8_t>(size);
+    ifs.read(reinterpret_cast<char*>(blocks->data()), size);
+    return (bool)ifs;
+}
+
+// Returns 1 when the test case failed, and 0 otherwise.
+static int RunTestCase(VulkanDeviceManager* manager, const TestCase& test, const std::string& golden_dir,
+                       uint32_t* skipped) {
+    std::cout << test.name << " (" << test.golden << "): ";
+
+    const GoldenCase* golden = FindGoldenCase(test.golden);
+    if (!golden) {
+        std::cout << "failed (unknown golden case)\n";
+        return 1;
+    }
+    std::vector<uint8_t> expected;
+    if (!LoadGolden(golden_dir + "/" + golden->name + ".bin", &expected)) {
+        std::cout << "failed (no golden blocks in " << golden_dir << ". Run test/make_golden.sh.)\n";
+        return 1;
+    }
+
+    GPUCompressBCVk compressor = GPUCompressBCVk();
+    compressor.SetSubgroupSizeControl(manager->HasSubgroupSizeControl());
+    compressor.SetMemoryBudgetExtension(manager->HasMemoryBudget());
+    if (test.configure)
+        test.configure(&compressor);
+    VkResult r = compressor.Initialize(
+            manager->GetDevice(),
+            manager->GetUsingGPU(),
+            manager->GetUsingFamilyId());
+    if (r != VK_SUCCESS) {
+        std::cout << "failed (Initialize() returned " << r << ")\n";
+        return 1;
+    }
+
+    TestContext ctx = {};
+    ctx.manager = manager;
+    ctx.compressor = &compressor;
+    ctx.golden = golden;
+    ctx.expected = &expected;
+    MakeGoldenImage(*golden, &ctx.src_pixels);
+
+    std::vector<uint8_t> actual;
+    r = test.run ? test.run(&ctx, &actual) : RunCompress(&ctx, &actual);
+    if (r == VK_ERROR_FEATURE_NOT_PRESENT) {
+        std::cout << "skipped (not supported by the device)\n";
+        (*skipped)++;
+        return 0;
+    }
+    if (r != VK_SUCCESS) {
+        std::cout << "failed (error " << r << ")\n";
+        return 1;
+    }
+
+    if (expected.size() != actual.size()) {
+        std::cout << "failed (output sizes differ: " << expected.size() << ", " << actual.size() << ")\n";
+        return 1;
+    }
+
+    const uint32_t xblocks = (golden->width + 3) / 4;
+    const uint32_t num_blocks = xblocks * ((golden->height + 3) / 4);
+    const uint32_t block_size = static_cast<uint32_t>(expected.size() / num_blocks);
+    uint32_t mismatches = 0;
+    uint32_t allowed = 0;
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        const uint8_t* expected_block = &expected[(size_t)i * block_size];
+        const uint8_t* actual_block = &actual[(size_t)i * block_size];
+        if (memcmp(expected_block, actual_block, block_size) == 0)
+            continue;
+        if (test.allow_mismatch && test.allow_mismatch(expected_block, actual_block)) {
+            allowed++;
+            continue;
+        }
+        if (mismatches == 0)
+            std::cout << "failed (the first mismatch is at block (" << i % xblocks << ", " << i / xblocks << "))\n";
+        mismatches++;
+    }
+    if (mismatches > 0) {
+        std::cout << "  " << mismatches << " of " << num_blocks << " blocks differ\n";
+        return 1;
+    }
+    if (allowed > 0)
+        std::cout << "ok (" << allowed << " of " << num_blocks << " blocks differ as allowed)\n";
+    else
+        std::cout << "ok\n";
+    return 0;
+}
+
+static void PrintUsage() {
+    static const char* const usage =
+        "Usage: bcvk-test [<options>]\n"
+        "\n"
+        "  Compress fixed images with various options,\n"
+        "  and check that they are the same as golden blocks of the baseline compressor.\n"
+        "\n"
+        "  options:\n"
+        "    --golden-dir <dir>: directory of golden blocks. (test/golden by default.)\n"
+        "    --enable-debug: enable the validation layer for Vulkan.\n"
+        "    --help: show this message.\n";
+    std::cout << usage;
+}
+
+int main(int argc, char** argv) {
+    bool enable_debug = false;
+    std::string golden_dir = "test/golden";
+
+    // Parse args
+    for (int i = 1; i < argc; i++) {
+        const char* opt = argv[i];
+        if (strcmp(opt, "--golden-dir") == 0 && i + 1 < argc) {
+            golden_dir = argv[++i];
+        } else if (strcmp(opt, "--enable-debug") == 0) {
+            enable_debug = true;
+        } else if (strcmp(opt, "--help") == 0) {
+            PrintUsage();
+            return 0;
+        } else {
+            std::cerr << "ERROR: unknown option (" << opt << ")\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    VulkanDeviceManager manager = VulkanDeviceManager();
+    VkResult r = manager.CreateInstance(enable_debug);
+    if (r != VK_SUCCESS) {
+        std::cerr << "Failed to create Vulkan instance (error " << r << ")\n";
+        return 1;
+    }
+
+    if (!manager.HasGPU()) {
+        std::cout << "No Vulkan-capable GPUs found.\n";
+        return 0;
+    }
+
+    r = manager.CreateDevice();
+    if (r != VK_SUCCESS) {
+        std::cout << "Failed to create VkDevice (error " << r << ")\n";
+        return 1;
+    }
+
+    int failures = 0;
+    uint32_t skipped = 0;
+    for (const TestCase& test : TEST_CASES)
+        failures += RunTestCase(&manager, test, golden_dir, &skipped);
+    if (failures > 0) {
+        std::cout << failures << " test case(s) failed\n";
+        return 1;
+    }
+
+    if (skipped > 0)
+        std::cout << skipped << " test case(s) skipped\n";
+    std::cout << "success\n";
+    return 0;
+}
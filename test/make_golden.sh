@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Writes golden blocks for bcvk-test to ./test/golden with the baseline compressor.
+#   The baseline commit is extracted to a temp directory, and patches in ./test/baseline are applied to it.
+#   It requires the git history (fetch-depth: 0 on CI), dxc, and a Vulkan device.
+#   Golden blocks depend on the device, so write them on the device which runs bcvk-test.
+
+set -euo pipefail
+
+# The commit before the first optimization
+BASELINE="${BCVK_BASELINE:-89053f350e3d7353b7b51117cfe9559bf647fdc0}"
+
+ROOT="$(realpath $(dirname "$0")/..)"
+GOLDEN_DIR="${ROOT}/test/golden"
+
+TMPDIR="$(mktemp -d)"
+trap 'rm -rf "$TMPDIR"' EXIT
+BASELINE_DIR="${TMPDIR}/baseline"
+
+# Extract the baseline
+mkdir -p "$BASELINE_DIR"
+git -C "$ROOT" archive "$BASELINE" | tar -x -C "$BASELINE_DIR"
+for patch in "${ROOT}"/test/baseline/*.patch; do
+    [ -e "$patch" ] || continue
+    echo "Applying $(basename "$patch")"
+    git -C "$BASELINE_DIR" apply "$patch"
+done
+
+# Compile shaders of the baseline (with ./dxc from install_dxc.sh if it exists)
+if [ -d "${ROOT}/dxc" ]; then
+    ln -s "${ROOT}/dxc" "${BASELINE_DIR}/dxc"
+fi
+"${BASELINE_DIR}/dxc_compile.sh"
+
+# Build bcvk-golden-writer with the baseline sources
+cmake -S "$ROOT" -B "${TMPDIR}/build" -D CMAKE_BUILD_TYPE=Debug -D BCVK_BASELINE_DIR="$BASELINE_DIR"
+cmake --build "${TMPDIR}/build" --config Debug --target bcvk-golden-writer
+
+mkdir -p "$GOLDEN_DIR"
+WRITER="${TMPDIR}/build/bcvk-golden-writer"
+[ -x "$WRITER" ] || WRITER="${TMPDIR}/build/Debug/bcvk-golden-writer"
+"$WRITER" "$GOLDEN_DIR"